@@ -31,6 +31,11 @@ typedef int RepaintType;
 #define RP_LOWER 3
 #define RP_UPPER 4
 
+typedef int BufferStorage;
+#define BS_AUTO     -1  // Pick based on file size.
+#define BS_LINES    0   // One String per line, held in the `Buffer.lines` tree.
+#define BS_PIECES   1   // Piece table, lines materialized when accessed.
+
 
 /**
  * Struct an edit to a line. TODO: bulk/group edits.
@@ -38,7 +43,7 @@ typedef int RepaintType;
 struct Edit {
     size_t undo_index;
     size_t start_row;
-    ssize_t start_col;  // -1 means entire row modification
+    ssize_t start_col;  // -1 means entire row modification (inserts and deletes can span rows)
     String* old_content;
     String* new_content;
 };
@@ -63,6 +68,34 @@ struct Mark {
 };
 typedef struct Mark Mark;
 
+/**
+ * What the last Buffer_save did, and how long it took.
+ */
+struct SaveStats {
+    size_t bytes;
+    size_t writes;      // writev calls.
+    double snapshot_ms; // Copying what could change while saving (on the thread that started it).
+    double write_ms;    // Until all of the contents were handed to the kernel.
+    double sync_ms;     // fsync, close and rename.
+    double total_ms;
+};
+typedef struct SaveStats SaveStats;
+
+/**
+ * The version of the file on disk that a buffer was last loaded from, saved
+ * to or reloaded from.
+ */
+struct DiskState {
+    bool exists;
+    unsigned long ino;
+    size_t size;
+    long mtime_sec;
+    long mtime_nsec;
+    unsigned long tail_hash;    // Hash of the last (up to) BUFFER_TAIL_CHECK bytes, to recognize appends.
+    size_t changes;             // Buffer.changes when the buffer matched the file.
+};
+typedef struct DiskState DiskState;
+
 struct Buffer {
     String* name;
     String* swapfile_name;
@@ -77,7 +110,21 @@ struct Buffer {
     ssize_t cursor_col;         // 0-indexed X coordinate on screen
     int natural_col;            // This is int because.. if you have more than int cols, I can't save you
     ssize_t undo_index;
-    Vector/*String* */ lines; //TODO: Cache/load buffered
+    BufferStorage storage;
+    LineTree/*String* */ lines;     // BS_LINES only. Use Buffer_get_line_abs!
+    Arena* line_arena;              // BS_LINES: lines as loaded from the file.
+    PieceTable* pieces;             // BS_PIECES only.
+    Vector/*CachedLine* */ line_cache;  // BS_PIECES: lines handed out by Buffer_get_line_abs.
+    size_t line_cache_clock;
+    size_t memory_budget;           // BS_PIECES: 0, or roughly the most memory to keep resident.
+    SaveStats last_save;
+    struct SaveJob* save_job;       // Save running in the background, or NULL.
+    struct Journal* journal;        // NULL unless edits are being journaled (Buffer_open_journal).
+    size_t changes;                 // Count of edits applied and undone. Compare to disk.changes.
+    DiskState disk;
+    bool lease_file;                // BS_PIECES: keep a lease on the mapped file (Buffer_lease_file).
+    struct CursorLineIndex* line_index;     // See Buffer_cursor_line_index. NULL until needed.
+    struct TrigramIndex* trigrams;  // NULL unless Buffer_enable_trigrams.
     size_t visual_row;      // Visual mode anchors.
     size_t visual_col;
     EditorMode buffer_mode;
@@ -7,6 +7,9 @@
  *  l       move right
  *  i       insert mode
  *  ESC     exit insert mode, cancel
+ *  ^E ^Y   scroll a line down / up
+ *  ^D ^U   scroll half a window down / up
+ *  ^F ^B   scroll a window down / up
  */
 
 void h_action_resolve(EditorAction* this, EditorContext* ctx) {
@@ -94,3 +97,97 @@ EditorAction* make_ESC_action(int control) {
             return ret;
     }
 }
+
+/**
+ * Scroll the window by `lines`. The cursor stays on its line if it can, or
+ * moves `lines` with the window if `follow` is set.
+ */
+void scroll_action_resolve(EditorContext* ctx, ssize_t lines, bool follow) {
+    ctx->action = AT_MOVE;
+    ctx->sharp_move = false;
+    ctx->jump_col = ctx->buffer->natural_col;
+    editor_scroll(lines);
+    if (follow) {
+        ctx->jump_row += lines;
+    }
+    ssize_t top = ctx->buffer->top_row;
+    ssize_t bottom = top + (editor_bottom - editor_top) - 1;
+    if (ctx->jump_row < top) ctx->jump_row = top;
+    if (ctx->jump_row > bottom) ctx->jump_row = bottom;
+}
+
+/**
+ * Half a window, the distance for ^D and ^U.
+ */
+static inline ssize_t half_window() {
+    ssize_t lines = (editor_bottom - editor_top) / 2;
+    return lines > 0 ? lines : 1;
+}
+
+/**
+ * A window less two lines of context, the distance for ^F and ^B.
+ */
+static inline ssize_t full_window() {
+    ssize_t lines = (editor_bottom - editor_top) - 2;
+    return lines > 0 ? lines : 1;
+}
+
+void CTRLE_action_resolve(EditorAction* this, EditorContext* ctx) {
+    scroll_action_resolve(ctx, 1, false);
+}
+
+EditorAction* make_CTRLE_action(int control) {
+    EditorAction* ret = make_DefaultAction("^E");
+    ret->resolve = &CTRLE_action_resolve;
+    return ret;
+}
+
+void CTRLY_action_resolve(EditorAction* this, EditorContext* ctx) {
+    scroll_action_resolve(ctx, -1, false);
+}
+
+EditorAction* make_CTRLY_action(int control) {
+    EditorAction* ret = make_DefaultAction("^Y");
+    ret->resolve = &CTRLY_action_resolve;
+    return ret;
+}
+
+void CTRLD_action_resolve(EditorAction* this, EditorContext* ctx) {
+    scroll_action_resolve(ctx, half_window(), true);
+}
+
+EditorAction* make_CTRLD_action(int control) {
+    EditorAction* ret = make_DefaultAction("^D");
+    ret->resolve = &CTRLD_action_resolve;
+    return ret;
+}
+
+void CTRLU_action_resolve(EditorAction* this, EditorContext* ctx) {
+    scroll_action_resolve(ctx, -half_window(), true);
+}
+
+EditorAction* make_CTRLU_action(int control) {
+    EditorAction* ret = make_DefaultAction("^U");
+    ret->resolve = &CTRLU_action_resolve;
+    return ret;
+}
+
+void CTRLF_action_resolve(EditorAction* this, EditorContext* ctx) {
+    scroll_action_resolve(ctx, full_window(), false);
+}
+
+EditorAction* make_CTRLF_action(int control) {
+    EditorAction* ret = make_DefaultAction("^F");
+    ret->resolve = &CTRLF_action_resolve;
+    return ret;
+}
+
+void CTRLB_action_resolve(EditorAction* this, EditorContext* ctx) {
+    scroll_action_resolve(ctx, -full_window(), false);
+}
+
+EditorAction* make_CTRLB_action(int control) {
+    EditorAction* ret = make_DefaultAction("^B");
+    ret->resolve = &CTRLB_action_resolve;
+    return ret;
+}
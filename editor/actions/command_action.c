@@ -14,10 +14,19 @@ void close_buffer() {
     }
 }
 
-void save_buffer() {
-    Buffer_save(current_buffer);
+/**
+ * Save the current buffer on a worker thread; editor_poll_saves reports when it's done.
+ * `wait` saves in the foreground instead (eg. before closing the buffer).
+ */
+void save_buffer(bool wait) {
+    if (wait) {
+        int result = Buffer_save(current_buffer);
+        editor_save_message(current_buffer, result);
+        return;
+    }
+    Buffer_save_start(current_buffer);
     String_clear(bottom_bar_info);
-    Strcats(&bottom_bar_info, "-- File saved: ");
+    Strcats(&bottom_bar_info, "-- Saving: ");
     Strcat(&bottom_bar_info, current_buffer->name);
     Strcats(&bottom_bar_info, " --");
     display_bottom_bar(bottom_bar_info->data, NULL);
@@ -37,14 +46,23 @@ void process_command(char* command, EditorContext* ctx) {
         return;
     }
     if (strcmp(command, "w") == 0) {
-        save_buffer();
+        save_buffer(false);
         return;
     }
     if (strcmp(command, "wq") == 0 || strcmp(command, "qw") == 0) {
-        save_buffer();
+        save_buffer(true);
         close_buffer();
         return;
     }
+    if (strcmp(command, "index") == 0) {
+        editor_index_buffer(current_buffer);
+        String_clear(bottom_bar_info);
+        Strcats(&bottom_bar_info, "-- Indexing: ");
+        Strcat(&bottom_bar_info, current_buffer->name);
+        Strcats(&bottom_bar_info, " --");
+        display_bottom_bar(bottom_bar_info->data, NULL);
+        return;
+    }
     char* rest;
     if (strncmp(command, "tabnew ", 7) == 0) {
         rest = command + 7;
@@ -4,12 +4,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <libgen.h>
+#include <sys/inotify.h>
 
 #include "editor.h"
 #include "editor_actions.h"
 #include "utils.h"
 #include "debugging.h"
+#include "screen.h"
+#include "../structures/line_scan.h"
+#include "../structures/trigram_index.h"
 
 int TAB_WIDTH = 4;
 bool PRESERVE_INDENT = true;
@@ -39,6 +44,37 @@ bool editor_macro_mode = 0;
 
 String* bottom_bar_info = NULL;
 
+int editor_watch_fd = -1;
+EventLoop editor_events = {0};
+// Files of buffers opened from now on get leases (see editor_lease_files).
+static bool editor_leases = false;
+
+// Polls background saves (for progress) while any is running.
+#define EDITOR_SAVE_POLL_MS 50
+static int editor_save_timer = -1;
+
+size_t EDITOR_INDEX_THRESHOLD = 0;
+
+// Builds trigram indexes a step (of about EDITOR_INDEX_STEP_MS) per tick, so
+// the main thread is never kept from input for long, nor busy most of the time.
+#define EDITOR_INDEX_TICK_MS 10
+#define EDITOR_INDEX_STEP_MS 2
+static int editor_index_timer = -1;
+
+/**
+ * An inotify watch on the directory of a buffer's file. Watching the directory
+ * (not the file) catches the file being replaced by a rename, too.
+ */
+struct FileWatch {
+    Buffer* buffer;
+    int wd;
+    String* name;       // File name within the directory.
+    bool pending;       // The file may have changed since the buffer was last checked.
+};
+typedef struct FileWatch FileWatch;
+
+Vector/*FileWatch* */ watches = {0};
+
 const char* EDITOR_MODE_STR[5] = {
     "NORMAL",
     "INSERT",
@@ -105,13 +141,57 @@ void process_input(char input, int control) {
     }
 }
 
+Screen editor_screen = {0};
+
+/**
+ * Draw to the virtual screen (see editor_flush), sized to the terminal.
+ */
 static inline ssize_t _write(const char* string, size_t n) {
     if (SCREEN_WRITE && editor_display) {
-        return write(STDOUT_FILENO, string, n);
+        if (editor_screen.out == NULL) {
+            inplace_make_Screen(&editor_screen, window_size.ws_row, window_size.ws_col);
+        }
+        else if (editor_screen.rows != window_size.ws_row || editor_screen.cols != window_size.ws_col) {
+            Screen_resize(&editor_screen, window_size.ws_row, window_size.ws_col);
+        }
+        Screen_write(&editor_screen, string, n);
+        return n;
     }
     return 0;
 }
 
+double EDITOR_FRAME_MAX_DELAY_MS = 25;
+size_t editor_frames_skipped = 0;
+static double editor_last_frame_ms = 0;
+
+/**
+ * PRIVATE
+ * Milliseconds on a monotonic clock.
+ */
+static double _editor_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void editor_flush() {
+    if (SCREEN_WRITE && editor_display && editor_screen.out != NULL && editor_screen.dirty) {
+        Screen_flush(&editor_screen, STDOUT_FILENO);
+        editor_last_frame_ms = _editor_now_ms();
+        print("frame %lu: %lu bytes, %lu writes, %lu skipped\n", editor_screen.frames,
+              editor_screen.frame_bytes, editor_screen.frame_writes, editor_frames_skipped);
+    }
+}
+
+void editor_end_frame(bool input_pending) {
+    if (input_pending && editor_screen.dirty
+            && _editor_now_ms() - editor_last_frame_ms < EDITOR_FRAME_MAX_DELAY_MS) {
+        editor_frames_skipped += 1;
+        return;
+    }
+    editor_flush();
+}
+
 /**
  * Callback function that gets called whenever the terminal size changes.
  * Updates the window_size variable to reflect changes made to the window size,
@@ -171,7 +251,7 @@ int get_cursor_pos(size_t *y, size_t *x) {
     *y = 0;
     *x = 0;
    
-    _write("\033[6n", 4);
+    write(STDOUT_FILENO, "\033[6n", 4);
    
     for ( i = 0, ch = 0; ch != 'R'; i++ ) {
         ret = read(STDIN_FILENO, &ch, 1);
@@ -233,6 +313,18 @@ size_t tab_round_up(size_t start) {
     return ((start / TAB_WIDTH) + 1) * TAB_WIDTH;
 }
 
+/**
+ * PRIVATE
+ * Display-column index for `buf`, if it's the cursor's line (long lines only;
+ * see Buffer_cursor_line_index). Otherwise NULL, and callers scan.
+ */
+static inline LineIndex* _line_index(const char* buf) {
+    if (current_buffer == NULL) {
+        return NULL;
+    }
+    return Buffer_cursor_line_index(current_buffer, buf, TAB_WIDTH);
+}
+
 /*
  * Position on screen in the line for a position in the string.
  * Always left aligns tabs.
@@ -241,6 +333,10 @@ size_t tab_round_up(size_t start) {
  * ptr: a position in the line. line_pos_ptr(buf, buf) == 0.
  */
 size_t line_pos_ptr(const char* buf, const char* ptr) {
+    LineIndex* idx = _line_index(buf);
+    if (idx != NULL) {
+        return LineIndex_column(idx, ptr - buf);
+    }
     size_t pos_x = 0;
     for (; buf != ptr; ++buf) {
         if (*buf == BYTE_TAB) {
@@ -257,6 +353,10 @@ size_t line_pos_ptr(const char* buf, const char* ptr) {
  * Return a pointer corresponding to the spot in buf at screen pos x. (0 indexed)
  */
 char* line_pos(char* buf, ssize_t x) {
+    LineIndex* idx = (x >= 0) ? _line_index(buf) : NULL;
+    if (idx != NULL) {
+        return buf + LineIndex_offset(idx, x);
+    }
     ssize_t pos_x = 0;
     char* prev = NULL;
     for (; *buf; ++buf) {
@@ -299,6 +399,10 @@ char line_pos_char(char* buf, size_t x) {
  * TODO: unify this with `format_respect_tabspace`.
  */
 size_t strlen_tab(const char* buf) {
+    LineIndex* idx = _line_index(buf);
+    if (idx != NULL) {
+        return idx->width;
+    }
     size_t ret = 0;
     for (; *buf; ++buf) {
         if (*buf == BYTE_TAB) {
@@ -353,26 +457,46 @@ size_t _format_respect_tabspace(String** write_buffer, const char* buf, size_t s
 }
 size_t format_respect_tabspace(String** write_buffer, const char* buf, size_t start, size_t count,
             size_t print_start, size_t print_end) {
-    // TODO: Mega optimize this
+    // Works a run of plain text at a time: runs before print_start are just
+    // counted, visible parts are copied whole.
+    size_t visible = print_end > print_start ? print_end - print_start : 0;
+    size_t most = count < visible / TAB_WIDTH ? count * TAB_WIDTH : visible;
+    String* out = realloc_String(*write_buffer, Strlen(*write_buffer) + most);
+    *write_buffer = out;
+    char* dest = out->data + out->length;
+
+    const char* p = buf;
+    const char* end = buf + count;
     size_t column = start;
-    for (size_t i = 0; i < count; ++i) {
-        if (buf[i] == BYTE_TAB) {
-            size_t end = tab_round_up(column);
-            for (; column < end; ++column) {
-                if (column >= print_start && column < print_end) {
-                    String_push(write_buffer, ' ');
-                }
-            }
-            continue;
+    while (p < end) {
+        const char* special = scan_tab_newline(p, end);
+        const char* run_end = (special != NULL) ? special : end;
+        size_t length = run_end - p;
+        if (column < print_end && column + length > print_start) {
+            size_t from = (column < print_start) ? print_start - column : 0;
+            size_t to = (column + length > print_end) ? print_end - column : length;
+            memcpy(dest, p + from, to - from);
+            dest += to - from;
         }
-        else if (buf[i] == BYTE_ENTER) {
-            continue;
+        column += length;
+        if (special == NULL) {
+            break;
         }
-        if (column >= print_start && column < print_end) {
-            String_push(write_buffer, buf[i]);
+        if (*special == BYTE_TAB) {
+            size_t tab_end = tab_round_up(column);
+            size_t from = column > print_start ? column : print_start;
+            size_t to = tab_end < print_end ? tab_end : print_end;
+            if (from < to) {
+                memset(dest, ' ', to - from);
+                dest += to - from;
+            }
+            column = tab_end;
         }
-        ++column;
+        // Newlines are dropped.
+        p = special + 1;
     }
+    out->length = dest - out->data;
+    *dest = 0;
     return column;
 }
 
@@ -394,13 +518,208 @@ size_t write_respect_tabspace(const char* buf, size_t start, size_t count) {
 /**
  * Creates a buffer for the given file and pushes it to the vector of buffers.
  */
+/**
+ * PRIVATE
+ * Journal edits to the buffer, recovering any left behind by a crash.
+ */
+void _editor_open_journal(Buffer* buffer) {
+    int recovered = Buffer_open_journal(buffer);
+    print("journal %s: %d edits recovered\n", buffer->swapfile_name->data, recovered);
+    if (recovered > 0 && bottom_bar_info != NULL) {
+        char message[64];
+        snprintf(message, sizeof(message), "-- Recovered %d edits --", recovered);
+        String_clear(bottom_bar_info);
+        Strcats(&bottom_bar_info, message);
+    }
+}
+
+/**
+ * PRIVATE
+ * Event loop callback: the inotify fd has events.
+ */
+static void _editor_watch_ready(int fd, void* data) {
+    editor_poll_watches();
+}
+
+/**
+ * PRIVATE
+ * Event loop callback: time to update the progress of background saves.
+ */
+static void _editor_save_tick(int fd, void* data) {
+    editor_poll_saves();
+}
+
+/**
+ * PRIVATE
+ * Event loop callback: time to index some more.
+ */
+static void _editor_index_tick(int fd, void* data) {
+    editor_poll_indexes();
+}
+
+/**
+ * PRIVATE
+ * Index a buffer just opened, if its file is big enough.
+ */
+void _editor_open_index(Buffer* buffer) {
+    if (EDITOR_INDEX_THRESHOLD > 0 && buffer->disk.size >= EDITOR_INDEX_THRESHOLD) {
+        editor_index_buffer(buffer);
+    }
+}
+
+/**
+ * PRIVATE
+ * Start watching a buffer's file for changes made by other programs.
+ */
+void _editor_watch_buffer(Buffer* buffer) {
+    if (editor_watch_fd < 0) {
+        editor_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        inplace_make_Vector(&watches, 4);
+        if (editor_watch_fd >= 0) {
+            EventLoop_watch(&editor_events, editor_watch_fd, POLLIN, _editor_watch_ready, NULL);
+        }
+    }
+    if (editor_watch_fd < 0) {
+        return;
+    }
+    // Watch the file a symlink points to.
+    char* target = realpath(buffer->name->data, NULL);
+    String* path = make_String(target != NULL ? target : buffer->name->data);
+    free(target);
+    String* dir_path = Strdup(path);
+    int wd = inotify_add_watch(editor_watch_fd, dirname(dir_path->data),
+                               IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd >= 0) {
+        FileWatch* watch = malloc(sizeof(FileWatch));
+        watch->buffer = buffer;
+        watch->wd = wd;
+        watch->name = make_String(basename(path->data));
+        watch->pending = false;
+        Vector_push(&watches, watch);
+    }
+    free(dir_path);
+    free(path);
+    if (editor_leases) {
+        Buffer_lease_file(buffer);
+    }
+}
+
+/**
+ * PRIVATE
+ * Stop watching a buffer's file. The directory watch is dropped when no other
+ * buffer is using it.
+ */
+void _editor_unwatch_buffer(Buffer* buffer) {
+    for (size_t i = 0; i < watches.size; ++i) {
+        FileWatch* watch = watches.elements[i];
+        if (watch->buffer != buffer) {
+            continue;
+        }
+        bool shared = false;
+        for (size_t j = 0; j < watches.size; ++j) {
+            shared |= j != i && ((FileWatch*) watches.elements[j])->wd == watch->wd;
+        }
+        if (!shared) {
+            inotify_rm_watch(editor_watch_fd, watch->wd);
+        }
+        free(watch->name);
+        free(watch);
+        Vector_delete(&watches, i);
+        return;
+    }
+}
+
+void editor_lease_files() {
+    editor_leases = true;
+    for (size_t i = 0; i < buffers.size; ++i) {
+        Buffer_lease_file(buffers.elements[i]);
+    }
+}
+
+void editor_check_leases() {
+    for (size_t i = 0; i < buffers.size; ++i) {
+        Buffer* buf = buffers.elements[i];
+        if (Buffer_check_lease(buf)) {
+            print("lease %s broken\n", buf->name->data);
+        }
+    }
+}
+
+void editor_poll_watches() {
+    if (editor_watch_fd < 0) {
+        return;
+    }
+    char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(editor_watch_fd, events, sizeof(events))) > 0) {
+        for (char* p = events; p < events + n; ) {
+            struct inotify_event* event = (struct inotify_event*) p;
+            for (size_t i = 0; i < watches.size; ++i) {
+                FileWatch* watch = watches.elements[i];
+                if ((event->mask & IN_Q_OVERFLOW)
+                        || (event->wd == watch->wd && event->len > 0
+                            && strcmp(event->name, watch->name->data) == 0)) {
+                    watch->pending = true;
+                }
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    for (size_t i = 0; i < watches.size; ++i) {
+        FileWatch* watch = watches.elements[i];
+        Buffer* buf = watch->buffer;
+        // Lines being typed into aren't in the buffer yet; wait until they are.
+        if (!watch->pending || Buffer_saving(buf)
+                || (buf == current_buffer && current_mode == EM_INSERT)) {
+            continue;
+        }
+        watch->pending = false;
+        int result = Buffer_reload(buf);
+        print("reload %s: %d\n", buf->name->data, result);
+        if (result == BUFFER_RELOAD_NONE) {
+            continue;
+        }
+        if (result != BUFFER_RELOAD_CONFLICT) {
+            // Its index has lines to catch up on.
+            editor_poll_indexes();
+        }
+        if (buf == current_buffer && result != BUFFER_RELOAD_CONFLICT) {
+            display_current_buffer();
+        }
+        if (result == BUFFER_RELOAD_APPENDED) {
+            continue;
+        }
+        String_clear(bottom_bar_info);
+        if (result != BUFFER_RELOAD_CONFLICT) {
+            Strcats(&bottom_bar_info, "-- Reloaded: ");
+        }
+        else if (Buffer_lost_data(buf)) {
+            Strcats(&bottom_bar_info, "-- Cut short on disk (not reloaded, buffer is modified; "
+                                      "the lines that were lost read as NUL): ");
+        }
+        else {
+            Strcats(&bottom_bar_info, "-- Changed on disk (not reloaded, buffer is modified): ");
+        }
+        Strcat(&bottom_bar_info, buf->name);
+        Strcats(&bottom_bar_info, " --");
+        display_bottom_bar(bottom_bar_info->data, NULL);
+    }
+}
+
 void editor_make_buffer(const char* filename, size_t index) {
     Buffer* buffer = make_Buffer(filename);
+    if (filename != NULL) {
+        _editor_open_journal(buffer);
+        _editor_watch_buffer(buffer);
+    }
     if (index > buffers.size) {
         Vector_push(&buffers, buffer);
     } else {
         Vector_insert(&buffers, index, buffer);
     }
+    if (filename != NULL) {
+        _editor_open_index(buffer);
+    }
 }
 
 void editor_switch_buffer(size_t n) {
@@ -425,7 +744,14 @@ void editor_init(const char* filename) {
     inplace_make_Vector(&buffers, 10);
     inplace_make_Vector(&active_copy.data, 10);
     current_buffer = make_Buffer(filename);
+    if (filename != NULL) {
+        _editor_open_journal(current_buffer);
+        _editor_watch_buffer(current_buffer);
+    }
     Vector_push(&buffers, current_buffer);
+    if (filename != NULL) {
+        _editor_open_index(current_buffer);
+    }
     current_buffer_idx = 0;
     editor_top = 1;
     editor_left = 5;
@@ -441,6 +767,7 @@ void editor_init(const char* filename) {
 void editor_close_buffer(int idx) {
     Buffer* buf = buffers.elements[idx];
     Vector_delete(&buffers, idx);
+    _editor_unwatch_buffer(buf);
     Buffer_destroy(buf);
     free(buf);
     if (idx == current_buffer_idx) {
@@ -486,18 +813,18 @@ void begin_insert() {
  */
 void push_current_action(String* new_content) {
     size_t line_num = Buffer_get_line_index(current_buffer, current_buffer->cursor_row);
-    String** line_p = Buffer_get_line_abs(current_buffer, line_num);
     // TODO: make constructor, check correctness
     Edit* action = malloc(sizeof(Edit));
     action->undo_index = current_buffer->undo_index;
     action->start_row = line_num;
     action->start_col = -1;
-    action->old_content = *line_p;
     if (new_content == NULL) {
-        Vector_delete(&current_buffer->lines, line_num);
+        Buffer_remove_lines(current_buffer, line_num, line_num+1, &action->old_content);
         action->new_content = NULL;
     }
     else {
+        String** line_p = Buffer_get_line_abs(current_buffer, line_num);
+        action->old_content = String_detach(*line_p);
         *line_p = new_content;
         action->new_content = Strdup(new_content);
     }
@@ -525,7 +852,7 @@ int editor_backspace() {
             size_t content_len = gapBuffer_content_length(&active_insert);
             push_current_action(NULL);
 
-            String* prev_line = current_buffer->lines.elements[line_num-1];
+            String* prev_line = *Buffer_get_line_abs(current_buffer, line_num-1);
             // lol lack of GapBuffer_destroy
             inplace_make_GapBuffer(&active_insert, prev_line->data, DEFAULT_GAP_SIZE);
             gapBuffer_move_gap(&active_insert, active_insert.total_size - active_insert.gap_end);
@@ -640,6 +967,71 @@ void add_chr(char c) {
     move_to_current();
 }
 
+void editor_paste(const char* data, size_t length) {
+    if (current_mode == EM_NORMAL && Buffer_get_mode(current_buffer) == EM_NORMAL
+            && current_recording_macro == NULL) {
+        // Like vim: paste as if inserted at the cursor, and stay in normal mode.
+        clear_action_stack();
+        process_input('i', 0);
+        editor_paste(data, length);
+        process_input(BYTE_ESC, 0);
+        return;
+    }
+    if (current_mode != EM_INSERT || current_recording_macro != NULL) {
+        // The command line, visual mode and macros get the keys.
+        for (size_t i = 0; i < length; ++i) {
+            process_input(data[i], 0);
+        }
+        return;
+    }
+    const char* end = data + length;
+    const char* last = data;
+    size_t col = current_buffer->cursor_col;
+    const char* newline = memchr(data, '\n', length);
+    if (newline != NULL) {
+        size_t n_lines = 0;
+        for (const char* p = newline; p != NULL; p = memchr(p + 1, '\n', end - p - 1)) {
+            n_lines += 1;
+            last = p + 1;
+        }
+        // The line at the cursor ends at the first newline; what was after the
+        // cursor goes after the last one.
+        gapBuffer_insertN(&active_insert, data, newline - data + 1);
+        String* first = alloc_String(active_insert.gap_start);
+        Strncats(&first, active_insert.content, active_insert.gap_start);
+        String* rest = make_String(active_insert.content + active_insert.gap_end);
+        gapBuffer_destroy(&active_insert);
+        push_current_action(first);
+
+        size_t line_num = Buffer_get_line_index(current_buffer, current_buffer->cursor_row) + 1;
+        if (n_lines > 1) {
+            // All the whole lines are one edit, so the paste fits in the undo history.
+            Buffer_insert_text(current_buffer, current_buffer->undo_index, line_num,
+                               newline + 1, last - (newline + 1));
+        }
+        // The last line is still being typed into: it goes in empty, like
+        // editor_newline does, and end_insert fills it in.
+        Buffer_insert_line(current_buffer, line_num + n_lines - 1, make_String(""));
+        Buffer_push_undo(current_buffer, make_Insert(current_buffer->undo_index,
+                                                     line_num + n_lines - 1, -1, make_String("")));
+
+        inplace_make_GapBuffer(&active_insert, rest->data, DEFAULT_GAP_SIZE);
+        free(rest);
+        current_buffer->cursor_row += n_lines;
+        col = 0;
+    }
+    gapBuffer_insertN(&active_insert, last, end - last);
+    for (const char* p = last; p < end; ++p) {
+        col = (*p == BYTE_TAB) ? tab_round_up(col) : col + 1;
+    }
+    current_buffer->cursor_col = col;
+    current_buffer->natural_col = col;
+    if (editor_fix_view() == RP_NONE) {
+        display_current_buffer();
+    }
+    move_to_current();
+}
+
 /**
  * "o" command in vim.
  * TODO: make "O".
@@ -660,7 +1052,7 @@ void editor_newline(int side, const char* head, const char* initial) {
         }
         // HACK new action just to insert. TODO
         // lack of start info -- gapbuffer tracks a lot of nice metadata implicitly, but not the insert status.
-        Vector_insert(&current_buffer->lines, line_num, make_String(""));
+        Buffer_insert_line(current_buffer, line_num, make_String(""));
         Edit* newline_edit = make_Insert(current_buffer->undo_index, line_num, -1, make_String(""));
         Buffer_push_undo(current_buffer, newline_edit);
         current_buffer->cursor_row += 1;
@@ -686,6 +1078,79 @@ void display_bottom_bar(char* left, char* right) {
     }
 }
 
+void editor_save_message(Buffer* buf, int result) {
+    String_clear(bottom_bar_info);
+    Strcats(&bottom_bar_info, result == 0 ? "-- File saved: " : "-- Could not save: ");
+    Strcat(&bottom_bar_info, buf->name);
+    if (result == 0) {
+        char timing[32];
+        snprintf(timing, sizeof(timing), " (%.1f ms)", buf->last_save.total_ms);
+        Strcats(&bottom_bar_info, timing);
+    }
+    Strcats(&bottom_bar_info, " --");
+    display_bottom_bar(bottom_bar_info->data, NULL);
+}
+
+void editor_poll_saves() {
+    static int last_percent = -1;
+    static bool ticking = false;
+    bool running = false;
+    for (size_t i = 0; i < buffers.size; ++i) {
+        Buffer* buf = buffers.elements[i];
+        if (!Buffer_saving(buf)) {
+            continue;
+        }
+        int result = Buffer_save_finish(buf, false);
+        if (result != BUFFER_SAVE_RUNNING) {
+            editor_save_message(buf, result);
+            last_percent = -1;
+            continue;
+        }
+        running = true;
+        // Don't draw over a command being typed.
+        int percent = Buffer_save_progress(buf) * 100;
+        if (percent != last_percent && current_mode != EM_COMMAND) {
+            char progress[32];
+            snprintf(progress, sizeof(progress), " %d%% --", percent);
+            String_clear(bottom_bar_info);
+            Strcats(&bottom_bar_info, "-- Saving: ");
+            Strcat(&bottom_bar_info, buf->name);
+            Strcats(&bottom_bar_info, progress);
+            display_bottom_bar(bottom_bar_info->data, NULL);
+            last_percent = percent;
+        }
+    }
+    // Nothing else wakes the event loop while a save runs.
+    if (running != ticking) {
+        if (editor_save_timer < 0) {
+            editor_save_timer = EventLoop_add_timer(&editor_events, _editor_save_tick, NULL);
+        }
+        EventLoop_set_timer(editor_save_timer, running ? EDITOR_SAVE_POLL_MS : 0, true);
+        ticking = running;
+    }
+}
+
+void editor_index_buffer(Buffer* buf) {
+    Buffer_enable_trigrams(buf);
+    editor_poll_indexes();
+}
+
+void editor_poll_indexes() {
+    static bool ticking = false;
+    bool running = false;
+    // One buffer a tick: the step's time is for all of them.
+    for (size_t i = 0; i < buffers.size && !running; ++i) {
+        running = !Buffer_index_step(buffers.elements[i], SIZE_MAX, EDITOR_INDEX_STEP_MS);
+    }
+    if (running != ticking) {
+        if (editor_index_timer < 0) {
+            editor_index_timer = EventLoop_add_timer(&editor_events, _editor_index_tick, NULL);
+        }
+        EventLoop_set_timer(editor_index_timer, running ? EDITOR_INDEX_TICK_MS : 0, true);
+        ticking = running;
+    }
+}
+
 void truncate_filename(String* path, char* buf) {
     if (Strlen(path) <= TRUNCATE_SIZE) {
         strcpy(buf, path->data);
@@ -793,7 +1258,7 @@ char* display_buffer_rows(ssize_t start, ssize_t end) {
 
         size_t line_idx = Buffer_get_line_index(current_buffer, i);
         size_t line_size = 0;
-        if (line_idx < current_buffer->lines.size) {
+        if (Buffer_has_line(current_buffer, line_idx)) {
             char* str;
             if (active_insert.content != NULL && current_buffer->cursor_row == i) {
                 format_left_bar(&output_buffer, i);
@@ -990,19 +1455,22 @@ void editor_move_left() {
 void editor_move_right() {
     int max_char = -1;
     char* line;
+    size_t length;
     bool insert = false;
     if (active_insert.content != NULL) {
         insert = true;
         line = gapBuffer_get_content(&active_insert);
+        length = strlen(line);
         max_char = 0;
     }
     else {
         String* _line = *get_line_in_buffer(current_buffer->cursor_row);
         line = _line->data;
+        length = Strlen(_line);
     }
-    max_char += strlen(line);
+    max_char += length;
     // Save newlines, but don't count them towards line length for cursor purposes.
-    if (strlen(line) != 0 && line[strlen(line) - 1] == '\n') {
+    if (length != 0 && line[length - 1] == '\n') {
         max_char -= 1;
     }
     if (line_pos(line, current_buffer->cursor_col) - line < max_char) {
@@ -1027,14 +1495,28 @@ void editor_move_right() {
     }
 }
 
+/**
+ * PRIVATE
+ * Tell the screen the buffer window moved by `lines`, so the next flush can
+ * scroll the terminal instead of sending every row again.
+ */
+void _editor_scroll_screen(ssize_t lines) {
+    if (SCREEN_WRITE && editor_display && editor_screen.out != NULL && lines != 0) {
+        Screen_scroll(&editor_screen, editor_top, editor_bottom, lines);
+    }
+}
+
 /**
  * Scrolls vertically until the cursor is in the window.
  */
 RepaintType editor_fix_view_v() {
     ssize_t bottom_limit = ((ssize_t) editor_bottom) - (editor_top + 1);
-    ssize_t buffer_limit = (ssize_t) current_buffer->lines.size - 1;
     bool display = false;
-    if (buffer_limit < bottom_limit) bottom_limit = buffer_limit;
+    if (bottom_limit < 0 || !Buffer_has_line(current_buffer, bottom_limit)) {
+        ssize_t buffer_limit = (ssize_t) Buffer_get_num_lines(current_buffer) - 1;
+        if (buffer_limit < bottom_limit) bottom_limit = buffer_limit;
+    }
+    ssize_t top_row = current_buffer->top_row;
     if (current_buffer->cursor_row > bottom_limit) {
         ssize_t delta = current_buffer->cursor_row - bottom_limit;
         current_buffer->cursor_row -= delta;
@@ -1047,6 +1529,7 @@ RepaintType editor_fix_view_v() {
         Buffer_scroll(current_buffer, editor_bottom-editor_top, -delta);
         display = true;
     }
+    _editor_scroll_screen(current_buffer->top_row - top_row);
     String** line_p = get_line_in_buffer(current_buffer->cursor_row);
     while (line_p == NULL) {
         --current_buffer->cursor_row;
@@ -1076,6 +1559,28 @@ RepaintType editor_fix_view_v() {
     return RP_NONE;
 }
 
+ssize_t editor_scroll(ssize_t lines) {
+    ssize_t height = editor_bottom - editor_top;
+    ssize_t top_row = current_buffer->top_row;
+    Buffer_scroll(current_buffer, height, lines);
+    ssize_t moved = current_buffer->top_row - top_row;
+    if (moved == 0) {
+        return 0;
+    }
+    current_buffer->cursor_row -= moved;
+    if (current_buffer->cursor_row < 0) {
+        current_buffer->cursor_row = 0;
+    }
+    if (current_buffer->cursor_row >= height) {
+        current_buffer->cursor_row = height - 1;
+    }
+    _editor_scroll_screen(moved);
+    editor_fix_view_v();
+    editor_fix_view_h();
+    display_current_buffer();
+    return moved;
+}
+
 RepaintType editor_fix_view_h() {
     print("fixview col: %ld\n", current_buffer->cursor_col);
     if (current_buffer->cursor_col < current_buffer->left_col) {
@@ -1129,7 +1634,7 @@ RepaintType editor_move_to(ssize_t row, ssize_t col, bool sharp) {
     RepaintType ret1 = editor_fix_view_v();
     String* _line = *get_line_in_buffer(current_buffer->cursor_row);
     char* line = _line->data;
-    if (col > strlen(line)) col = strlen(line);
+    if (col > Strlen(_line)) col = Strlen(_line);
     col = line_pos_ptr(line, line+col);
     size_t max_col = strlen_tab(line);
     if (max_col > 0) --max_col;
@@ -3,10 +3,17 @@
 
 #include "../structures/buffer.h"
 #include "utils.h"
+#include "screen.h"
+#include "event_loop.h"
 #include "../common.h"
 
 #define BYTE_CTRLC      '\003'      // end of text
 #define BYTE_CTRLD      '\004'      // end of transmission
+#define BYTE_CTRLE      '\005'
+#define BYTE_CTRLF      '\006'
+#define BYTE_CTRLB      '\002'
+#define BYTE_CTRLU      '\025'
+#define BYTE_CTRLY      '\031'
 #define BYTE_CTRLZ      '\032'      // substitute?
 #define BYTE_ESC        '\033'
 //#define BYTE_ENTER      '\015'      // Carriage Return
@@ -23,6 +30,24 @@
 
 extern String* bottom_bar_info;
 
+/**
+ * Everything the editor draws goes to this virtual screen, and reaches the
+ * terminal (as just the cells that changed) on editor_flush.
+ * `frame_bytes` / `frame_writes` are how much the last frame took.
+ */
+extern Screen editor_screen;
+
+/**
+ * While more input is waiting, frames are put off (see editor_end_frame), but
+ * never for longer than this since the last one was sent.
+ */
+extern double EDITOR_FRAME_MAX_DELAY_MS;
+
+/**
+ * Frames that weren't sent because more input was already waiting.
+ */
+extern size_t editor_frames_skipped;
+
 extern EditorMode current_mode;
 
 extern struct winsize window_size;
@@ -157,6 +182,14 @@ int editor_backspace();
  */
 void add_chr(char c);
 
+/**
+ * Insert pasted text at the cursor as one edit: the lines go into the buffer
+ * in one batch, in the current undo group, with one repaint.
+ * In normal mode it's inserted like `i` + text + ESC. Elsewhere (command line,
+ * visual mode, recording a macro) it's handled as typed keys.
+ */
+void editor_paste(const char* data, size_t length);
+
 /**
  * Adds a line below the current line and begins insert mode.
  */
@@ -164,6 +197,81 @@ void editor_newline(int, const char* head, const char* initial);
 
 void display_bottom_bar(char* left, char* right);
 
+/**
+ * Show the result of saving `buf` (a Buffer_save result) in the bottom bar.
+ */
+void editor_save_message(Buffer* buf, int result);
+
+/**
+ * Show the progress of background saves in the bottom bar, and clean up
+ * (and report) the ones that have finished. Call once per iteration of the main loop.
+ */
+void editor_poll_saves();
+
+/**
+ * Files at least this many bytes get a trigram index (see trigram_index.h) as
+ * they're opened. 0: only buffers indexed with `:index`.
+ */
+extern size_t EDITOR_INDEX_THRESHOLD;
+
+/**
+ * Give `buf` a trigram index, built in the background by editor_poll_indexes.
+ */
+void editor_index_buffer(Buffer* buf);
+
+/**
+ * Index a couple of milliseconds' worth more of the buffers whose trigram
+ * index isn't built yet.
+ * Runs on a timer until they all are: on the main thread, between input, so
+ * it never reads a buffer while an edit is half done.
+ */
+void editor_poll_indexes();
+
+/**
+ * Send what was drawn since the last call to the terminal, in one write().
+ * Call once the pending input has been handled.
+ */
+void editor_flush();
+
+/**
+ * End of a main loop iteration: editor_flush, unless `input_pending` and the
+ * last frame went out less than EDITOR_FRAME_MAX_DELAY_MS ago. Then the frame
+ * is skipped; whatever it had is sent with the next one.
+ */
+void editor_end_frame(bool input_pending);
+
+/**
+ * inotify descriptor the open files are watched through (-1 if there is none yet).
+ */
+extern int editor_watch_fd;
+
+/**
+ * What the main loop waits on. Stdin and signals are registered by main; the
+ * editor adds the inotify fd and a timer while saves run. Other fds can be
+ * added with EventLoop_watch.
+ */
+extern EventLoop editor_events;
+
+/**
+ * Reload buffers whose files were changed by other programs (see Buffer_reload).
+ * Runs when the inotify fd has events, and once per iteration of the main loop
+ * (for reloads put off until the buffer was free).
+ */
+void editor_poll_watches();
+
+/**
+ * From now on, hold leases on the files of buffers that read them through a
+ * mapping (see Buffer_lease_file). SIGIO has to be dispatched to
+ * editor_check_leases before this is called: a writer of a leased file sends it.
+ */
+void editor_lease_files();
+
+/**
+ * Let programs waiting on a lease write to the file, once the buffers that
+ * need one have a copy of it (see Buffer_check_lease). Call on SIGIO.
+ */
+void editor_check_leases();
+
 void display_top_bar();
 
 /**
@@ -199,6 +307,13 @@ void editor_move_right();
 RepaintType editor_fix_view();
 void editor_align_tab();
 
+/**
+ * Scroll the window by `lines` (down the file if positive), keeping the cursor
+ * on its line unless that line leaves the window.
+ * Return: how many lines the window actually moved.
+ */
+ssize_t editor_scroll(ssize_t lines);
+
 /**
  * Moves the editor view to (row, col) in the file. 0-indexed.
  * sharp: whether to update natural col or not.
@@ -14,6 +14,12 @@ EditorAction* make_k_action(int control);  // Move up. (repeatable)
 EditorAction* make_l_action(int control);  // Move right. (repeatable, no line wrap)
 EditorAction* make_i_action(int control);  // Enter insert mode.
 EditorAction* make_ESC_action(int control);    // Pop cmdstack, exit visual, etc etc.
+EditorAction* make_CTRLE_action(int control);  // Scroll the window down a line. (repeatable)
+EditorAction* make_CTRLY_action(int control);  // Scroll the window up a line. (repeatable)
+EditorAction* make_CTRLD_action(int control);  // Scroll down half a window, cursor too. (repeatable)
+EditorAction* make_CTRLU_action(int control);  // Scroll up half a window, cursor too. (repeatable)
+EditorAction* make_CTRLF_action(int control);  // Page down. (repeatable)
+EditorAction* make_CTRLB_action(int control);  // Page up. (repeatable)
 
 
 // editing_actions.c
@@ -89,6 +95,18 @@ void init_actions() {
     action_type_table['i'] = AT_OVERRIDE;
     action_jump_table[BYTE_ESC] = &make_ESC_action;
     action_type_table[BYTE_ESC] = AT_ESCAPE;
+    action_jump_table[BYTE_CTRLE] = &make_CTRLE_action;
+    action_type_table[BYTE_CTRLE] = AT_MOVE;
+    action_jump_table[BYTE_CTRLY] = &make_CTRLY_action;
+    action_type_table[BYTE_CTRLY] = AT_MOVE;
+    action_jump_table[BYTE_CTRLD] = &make_CTRLD_action;
+    action_type_table[BYTE_CTRLD] = AT_MOVE;
+    action_jump_table[BYTE_CTRLU] = &make_CTRLU_action;
+    action_type_table[BYTE_CTRLU] = AT_MOVE;
+    action_jump_table[BYTE_CTRLF] = &make_CTRLF_action;
+    action_type_table[BYTE_CTRLF] = AT_MOVE;
+    action_jump_table[BYTE_CTRLB] = &make_CTRLB_action;
+    action_type_table[BYTE_CTRLB] = AT_MOVE;
 
     action_jump_table['0'] = &make_0_action;
     action_type_table['0'] = AT_MOVE;
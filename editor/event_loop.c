@@ -0,0 +1,162 @@
+#include "event_loop.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/**
+ * PRIVATE
+ * Index of the source for `fd`, or -1.
+ */
+static ssize_t _EventLoop_find(EventLoop* loop, int fd) {
+    for (size_t i = 0; i < loop->size; ++i) {
+        if (loop->sources[i].fd == fd) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * PRIVATE
+ */
+static void _EventLoop_add(EventLoop* loop, int fd, int kind, short events,
+                           EventCallback callback, void* data) {
+    ssize_t i = _EventLoop_find(loop, fd);
+    if (i < 0) {
+        if (loop->size == loop->capacity) {
+            loop->capacity = loop->capacity ? loop->capacity * 2 : 4;
+            loop->sources = realloc(loop->sources, loop->capacity * sizeof(EventSource));
+            loop->fds = realloc(loop->fds, loop->capacity * sizeof(struct pollfd));
+        }
+        i = loop->size++;
+    }
+    loop->sources[i] = (EventSource) { fd, kind, callback, data };
+    loop->fds[i] = (struct pollfd) { fd, events, 0 };
+}
+
+void EventLoop_destroy(EventLoop* loop) {
+    for (size_t i = 0; i < loop->size; ++i) {
+        if (loop->sources[i].kind != EVENT_FD) {
+            close(loop->sources[i].fd);
+        }
+    }
+    sigprocmask(SIG_UNBLOCK, &loop->blocked, NULL);
+    free(loop->sources);
+    free(loop->fds);
+    memset(loop, 0, sizeof(EventLoop));
+}
+
+void EventLoop_watch(EventLoop* loop, int fd, short events, EventCallback callback, void* data) {
+    _EventLoop_add(loop, fd, EVENT_FD, events, callback, data);
+}
+
+void EventLoop_unwatch(EventLoop* loop, int fd) {
+    ssize_t i = _EventLoop_find(loop, fd);
+    if (i < 0) {
+        return;
+    }
+    if (loop->sources[i].kind != EVENT_FD) {
+        close(fd);
+    }
+    loop->size -= 1;
+    memmove(loop->sources + i, loop->sources + i + 1, (loop->size - i) * sizeof(EventSource));
+    memmove(loop->fds + i, loop->fds + i + 1, (loop->size - i) * sizeof(struct pollfd));
+}
+
+int EventLoop_add_timer(EventLoop* loop, EventCallback callback, void* data) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd >= 0) {
+        _EventLoop_add(loop, fd, EVENT_TIMER, POLLIN, callback, data);
+    }
+    return fd;
+}
+
+void EventLoop_set_timer(int timer, double ms, bool repeat) {
+    struct itimerspec spec = {0};
+    long ns = ms * 1e6;
+    spec.it_value.tv_sec = ns / 1000000000;
+    spec.it_value.tv_nsec = ns % 1000000000;
+    if (repeat) {
+        spec.it_interval = spec.it_value;
+    }
+    timerfd_settime(timer, 0, &spec, NULL);
+}
+
+int EventLoop_add_signals(EventLoop* loop, const int* signals, size_t count,
+                          EventCallback callback, void* data) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (size_t i = 0; i < count; ++i) {
+        sigaddset(&mask, signals[i]);
+    }
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    // Blocked, so they wait in the signalfd instead of being delivered.
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    for (size_t i = 0; i < count; ++i) {
+        sigaddset(&loop->blocked, signals[i]);
+    }
+    _EventLoop_add(loop, fd, EVENT_SIGNAL, POLLIN, callback, data);
+    return fd;
+}
+
+/**
+ * PRIVATE
+ * Run the callback(s) for a ready source.
+ */
+static int _EventLoop_dispatch(EventSource source) {
+    if (source.kind == EVENT_TIMER) {
+        uint64_t expirations;
+        if (read(source.fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            return 0;
+        }
+        source.callback(source.fd, source.data);
+        return 1;
+    }
+    if (source.kind == EVENT_SIGNAL) {
+        int ran = 0;
+        struct signalfd_siginfo info;
+        while (read(source.fd, &info, sizeof(info)) == sizeof(info)) {
+            source.callback(info.ssi_signo, source.data);
+            ran += 1;
+        }
+        return ran;
+    }
+    source.callback(source.fd, source.data);
+    return 1;
+}
+
+int EventLoop_run_once(EventLoop* loop, int timeout_ms) {
+    int ready = poll(loop->fds, loop->size, timeout_ms);
+    if (ready < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    if (ready == 0) {
+        return 0;
+    }
+    loop->wakeups += 1;
+    // Callbacks may watch and unwatch fds: take the ready ones first, and
+    // look each up again before running it.
+    int ready_fds[ready];
+    int n = 0;
+    for (size_t i = 0; i < loop->size && n < ready; ++i) {
+        if (loop->fds[i].revents != 0) {
+            ready_fds[n++] = loop->fds[i].fd;
+        }
+    }
+    int ran = 0;
+    for (int i = 0; i < n; ++i) {
+        ssize_t j = _EventLoop_find(loop, ready_fds[i]);
+        if (j >= 0) {
+            ran += _EventLoop_dispatch(loop->sources[j]);
+        }
+    }
+    return ran;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Event loop: one poll() over every file descriptor the editor waits on.
+ *
+ * Besides plain file descriptors (stdin, inotify, ...), it handles timers
+ * (timerfd) and signals (signalfd), so those are dispatched from the loop like
+ * everything else instead of interrupting it. With nothing to do, the loop
+ * sleeps in poll() and takes no CPU.
+ *
+ * A zeroed EventLoop is empty and ready to use.
+ */
+
+#define EVENT_FD     0
+#define EVENT_TIMER  1
+#define EVENT_SIGNAL 2
+
+/**
+ * Called when a source is ready, with the fd (EVENT_FD, EVENT_TIMER) or the
+ * signal number (EVENT_SIGNAL). Timer expirations and signals are already
+ * read from their fd; plain fds are up to the callback.
+ */
+typedef void (*EventCallback)(int value, void* data);
+
+struct EventSource {
+    int fd;
+    int kind;
+    EventCallback callback;
+    void* data;
+};
+typedef struct EventSource EventSource;
+
+struct EventLoop {
+    EventSource* sources;
+    struct pollfd* fds;
+    size_t size;
+    size_t capacity;
+    sigset_t blocked;           // Signals routed to a signalfd (unblocked again on destroy).
+    size_t wakeups;             // poll() calls that dispatched something.
+};
+typedef struct EventLoop EventLoop;
+
+/**
+ * Close the timers and signalfds the loop made, and unblock its signals.
+ * Plain fds are left to whoever watched them.
+ */
+void EventLoop_destroy(EventLoop* loop);
+
+/**
+ * Call `callback` whenever `fd` has one of `events` (POLLIN, ...).
+ * Watching an fd again replaces its callback.
+ */
+void EventLoop_watch(EventLoop* loop, int fd, short events, EventCallback callback, void* data);
+
+/**
+ * Stop watching `fd`. Closes it if the loop made it (timers, signalfds).
+ */
+void EventLoop_unwatch(EventLoop* loop, int fd);
+
+/**
+ * Make a timer, disarmed (see EventLoop_set_timer).
+ * Return: its fd (used to refer to it), or -1 on error.
+ */
+int EventLoop_add_timer(EventLoop* loop, EventCallback callback, void* data);
+
+/**
+ * Fire `timer` in `ms` milliseconds, then every `ms` if `repeat`.
+ * 0 disarms it.
+ */
+void EventLoop_set_timer(int timer, double ms, bool repeat);
+
+/**
+ * Take `signals` out of normal delivery (they are blocked) and dispatch them
+ * from the loop instead.
+ * Return: the signalfd, or -1 on error (then the signals are left alone).
+ */
+int EventLoop_add_signals(EventLoop* loop, const int* signals, size_t count,
+                          EventCallback callback, void* data);
+
+/**
+ * Wait up to `timeout_ms` (-1: forever, 0: don't wait) for sources to be
+ * ready, and run their callbacks.
+ * Return: the number of callbacks run, or -1 on error (not counting EINTR).
+ */
+int EventLoop_run_once(EventLoop* loop, int timeout_ms);
@@ -0,0 +1,290 @@
+#include "input.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "debugging.h"
+#include "editor.h"
+
+#define INPUT_MASK (INPUT_RING_SIZE - 1)
+
+#define INPUT_GROUND    0
+#define INPUT_ESC       1           // After ESC.
+#define INPUT_CSI       2           // After ESC [.
+#define INPUT_SS3       3           // After ESC O.
+#define INPUT_PASTE     4           // Between ESC [200~ and ESC [201~.
+#define INPUT_REPLAY    5           // Giving out seq as plain keys.
+
+static const char PASTE_END[] = "\033[201~";
+
+void inplace_make_InputDecoder(InputDecoder* dec) {
+    memset(dec, 0, sizeof(InputDecoder));
+    dec->paste = alloc_String(64);
+}
+
+void InputDecoder_destroy(InputDecoder* dec) {
+    free(dec->paste);
+}
+
+size_t InputDecoder_buffered(const InputDecoder* dec) {
+    return dec->tail - dec->head;
+}
+
+bool InputDecoder_pending(const InputDecoder* dec) {
+    return dec->state == INPUT_ESC || dec->state == INPUT_CSI || dec->state == INPUT_SS3;
+}
+
+ssize_t InputDecoder_read(InputDecoder* dec, int fd) {
+    ssize_t total = 0;
+    while (InputDecoder_buffered(dec) < INPUT_RING_SIZE) {
+        // The free space is at most two pieces: up to the end of the ring, and
+        // from its start.
+        size_t start = dec->tail & INPUT_MASK;
+        size_t free_space = INPUT_RING_SIZE - InputDecoder_buffered(dec);
+        size_t first = INPUT_RING_SIZE - start;
+        if (first > free_space) {
+            first = free_space;
+        }
+        struct iovec iov[2] = {
+            { dec->ring + start, first },
+            { dec->ring, free_space - first },
+        };
+        ssize_t n = readv(fd, iov, (free_space > first) ? 2 : 1);
+        if (n == 0) {
+            return total;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        dec->tail += n;
+        total += n;
+    }
+    return (total > 0) ? total : -1;
+}
+
+size_t InputDecoder_feed(InputDecoder* dec, const char* data, size_t length) {
+    size_t n = INPUT_RING_SIZE - InputDecoder_buffered(dec);
+    if (n > length) {
+        n = length;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        dec->ring[(dec->tail + i) & INPUT_MASK] = data[i];
+    }
+    dec->tail += n;
+    return n;
+}
+
+void InputDecoder_timeout(InputDecoder* dec) {
+    if (InputDecoder_pending(dec)) {
+        dec->state = INPUT_REPLAY;
+        dec->replay = 0;
+    }
+}
+
+double InputDecoder_timer_ms(InputDecoder* dec) {
+    size_t timing = InputDecoder_pending(dec) ? dec->started : 0;
+    if (timing == dec->timing) {
+        return -1;
+    }
+    dec->timing = timing;
+    return (timing != 0) ? INPUT_ESC_TIMEOUT_MS : 0;
+}
+
+/**
+ * PRIVATE
+ */
+static inline bool _InputDecoder_key(InputKey* key, char c, int control, int modifiers) {
+    key->c = c;
+    key->control = control;
+    key->modifiers = modifiers;
+    return true;
+}
+
+/**
+ * PRIVATE
+ * The sequence in dec->seq is complete (ends in its final byte).
+ * Return: whether it's a key (then in `key`).
+ */
+static bool _InputDecoder_dispatch(InputDecoder* dec, InputKey* key) {
+    dec->state = INPUT_GROUND;
+    dec->sequences += 1;
+    char final = dec->seq[dec->seq_len - 1];
+    int params[2] = { 0, 0 };
+    size_t num_params = 0;
+    bool valid = dec->seq_len < INPUT_SEQ_MAX;
+    if (dec->seq[1] == '[') {
+        // Numeric parameters separated by ';'. Anything else (private
+        // markers, intermediates) isn't a key we know.
+        for (size_t i = 2; i + 1 < dec->seq_len && valid; ++i) {
+            char c = dec->seq[i];
+            if (c == ';') {
+                num_params += 1;
+            }
+            else if (c >= '0' && c <= '9') {
+                if (num_params < 2) {
+                    params[num_params] = params[num_params] * 10 + (c - '0');
+                }
+            }
+            else {
+                valid = false;
+            }
+        }
+    }
+    int modifiers = (params[1] > 1) ? params[1] - 1 : 0;
+    if (valid) {
+        switch (final) {
+            case 'A':
+                return _InputDecoder_key(key, BYTE_ESC, BYTE_UPARROW, modifiers);
+            case 'B':
+                return _InputDecoder_key(key, BYTE_ESC, BYTE_DOWNARROW, modifiers);
+            case 'C':
+                return _InputDecoder_key(key, BYTE_ESC, BYTE_RIGHTARROW, modifiers);
+            case 'D':
+                return _InputDecoder_key(key, BYTE_ESC, BYTE_LEFTARROW, modifiers);
+            case '~':
+                if (dec->seq[1] != '[') {
+                    break;
+                }
+                if (params[0] == 3) {
+                    return _InputDecoder_key(key, BYTE_ESC, CODE_DELETE, modifiers);
+                }
+                if (params[0] == 200) {
+                    dec->state = INPUT_PASTE;
+                    dec->paste_match = 0;
+                    String_clear(dec->paste);
+                    return false;
+                }
+                break;
+        }
+    }
+    dec->dropped += 1;
+    print("input: dropped ESC%.*s\n", (int) dec->seq_len - 1, dec->seq + 1);
+    return false;
+}
+
+/**
+ * PRIVATE
+ * In a paste: take bytes up to the end marker. Runs without an ESC are copied
+ * in one go.
+ * Return: whether the paste is complete.
+ */
+static bool _InputDecoder_paste(InputDecoder* dec) {
+    while (dec->head != dec->tail) {
+        if (dec->paste_match == 0) {
+            size_t start = dec->head & INPUT_MASK;
+            size_t length = INPUT_RING_SIZE - start;
+            if (length > dec->tail - dec->head) {
+                length = dec->tail - dec->head;
+            }
+            const char* esc = memchr(dec->ring + start, '\033', length);
+            size_t run = (esc != NULL) ? (size_t) (esc - (dec->ring + start)) : length;
+            Strncats(&dec->paste, dec->ring + start, run);
+            dec->head += run;
+            if (esc == NULL) {
+                continue;
+            }
+        }
+        char c = dec->ring[dec->head & INPUT_MASK];
+        dec->head += 1;
+        if (c == PASTE_END[dec->paste_match]) {
+            dec->paste_match += 1;
+            if (PASTE_END[dec->paste_match] == '\0') {
+                dec->state = INPUT_GROUND;
+                return true;
+            }
+            continue;
+        }
+        // Not the end after all: what looked like it is text.
+        Strncats(&dec->paste, PASTE_END, dec->paste_match);
+        dec->paste_match = 0;
+        if (c == '\033') {
+            dec->paste_match = 1;
+        }
+        else {
+            String_push(&dec->paste, c);
+        }
+    }
+    return false;
+}
+
+bool InputDecoder_next(InputDecoder* dec, InputKey* key) {
+    while (true) {
+        if (dec->state == INPUT_REPLAY) {
+            if (dec->replay < dec->seq_len) {
+                return _InputDecoder_key(key, dec->seq[dec->replay++], 0, 0);
+            }
+            dec->state = INPUT_GROUND;
+        }
+        if (dec->state == INPUT_PASTE) {
+            if (_InputDecoder_paste(dec)) {
+                return _InputDecoder_key(key, 0, CODE_PASTE, 0);
+            }
+            return false;
+        }
+        if (dec->head == dec->tail) {
+            return false;
+        }
+        char c = dec->ring[dec->head & INPUT_MASK];
+        switch (dec->state) {
+            case INPUT_GROUND:
+                dec->head += 1;
+                if (c == '\033') {
+                    dec->started += 1;
+                    dec->state = INPUT_ESC;
+                    dec->seq[0] = c;
+                    dec->seq_len = 1;
+                    continue;
+                }
+                return _InputDecoder_key(key, c, 0, 0);
+            case INPUT_ESC:
+                if (c == '[' || c == 'O') {
+                    dec->head += 1;
+                    dec->seq[dec->seq_len++] = c;
+                    dec->state = (c == '[') ? INPUT_CSI : INPUT_SS3;
+                    continue;
+                }
+                // Just the escape key; `c` is decoded on its own next time.
+                dec->state = INPUT_GROUND;
+                return _InputDecoder_key(key, '\033', 0, 0);
+            case INPUT_CSI:
+                if (c < 0x20 || c > 0x7e) {
+                    // Cut off by a control character: not a sequence.
+                    dec->state = INPUT_REPLAY;
+                    dec->replay = 0;
+                    continue;
+                }
+                dec->head += 1;
+                if (dec->seq_len < INPUT_SEQ_MAX - 1) {
+                    dec->seq[dec->seq_len++] = c;
+                }
+                else {
+                    // Too long: keep the final byte only, and drop it.
+                    dec->seq[INPUT_SEQ_MAX - 1] = c;
+                    dec->seq_len = INPUT_SEQ_MAX;
+                }
+                if (c >= 0x40 && _InputDecoder_dispatch(dec, key)) {
+                    return true;
+                }
+                continue;
+            case INPUT_SS3:
+                if (c < 'A' || c > 'D') {
+                    // Not a key we know: ESC O was typed.
+                    dec->state = INPUT_REPLAY;
+                    dec->replay = 0;
+                    continue;
+                }
+                dec->head += 1;
+                dec->seq[dec->seq_len++] = c;
+                if (_InputDecoder_dispatch(dec, key)) {
+                    return true;
+                }
+                continue;
+        }
+    }
+}
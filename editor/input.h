@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "../structures/String.h"
+
+/**
+ * Streaming decoder for terminal input.
+ *
+ * Bytes are read into a ring buffer and decoded one at a time by a state
+ * machine, which keeps its place between reads: an escape sequence split
+ * across reads is finished when the rest arrives, and no byte is looked at
+ * twice. Decoded keys come out in the (char, control) form process_input takes.
+ *
+ * Recognized: CSI (ESC [) and SS3 (ESC O) arrow keys, with xterm modifiers
+ * (ESC [1;5A), delete (ESC [3~) and bracketed paste (ESC [200~ ... ESC [201~).
+ * Other complete CSI sequences are dropped. A lone ESC is only ambiguous until
+ * the next byte, or until InputDecoder_timeout says none is coming.
+ */
+
+#define INPUT_RING_SIZE 4096        // Power of two.
+#define INPUT_SEQ_MAX   32          // Longer sequences are dropped.
+
+// After an ESC, how long to wait for the rest of a sequence.
+#define INPUT_ESC_TIMEOUT_MS 25
+
+// InputKey.modifiers, as xterm encodes them (parameter - 1).
+#define KEY_MOD_SHIFT   1
+#define KEY_MOD_ALT     2
+#define KEY_MOD_CTRL    4
+
+// InputKey.control for a bracketed paste; the text is in InputDecoder.paste.
+#define CODE_PASTE      2327
+
+struct InputKey {
+    char c;
+    int control;
+    int modifiers;
+};
+typedef struct InputKey InputKey;
+
+struct InputDecoder {
+    char ring[INPUT_RING_SIZE];
+    size_t head;                // Next byte to decode (counts up; index with & mask).
+    size_t tail;                // End of the bytes read.
+    int state;
+    char seq[INPUT_SEQ_MAX];    // The sequence being decoded, from its ESC.
+    size_t seq_len;
+    size_t replay;              // Timed out: bytes of seq given out as keys so far.
+    String* paste;              // Text of the paste being read / just decoded.
+    size_t paste_match;         // Bytes of the paste end marker seen so far.
+    size_t sequences;           // Escape sequences decoded.
+    size_t dropped;             // ... and dropped (not understood).
+    size_t started;             // ESCs that started a sequence.
+    size_t timing;              // `started` when the ESC timer was armed for it, 0 if disarmed.
+};
+typedef struct InputDecoder InputDecoder;
+
+void inplace_make_InputDecoder(InputDecoder* dec);
+void InputDecoder_destroy(InputDecoder* dec);
+
+/**
+ * Read what `fd` (non-blocking) has waiting, as much as fits.
+ * Return: bytes read; 0 at end of file; -1 if nothing was waiting.
+ */
+ssize_t InputDecoder_read(InputDecoder* dec, int fd);
+
+/**
+ * Append `length` bytes of input (as if read).
+ * Return: how many fit.
+ */
+size_t InputDecoder_feed(InputDecoder* dec, const char* data, size_t length);
+
+/**
+ * Decode the next key.
+ * Return: false if there isn't a complete one yet.
+ */
+bool InputDecoder_next(InputDecoder* dec, InputKey* key);
+
+/**
+ * Bytes read but not decoded yet.
+ */
+size_t InputDecoder_buffered(const InputDecoder* dec);
+
+/**
+ * Whether a sequence was started but not finished (see InputDecoder_timeout).
+ */
+bool InputDecoder_pending(const InputDecoder* dec);
+
+/**
+ * The rest of the pending sequence isn't coming: InputDecoder_next gives out
+ * its bytes as plain keys (a lone ESC is the escape key). A paste isn't cut
+ * short.
+ */
+void InputDecoder_timeout(InputDecoder* dec);
+
+/**
+ * What to set the ESC timer to before waiting for more input:
+ * INPUT_ESC_TIMEOUT_MS when a sequence has started pending, 0 (disarm) when
+ * none is, and -1 (leave it running) while the same one still is. Setting it
+ * again on every wakeup would push the timeout back each time, so anything
+ * waking the loop more often would keep a lone ESC from ever timing out.
+ */
+double InputDecoder_timer_ms(InputDecoder* dec);
@@ -10,16 +10,23 @@
 
 #include "debugging.h"
 #include "../structures/buffer.h"
+#include "../structures/search.h"
 #include "editor.h"
 #include "editor_actions.h"
+#include "input.h"
 #include "../common.h"
 
+// Bracketed paste: the terminal marks pasted text, so it can be inserted in one go.
+#define PASTE_ENABLE    "\033[?2004h"
+#define PASTE_DISABLE   "\033[?2004l"
+
 struct termios save_settings;
 struct termios set_settings = {0};
-struct sigaction sa = {0};
-struct sigaction sa_old = {0};
 
-volatile bool force_repaint = false;
+// Keys read but not handled yet.
+InputDecoder input;
+// Fires when an escape sequence was started but its end didn't follow.
+int input_timer = -1;
 
 /**
  * Assumes the program is running in a terminal with support for Xterm's alternate screen buffer.
@@ -27,7 +34,7 @@ volatile bool force_repaint = false;
  * from overwriting the previous terminal content.
  */
 void display_altscreen() {
-    printf("\033[?1049h\033[H");
+    printf("\033[?1049h\033[H" PASTE_ENABLE);
 }
 
 /**
@@ -36,32 +43,37 @@ void display_altscreen() {
  * content to whatever was present before calling display_altscreen.
  */
 void hide_altscreen() {
-    printf("\033[?1049l");
+    printf(PASTE_DISABLE "\033[?1049l");
 }
 
-void signal_handler(int signum) {
-    sigset_t mask;
+/**
+ * Event loop callback for the signals main routes through a signalfd.
+ */
+void on_signal(int signum, void* data) {
     switch (signum) {
         case SIGINT:
             current_mode = EM_QUIT;
             return;
+        case SIGIO:
+            editor_check_leases();
+            return;
         case SIGWINCH:
             editor_window_size_change();
-            force_repaint = true;
+            Screen_invalidate(&editor_screen);
+            display_current_buffer();
             return;
         case SIGTSTP:
             print("sigstop\n");
             tcsetattr(STDIN_FILENO, TCSANOW, &save_settings);
             hide_altscreen();
-            sigemptyset(&mask);
-            sigaddset(&mask, SIGTSTP);
-            sigprocmask(SIG_UNBLOCK, &mask, NULL);
-            sigaction(SIGTSTP, &sa_old, NULL);
-            kill(0, SIGTSTP);
-            sigaction(SIGTSTP, &sa, NULL);
+            // SIGTSTP is blocked (it's read from the signalfd), SIGSTOP can't be.
+            // The SIGCONT that resumes us comes through the signalfd, too.
+            kill(0, SIGSTOP);
+            return;
         case SIGCONT:
             print("sigcont\n");
             display_altscreen();
+            Screen_invalidate(&editor_screen);
 
             int n = 10;
             // A signal may cause tcsetattr() to fail (e.g., SIGCONT).
@@ -71,11 +83,30 @@ void signal_handler(int signum) {
                 --n;
             }
 
-            force_repaint = true;
+            display_current_buffer();
             return;
     }
 }
 
+/**
+ * Event loop callback: read everything stdin has waiting, so keys that
+ * arrived together are handled before the next frame is drawn.
+ */
+void on_stdin(int fd, void* data) {
+    if (InputDecoder_read(&input, fd) == 0) {
+        // The terminal hung up: don't keep waking up for it.
+        EventLoop_unwatch(&editor_events, fd);
+    }
+}
+
+/**
+ * Event loop callback: an ESC wasn't followed by the rest of a sequence, so
+ * it was the escape key.
+ */
+void on_input_timeout(int fd, void* data) {
+    InputDecoder_timeout(&input);
+}
+
 int main(int argc, char** argv) {
     __debug_init();
 
@@ -86,6 +117,25 @@ int main(int argc, char** argv) {
 
     bottom_bar_info = alloc_String(20);
 
+    // Memory budget (MiB) for files opened in large-file mode.
+    char* budget = getenv("TXT_MEMORY_MB");
+    if (budget != NULL && atol(budget) > 0) {
+        BUFFER_MEMORY_BUDGET = (size_t) atol(budget) << 20;
+    }
+    char* save_fsync = getenv("TXT_SAVE_FSYNC");
+    if (save_fsync != NULL && strcmp(save_fsync, "0") == 0) {
+        BUFFER_SAVE_FSYNC = false;
+    }
+    char* search_threads = getenv("TXT_SEARCH_THREADS");
+    if (search_threads != NULL && atol(search_threads) > 0) {
+        SEARCH_THREADS = (size_t) atol(search_threads);
+    }
+    // Files of this many MiB and up get a trigram index for searches.
+    char* index_mb = getenv("TXT_TRIGRAM_INDEX_MB");
+    if (index_mb != NULL && atol(index_mb) > 0) {
+        EDITOR_INDEX_THRESHOLD = (size_t) atol(index_mb) << 20;
+    }
+
     // No terminal supports.
     if (isatty(STDIN_FILENO) == 0 || isatty(STDOUT_FILENO) == 0) {
         return 1;
@@ -98,12 +148,15 @@ int main(int argc, char** argv) {
     editor_init(argv[1]);
     init_actions();
 
-    sa.sa_handler = signal_handler;
-    sigaction(SIGINT, &sa, NULL);
-    sigaction(SIGWINCH, &sa, NULL);
-    sigaction(SIGTSTP, &sa, &sa_old);
-    sigaction(SIGCONT, &sa, NULL);
-    
+    const int signals[] = { SIGINT, SIGWINCH, SIGTSTP, SIGCONT, SIGIO };
+    if (EventLoop_add_signals(&editor_events, signals, sizeof(signals) / sizeof(int), on_signal, NULL) >= 0) {
+        // Programs about to write to a file the editor maps wait for it (SIGIO).
+        editor_lease_files();
+    }
+    inplace_make_InputDecoder(&input);
+    EventLoop_watch(&editor_events, STDIN_FILENO, POLLIN, on_stdin, NULL);
+    input_timer = EventLoop_add_timer(&editor_events, on_input_timeout, NULL);
+
     tcgetattr(STDIN_FILENO, &save_settings);
     set_settings = save_settings;
     const tcflag_t local_modes = ~(ICANON | ECHO | ISIG);
@@ -116,79 +169,60 @@ int main(int argc, char** argv) {
 
     clear_screen();
     
-    char buf[30];
-    buf[0] = 0;
-    char read_buf[15];
-    buf[1] = '\0';
     display_current_buffer();
     move_to_current();
     process_input(BYTE_ESC, 0);
+    editor_flush();
     while (true) {
-        if (strlen(buf) < 15) {
-            ssize_t result = read(STDIN_FILENO, read_buf, 14);
-            if (result > 0) {
-                read_buf[result] = 0;
-                strcat(buf, read_buf);
+        InputKey key;
+        if (InputDecoder_next(&input, &key)) {
+            if (key.control == CODE_PASTE) {
+                print("paste %zu bytes\n", Strlen(input.paste));
+                editor_paste(input.paste->data, Strlen(input.paste));
             }
             else {
-                usleep(100);
+                switch (key.control ? 0 : key.c) {
+                    case BYTE_CTRLC:
+                        // TODO: handle
+                        kill(0, SIGINT);
+                        break;
+                    case BYTE_CTRLZ:
+                        // TODO: handle custom maybe.
+                        kill(0, SIGTSTP);
+                        break;
+                }
+                print("input %c %d\n", key.c, key.c);
+                process_input(key.c, key.control);
+            }
+            if (current_mode != EM_INSERT && current_mode != EM_QUIT) {
+                Buffer_checkpoint(current_buffer);
             }
         }
-        if (strlen(buf) > 0) {
-            int control = 0;
-            int consume = 1;
-            switch(buf[0]) {
-                case BYTE_ESC:
-                    if (strcmp(buf+1, "[A") == 0) {
-                        consume = 3;
-                        control = BYTE_UPARROW;
-                    }
-                    else if (strcmp(buf+1, "[B") == 0) {
-                        consume = 3;
-                        control = BYTE_DOWNARROW;
-                    }
-                    else if (strcmp(buf+1, "[C") == 0) {
-                        consume = 3;
-                        control = BYTE_RIGHTARROW;
-                    }
-                    else if (strcmp(buf+1, "[D") == 0) {
-                        consume = 3;
-                        control = BYTE_LEFTARROW;
-                    }
-                    else if (strcmp(buf+1, "[3~") == 0) {
-                        consume = 4;
-                        control = CODE_DELETE;
-                    }
-                    else {
-                        print("??? %s", buf+1);
-                    }
-                    break;
-                case BYTE_CTRLC:
-                    // TODO: handle
-                    kill(0, SIGINT);
-                    break;
-                case BYTE_CTRLD:
-                    // probably do nothing.
-                    break;
-                case BYTE_CTRLZ:
-                    // TODO: handle custom maybe.
-                    kill(0, SIGTSTP);
-                    break;
+        else {
+            // Sleep until something happens. The end of a sequence that was
+            // cut short gets INPUT_ESC_TIMEOUT_MS to arrive.
+            double timeout_ms = InputDecoder_timer_ms(&input);
+            if (timeout_ms >= 0) {
+                EventLoop_set_timer(input_timer, timeout_ms, false);
             }
-            print("input %c %d\n", buf[0], buf[0]);
-            process_input(buf[0], control);
-            memmove(buf, buf+consume, strlen(buf) - consume + 1);
+            EventLoop_run_once(&editor_events, -1);
         }
+        editor_poll_saves();
+        editor_poll_watches();
         if (current_mode == EM_QUIT) {
             print("Quit");
             break;
         }
-        if (force_repaint) {
-            display_current_buffer();
-            force_repaint = false;
-        }
+        editor_end_frame(InputDecoder_buffered(&input) > 0);
     }
 
+    // Don't leave a save half written.
+    for (size_t i = 0; i < buffers.size; ++i) {
+        Buffer_save_finish(buffers.elements[i], true);
+    }
+    print("frames: %lu sent, %lu skipped\n", editor_screen.frames, editor_frames_skipped);
+    InputDecoder_destroy(&input);
+    EventLoop_destroy(&editor_events);
     tcsetattr(STDOUT_FILENO, TCSANOW, &save_settings);
     hide_altscreen();
     return 0;
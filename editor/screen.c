@@ -0,0 +1,466 @@
+#include "screen.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Unchanged cells between two changed ones that get rewritten rather than
+// moved over (a cursor move costs at least 3 bytes).
+#define SCREEN_MAX_GAP 3
+
+static const Cell BLANK = { ' ', 0 };
+
+/**
+ * PRIVATE
+ */
+static inline bool _Cell_eq(Cell a, Cell b) {
+    return a.ch == b.ch && a.attr == b.attr;
+}
+
+/**
+ * PRIVATE
+ */
+void _Screen_blank(Cell* cells, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        cells[i] = BLANK;
+    }
+}
+
+void inplace_make_Screen(Screen* s, size_t rows, size_t cols) {
+    memset(s, 0, sizeof(Screen));
+    s->out = alloc_String(256);
+    Screen_resize(s, rows, cols);
+}
+
+void Screen_destroy(Screen* s) {
+    free(s->front);
+    free(s->back);
+    free(s->out);
+}
+
+void Screen_resize(Screen* s, size_t rows, size_t cols) {
+    s->rows = rows;
+    s->cols = cols;
+    s->front = realloc(s->front, (rows * cols + 1) * sizeof(Cell));
+    s->back = realloc(s->back, (rows * cols + 1) * sizeof(Cell));
+    _Screen_blank(s->back, rows * cols);
+    s->row = 0;
+    s->col = 0;
+    s->scroll_lines = 0;
+    s->invalid = true;
+    s->dirty = true;
+}
+
+void Screen_invalidate(Screen* s) {
+    s->invalid = true;
+    s->dirty = true;
+}
+
+void Screen_scroll(Screen* s, size_t top, size_t bottom, ssize_t lines) {
+    if (s->scroll_lines != 0 && (s->scroll_top != top || s->scroll_bottom != bottom)) {
+        // Only one region at a time; the diff copes with the rest.
+        s->scroll_lines = 0;
+    }
+    s->scroll_top = top;
+    s->scroll_bottom = bottom;
+    s->scroll_lines += lines;
+    s->dirty = true;
+}
+
+/**
+ * PRIVATE
+ * Handle a CSI sequence: `params` (n of them, -1 if missing), and its final byte.
+ */
+void _Screen_csi(Screen* s, ssize_t* params, size_t n, bool private, char final) {
+    ssize_t p0 = n > 0 ? params[0] : -1;
+    Cell* row = s->back + s->row * s->cols;
+    if (private) {
+        return;
+    }
+    switch (final) {
+        case 'H':
+        case 'f':
+            s->row = p0 > 0 ? p0 - 1 : 0;
+            s->col = (n > 1 && params[1] > 0) ? params[1] - 1 : 0;
+            if (s->row >= s->rows) s->row = s->rows > 0 ? s->rows - 1 : 0;
+            if (s->col >= s->cols) s->col = s->cols > 0 ? s->cols - 1 : 0;
+            break;
+        case 'K':
+            if (s->row >= s->rows) break;
+            if (p0 <= 0) {
+                if (s->col < s->cols) _Screen_blank(row + s->col, s->cols - s->col);
+            }
+            else if (p0 == 1) {
+                _Screen_blank(row, s->col < s->cols ? s->col + 1 : s->cols);
+            }
+            else {
+                _Screen_blank(row, s->cols);
+            }
+            break;
+        case 'J':
+            if (p0 == 2 || p0 == 3) {
+                _Screen_blank(s->back, s->rows * s->cols);
+            }
+            else if (p0 <= 0 && s->row < s->rows) {
+                size_t start = s->row * s->cols + (s->col < s->cols ? s->col : s->cols);
+                _Screen_blank(s->back + start, s->rows * s->cols - start);
+            }
+            break;
+        case 'm':
+            if (n == 0) {
+                s->attr = 0;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                if (params[i] <= 0) s->attr = 0;
+                else if (params[i] == 7) s->attr |= SCREEN_REVERSE;
+                else if (params[i] == 27) s->attr &= ~SCREEN_REVERSE;
+            }
+            break;
+    }
+}
+
+void Screen_write(Screen* s, const char* data, size_t length) {
+    s->dirty = true;
+    const char* end = data + length;
+    for (const char* p = data; p < end; ++p) {
+        char c = *p;
+        if (c == '\033') {
+            if (p + 1 >= end || p[1] != '[') {
+                continue;
+            }
+            ssize_t params[16];
+            size_t n = 0;
+            bool private = false;
+            ssize_t value = -1;
+            for (p += 2; p < end; ++p) {
+                if (*p >= '0' && *p <= '9') {
+                    value = (value < 0 ? 0 : value * 10) + (*p - '0');
+                }
+                else if (*p == ';') {
+                    if (n < 16) params[n++] = value;
+                    value = -1;
+                }
+                else if (*p == '?') {
+                    private = true;
+                }
+                else {
+                    break;
+                }
+            }
+            if (p == end) {
+                break;
+            }
+            if (value >= 0 || n > 0) {
+                if (n < 16) params[n++] = value;
+            }
+            _Screen_csi(s, params, n, private, *p);
+            continue;
+        }
+        switch (c) {
+            case '\n':
+                s->col = 0;
+                if (s->row + 1 < s->rows) ++s->row;
+                continue;
+            case '\r':
+                s->col = 0;
+                continue;
+            case '\b':
+                if (s->col > 0) --s->col;
+                continue;
+            case '\t':
+                s->col = (s->col / 8 + 1) * 8;
+                continue;
+        }
+        if ((unsigned char) c < ' ') {
+            continue;
+        }
+        if (s->row < s->rows && s->col < s->cols) {
+            Cell cell = { c, s->attr };
+            s->back[s->row * s->cols + s->col] = cell;
+        }
+        ++s->col;
+    }
+}
+
+/**
+ * PRIVATE
+ * Append the cheapest escape sequence that moves the terminal cursor to (row, col).
+ */
+void _Screen_move(Screen* s, size_t row, size_t col) {
+    if (s->term_row == (ssize_t) row && s->term_col == (ssize_t) col) {
+        return;
+    }
+    char best[48];
+    if (col == 0) snprintf(best, sizeof(best), row == 0 ? "\033[H" : "\033[%luH", row + 1);
+    else snprintf(best, sizeof(best), "\033[%lu;%luH", row + 1, col + 1);
+    char other[48];
+    other[0] = 0;
+    if (s->term_row == (ssize_t) row) {
+        if ((ssize_t) col > s->term_col) {
+            size_t n = col - s->term_col;
+            snprintf(other, sizeof(other), n == 1 ? "\033[C" : "\033[%luC", n);
+        }
+        else if (col == 0) {
+            strcpy(other, "\r");
+        }
+        else {
+            size_t n = s->term_col - col;
+            snprintf(other, sizeof(other), n == 1 ? "\033[D" : "\033[%luD", n);
+        }
+    }
+    else if (s->term_row >= 0 && (ssize_t) row == s->term_row + 1 && col == 0) {
+        strcpy(other, "\r\n");
+    }
+    Strcats(&s->out, (other[0] != 0 && strlen(other) < strlen(best)) ? other : best);
+    s->term_row = row;
+    s->term_col = col;
+}
+
+/**
+ * PRIVATE
+ */
+void _Screen_set_attr(Screen* s, unsigned char attr) {
+    if (attr != s->term_attr) {
+        Strcats(&s->out, (attr & SCREEN_REVERSE) ? "\033[7m" : "\033[m");
+        s->term_attr = attr;
+    }
+}
+
+/**
+ * PRIVATE
+ * Write cells [start, end) of `row` and record them as shown.
+ */
+void _Screen_emit(Screen* s, size_t row, size_t start, size_t end) {
+    Cell* back = s->back + row * s->cols;
+    Cell* front = s->front + row * s->cols;
+    _Screen_move(s, row, start);
+    for (size_t i = start; i < end; ++i) {
+        _Screen_set_attr(s, back[i].attr);
+        String_push(&s->out, back[i].ch);
+        front[i] = back[i];
+    }
+    s->term_col = end;
+    if (end >= s->cols) {
+        // Pending wrap: where the cursor really is depends on the terminal.
+        s->term_row = -1;
+        s->term_col = -1;
+    }
+}
+
+/**
+ * PRIVATE
+ * Check if cells hold only ASCII, so that each byte is one terminal column.
+ */
+bool _Screen_ascii(const Cell* cells, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if ((unsigned char) cells[i].ch >= 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * PRIVATE
+ * Write cells [0, end) of `row` from the start of the line, clear the rest, and
+ * record the whole row as shown. For rows with multibyte characters, whose cells
+ * (bytes) don't line up with the terminal's columns.
+ */
+void _Screen_redraw_row(Screen* s, size_t row, size_t end) {
+    Cell* back = s->back + row * s->cols;
+    Cell* front = s->front + row * s->cols;
+    // Don't send a character cut short by the right edge.
+    size_t lead = end;
+    while (lead > 0 && end - lead < 3 && ((unsigned char) back[lead - 1].ch & 0xc0) == 0x80) {
+        --lead;
+    }
+    if (lead > 0 && (unsigned char) back[lead - 1].ch >= 0xc0) {
+        unsigned char c = back[lead - 1].ch;
+        size_t need = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+        if (end - (lead - 1) < need) {
+            end = lead - 1;
+        }
+    }
+    _Screen_move(s, row, 0);
+    for (size_t i = 0; i < end; ++i) {
+        _Screen_set_attr(s, back[i].attr);
+        String_push(&s->out, back[i].ch);
+    }
+    _Screen_set_attr(s, 0);
+    Strcats(&s->out, "\033[K");
+    memcpy(front, back, s->cols * sizeof(Cell));
+    // The cursor is somewhere short of `end`.
+    s->term_row = -1;
+    s->term_col = -1;
+}
+
+/**
+ * PRIVATE
+ * Count rows in [top, bottom) of the next frame that match the terminal's rows
+ * `lines` further down.
+ */
+size_t _Screen_matching_rows(Screen* s, size_t top, size_t bottom, ssize_t lines) {
+    size_t count = 0;
+    for (size_t row = top; row < bottom; ++row) {
+        ssize_t from = row + lines;
+        if (from < (ssize_t) top || from >= (ssize_t) bottom) {
+            continue;
+        }
+        if (memcmp(s->back + row * s->cols, s->front + from * s->cols, s->cols * sizeof(Cell)) == 0) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+/**
+ * PRIVATE
+ * Carry out the pending scroll: set a scroll region (DECSTBM) and scroll it with
+ * SU/SD, then move the rows of `front` the same way. Skipped if it doesn't leave
+ * more rows matching the next frame than before.
+ */
+void _Screen_flush_scroll(Screen* s) {
+    ssize_t lines = s->scroll_lines;
+    size_t top = s->scroll_top;
+    size_t bottom = s->scroll_bottom < s->rows ? s->scroll_bottom : s->rows;
+    s->scroll_lines = 0;
+    if (lines == 0 || top >= bottom) {
+        return;
+    }
+    size_t amount = lines > 0 ? lines : -lines;
+    size_t height = bottom - top;
+    if (amount >= height
+            || _Screen_matching_rows(s, top, bottom, lines) <= _Screen_matching_rows(s, top, bottom, 0)) {
+        return;
+    }
+    // The rows scrolled in take the current background.
+    _Screen_set_attr(s, 0);
+    bool region = (top != 0 || bottom != s->rows);
+    char buf[64];
+    if (region) {
+        snprintf(buf, sizeof(buf), "\033[%lu;%lur", top + 1, bottom);
+        Strcats(&s->out, buf);
+    }
+    if (amount == 1) snprintf(buf, sizeof(buf), lines > 0 ? "\033[S" : "\033[T");
+    else snprintf(buf, sizeof(buf), lines > 0 ? "\033[%luS" : "\033[%luT", amount);
+    Strcats(&s->out, buf);
+    if (region) {
+        // Setting (and resetting) the region homes the cursor.
+        Strcats(&s->out, "\033[r");
+        s->term_row = 0;
+        s->term_col = 0;
+    }
+
+    Cell* first = s->front + top * s->cols;
+    size_t kept = (height - amount) * s->cols;
+    if (lines > 0) {
+        memmove(first, first + amount * s->cols, kept * sizeof(Cell));
+        _Screen_blank(first + kept, amount * s->cols);
+    }
+    else {
+        memmove(first + amount * s->cols, first, kept * sizeof(Cell));
+        _Screen_blank(first, amount * s->cols);
+    }
+}
+
+/**
+ * PRIVATE
+ * Bring one row of the terminal up to date.
+ */
+void _Screen_flush_row(Screen* s, size_t row) {
+    Cell* back = s->back + row * s->cols;
+    Cell* front = s->front + row * s->cols;
+    // Everything from `blank_from` on is blank, so can be cleared with EL.
+    size_t blank_from = s->cols;
+    while (blank_from > 0 && _Cell_eq(back[blank_from - 1], BLANK)) {
+        --blank_from;
+    }
+    if (!_Screen_ascii(back, s->cols) || !_Screen_ascii(front, s->cols)) {
+        if (memcmp(back, front, s->cols * sizeof(Cell)) != 0) {
+            _Screen_redraw_row(s, row, blank_from);
+        }
+        return;
+    }
+    size_t col = 0;
+    while (col < s->cols) {
+        if (_Cell_eq(front[col], back[col])) {
+            ++col;
+            continue;
+        }
+        if (col >= blank_from) {
+            _Screen_move(s, row, col);
+            _Screen_set_attr(s, 0);
+            Strcats(&s->out, "\033[K");
+            _Screen_blank(front + col, s->cols - col);
+            return;
+        }
+        // Changed run, including short unchanged gaps.
+        size_t end = col + 1;
+        size_t last = col;
+        while (end < s->cols && end < blank_from && end - last <= SCREEN_MAX_GAP) {
+            if (!_Cell_eq(front[end], back[end])) {
+                last = end;
+            }
+            ++end;
+        }
+        _Screen_emit(s, row, col, last + 1);
+        col = last + 1;
+    }
+}
+
+size_t Screen_flush(Screen* s, int fd) {
+    if (!s->dirty) {
+        s->frame_bytes = 0;
+        s->frame_writes = 0;
+        return 0;
+    }
+    String_clear(s->out);
+    if (s->invalid) {
+        s->invalid = false;
+        Strcats(&s->out, "\033[m\033[H\033[2J");
+        _Screen_blank(s->front, s->rows * s->cols);
+        s->term_attr = 0;
+        s->term_row = 0;
+        s->term_col = 0;
+        s->scroll_lines = 0;
+    }
+    _Screen_flush_scroll(s);
+    for (size_t row = 0; row < s->rows; ++row) {
+        _Screen_flush_row(s, row);
+    }
+    _Screen_set_attr(s, 0);
+    size_t row = s->row < s->rows ? s->row : s->rows - 1;
+    size_t col = s->col < s->cols ? s->col : s->cols - 1;
+    if (s->rows > 0 && s->cols > 0) {
+        _Screen_move(s, row, col);
+    }
+
+    const char* data = s->out->data;
+    size_t left = s->out->length;
+    s->frame_writes = 0;
+    while (left > 0) {
+        ssize_t n = write(fd, data, left);
+        s->frame_writes += 1;
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                // The terminal is shared with stdin, which is non-blocking.
+                struct pollfd pfd = { fd, POLLOUT, 0 };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            if (errno == EINTR) continue;
+            break;
+        }
+        data += n;
+        left -= n;
+    }
+    s->dirty = false;
+    s->frame_bytes = s->out->length;
+    s->total_bytes += s->frame_bytes;
+    s->total_writes += s->frame_writes;
+    s->frames += 1;
+    return s->frame_bytes;
+}
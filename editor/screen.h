@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "../structures/String.h"
+
+/**
+ * Virtual screen: a grid of what the terminal shows, and of the frame being
+ * drawn.
+ *
+ * Drawing code writes to it as it would to the terminal (text, '\n', and the
+ * few escape sequences the editor uses: cursor position, erase line/screen and
+ * reverse video). Screen_flush then sends the terminal only the cells that
+ * changed since the last frame, moving the cursor as cheaply as it can.
+ *
+ * Every byte is one cell, like the rest of the editor assumes. A multibyte
+ * (UTF-8) character takes fewer columns on the terminal than it has bytes, so
+ * a row with any is redrawn whole, from its start, when it changes.
+ *
+ * Scrolling is hinted (Screen_scroll) rather than drawn: the flush scrolls the
+ * terminal with a scroll region, so rows that only moved aren't sent again.
+ */
+
+#define SCREEN_REVERSE 1
+
+struct Cell {
+    char ch;
+    unsigned char attr;
+};
+typedef struct Cell Cell;
+
+struct Screen {
+    size_t rows;
+    size_t cols;
+    Cell* front;                // What the terminal shows.
+    Cell* back;                 // The next frame.
+    volatile bool invalid;      // The terminal's contents are unknown; repaint everything.
+    bool dirty;                 // Something was drawn since the last flush.
+    size_t row;                 // Drawing position (and where the cursor ends up).
+    size_t col;
+    unsigned char attr;         // Drawing attributes.
+    ssize_t term_row;           // Terminal cursor, or -1 if unknown.
+    ssize_t term_col;
+    unsigned char term_attr;
+    size_t scroll_top;          // Pending scroll (see Screen_scroll).
+    size_t scroll_bottom;
+    ssize_t scroll_lines;
+    String* out;
+    size_t frame_bytes;         // Bytes sent to the terminal by the last flush.
+    size_t frame_writes;        // write() calls it took (1, unless the terminal was slow).
+    size_t total_bytes;
+    size_t total_writes;
+    size_t frames;
+};
+typedef struct Screen Screen;
+
+void inplace_make_Screen(Screen* s, size_t rows, size_t cols);
+void Screen_destroy(Screen* s);
+
+/**
+ * Change the size. Invalidates the screen (the terminal reflows on resize).
+ */
+void Screen_resize(Screen* s, size_t rows, size_t cols);
+
+/**
+ * Forget what the terminal shows, so the next flush repaints everything.
+ * Only sets a flag, so it's safe in a signal handler.
+ */
+void Screen_invalidate(Screen* s);
+
+/**
+ * Hint that rows [top, bottom) of the next frame are those of the last one moved
+ * up by `lines` (down if negative). Hints for the same rows add up.
+ * The next flush scrolls the terminal to match, if that saves redrawing rows.
+ */
+void Screen_scroll(Screen* s, size_t top, size_t bottom, ssize_t lines);
+
+/**
+ * Draw into the next frame, interpreting `data` like a terminal would.
+ * Text past the right edge is dropped (no wrapping).
+ */
+void Screen_write(Screen* s, const char* data, size_t length);
+
+/**
+ * Send the changes since the last frame to `fd` in one write(), and leave the
+ * cursor at the drawing position.
+ * Return: bytes written (also in s->frame_bytes).
+ */
+size_t Screen_flush(Screen* s, int fd);
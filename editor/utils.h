@@ -7,6 +7,9 @@
 #include "../structures/Vector.h"
 #include "../structures/History.h"
 #include "../structures/String.h"
+#include "../structures/arena.h"
+#include "../structures/line_tree.h"
+#include "../structures/piece_table.h"
 #include "../structures/gap_buffer.h"
 
 /**
@@ -20,6 +20,7 @@ String* convert_String(char* data) {
     memmove(ret + 1, ret, maxlen+1);
     ret->length = maxlen;
     ret->max_length = maxlen;
+    ret->arena = 0;
     return ret;
 }
 
@@ -27,6 +28,9 @@ String* convert_String(char* data) {
  * Take a malloc'd String and "realloc" it into a string.
  */
 char* String_to_cstr(String* data) {
+    if (data->arena) {
+        return strdup(data->data);
+    }
     char* ret = (char*) data;
     memmove(ret, data+1, data->length+1);
     return ret;
@@ -37,16 +41,37 @@ String* alloc_String(size_t maxlen) {
     ret->data[0] = 0;
     ret->length = 0;
     ret->max_length = maxlen;
+    ret->arena = 0;
     return ret;
 }
 
+void String_free(String* s) {
+    if (s != NULL && !s->arena) {
+        free(s);
+    }
+}
+
+String* String_detach(String* s) {
+    if (!s->arena) {
+        return s;
+    }
+    return Strdup(s);
+}
+
 String* realloc_String(String* s, size_t maxlen) {
     if (s->max_length > maxlen) {
         return s;
     }
-    if (maxlen < 2 * s->max_length && maxlen < 4096) {
+    if (maxlen < 2 * (size_t) s->max_length && maxlen < 4096) {
         maxlen = 2 * s->max_length;
     }
+    if (s->arena) {
+        // Promote to the heap. The old copy stays in the arena until it is freed.
+        String* ret = alloc_String(maxlen);
+        memcpy(ret->data, s->data, s->length + 1);
+        ret->length = s->length;
+        return ret;
+    }
     String* ret = (String*) realloc(s, sizeof(String) + maxlen + 1);
     ret->max_length = maxlen;
     if (ret->length > maxlen) {
@@ -61,16 +86,17 @@ size_t Strlen(const String* s) {
 }
 
 String* Strdup(const String* s) {
-    size_t data_size = sizeof(String) + s->max_length + 1;
-    String* ret = malloc(data_size);
-    memcpy(ret, s, data_size);
+    String* ret = alloc_String(s->length);
+    memcpy(ret->data, s->data, s->length + 1);
+    ret->length = s->length;
     return ret;
 }
 
 String* Strndup(const String* s, size_t count) {
     assert(count <= s->length);
     String* ret = alloc_String(count);
-    memcpy(ret->data, s->data, count+1);
+    memcpy(ret->data, s->data, count);
+    ret->data[count] = 0;
     ret->length = count;
     return ret;
 }
@@ -131,7 +157,7 @@ void Strcpy(String** _s, String* src) {
 void Strncpys(String** _s, char* dat, size_t length) {
     String* s = *_s;
     if (s->length < length) {
-        free(s);
+        String_free(s);
         *_s = make_String(dat);
     }
     else {
@@ -245,12 +271,20 @@ void String_ninserts(String** _s, size_t index, const char* insert, size_t n) {
 }
 
 /**
- * "Fit" the string (realloc to fit length).
+ * "Fit" the string (realloc to fit length), if that frees at least
+ * STRING_FIT_SLACK bytes.
  * Use:
  *      String* s = ...;
  *      s = String_fit(s);
  */
 String* String_fit(String* s) {
+    if (s->arena) {
+        // Arena memory can't be realloc'd; leave it where it is.
+        return s;
+    }
+    if (s->max_length - s->length < STRING_FIT_SLACK) {
+        return s;
+    }
     String* ret = (String*) realloc(s, sizeof(String) + s->length + 1);
     ret->max_length = ret->length;
     return ret;
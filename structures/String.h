@@ -1,9 +1,18 @@
 #pragma once
 #include <stddef.h>
 
+// String_fit doesn't bother giving back less than this (malloc granularity).
+#define STRING_FIT_SLACK 16
+
+/**
+ * Header (two words) with the characters stored inline right after it.
+ */
 struct String {
     size_t length;
-    size_t max_length;
+    size_t max_length : 63;
+    // Allocated from an Arena: not individually malloc'd. realloc_String copies
+    // it out to the heap when it needs to grow; never free() it directly.
+    size_t arena : 1;
     char data[0];
 };
 
@@ -37,6 +46,17 @@ static String* name = NULL; \
 if (name == NULL) { name = alloc_String(init_sz); } \
 else { String_clear(name); }
 
+/**
+ * free() a String, unless it lives in an arena.
+ */
+void String_free(String* s);
+
+/**
+ * Make sure `s` is individually allocated (so it can outlive its arena).
+ * Returns `s` itself, or a heap copy of it.
+ */
+String* String_detach(String* s);
+
 /**
  * Reallocates the space allocated for some String* to
  * accomodate some new size_t, if needed. Also updates the max_length
@@ -49,6 +69,9 @@ String* realloc_String(String*, size_t);
  */
 size_t Strlen(const String* s);
 
+/**
+ * Copies are sized to the length, not to the capacity of `s`.
+ */
 String* Strdup(const String* s);
 String* Strndup(const String* s, size_t count);
 
@@ -134,7 +157,8 @@ void String_inserts(String** s, size_t index, const char* insert);
 void String_ninserts(String** s, size_t index, const char* insert, size_t n);
 
 /**
- * "Fit" the string (realloc to fit length).
+ * "Fit" the string (realloc to fit length), if that frees at least
+ * STRING_FIT_SLACK bytes.
  * Use:
  *      String* s = ...;
  *      s = String_fit(s);
@@ -0,0 +1,93 @@
+#include "arena.h"
+
+#include <stdlib.h>
+
+#define ARENA_ALIGN 8
+
+Arena* make_Arena(size_t chunk_size) {
+    Arena* ret = malloc(sizeof(Arena));
+    inplace_make_Arena(ret, chunk_size);
+    return ret;
+}
+
+void inplace_make_Arena(Arena* arena, size_t chunk_size) {
+    inplace_make_Vector(&arena->chunks, 16);
+    arena->cursor = NULL;
+    arena->end = NULL;
+    arena->chunk_size = chunk_size;
+    arena->last_hit = 0;
+}
+
+void Arena_destroy(Arena* arena) {
+    for (size_t i = 0; i < arena->chunks.size; ++i) {
+        free(arena->chunks.elements[i]);
+    }
+    Vector_destroy(&arena->chunks);
+    arena->cursor = NULL;
+    arena->end = NULL;
+}
+
+/**
+ * PRIVATE
+ * Get a new chunk with at least `size` usable bytes. Returns the usable part.
+ */
+char* _Arena_new_chunk(Arena* arena, size_t size) {
+    size_t total = sizeof(size_t) + size;
+    char* chunk = malloc(total);
+    *(size_t*) chunk = total;
+    Vector_push(&arena->chunks, chunk);
+    return chunk + sizeof(size_t);
+}
+
+void* Arena_alloc(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+    if (size > arena->chunk_size / 4) {
+        // Don't waste the rest of the current chunk on a big allocation.
+        return _Arena_new_chunk(arena, size);
+    }
+    if ((size_t) (arena->end - arena->cursor) < size) {
+        arena->cursor = _Arena_new_chunk(arena, arena->chunk_size);
+        arena->end = arena->cursor + arena->chunk_size;
+    }
+    void* ret = arena->cursor;
+    arena->cursor += size;
+    return ret;
+}
+
+/**
+ * PRIVATE
+ */
+static inline bool _Arena_chunk_owns(Arena* arena, size_t idx, const char* p) {
+    const char* chunk = arena->chunks.elements[idx];
+    return p >= chunk && p < chunk + *(size_t*) chunk;
+}
+
+bool Arena_owns(Arena* arena, const void* p) {
+    size_t n = arena->chunks.size;
+    if (n == 0) {
+        return false;
+    }
+    // Lines are usually visited in the order they were allocated.
+    for (size_t i = arena->last_hit; i < n && i < arena->last_hit + 2; ++i) {
+        if (_Arena_chunk_owns(arena, i, p)) {
+            arena->last_hit = i;
+            return true;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (_Arena_chunk_owns(arena, i, p)) {
+            arena->last_hit = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+String* Arena_alloc_String(Arena* arena, size_t length) {
+    String* ret = Arena_alloc(arena, sizeof(String) + length + 1);
+    ret->data[0] = 0;
+    ret->length = 0;
+    ret->max_length = length;
+    ret->arena = 1;
+    return ret;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "String.h"
+#include "Vector.h"
+
+/**
+ * Bump allocator. Memory is handed out from large chunks and only given back
+ * all at once, by Arena_destroy.
+ *
+ * Used for the lines of a freshly loaded file: one allocation per chunk instead
+ * of one per line, and freeing the buffer releases whole chunks.
+ */
+
+#define ARENA_DEFAULT_CHUNK (1 << 20)
+
+struct Arena {
+    Vector/*char* */ chunks;    // Each chunk starts with its size (size_t).
+    char* cursor;               // Free space in the current chunk.
+    char* end;
+    size_t chunk_size;
+    size_t last_hit;            // Chunk index of the last Arena_owns match.
+};
+typedef struct Arena Arena;
+
+Arena* make_Arena(size_t chunk_size);
+void inplace_make_Arena(Arena* arena, size_t chunk_size);
+
+/**
+ * Frees every chunk (and so everything ever allocated from the arena).
+ */
+void Arena_destroy(Arena* arena);
+
+/**
+ * Allocate `size` bytes (8 byte aligned). Never fails.
+ * Big requests get a chunk of their own.
+ */
+void* Arena_alloc(Arena* arena, size_t size);
+
+/**
+ * Check if `p` points into memory from this arena.
+ * Cheap for consecutive queries that hit the same chunk.
+ */
+bool Arena_owns(Arena* arena, const void* p);
+
+/**
+ * Allocate a String with room for exactly `length` chars, marked as arena memory.
+ * @see String.arena
+ */
+String* Arena_alloc_String(Arena* arena, size_t length);
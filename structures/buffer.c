@@ -2,11 +2,22 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
-#ifndef __APPLE__
-#include <sys/sendfile.h>
-#endif
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "buffer.h"
+#include "line_scan.h"
+#include "iov_writer.h"
+#include "journal.h"
+#include "line_diff.h"
+#include "regex_cache.h"
+#include "search.h"
+#include "trigram_index.h"
 #include "../editor/utils.h"
 #include "../editor/editor.h"
 
@@ -64,36 +75,190 @@ void Buffer_close_files(Buffer* buf) {
     }
 }
 
+size_t BUFFER_PIECES_THRESHOLD = 64 << 20;
+size_t BUFFER_LARGE_THRESHOLD = (size_t) 1 << 30;
+size_t BUFFER_MEMORY_BUDGET = 256 << 20;
+
+// Edits kept in the undo buffer.
+#define UNDO_HISTORY_SIZE 1000
+// Bytes at the end of the file on disk checked to tell an append from a rewrite.
+#define BUFFER_TAIL_CHECK 4096
+
+// Max number of lines a BS_PIECES buffer keeps materialized.
+#define LINE_CACHE_SIZE 256
+// Lines that stay cached however big they are, so recently handed out pointers stay valid.
+#define LINE_CACHE_KEEP 8
+
+/**
+ * A line materialized out of the piece table. Buffer_get_line_abs hands out
+ * pointers to `line`, so edits go here first and get written back lazily.
+ */
+struct CachedLine {
+    size_t row;
+    size_t last_use;
+    String* line;
+};
+typedef struct CachedLine CachedLine;
+
+/**
+ * The cursor line's display-column index, and what it was built from.
+ * Every edit bumps Buffer.changes, so the index is good while that and the
+ * line's String are the same.
+ */
+struct CursorLineIndex {
+    size_t row;
+    size_t changes;
+    const char* data;
+    size_t length;
+    int tab_width;
+    LineIndex index;
+};
+typedef struct CursorLineIndex CursorLineIndex;
+
 Buffer* make_Buffer(const char* filename) {
+    return make_Buffer_storage(filename, BS_AUTO);
+}
+
+Buffer* make_Buffer_storage(const char* filename, BufferStorage storage) {
     Buffer* ret = malloc(sizeof(Buffer));
-    inplace_make_Buffer(ret, filename);
+    inplace_make_Buffer_storage(ret, filename, storage);
     return ret;
 }
 
 void inplace_make_Buffer(Buffer* buf, const char* filename) {
+    inplace_make_Buffer_storage(buf, filename, BS_AUTO);
+}
+
+/**
+ * Read an entire file into one malloc'd block.
+ * Return: number of bytes read.
+ */
+size_t read_file_contents(FILE* infile, char** ret) {
+    struct stat st;
+    size_t capacity = 4096;
+    if (fstat(fileno(infile), &st) == 0 && st.st_size > 0) {
+        capacity = st.st_size;
+    }
+    char* data = malloc(capacity);
+    size_t total = 0;
+    while (true) {
+        if (total == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+        size_t num_read = fread(data + total, 1, capacity - total, infile);
+        if (num_read == 0) { break; }
+        total += num_read;
+    }
+    *ret = data;
+    return total;
+}
+
+/**
+ * PRIVATE
+ * Hash of the last (up to) BUFFER_TAIL_CHECK bytes before `size` in the file `fd`.
+ */
+unsigned long _Buffer_tail_hash(int fd, size_t size) {
+    char tail[BUFFER_TAIL_CHECK];
+    size_t length = size < sizeof(tail) ? size : sizeof(tail);
+    if (pread(fd, tail, length, size - length) != (ssize_t) length) {
+        return 0;
+    }
+    return line_hash(tail, length);
+}
+
+/**
+ * PRIVATE
+ * Remember the file `fd` as the version on disk, which the buffer matched
+ * when its change count was `changes`.
+ */
+void _Buffer_record_disk(Buffer* buf, int fd, size_t changes) {
+    DiskState* disk = &buf->disk;
+    struct stat st;
+    disk->changes = changes;
+    disk->exists = fstat(fd, &st) == 0;
+    if (!disk->exists) {
+        return;
+    }
+    disk->ino = st.st_ino;
+    disk->size = st.st_size;
+    disk->mtime_sec = st.st_mtim.tv_sec;
+    disk->mtime_nsec = st.st_mtim.tv_nsec;
+    disk->tail_hash = _Buffer_tail_hash(fd, st.st_size);
+}
+
+/**
+ * PRIVATE
+ * Free a BS_PIECES buffer's materialized lines, without writing them back.
+ */
+void _Buffer_drop_line_cache(Buffer* buf) {
+    for (size_t i = 0; i < buf->line_cache.size; ++i) {
+        CachedLine* entry = buf->line_cache.elements[i];
+        free(entry->line);
+        free(entry);
+    }
+    Vector_clear(&buf->line_cache, LINE_CACHE_SIZE);
+}
+
+void inplace_make_Buffer_storage(Buffer* buf, const char* filename, BufferStorage storage) {
     // zero initialize fields by default.
     memset(buf, 0, sizeof(Buffer));
 
-    inplace_make_History(&buf->undo_history, 1000, (destructor_t) &Edit_destroy);
-    inplace_make_Vector(&buf->lines, 100);
+    inplace_make_History(&buf->undo_history, UNDO_HISTORY_SIZE, (destructor_t) &Edit_destroy);
+    FILE* infile = NULL;
     if (filename == NULL) {
         filename = "__tmp__";
-        Vector_push(&buf->lines, make_String(""));
     }
     else {
-        FILE* infile = fopen(filename, "r+");
-        // TODO use n_read
-        size_t n_read;
+        // Read-only: opening it for writing would break other readers' leases.
+        infile = fopen(filename, "r");
+    }
+    size_t budget = 0;
+    if (storage == BS_AUTO) {
+        struct stat st;
+        storage = BS_LINES;
+        if (infile != NULL && fstat(fileno(infile), &st) == 0
+                && st.st_size >= BUFFER_PIECES_THRESHOLD) {
+            storage = BS_PIECES;
+            if (st.st_size >= BUFFER_LARGE_THRESHOLD) {
+                budget = BUFFER_MEMORY_BUDGET;
+            }
+        }
+    }
+    buf->storage = storage;
+
+    if (storage == BS_PIECES) {
+        if (infile != NULL) {
+            buf->pieces = make_PieceTable_mapped(fileno(infile));
+        }
+        if (buf->pieces == NULL) {
+            char* data = NULL;
+            size_t size = 0;
+            if (infile != NULL) {
+                size = read_file_contents(infile, &data);
+            }
+            buf->pieces = make_PieceTable(data, size);
+        }
+        inplace_make_Vector(&buf->line_cache, LINE_CACHE_SIZE);
+        Buffer_set_memory_budget(buf, budget);
+    }
+    else {
+        Vector lines;
+        inplace_make_Vector(&lines, 100);
         if (infile != NULL)  {
             //TODO buffer/read not the whole file
-            n_read = read_file_break_lines(&buf->lines, infile);
-            fclose(infile);
+            buf->line_arena = make_Arena(ARENA_DEFAULT_CHUNK);
+            read_file_break_lines(&lines, infile, buf->line_arena);
         }
         else {
-            Vector_push(&buf->lines, make_String(""));
-            n_read = 0;
+            Vector_push(&lines, make_String(""));
         }
-        (void) n_read;
+        inplace_make_LineTree_from(&buf->lines, lines.elements, lines.size);
+        Vector_destroy(&lines);
+    }
+    if (infile != NULL) {
+        _Buffer_record_disk(buf, fileno(infile), 0);
+        fclose(infile);
     }
     buf->name = make_String(filename);
     buf->swapfile_name = Strdup(buf->name);
@@ -102,24 +267,50 @@ void inplace_make_Buffer(Buffer* buf, const char* filename) {
 }
     
 void Buffer_destroy(Buffer* buf) {
+    Buffer_save_finish(buf, true);
     History_destroy(&buf->undo_history);
 
-    for (size_t i = 0; i < buf->lines.size; ++i) {
-        free(buf->lines.elements[i]);
+    if (buf->storage == BS_PIECES) {
+        _Buffer_drop_line_cache(buf);
+        Vector_destroy(&buf->line_cache);
+        PieceTable_destroy(buf->pieces);
+        free(buf->pieces);
+    }
+    else {
+        // Only lines that were added or grown since loading are on the heap;
+        // the rest go with the arena's chunks. The arena bit tells them apart
+        // without looking the pointer up in the chunk list.
+        size_t num_lines = LineTree_size(&buf->lines);
+        void** span;
+        for (size_t i = 0; i < num_lines; ) {
+            size_t n = LineTree_span(&buf->lines, i, &span);
+            for (size_t j = 0; j < n; ++j) {
+                String_free(span[j]);
+            }
+            i += n;
+        }
+        LineTree_destroy(&buf->lines);
+        if (buf->line_arena != NULL) {
+            Arena_destroy(buf->line_arena);
+            free(buf->line_arena);
+        }
+    }
+    if (buf->journal != NULL) {
+        Journal_close(buf->journal, buf->swapfile_name->data, true);
+    }
+    if (buf->line_index != NULL) {
+        LineIndex_destroy(&buf->line_index->index);
+        free(buf->line_index);
+    }
+    if (buf->trigrams != NULL) {
+        TrigramIndex_destroy(buf->trigrams);
+        free(buf->trigrams);
     }
-    Vector_destroy(&buf->lines);
     free(buf->name);
     free(buf->swapfile_name);
     Buffer_close_files(buf);
 }
 
-void Buffer_open_files(Buffer* buf, const char* mode_infile, const char* mode_swapfile) {
-    if (mode_infile != NULL) { buf->file = fopen(buf->name->data, mode_infile); }
-    if (mode_swapfile != NULL) {
-        buf->swapfile = fopen(buf->swapfile_name->data, mode_swapfile);
-    }
-}
-
 
 /**
  * Scroll by up to `amount` (signed). Positive is down.
@@ -135,9 +326,13 @@ ssize_t Buffer_scroll(Buffer* buf, ssize_t window_height, ssize_t amount) {
     else {
         ssize_t save = buf->top_row;
         buf->top_row += amount;
-        if (buf->top_row + window_height > buf->lines.size) {
-            scroll_amount = buf->lines.size - window_height - save;
-            buf->top_row = buf->lines.size - window_height;
+        if (window_height > 0 && Buffer_has_line(buf, buf->top_row + window_height - 1)) {
+            return amount;
+        }
+        ssize_t num_lines = Buffer_get_num_lines(buf);
+        if (buf->top_row + window_height > num_lines) {
+            scroll_amount = num_lines - window_height - save;
+            buf->top_row = num_lines - window_height;
             if (buf->top_row < 0) buf->top_row = 0;
             return scroll_amount;
         }
@@ -146,7 +341,21 @@ ssize_t Buffer_scroll(Buffer* buf, ssize_t window_height, ssize_t amount) {
 }
 
 size_t Buffer_get_num_lines(Buffer* buf) {
-    return buf->lines.size;
+    if (buf->storage == BS_PIECES) {
+        return PieceTable_num_lines(buf->pieces);
+    }
+    return LineTree_size(&buf->lines);
+}
+
+/**
+ * Check if line `row` exists. Unlike Buffer_get_num_lines, this doesn't need
+ * to index the whole file.
+ */
+bool Buffer_has_line(Buffer* buf, size_t row) {
+    if (buf->storage == BS_PIECES) {
+        return PieceTable_has_line(buf->pieces, row);
+    }
+    return row < LineTree_size(&buf->lines);
 }
 
 /**
@@ -178,15 +387,266 @@ ssize_t Buffer_get_line_index(Buffer* buf, ssize_t y) {
     return y + buf->top_row;
 }
 String** Buffer_get_line(Buffer* buf, ssize_t y) {
-    if (y + buf->top_row >= buf->lines.size) return NULL;
-    return (String**) &(buf->lines.elements[y + buf->top_row]);
+    if (!Buffer_has_line(buf, y + buf->top_row)) return NULL;
+    return Buffer_get_line_abs(buf, y + buf->top_row);
+}
+
+/**
+ * PRIVATE
+ * Write a cached line back into the piece table, if it was changed.
+ */
+void _Buffer_writeback_line(Buffer* buf, CachedLine* entry) {
+    String* line = entry->line;
+    if (!PieceTable_line_equals(buf->pieces, entry->row, line->data, line->length)) {
+        PieceTable_replace_line(buf->pieces, entry->row, line->data, line->length);
+    }
+}
+
+void Buffer_set_memory_budget(Buffer* buf, size_t budget) {
+    if (buf->storage != BS_PIECES) {
+        return;
+    }
+    // An eighth for materialized lines, the rest for the piece table.
+    buf->memory_budget = budget;
+    PieceTable_set_budget(buf->pieces, budget - budget / 8);
+}
+
+/**
+ * PRIVATE
+ * Write back and drop the least recently used cached line.
+ * Return: its size in bytes.
+ */
+size_t _Buffer_evict_line(Buffer* buf) {
+    Vector* cache = &buf->line_cache;
+    size_t lru = 0;
+    for (size_t i = 1; i < cache->size; ++i) {
+        if (((CachedLine*) cache->elements[i])->last_use
+                < ((CachedLine*) cache->elements[lru])->last_use) {
+            lru = i;
+        }
+    }
+    CachedLine* evict = cache->elements[lru];
+    size_t ret = evict->line->max_length;
+    _Buffer_writeback_line(buf, evict);
+    free(evict->line);
+    free(evict);
+    Vector_delete(cache, lru);
+    return ret;
+}
+
+/**
+ * PRIVATE
+ * Find (or materialize) the cached copy of a line in a BS_PIECES buffer.
+ * Evicts least recently used lines if the cache is full, or (with a memory
+ * budget) holds too many bytes.
+ */
+String** _Buffer_cache_line(Buffer* buf, size_t row) {
+    Vector* cache = &buf->line_cache;
+    size_t bytes = 0;
+    for (size_t i = 0; i < cache->size; ++i) {
+        CachedLine* entry = cache->elements[i];
+        if (entry->row == row) {
+            entry->last_use = ++buf->line_cache_clock;
+            return &entry->line;
+        }
+        bytes += entry->line->max_length;
+    }
+    CachedLine* entry = malloc(sizeof(CachedLine));
+    entry->row = row;
+    entry->last_use = ++buf->line_cache_clock;
+    entry->line = PieceTable_get_line(buf->pieces, row);
+    Vector_push(cache, entry);
+    bytes += entry->line->max_length;
+
+    size_t limit = buf->memory_budget / 8;
+    while (cache->size > LINE_CACHE_SIZE
+            || (limit > 0 && bytes > limit && cache->size > LINE_CACHE_KEEP)) {
+        bytes -= _Buffer_evict_line(buf);
+    }
+    return &entry->line;
 }
 
 /**
  * This gets relative to document pos.
  */
 String** Buffer_get_line_abs(Buffer* buf, size_t row) {
-    return (String**) &(buf->lines.elements[row]);
+    if (buf->storage == BS_PIECES) {
+        return _Buffer_cache_line(buf, row);
+    }
+    return (String**) LineTree_get_ref(&buf->lines, row);
+}
+
+/**
+ * PRIVATE
+ * The line at `row`, if it's in memory; NULL otherwise (never materializes it,
+ * which could free lines the caller holds).
+ */
+String* _Buffer_resident_line(Buffer* buf, size_t row) {
+    if (buf->storage == BS_PIECES) {
+        for (size_t i = 0; i < buf->line_cache.size; ++i) {
+            CachedLine* entry = buf->line_cache.elements[i];
+            if (entry->row == row) {
+                return entry->line;
+            }
+        }
+        return NULL;
+    }
+    if (row >= LineTree_size(&buf->lines)) {
+        return NULL;
+    }
+    return LineTree_get(&buf->lines, row);
+}
+
+LineIndex* Buffer_cursor_line_index(Buffer* buf, const char* line, int tab_width) {
+    ssize_t row = buf->top_row + buf->cursor_row;
+    if (row < 0) {
+        return NULL;
+    }
+    String* s = _Buffer_resident_line(buf, row);
+    if (s == NULL || s->data != line || s->length < BUFFER_LINE_INDEX_MIN) {
+        return NULL;
+    }
+    CursorLineIndex* cached = buf->line_index;
+    if (cached == NULL) {
+        cached = malloc(sizeof(CursorLineIndex));
+        inplace_make_LineIndex(&cached->index);
+        buf->line_index = cached;
+    }
+    else if (cached->row == row && cached->changes == buf->changes && cached->data == line
+             && cached->length == s->length && cached->tab_width == tab_width) {
+        return &cached->index;
+    }
+    cached->row = row;
+    cached->changes = buf->changes;
+    cached->data = line;
+    cached->length = s->length;
+    cached->tab_width = tab_width;
+    // Like the editor's scans, stop at a NUL.
+    LineIndex_build(&cached->index, line, strnlen(line, s->length), tab_width);
+    return &cached->index;
+}
+
+/**
+ * Get a (malloc'd) copy of a line.
+ */
+String* Buffer_dup_line(Buffer* buf, size_t row) {
+    if (buf->storage == BS_PIECES) {
+        for (size_t i = 0; i < buf->line_cache.size; ++i) {
+            CachedLine* entry = buf->line_cache.elements[i];
+            if (entry->row == row) {
+                return Strdup(entry->line);
+            }
+        }
+        return PieceTable_get_line(buf->pieces, row);
+    }
+    return Strdup(LineTree_get(&buf->lines, row));
+}
+
+const char* Buffer_line_span(Buffer* buf, size_t row, size_t* length) {
+    if (buf->storage == BS_PIECES) {
+        return PieceTable_line_span(buf->pieces, row, length);
+    }
+    String* line = LineTree_get(&buf->lines, row);
+    *length = line->length;
+    return line->data;
+}
+
+/**
+ * Insert `count` lines so that the first one becomes line `row`.
+ * Takes ownership of the lines.
+ */
+void Buffer_insert_lines(Buffer* buf, size_t row, String** lines, size_t count) {
+    if (buf->storage == BS_PIECES) {
+        for (size_t i = 0; i < buf->line_cache.size; ++i) {
+            CachedLine* entry = buf->line_cache.elements[i];
+            if (entry->row >= row) {
+                entry->row += count;
+            }
+        }
+        for (size_t i = 0; i < count; ++i) {
+            PieceTable_insert_line(buf->pieces, row + i, lines[i]->data, lines[i]->length);
+            free(lines[i]);
+        }
+        return;
+    }
+    LineTree_insert_range(&buf->lines, row, (void**) lines, count);
+}
+
+void Buffer_insert_line(Buffer* buf, size_t row, String* line) {
+    Buffer_insert_lines(buf, row, &line, 1);
+}
+
+/**
+ * Remove lines [a, b). If `removed` is not NULL, the removed lines are stored
+ * there and the caller takes ownership of them. Otherwise they are freed.
+ */
+void Buffer_remove_lines(Buffer* buf, size_t a, size_t b, String** removed) {
+    if (buf->storage == BS_PIECES) {
+        if (removed != NULL) {
+            for (size_t row = a; row < b; ++row) {
+                removed[row - a] = NULL;
+            }
+        }
+        Vector* cache = &buf->line_cache;
+        for (size_t i = 0; i < cache->size; ) {
+            CachedLine* entry = cache->elements[i];
+            if (entry->row >= b) {
+                entry->row -= b - a;
+            }
+            else if (entry->row >= a) {
+                if (removed != NULL) { removed[entry->row - a] = entry->line; }
+                else { free(entry->line); }
+                free(entry);
+                Vector_delete(cache, i);
+                continue;
+            }
+            ++i;
+        }
+        if (removed != NULL) {
+            for (size_t row = a; row < b; ++row) {
+                if (removed[row - a] == NULL) {
+                    removed[row - a] = PieceTable_get_line(buf->pieces, row);
+                }
+            }
+        }
+        PieceTable_delete_lines(buf->pieces, a, b);
+        return;
+    }
+    if (removed != NULL) {
+        LineTree_delete_range(&buf->lines, a, b, (void**) removed);
+        for (size_t i = 0; i < b - a; ++i) {
+            removed[i] = String_detach(removed[i]);
+        }
+        return;
+    }
+    String** lines = malloc((b - a) * sizeof(String*));
+    LineTree_delete_range(&buf->lines, a, b, (void**) lines);
+    for (size_t i = 0; i < b - a; ++i) {
+        String_free(lines[i]);
+    }
+    free(lines);
+}
+
+/**
+ * Push edits held by Buffer_get_line_abs pointers down into the storage engine.
+ */
+void Buffer_sync(Buffer* buf) {
+    if (buf->storage != BS_PIECES) {
+        return;
+    }
+    for (size_t i = 0; i < buf->line_cache.size; ++i) {
+        _Buffer_writeback_line(buf, buf->line_cache.elements[i]);
+    }
+}
+
+/**
+ * PRIVATE
+ * A buffer always has at least one (possibly empty) line.
+ */
+void _Buffer_ensure_line(Buffer* buf) {
+    if (Buffer_get_num_lines(buf) == 0) {
+        Buffer_insert_line(buf, 0, make_String(""));
+    }
 }
 
 /**
@@ -200,7 +660,7 @@ void Buffer_clip_context(Buffer* buf, EditorContext* ctx) {
     if (ctx->jump_row < 0) {
         ctx->jump_row = 0;
     }
-    if (ctx->jump_row >= Buffer_get_num_lines(buf)) {
+    if (!Buffer_has_line(buf, ctx->jump_row)) {
         ctx->jump_row = Buffer_get_num_lines(buf) - 1;
     }
     String* line = *Buffer_get_line_abs(buf, ctx->jump_row);
@@ -223,17 +683,19 @@ RepaintType Buffer_insert_copy(Buffer* buf, Copy* copy, EditorContext* ctx) {
     size_t undo_idx = ctx->undo_idx;
 
     if (copy->cp_type == CP_LINE) {
-        Vector_create_range(&buf->lines, ctx->start_row+1, n_lines);
-        for (int i = 0; i < n_lines; ++i) {
+        String** new_lines = malloc(n_lines * sizeof(String*));
+        for (size_t i = 0; i < n_lines; ++i) {
             String* s = copy->data.elements[i];
-            buf->lines.elements[ctx->start_row+1 + i] = Strdup(s);
+            new_lines[i] = Strdup(s);
             Buffer_push_undo(buf, make_Insert(undo_idx, ctx->start_row+1 + i, -1, Strdup(s)));
         }
+        Buffer_insert_lines(buf, ctx->start_row+1, new_lines, n_lines);
+        free(new_lines);
         return RP_LOWER;
     }
     else if (copy->cp_type == CP_SPLIT) {
         size_t n_newlines = n_lines - 1;
-        String** line_p = (String**) &buf->lines.elements[ctx->start_row];
+        String** line_p = Buffer_get_line_abs(buf, ctx->start_row);
         
         // Extra +1 to emulate vim's paste behavior (paste after).
         size_t paste_col = ctx->start_col + 1;
@@ -252,11 +714,10 @@ RepaintType Buffer_insert_copy(Buffer* buf, Copy* copy, EditorContext* ctx) {
             return RP_ALL;
         }
 
-        Vector_create_range(&buf->lines, ctx->start_row+1, n_newlines);
-
+        String** new_lines = malloc(n_newlines * sizeof(String*));
         for (size_t i = 1; i < n_newlines; ++i) {
             String* s = copy->data.elements[i];
-            buf->lines.elements[ctx->start_row + n_newlines] = Strdup(s);
+            new_lines[i-1] = Strdup(s);
             Buffer_push_undo(buf, make_Insert(undo_idx, ctx->start_row + i, -1, Strdup(s)));
         }
 
@@ -265,7 +726,7 @@ RepaintType Buffer_insert_copy(Buffer* buf, Copy* copy, EditorContext* ctx) {
         Strcats(&last_line_start, rest);
         Buffer_push_undo(buf, make_Insert(undo_idx, ctx->start_row + n_newlines, -1,
                                           Strdup(last_line_start)));
-        buf->lines.elements[ctx->start_row + n_newlines] = last_line_start;
+        new_lines[n_newlines-1] = last_line_start;
 
         // Fix the first line.
         Edit* edit = make_Insert(undo_idx, ctx->start_row, ctx->start_col+1, Strdup(first));
@@ -274,6 +735,8 @@ RepaintType Buffer_insert_copy(Buffer* buf, Copy* copy, EditorContext* ctx) {
         Strcat(line_p, first);
 
         Buffer_push_undo(buf, edit);
+        Buffer_insert_lines(buf, ctx->start_row+1, new_lines, n_newlines);
+        free(new_lines);
 
         // TODO signal lines for RP_LINES
         return RP_ALL;
@@ -296,17 +759,17 @@ RepaintType Buffer_delete_range(Buffer* buf, Copy* copy, EditorContext* range) {
     size_t undo_idx = range->undo_idx;
     if (range->start_col == -1) {   // Line delete mode
         copy->cp_type = CP_LINE;
-        for (ssize_t i = first_row; i <= last_row; ++i) {
-            String* line = *Buffer_get_line_abs(buf, i);
-            Vector_push(&copy->data, Strdup(line));
+        size_t n_lines = last_row + 1 - first_row;
+        String** removed = malloc(n_lines * sizeof(String*));
+        Buffer_remove_lines(buf, first_row, last_row+1, removed);
+        for (size_t i = 0; i < n_lines; ++i) {
+            Vector_push(&copy->data, Strdup(removed[i]));
 
             // Ownership transfer (line)
-            Buffer_push_undo(buf, make_Delete(undo_idx, first_row, -1, line));
-        }
-        Vector_delete_range(&buf->lines, first_row, last_row+1);
-        if (buf->lines.size == 0) {
-            Vector_push(&buf->lines, make_String(""));
+            Buffer_push_undo(buf, make_Delete(undo_idx, first_row, -1, removed[i]));
         }
+        free(removed);
+        _Buffer_ensure_line(buf);
         return RP_LOWER;
     }
 
@@ -323,6 +786,7 @@ RepaintType Buffer_delete_range(Buffer* buf, Copy* copy, EditorContext* range) {
         Buffer_push_undo(buf, edit);
 
         String_delete_range(*line_p, start_c, end_c);
+        *line_p = String_fit(*line_p);
         return RP_LINES;
     }
 
@@ -334,9 +798,9 @@ RepaintType Buffer_delete_range(Buffer* buf, Copy* copy, EditorContext* range) {
     String* final_copy_add = NULL;
     if (last_row < Buffer_get_num_lines(buf)) {
         // Remove last row, merge with first row
+        Buffer_remove_lines(buf, last_row, last_row+1, &old_content);
 
         // Delete to jump col, inclusive.
-        old_content = *Buffer_get_line_abs(buf, last_row);
         size_t target_len = Strlen(old_content);
         size_t delete_to = range->jump_col + 1;
         if (target_len < delete_to) {
@@ -350,16 +814,11 @@ RepaintType Buffer_delete_range(Buffer* buf, Copy* copy, EditorContext* range) {
 
         String* last_row_fragment = Strsub(old_content, delete_to, old_content->length);
 
-        Vector_delete(&buf->lines, last_row);
-
         // Ownership transfer.
         modify_first_row->new_content = last_row_fragment;
         print("Save end: %ld %ld %s\n", target_len, delete_to, last_row_fragment->data);
     }
-    size_t new_len = start_c + 1;
-    if (modify_first_row->new_content != NULL) {
-        new_len += Strlen(modify_first_row->new_content);
-    }
+    line_p = Buffer_get_line_abs(buf, first_row);
     Strtrunc(*line_p, start_c);
     if (modify_first_row->new_content != NULL) {
         Strcat(line_p, modify_first_row->new_content);
@@ -367,17 +826,19 @@ RepaintType Buffer_delete_range(Buffer* buf, Copy* copy, EditorContext* range) {
     }
 
     if (last_row > first_row + 1) {
-        for (size_t i = last_row - 1; i > first_row; --i) {
-            String* line = *Buffer_get_line_abs(buf, i);
-            Vector_push(&copy->data, Strdup(line));
-
-            // Ownership transfer (line)
-            Buffer_push_undo(buf, make_Delete(undo_idx, i, -1, line));
+        size_t n_lines = last_row - (first_row + 1);
+        String** removed = malloc(n_lines * sizeof(String*));
+        Buffer_remove_lines(buf, first_row+1, last_row, removed);
+        for (size_t i = 0; i < n_lines; ++i) {
+            Vector_push(&copy->data, Strdup(removed[i]));
         }
-        Vector_delete_range(&buf->lines, first_row+1, last_row);
-        if (buf->lines.size == 0) {
-            Vector_push(&buf->lines, make_String(""));
+        // Undo re-inserts these in reverse push order, so push the last row first.
+        for (size_t i = n_lines; i > 0; --i) {
+            // Ownership transfer (line)
+            Buffer_push_undo(buf, make_Delete(undo_idx, first_row + i, -1, removed[i-1]));
         }
+        free(removed);
+        _Buffer_ensure_line(buf);
     }
     if (final_copy_add != NULL) {
         Vector_push(&copy->data, final_copy_add);
@@ -401,8 +862,7 @@ void Buffer_copy_range(Buffer* buf, Copy* copy, EditorContext* range) {
     if (range->start_col == -1) {   // Line copy mode.
         copy->cp_type = CP_LINE;
         for (ssize_t i = first_row; i <= last_row; ++i) {
-            String* line = *Buffer_get_line_abs(buf, i);
-            Vector_push(&copy->data, Strdup(line));
+            Vector_push(&copy->data, Buffer_dup_line(buf, i));
         }
         return;
     }
@@ -419,11 +879,8 @@ void Buffer_copy_range(Buffer* buf, Copy* copy, EditorContext* range) {
 
     Vector_push(&copy->data, Strsub(*line_p, start_c, (*line_p)->length));
 
-    if (last_row > first_row + 1) {
-        for (size_t i = last_row - 1; i > first_row; --i) {
-            String* line = *Buffer_get_line_abs(buf, i);
-            Vector_push(&copy->data, Strdup(line));
-        }
+    for (size_t i = first_row + 1; i < last_row; ++i) {
+        Vector_push(&copy->data, Buffer_dup_line(buf, i));
     }
 
     if (last_row < Buffer_get_num_lines(buf)) {
@@ -438,52 +895,782 @@ void Buffer_copy_range(Buffer* buf, Copy* copy, EditorContext* range) {
     }
 }
 
+bool BUFFER_SAVE_FSYNC = true;
+size_t BUFFER_RELOAD_MAX_DIFF = 4096;
+
+/**
+ * PRIVATE
+ * Milliseconds on a monotonic clock.
+ */
+double _Buffer_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * PRIVATE
+ * fsync the directory containing `path`, so that a rename into it is durable.
+ */
+void _Buffer_sync_dir(const char* path) {
+    String* dir = make_String(path);
+    char* slash = strrchr(dir->data, '/');
+    if (slash == NULL) {
+        String_clear(dir);
+        Strcats(&dir, ".");
+    }
+    else {
+        slash[slash == dir->data] = 0;
+    }
+    int fd = open(dir->data, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+// The worker writes (and reports progress) this many bytes at a time.
+#define SAVE_CHUNK (1 << 20)
+
+/**
+ * A range of the contents being saved: `length` bytes at `data`, or if `data`
+ * is NULL, at `offset` in the job's `fd`.
+ */
+struct SaveRange {
+    const char* data;
+    size_t offset;
+    size_t length;
+    bool mapped;        // `data` is in a file mapping, so its pages can be dropped once written.
+};
+typedef struct SaveRange SaveRange;
+
+/**
+ * A save running on a worker thread. The worker only touches the job, and
+ * memory that doesn't change until the job is finished.
+ */
+struct SaveJob {
+    pthread_t thread;
+    bool threaded;
+    String* dest;
+    String* temp;
+    bool exists;                // `base` is the file being replaced.
+    struct stat base;
+    mode_t mode;                // For the new file: the old one's, or 0666 less the umask.
+    bool fsync;
+    bool release;               // Drop mapped pages once written (buffer has a memory budget).
+    SaveRange* ranges;
+    size_t num_ranges;
+    char* copy;                 // Snapshot of the contents that can change while saving.
+    int fd;                     // dup of the add buffer's scratch file, or -1.
+    size_t total;
+    _Atomic size_t written;
+    _Atomic bool done;
+    int result;
+    size_t journal_mark;        // Journal records from here on are for edits made after the snapshot.
+    size_t changes;             // Buffer.changes at the snapshot.
+    SaveStats stats;
+};
+typedef struct SaveJob SaveJob;
+
+/**
+ * PRIVATE
+ * Take an immutable snapshot of the buffer contents for `job`.
+ * BS_LINES buffers are copied (they are never bigger than BUFFER_PIECES_THRESHOLD
+ * when opened automatically). BS_PIECES buffers only copy the added lines on
+ * the heap: the original never changes, and a spilled add buffer is append-only.
+ */
+void _Buffer_snapshot(Buffer* buf, SaveJob* job) {
+    if (buf->storage == BS_PIECES) {
+        Buffer_sync(buf);
+        PieceTable* pt = buf->pieces;
+        size_t count;
+        PieceSpan* spans = PieceTable_spans(pt, &count);
+        size_t copy_size = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (spans[i].source == PT_ADD && pt->spill_fd < 0) {
+                copy_size += spans[i].end - spans[i].start;
+            }
+        }
+        if (pt->spill_fd >= 0) {
+            job->fd = dup(pt->spill_fd);
+        }
+        job->copy = malloc(copy_size + 1);
+        job->ranges = malloc((count + 1) * sizeof(SaveRange));
+        job->num_ranges = count;
+        job->release = pt->budget > 0;
+        copy_size = 0;
+        for (size_t i = 0; i < count; ++i) {
+            SaveRange* r = &job->ranges[i];
+            r->length = spans[i].end - spans[i].start;
+            r->offset = spans[i].start;
+            r->mapped = false;
+            if (spans[i].source == PT_ORIGINAL) {
+                r->data = pt->original + spans[i].start;
+                r->mapped = pt->mapped;
+            }
+            else if (pt->spill_fd >= 0) {
+                r->data = NULL;
+            }
+            else {
+                memcpy(job->copy + copy_size, pt->add + spans[i].start, r->length);
+                r->data = job->copy + copy_size;
+                copy_size += r->length;
+            }
+            job->total += r->length;
+        }
+        free(spans);
+        return;
+    }
+    size_t num_lines = LineTree_size(&buf->lines);
+    void** span;
+    for (size_t i = 0; i < num_lines; ) {
+        size_t n = LineTree_span(&buf->lines, i, &span);
+        for (size_t j = 0; j < n; ++j) {
+            job->total += ((String*) span[j])->length;
+        }
+        i += n;
+    }
+    job->copy = malloc(job->total + 1);
+    size_t pos = 0;
+    for (size_t i = 0; i < num_lines; ) {
+        size_t n = LineTree_span(&buf->lines, i, &span);
+        for (size_t j = 0; j < n; ++j) {
+            String* line = span[j];
+            memcpy(job->copy + pos, line->data, line->length);
+            pos += line->length;
+        }
+        i += n;
+    }
+    job->ranges = malloc(sizeof(SaveRange));
+    job->ranges[0] = (SaveRange) { job->copy, 0, job->total, false };
+    job->num_ranges = 1;
+}
+
+/**
+ * PRIVATE
+ * Drop the whole pages of [data, data + length) from a file mapping.
+ */
+void _Buffer_release_pages(const char* data, size_t length) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = ((size_t) data + page - 1) / page * page;
+    size_t end = ((size_t) data + length) / page * page;
+    if (end > start) {
+        madvise((void*) start, end - start, MADV_DONTNEED);
+    }
+}
+
+/**
+ * PRIVATE
+ * Worker thread: write the snapshot to the temp file, then rename it into place.
+ */
+void* _Buffer_save_worker(void* arg) {
+    SaveJob* job = arg;
+    double start = _Buffer_now_ms();
+    // A new file of our own (O_EXCL, 0600): never a file or link that was
+    // already there, nor another editor's temp file. Its mode is set before
+    // anything is written, so the contents are never less protected than the file.
+    int fd = mkstemp(job->temp->data);
+    bool ok = fd >= 0 && fchmod(fd, job->mode) == 0;
+    IovWriter w;
+    inplace_make_IovWriter(&w, fd);
+    char* bounce = NULL;
+    size_t pending = 0;
+    for (size_t i = 0; i < job->num_ranges && ok; ++i) {
+        SaveRange* r = &job->ranges[i];
+        for (size_t pos = 0; pos < r->length && ok; ) {
+            size_t chunk = r->length - pos < SAVE_CHUNK ? r->length - pos : SAVE_CHUNK;
+            const char* data = r->data + pos;
+            if (r->data == NULL) {
+                if (bounce == NULL) {
+                    bounce = malloc(SAVE_CHUNK);
+                }
+                ok = pread(job->fd, bounce, chunk, r->offset + pos) == (ssize_t) chunk;
+                data = bounce;
+            }
+            IovWriter_add(&w, data, chunk);
+            pending += chunk;
+            bool release = job->release && r->mapped;
+            if (ok && (pending >= SAVE_CHUNK || r->data == NULL || release)) {
+                ok = IovWriter_flush(&w);
+                pending = 0;
+                atomic_store(&job->written, w.written);
+            }
+            if (ok && release) {
+                _Buffer_release_pages(data, chunk);
+            }
+            pos += chunk;
+        }
+    }
+    free(bounce);
+    ok = ok && IovWriter_flush(&w);
+    atomic_store(&job->written, w.written);
+    SaveStats* stats = &job->stats;
+    stats->bytes = w.written;
+    stats->writes = w.calls;
+    double written = _Buffer_now_ms();
+    stats->write_ms = written - start;
+
+    if (ok && job->fsync) {
+        ok = fsync(fd) == 0;
+    }
+    if (fd >= 0) {
+        ok = close(fd) == 0 && ok;
+    }
+    // Renaming (rather than writing over the file) also leaves the pages under
+    // a BS_PIECES mapping alone; the mapping keeps the old inode alive.
+    if (ok && rename(job->temp->data, job->dest->data) == 0) {
+        if (job->fsync) {
+            _Buffer_sync_dir(job->dest->data);
+        }
+        job->result = 0;
+    }
+    else {
+        if (fd >= 0) {
+            remove(job->temp->data);
+        }
+        job->result = -1;
+    }
+    stats->sync_ms = _Buffer_now_ms() - written;
+    stats->total_ms = stats->snapshot_ms + _Buffer_now_ms() - start;
+    atomic_store(&job->done, true);
+    return NULL;
+}
+
+void Buffer_save_start(Buffer* buf) {
+    Buffer_save_finish(buf, true);
+    double start = _Buffer_now_ms();
+    SaveJob* job = calloc(1, sizeof(SaveJob));
+    job->fd = -1;
+    job->fsync = BUFFER_SAVE_FSYNC;
+
+    // Replace the file a symlink points to, not the link.
+    char* target = realpath(buf->name->data, NULL);
+    job->dest = make_String(target != NULL ? target : buf->name->data);
+    free(target);
+    job->temp = Strdup(job->dest);
+    Strcats(&job->temp, ".XXXXXX");
+    job->exists = stat(job->dest->data, &job->base) == 0;
+    if (job->exists) {
+        job->mode = job->base.st_mode & 07777;
+    }
+    else {
+        mode_t mask = umask(0);
+        umask(mask);
+        job->mode = 0666 & ~mask;
+    }
+
+    _Buffer_snapshot(buf, job);
+    job->journal_mark = buf->journal != NULL ? buf->journal->size : 0;
+    job->changes = buf->changes;
+    job->stats.snapshot_ms = _Buffer_now_ms() - start;
+    buf->save_job = job;
+    job->threaded = pthread_create(&job->thread, NULL, &_Buffer_save_worker, job) == 0;
+    if (!job->threaded) {
+        _Buffer_save_worker(job);
+    }
+}
+
+bool Buffer_saving(Buffer* buf) {
+    return buf->save_job != NULL;
+}
+
+double Buffer_save_progress(Buffer* buf) {
+    SaveJob* job = buf->save_job;
+    if (job == NULL || job->total == 0) {
+        return 1;
+    }
+    return (double) atomic_load(&job->written) / job->total;
+}
+
+int Buffer_save_finish(Buffer* buf, bool wait) {
+    SaveJob* job = buf->save_job;
+    if (job == NULL) {
+        return 0;
+    }
+    if (!wait && !atomic_load(&job->done)) {
+        return BUFFER_SAVE_RUNNING;
+    }
+    if (job->threaded) {
+        pthread_join(job->thread, NULL);
+    }
+    int fd = job->result == 0 ? open(job->dest->data, O_RDONLY) : -1;
+    if (fd >= 0) {
+        _Buffer_record_disk(buf, fd, job->changes);
+        struct stat st;
+        if (buf->journal != NULL && fstat(fd, &st) == 0) {
+            // Only the edits made while saving aren't in the file.
+            Journal_rebase(buf->journal, &st, job->journal_mark);
+        }
+        close(fd);
+    }
+    buf->last_save = job->stats;
+    SaveStats* stats = &job->stats;
+    print("save %s: %d, %zu bytes in %zu writes, %.2f ms snapshot, %.2f ms write, %.2f ms sync\n",
+            job->dest->data, job->result, stats->bytes, stats->writes,
+            stats->snapshot_ms, stats->write_ms, stats->sync_ms);
+    int ret = job->result;
+    if (job->fd >= 0) {
+        close(job->fd);
+    }
+    free(job->ranges);
+    free(job->copy);
+    free(job->dest);
+    free(job->temp);
+    free(job);
+    buf->save_job = NULL;
+    return ret;
+}
+
 int Buffer_save(Buffer* buf) {
-    Buffer_open_files(buf, NULL, "w");
-    for (int i = 0; i < buf->lines.size; ++i) {
-        // TODO check return value
-        String* line = buf->lines.elements[i];
-        fwrite(line->data, Strlen(line), 1, buf->swapfile);
-    }
-    fseek(buf->swapfile, 0, SEEK_END);
-    size_t bytes = ftell(buf->swapfile);
-    Buffer_close_files(buf);
-    Buffer_open_files(buf, "w", "r");
-#ifdef __APPLE__
-    char* tmp_buf = calloc(bytes, 1);
-    size_t read_bytes = fread(tmp_buf, 1, bytes, buf->swapfile);
-    if (ferror(buf->swapfile)) {
-    fail:
-        free(tmp_buf);
-        Buffer_close_files(buf);
-        return -1;
+    Buffer_save_start(buf);
+    return Buffer_save_finish(buf, true);
+}
+
+bool Buffer_modified(Buffer* buf) {
+    return buf->changes != buf->disk.changes;
+}
+
+/**
+ * PRIVATE
+ * Append the file `fd` from byte `from` on to the end of the buffer.
+ */
+void _Buffer_reload_append(Buffer* buf, int fd, size_t from) {
+    FILE* infile = fdopen(dup(fd), "r");
+    fseek(infile, from, SEEK_SET);
+    Vector lines;
+    inplace_make_Vector(&lines, 16);
+    read_file_break_lines(&lines, infile, NULL);
+    fclose(infile);
+    // The last line has no newline, so the first new one continues it.
+    size_t last = Buffer_get_num_lines(buf) - 1;
+    String* first = lines.elements[0];
+    Strncats(Buffer_get_line_abs(buf, last), first->data, first->length);
+    free(first);
+    Buffer_insert_lines(buf, last + 1, (String**) lines.elements + 1, lines.size - 1);
+    Vector_destroy(&lines);
+}
+
+/**
+ * PRIVATE
+ * Where line `row` of the old version is in the new one. Rows in a changed
+ * region go to the same offset in its replacement (or its last line).
+ */
+ssize_t _Buffer_map_row(DiffHunk* hunks, size_t count, ssize_t row) {
+    ssize_t shift = 0;
+    for (size_t i = 0; i < count; ++i) {
+        DiffHunk* h = &hunks[i];
+        if (row < (ssize_t) h->a_start) {
+            break;
+        }
+        if (row < (ssize_t) (h->a_start + h->a_count)) {
+            size_t offset = row - h->a_start;
+            if (offset >= h->b_count) {
+                offset = h->b_count > 0 ? h->b_count - 1 : 0;
+            }
+            return h->b_start + offset;
+        }
+        shift = (ssize_t) (h->b_start + h->b_count) - (ssize_t) (h->a_start + h->a_count);
     }
-    size_t written_bytes = fwrite(tmp_buf, 1, read_bytes, buf->file);
-    if (written_bytes < read_bytes || ferror(buf->file)) { goto fail; }
-    free(tmp_buf);
-#else
-    while (bytes > 0) {
-        // TODO: sendfile isn't portable at all.
-        ssize_t nbytes = sendfile(fileno(buf->file), fileno(buf->swapfile), NULL, bytes);
-        if (nbytes < 0) {
-            // TODO handle failure?
-            Buffer_close_files(buf);
-            return -1;
-        }
-        bytes -= nbytes;
-    }
-#endif
-    Buffer_close_files(buf);
-    remove(buf->swapfile_name->data);
-    return 0;
+    return row + shift;
+}
+
+/**
+ * PRIVATE
+ * Apply a reload edit, keeping it in the undo buffer if `record`.
+ */
+void _Buffer_reload_Edit(Buffer* buf, Edit* ed, bool record) {
+    Buffer_apply_Edit(buf, ed);
+    if (record) {
+        History_push(&buf->undo_history, ed);
+        return;
+    }
+    Edit_destroy(ed);
+    free(ed);
+}
+
+/**
+ * PRIVATE
+ * Keep the cursor, marks and view on the same lines after the buffer was
+ * changed by `hunks`.
+ */
+void _Buffer_reload_positions(Buffer* buf, DiffHunk* hunks, size_t count) {
+    ssize_t last = Buffer_get_num_lines(buf) - 1;
+    // The cursor's line stays at the same height on the screen.
+    ssize_t cursor = _Buffer_map_row(hunks, count, buf->top_row + buf->cursor_row);
+    cursor = cursor < last ? cursor : last;
+    buf->top_row = cursor > buf->cursor_row ? cursor - buf->cursor_row : 0;
+    buf->cursor_row = cursor - buf->top_row;
+    ssize_t visual = _Buffer_map_row(hunks, count, buf->visual_row);
+    buf->visual_row = visual < last ? visual : last;
+    for (size_t i = 0; i < sizeof(buf->marks) / sizeof(buf->marks[0]); ++i) {
+        Mark* mark = &buf->marks[i];
+        if (mark->set) {
+            ssize_t row = _Buffer_map_row(hunks, count, mark->row);
+            mark->row = row < last ? row : last;
+        }
+    }
+}
+
+/**
+ * PRIVATE
+ * Make the buffer match the file `fd` by rewriting only the lines that differ.
+ * The rewrite is one undoable action, unless it's too big for the undo buffer
+ * (then the undo buffer is emptied, as its rows would no longer line up).
+ */
+void _Buffer_reload_diff(Buffer* buf, int fd) {
+    FILE* infile = fdopen(dup(fd), "r");
+    Vector lines;
+    inplace_make_Vector(&lines, 100);
+    read_file_break_lines(&lines, infile, NULL);
+    fclose(infile);
+
+    size_t n = Buffer_get_num_lines(buf);
+    size_t m = lines.size;
+    uint64_t* old_hashes = malloc((n + 1) * sizeof(uint64_t));
+    uint64_t* new_hashes = malloc((m + 1) * sizeof(uint64_t));
+    for (size_t i = 0; i < n; ) {
+        if (buf->storage == BS_PIECES) {
+            String* line = Buffer_dup_line(buf, i);
+            old_hashes[i++] = line_hash(line->data, line->length);
+            free(line);
+            continue;
+        }
+        void** span;
+        size_t count = LineTree_span(&buf->lines, i, &span);
+        for (size_t j = 0; j < count; ++j) {
+            String* line = span[j];
+            old_hashes[i + j] = line_hash(line->data, line->length);
+        }
+        i += count;
+    }
+    for (size_t i = 0; i < m; ++i) {
+        String* line = lines.elements[i];
+        new_hashes[i] = line_hash(line->data, line->length);
+    }
+    size_t num_hunks;
+    DiffHunk* hunks = line_diff(old_hashes, n, new_hashes, m, BUFFER_RELOAD_MAX_DIFF, &num_hunks);
+    free(old_hashes);
+    free(new_hashes);
+
+    size_t num_edits = 0;
+    for (size_t i = 0; i < num_hunks; ++i) {
+        num_edits += hunks[i].a_count > hunks[i].b_count ? hunks[i].a_count : hunks[i].b_count;
+    }
+    bool record = num_edits <= UNDO_HISTORY_SIZE / 2;
+    size_t undo = ++buf->undo_index;
+    // Last hunk first, so the rows of the ones before it don't move.
+    for (size_t h = num_hunks; h-- > 0; ) {
+        DiffHunk* hunk = &hunks[h];
+        size_t common = hunk->a_count < hunk->b_count ? hunk->a_count : hunk->b_count;
+        for (size_t i = 0; i < common; ++i) {
+            size_t row = hunk->a_start + i;
+            Edit* ed = make_Delete(undo, row, -1, Buffer_dup_line(buf, row));
+            ed->new_content = Strdup(lines.elements[hunk->b_start + i]);
+            _Buffer_reload_Edit(buf, ed, record);
+        }
+        for (size_t i = common; i < hunk->a_count; ++i) {
+            size_t row = hunk->a_start + common;
+            _Buffer_reload_Edit(buf, make_Delete(undo, row, -1, Buffer_dup_line(buf, row)), record);
+        }
+        for (size_t i = common; i < hunk->b_count; ++i) {
+            String* line = Strdup(lines.elements[hunk->b_start + i]);
+            _Buffer_reload_Edit(buf, make_Insert(undo, hunk->a_start + i, -1, line), record);
+        }
+    }
+    if (!record) {
+        History_destroy(&buf->undo_history);
+        inplace_make_History(&buf->undo_history, UNDO_HISTORY_SIZE, (destructor_t) &Edit_destroy);
+    }
+    _Buffer_reload_positions(buf, hunks, num_hunks);
+    free(hunks);
+    Vector_clear_free(&lines, 1);
+    Vector_destroy(&lines);
+}
+
+/**
+ * PRIVATE
+ * Reopen a BS_PIECES buffer on the file `fd`, from scratch. For files rewritten
+ * in place: the old version can't be diffed, as it was read through a mapping
+ * of the same file.
+ */
+void _Buffer_reload_pieces(Buffer* buf, int fd) {
+    _Buffer_drop_line_cache(buf);
+    PieceTable_destroy(buf->pieces);
+    free(buf->pieces);
+    buf->pieces = make_PieceTable_mapped(fd);
+    if (buf->pieces == NULL) {
+        buf->pieces = make_PieceTable(NULL, 0);
+    }
+    Buffer_set_memory_budget(buf, buf->memory_budget);
+    History_destroy(&buf->undo_history);
+    inplace_make_History(&buf->undo_history, UNDO_HISTORY_SIZE, (destructor_t) &Edit_destroy);
+    // Nothing lines up anymore; just keep the positions in bounds.
+    _Buffer_reload_positions(buf, NULL, 0);
+}
+
+/**
+ * PRIVATE
+ * Lease the file a BS_PIECES buffer maps, if it still has that name.
+ */
+bool _Buffer_lease(Buffer* buf) {
+    if (buf->storage != BS_PIECES || !buf->pieces->mapped || buf->pieces->detached) {
+        return false;
+    }
+    if (buf->pieces->lease_fd >= 0) {
+        return true;
+    }
+    int fd = open(buf->name->data, O_RDONLY | O_CLOEXEC);
+    return fd >= 0 && PieceTable_lease(buf->pieces, fd);
+}
+
+bool Buffer_lease_file(Buffer* buf) {
+    buf->lease_file = true;
+    return _Buffer_lease(buf);
+}
+
+bool Buffer_check_lease(Buffer* buf) {
+    if (buf->storage != BS_PIECES || !PieceTable_lease_broken(buf->pieces)) {
+        return false;
+    }
+    if (Buffer_modified(buf) || Buffer_saving(buf)) {
+        if (!PieceTable_detach(buf->pieces)) {
+            print("detach %s failed\n", buf->name->data);
+        }
+    }
+    // The writer goes ahead, whether or not there's a copy.
+    PieceTable_drop_lease(buf->pieces);
+    return true;
+}
+
+bool Buffer_lost_data(Buffer* buf) {
+    return buf->storage == BS_PIECES && buf->pieces->lost;
+}
+
+int Buffer_reload(Buffer* buf) {
+    if (Buffer_saving(buf)) {
+        return BUFFER_RELOAD_NONE;
+    }
+    int fd = open(buf->name->data, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        // Gone (maybe for now, while it's being replaced).
+        if (fd >= 0) {
+            close(fd);
+        }
+        return BUFFER_RELOAD_NONE;
+    }
+    DiskState* disk = &buf->disk;
+    bool same_file = disk->exists && disk->ino == st.st_ino;
+    if (same_file && disk->size == (size_t) st.st_size
+            && disk->mtime_sec == st.st_mtim.tv_sec && disk->mtime_nsec == st.st_mtim.tv_nsec) {
+        close(fd);
+        return BUFFER_RELOAD_NONE;
+    }
+    if (Buffer_modified(buf)) {
+        if (same_file && buf->storage == BS_PIECES && !PieceTable_detach(buf->pieces)) {
+            print("detach %s failed\n", buf->name->data);
+        }
+        // Remember this version, so it's only reported once.
+        _Buffer_record_disk(buf, fd, disk->changes);
+        close(fd);
+        return BUFFER_RELOAD_CONFLICT;
+    }
+    int ret = BUFFER_RELOAD_CHANGED;
+    if (same_file && (size_t) st.st_size > disk->size
+            && _Buffer_tail_hash(fd, disk->size) == disk->tail_hash) {
+        _Buffer_reload_append(buf, fd, disk->size);
+        ret = BUFFER_RELOAD_APPENDED;
+    }
+    else if (same_file && buf->storage == BS_PIECES) {
+        _Buffer_reload_pieces(buf, fd);
+    }
+    else {
+        _Buffer_reload_diff(buf, fd);
+    }
+    if (buf->line_index != NULL) {
+        // BS_PIECES lines are replaced without edits; don't trust the index.
+        buf->line_index->data = NULL;
+    }
+    _Buffer_record_disk(buf, fd, buf->changes);
+    if (buf->lease_file) {
+        // A lease given up for this write, or a new mapping.
+        _Buffer_lease(buf);
+    }
+    if (buf->journal != NULL) {
+        Journal_reset(buf->journal, &st);
+    }
+    if (buf->trigrams != NULL && ret == BUFFER_RELOAD_APPENDED) {
+        // The new lines are indexed by the next Buffer_index_step; the old last one may have grown.
+        TrigramIndex* index = buf->trigrams;
+        if (index->indexed_rows > 0) {
+            TrigramIndex_change_line(index, index->indexed_rows - 1);
+        }
+        index->complete = false;
+    }
+    else if (buf->trigrams != NULL) {
+        // Lines were replaced without edits: index it all again.
+        TrigramIndex_reset(buf->trigrams);
+    }
+    close(fd);
+    return ret;
 }
 
 void Buffer_rename(Buffer* buf, char* new_name) {
+    String* old_swapfile = Strdup(buf->swapfile_name);
     String_clear(buf->name);
     String_clear(buf->swapfile_name);
     Strcats(&buf->name, new_name);
     Strcats(&buf->swapfile_name, new_name);
     Strcats(&buf->swapfile_name, ".swp");
+    if (buf->journal != NULL) {
+        rename(old_swapfile->data, buf->swapfile_name->data);
+    }
+    free(old_swapfile);
+}
+
+size_t BUFFER_JOURNAL_COMPACT = 64 << 20;
+
+int Buffer_open_journal(Buffer* buf) {
+    struct stat st;
+    if (stat(buf->name->data, &st) != 0) {
+        // New file: the journal applies to an empty buffer.
+        memset(&st, 0, sizeof(st));
+    }
+    Vector recovered;
+    inplace_make_Vector(&recovered, 16);
+    Journal* journal = make_Journal(buf->swapfile_name->data, &st, &recovered);
+    for (size_t i = 0; i < recovered.size; ++i) {
+        Edit* ed = recovered.elements[i];
+        Buffer_apply_Edit(buf, ed);
+        Edit_destroy(ed);
+        free(ed);
+    }
+    int ret = recovered.size;
+    Vector_destroy(&recovered);
+    if (journal == NULL) {
+        return -1;
+    }
+    buf->journal = journal;
+    return ret;
+}
+
+void Buffer_checkpoint(Buffer* buf) {
+    if (buf->journal != NULL && buf->journal->size > BUFFER_JOURNAL_COMPACT && !Buffer_saving(buf)) {
+        Buffer_save_start(buf);
+    }
+}
+
+/**
+ * PRIVATE
+ * Append an edit (or its undo, if `inverse`) to the journal, if there is one.
+ */
+void _Buffer_journal_Edit(Buffer* buf, Edit* ed, bool inverse) {
+    if (buf->journal != NULL && !Journal_append(buf->journal, ed, inverse)) {
+        print("journal write failed: %s\n", buf->swapfile_name->data);
+    }
+}
+
+/**
+ * PRIVATE
+ * Number of lines in the content of a whole-line insert or delete: one per
+ * '\n', plus the last one if it doesn't end in one.
+ */
+size_t _Edit_num_lines(const String* content) {
+    size_t count = 0;
+    const char* end = content->data + content->length;
+    for (const char* p = content->data; (p = memchr(p, '\n', end - p)) != NULL; ++p) {
+        count += 1;
+    }
+    if (content->length == 0 || end[-1] != '\n') {
+        count += 1;
+    }
+    return count;
+}
+
+/**
+ * PRIVATE
+ * Keep the trigram index up to date with an edit (or its inverse, if undone).
+ * Works from the edit alone: it may be pushed before or after it's applied.
+ */
+void _Buffer_index_Edit(Buffer* buf, Edit* ed, bool inverse) {
+    TrigramIndex* index = buf->trigrams;
+    if (index == NULL) {
+        return;
+    }
+    String* added = inverse ? ed->old_content : ed->new_content;
+    String* removed = inverse ? ed->new_content : ed->old_content;
+    if (ed->start_col != -1) {
+        TrigramIndex_change_line(index, ed->start_row);
+    }
+    else if (removed == NULL) {
+        TrigramIndex_insert_lines(index, ed->start_row, _Edit_num_lines(added), added->data, added->length);
+    }
+    else if (added == NULL) {
+        TrigramIndex_delete_lines(index, ed->start_row, _Edit_num_lines(removed));
+    }
+    else {
+        TrigramIndex_replace_line(index, ed->start_row, added->data, added->length);
+    }
+}
+
+/**
+ * PRIVATE
+ * Insert the lines of a whole-line edit's `content` at `row`.
+ */
+void _Buffer_insert_content(Buffer* buf, size_t row, const String* content) {
+    size_t count = _Edit_num_lines(content);
+    if (count == 1) {
+        Buffer_insert_line(buf, row, Strdup(content));
+        return;
+    }
+    String** lines = malloc(count * sizeof(String*));
+    const char* p = content->data;
+    const char* end = content->data + content->length;
+    for (size_t i = 0; i < count; ++i) {
+        const char* next = memchr(p, '\n', end - p);
+        size_t length = (next != NULL) ? next + 1 - p : end - p;
+        lines[i] = alloc_String(length);
+        Strncats(&lines[i], p, length);
+        p += length;
+    }
+    Buffer_insert_lines(buf, row, lines, count);
+    free(lines);
+}
+
+size_t Buffer_insert_text(Buffer* buf, size_t undo, size_t row, const char* text, size_t length) {
+    String* content = alloc_String(length);
+    Strncats(&content, text, length);
+    size_t count = _Edit_num_lines(content);
+    _Buffer_insert_content(buf, row, content);
+    Buffer_push_undo(buf, make_Insert(undo, row, -1, content));
+    return count;
+}
+
+void Buffer_apply_Edit(Buffer* buf, Edit* ed) {
+    size_t index = ed->start_row;
+    buf->changes += 1;
+    if (ed->start_col == -1) {
+        if (ed->old_content == NULL) {  // Line insert
+            _Buffer_insert_content(buf, index, ed->new_content);
+        }
+        else if (ed->new_content == NULL) {  // Line delete
+            Buffer_remove_lines(buf, index, index + _Edit_num_lines(ed->old_content), NULL);
+        }
+        else {  // Line replace
+            String** lineptr = Buffer_get_line_abs(buf, index);
+            String_free(*lineptr);
+            *lineptr = Strdup(ed->new_content);
+        }
+        return;
+    }
+    String** lineptr = Buffer_get_line_abs(buf, index);
+    if (ed->old_content != NULL) {
+        String_delete_range(*lineptr, ed->start_col, ed->start_col + Strlen(ed->old_content));
+    }
+    if (ed->new_content != NULL) {
+        String_inserts(lineptr, ed->start_col, ed->new_content->data);
+    }
 }
 
 /**
@@ -495,6 +1682,9 @@ void Buffer_push_undo(Buffer* buf, Edit* ed) {
         free(ed);
         return;
     }
+    _Buffer_journal_Edit(buf, ed, false);
+    _Buffer_index_Edit(buf, ed, false);
+    buf->changes += 1;
     History_push(&buf->undo_history, ed);
 }
 
@@ -504,30 +1694,32 @@ void Buffer_push_undo(Buffer* buf, Edit* ed) {
  */
 void Buffer_undo_Edit(Buffer* buf, Edit* ed) {
     print("Undo edit: %ld, %ld\n", ed->start_row, ed->start_col);
+    _Buffer_journal_Edit(buf, ed, true);
+    _Buffer_index_Edit(buf, ed, true);
+    buf->changes += 1;
     size_t index = ed->start_row;
     if (ed->old_content == NULL) {
         // Insert action. Undo by deleting.
-        String* lineptr = buf->lines.elements[index];
         if (ed->start_col == -1) {  // Line insert
-            Vector_delete(&buf->lines, index);
-            free(lineptr);
+            Buffer_remove_lines(buf, index, index + _Edit_num_lines(ed->new_content), NULL);
             return;
         }
+        String* lineptr = *Buffer_get_line_abs(buf, index);
         String_delete_range(lineptr, ed->start_col, ed->start_col + Strlen(ed->new_content));
     }
     else if (ed->new_content == NULL) {
         // Delete action. Undo by inserting.
         if (ed->start_col == -1) {  // Line delete
-            Vector_insert(&buf->lines, index, Strdup(ed->old_content));
+            _Buffer_insert_content(buf, index, ed->old_content);
             return;
         }
-        String** lineptr = (String**) &(buf->lines.elements[index]);
+        String** lineptr = Buffer_get_line_abs(buf, index);
         String_inserts(lineptr, ed->start_col, ed->old_content->data);
     }
     else {
-        String** lineptr = (String**) &(buf->lines.elements[index]);
+        String** lineptr = Buffer_get_line_abs(buf, index);
         if (ed->start_col == -1) {  // Line replace
-            free(*lineptr);
+            String_free(*lineptr);
             *lineptr = Strdup(ed->old_content);
             return;
         }
@@ -568,36 +1760,11 @@ int Buffer_undo(Buffer* buf, size_t undo_index, EditorContext* ctx) {
 int Buffer_redo(Buffer*, size_t undo_index, EditorContext* ctx);
 
 /**
- * Find a string in this buffer.
- * Starts from the position given in the EditorContext struct (row, col)
- * Search forward if direction is true, else backwards
- * Search in more than the current line if cross_lines is true
- * If found, returns the row, col in the EditorContext struct
- *
- * Return: 0 = OK, 1 = NOT_FOUND, -1 = error
+ * PRIVATE
+ * Buffer_find_str_inline, with the pattern already compiled.
  */
-int Buffer_find_str(Buffer* buf, EditorContext* ctx, char* str, bool cross_lines, bool direction) {
-    if (!cross_lines) {
-        return Buffer_find_str_inline(buf, ctx, str, ctx->jump_row, ctx->jump_col, direction);
-    }
-    int boundary = Buffer_get_num_lines(buf);
-    int offset = 1;
-    if (!direction) {
-        boundary = -1;
-        offset = -1;
-    }
-    int col_offset = ctx->jump_col;
-    for (size_t i = ctx->jump_row; i != boundary; i += offset) {
-        int result = Buffer_find_str_inline(buf, ctx, str, i, col_offset, direction);
-        if (result == 0) {
-            return result;
-        }
-        col_offset = -1;
-    }
-    return -1;  // TODO
-}
-
-int Buffer_find_str_inline(Buffer* buf, EditorContext* ctx, char* str, size_t line_num, ssize_t offset, bool direction) {
+static int _Buffer_find_regex_inline(Buffer* buf, EditorContext* ctx, const regex_t* regex,
+                                     size_t line_num, ssize_t offset, bool direction) {
     bool search_full = false;
     if (offset == -1) {
         search_full = true;
@@ -605,14 +1772,9 @@ int Buffer_find_str_inline(Buffer* buf, EditorContext* ctx, char* str, size_t li
     }
     String* _line = *(Buffer_get_line_abs(buf, line_num));
     char* line = _line->data;
-    regex_t regex;
     regmatch_t pmatch;
-    int status = regcomp(&regex, str, 0);
-    if (status != 0) {
-        return -2;
-    }
     size_t search_offset = 0;
-    status = regexec(&regex, line, 1, &pmatch, 0);
+    int status = regexec(regex, line, 1, &pmatch, 0);
     ssize_t pattern_loc = -1;
     ssize_t prev_loc = -1;
     while (status == 0) {
@@ -624,14 +1786,12 @@ int Buffer_find_str_inline(Buffer* buf, EditorContext* ctx, char* str, size_t li
             if (search_full || pattern_loc > offset) {
                 ctx->jump_col = pattern_loc;
                 ctx->jump_row = line_num;
-                regfree(&regex);
                 return 0;
             }
         }
         search_offset += pmatch.rm_eo;
-        status = regexec(&regex, line + search_offset, 1, &pmatch, REG_NOTBOL);
+        status = regexec(regex, line + search_offset, 1, &pmatch, REG_NOTBOL);
     }
-    regfree(&regex);
     //After loop finishes, non-negative prev_loc indicates location of last match before cursor offset
     if (!direction) {
         if (prev_loc >= 0 && (search_full || prev_loc < offset)) {
@@ -643,49 +1803,141 @@ int Buffer_find_str_inline(Buffer* buf, EditorContext* ctx, char* str, size_t li
     return -1;
 }
 
+/**
+ * PRIVATE
+ * Buffer_find_str_inline for a pattern without metacharacters: a substring
+ * search (scan_substr), which is much faster than regexec and finds the same
+ * thing. Unlike regexec, it also finds matches overlapping an earlier one.
+ */
+static int _Buffer_find_literal_inline(Buffer* buf, EditorContext* ctx, const String* needle,
+                                       size_t line_num, ssize_t offset, bool direction) {
+    String* line = *(Buffer_get_line_abs(buf, line_num));
+    const char* start = line->data;
+    const char* end = line->data + line->length;
+    const char* found;
+    if (direction) {
+        // After the cursor.
+        if (offset >= 0) {
+            start += ((size_t) offset < line->length) ? offset + 1 : line->length;
+        }
+        found = scan_substr(start, end, needle->data, needle->length);
+    }
+    else {
+        // Starting before the cursor.
+        if (offset >= 0) {
+            size_t limit = offset + needle->length - 1;
+            end = line->data + ((limit < line->length) ? limit : line->length);
+        }
+        found = scan_substr_last(start, end, needle->data, needle->length);
+    }
+    if (found == NULL) {
+        return -1;
+    }
+    ctx->jump_col = found - line->data;
+    ctx->jump_row = line_num;
+    return 0;
+}
+
+/**
+ * PRIVATE
+ */
+static int _Buffer_find_pattern_inline(Buffer* buf, EditorContext* ctx, const SearchPattern* pattern,
+                                       size_t line_num, ssize_t offset, bool direction) {
+    if (pattern->literal) {
+        return _Buffer_find_literal_inline(buf, ctx, pattern->text, line_num, offset, direction);
+    }
+    return _Buffer_find_regex_inline(buf, ctx, pattern->regex, line_num, offset, direction);
+}
+
+/**
+ * Find a string in this buffer.
+ * Starts from the position given in the EditorContext struct (row, col)
+ * Search forward if direction is true, else backwards
+ * Search in more than the current line if cross_lines is true
+ * If found, returns the row, col in the EditorContext struct
+ *
+ * Across lines, the whole buffer is searched a chunk at a time (Buffer_search),
+ * and `\n` in the pattern matches a line break.
+ *
+ * Return: 0 = found; -1 = not found; -2 = the pattern is invalid (as Buffer_search).
+ */
+int Buffer_find_str(Buffer* buf, EditorContext* ctx, char* str, bool cross_lines, bool direction) {
+    SearchPattern pattern;
+    inplace_make_SearchPattern(&pattern, str);
+    int result = -2;
+    if (!SearchPattern_valid(&pattern)) {
+        // Bad pattern.
+    }
+    else if (cross_lines) {
+        SearchMatch match;
+        size_t col = (ctx->jump_col > 0) ? ctx->jump_col : 0;
+        result = Buffer_search(buf, &pattern, ctx->jump_row, col, direction, &match);
+        if (result == 0) {
+            ctx->jump_row = match.row;
+            ctx->jump_col = match.col;
+        }
+    }
+    else {
+        result = _Buffer_find_pattern_inline(buf, ctx, &pattern, ctx->jump_row, ctx->jump_col, direction);
+    }
+    SearchPattern_destroy(&pattern);
+    return result;
+}
+
+int Buffer_find_str_inline(Buffer* buf, EditorContext* ctx, char* str, size_t line_num, ssize_t offset, bool direction) {
+    SearchPattern pattern;
+    inplace_make_SearchPattern(&pattern, str);
+    int result = -2;
+    if (SearchPattern_valid(&pattern)) {
+        result = _Buffer_find_pattern_inline(buf, ctx, &pattern, line_num, offset, direction);
+    }
+    SearchPattern_destroy(&pattern);
+    return result;
+}
+
 /**
  * Read a file into a vector. One entry in the vector for each line in the file.
- * All strings in the return vector are malloc'd, and keep their trailing newlines (if they had them).
+ * Strings in the return vector are carved from `arena` (if not NULL) or malloc'd,
+ * and keep their trailing newlines (if they had them).
  */
-size_t read_file_break_lines(Vector* ret, FILE* infile) {
-    const size_t BLOCKSIZE = 4096;
-    char read_buf[BLOCKSIZE+1];
-    String* save = make_String("");
-    read_buf[BLOCKSIZE] = 0;
+size_t read_file_break_lines(Vector* ret, FILE* infile, Arena* arena) {
+    const size_t BLOCKSIZE = 1 << 20;
+    char* read_buf = malloc(BLOCKSIZE);
+    // Line that runs past the end of a block. Usually empty.
+    String* save = alloc_String(0);
     size_t total_copied = 0;
     while (true) {
-        ssize_t num_read = fread(read_buf, sizeof(char), BLOCKSIZE, infile);
+        size_t num_read = fread(read_buf, sizeof(char), BLOCKSIZE, infile);
         // TODO: error check
         if (num_read == 0) {
             Vector_push(ret, save);
+            free(read_buf);
             return total_copied;
         }
-        read_buf[num_read] = 0;
-        char* scan_start = read_buf;
-        size_t remaining_size = num_read;
+        const char* scan_start = read_buf;
+        const char* end = read_buf + num_read;
         while (true) {
-            char* split_loc = strchr(scan_start, '\n');
+            const char* split_loc = scan_newline(scan_start, end);
             if (split_loc == NULL) {
-                if (remaining_size != strlen(scan_start)) {
-                    int* x = 0;
-                    *x = 1;
-                }
-                Strncats(&save, scan_start, remaining_size);
+                Strncats(&save, scan_start, end - scan_start);
                 break;
             }
-            size_t char_idx = (split_loc - scan_start);
+            size_t line_size = split_loc + 1 - scan_start;
             if (save->length) {
-                Strncats(&save, scan_start, char_idx+1);
+                Strncats(&save, scan_start, line_size);
                 Vector_push(ret, save);
-
-                save = make_String("");
+                save = alloc_String(0);
             }
             else {
-                char* s = strndup(scan_start, char_idx+1);
-                Vector_push(ret, convert_String(s));
+                // One allocation per line (or none, with an arena).
+                String* line = (arena != NULL) ? Arena_alloc_String(arena, line_size)
+                                               : alloc_String(line_size);
+                memcpy(line->data, scan_start, line_size);
+                line->data[line_size] = 0;
+                line->length = line_size;
+                Vector_push(ret, line);
             }
-            scan_start = split_loc+1;
-            remaining_size -= char_idx + 1;
+            scan_start = split_loc + 1;
         }
         total_copied += num_read;
     }
@@ -744,7 +1996,7 @@ int Buffer_skip_word(Buffer* buf, EditorContext* ctx, bool skip_punct) {
             }
         }
         current_pos++;
-        if (line[current_pos] == '\0' && current_row + 1 < Buffer_get_num_lines(buf)) {
+        if (line[current_pos] == '\0' && Buffer_has_line(buf, current_row + 1)) {
             current_row++;
             current_pos = 0;
             _line = *(Buffer_get_line_abs(buf, current_row));
@@ -5,6 +5,7 @@
 
 #include "../editor/utils.h"
 #include "../common.h"
+#include "line_index.h"
 
 Edit* make_Insert(size_t undo, size_t start_row, size_t start_col, String* new_content);
 /**
@@ -15,10 +16,36 @@ Edit* make_Edit(size_t undo, size_t start_row, size_t start_col, String* old_con
 void inplace_make_Edit(Edit*, size_t, size_t, size_t, String*);
 void Edit_destroy(Edit*);
 
+/**
+ * Files at least this many bytes are opened with the piece table engine (BS_PIECES)
+ * when the storage is BS_AUTO.
+ */
+extern size_t BUFFER_PIECES_THRESHOLD;
+
+/**
+ * Files at least this many bytes are opened in large-file mode when the storage
+ * is BS_AUTO: BS_PIECES, with a memory budget of BUFFER_MEMORY_BUDGET bytes.
+ */
+extern size_t BUFFER_LARGE_THRESHOLD;
+extern size_t BUFFER_MEMORY_BUDGET;
+
+/**
+ * Open a buffer, picking the storage engine automatically (BS_AUTO).
+ */
 Buffer* make_Buffer(const char* filename);
 void inplace_make_Buffer(Buffer*, const char*);
+Buffer* make_Buffer_storage(const char* filename, BufferStorage storage);
+void inplace_make_Buffer_storage(Buffer*, const char*, BufferStorage);
 void Buffer_destroy(Buffer*);
 
+/**
+ * Try to keep the memory a BS_PIECES buffer holds to about `budget` bytes
+ * (0 = no limit), whatever the size of the file. Only a window of the file stays
+ * resident; the rest is paged in again from the file as needed.
+ * No effect on BS_LINES buffers.
+ */
+void Buffer_set_memory_budget(Buffer* buf, size_t budget);
+
 /**
  * Scroll by up to `amount` (signed). Positive is down.
  * Return: The actual amount scrolled
@@ -27,6 +54,12 @@ ssize_t Buffer_scroll(Buffer* buf, ssize_t window_height, ssize_t amount);
 
 size_t Buffer_get_num_lines(Buffer* buf);
 
+/**
+ * Check if line `row` exists, without forcing a full line count.
+ * Prefer this to Buffer_get_num_lines in anything that runs per frame.
+ */
+bool Buffer_has_line(Buffer* buf, size_t row);
+
 /**
  * Get buffer mode. For now only guaranteed to be accurate for visual/visual line.
  */
@@ -42,9 +75,64 @@ String** Buffer_get_line(Buffer* buf, ssize_t y);
 
 /**
  * This gets relative to document pos.
+ * The returned pointer is only good until the next structural change
+ * (Buffer_insert_lines / Buffer_remove_lines).
  */
 String** Buffer_get_line_abs(Buffer* buf, size_t row);
 
+/**
+ * Lines shorter than this aren't indexed by Buffer_cursor_line_index: scanning
+ * them is about as fast.
+ */
+#define BUFFER_LINE_INDEX_MIN 256
+
+/**
+ * Display-column index (see line_index.h) of the line under the cursor, if
+ * `line` is that line's content as handed out by Buffer_get_line; else NULL.
+ * Kept until the buffer changes, so repeated column lookups on the cursor's
+ * line don't rescan it.
+ */
+LineIndex* Buffer_cursor_line_index(Buffer* buf, const char* line, int tab_width);
+
+/**
+ * Get a (malloc'd) copy of a line.
+ * Unlike Buffer_get_line_abs, this doesn't materialize the line in BS_PIECES.
+ */
+String* Buffer_dup_line(Buffer* buf, size_t row);
+
+/**
+ * Line `row` in place: `length` bytes, good until the next edit.
+ * BS_PIECES: as in the piece table, so Buffer_sync first.
+ */
+const char* Buffer_line_span(Buffer* buf, size_t row, size_t* length);
+
+/**
+ * Insert `count` lines so that the first one becomes line `row`.
+ * Takes ownership of the lines.
+ */
+void Buffer_insert_lines(Buffer* buf, size_t row, String** lines, size_t count);
+void Buffer_insert_line(Buffer* buf, size_t row, String* line);
+
+/**
+ * Insert the lines of `text` (each ending in '\n', except maybe the last) so
+ * that the first one becomes line `row`. Pushes a single undo entry for all of
+ * them, in undo group `undo`.
+ * Return: the number of lines inserted.
+ */
+size_t Buffer_insert_text(Buffer* buf, size_t undo, size_t row, const char* text, size_t length);
+
+/**
+ * Remove lines [a, b). If `removed` is not NULL, the removed lines are stored
+ * there and the caller takes ownership of them. Otherwise they are freed.
+ */
+void Buffer_remove_lines(Buffer* buf, size_t a, size_t b, String** removed);
+
+/**
+ * Push edits held by Buffer_get_line_abs pointers down into the storage engine.
+ * Only does anything for BS_PIECES.
+ */
+void Buffer_sync(Buffer* buf);
+
 /**
  * Clip the context to the buffer's bounds.
  * Only touches jump entries.
@@ -69,8 +157,126 @@ RepaintType Buffer_delete_range(Buffer* buf, Copy* copy, EditorContext* range);
  */
 void Buffer_copy_range(Buffer* buf, Copy* copy, EditorContext* range);
 
+/**
+ * If false, Buffer_save skips the fsyncs: faster, but a crash right after a save
+ * can lose it. The file is still never left half written.
+ */
+extern bool BUFFER_SAVE_FSYNC;
+
+/**
+ * Write the buffer to a temp file next to it (gathering lines into writev calls),
+ * fsync it, and rename it over the file. Saves through symlinks.
+ * Fills in buf->last_save.
+ * Return: 0 = OK, -1 = error (the file is left as it was).
+ */
 int Buffer_save(Buffer* buf);
 
+/**
+ * Start a Buffer_save on a worker thread, and return once the contents have
+ * been snapshotted. The buffer can be edited while it runs; the edits go into
+ * the next save (and stay in the journal).
+ * Waits for a save that is already running to finish first.
+ */
+void Buffer_save_start(Buffer* buf);
+
+bool Buffer_saving(Buffer* buf);
+
+/**
+ * Fraction of the running save written so far (0 to 1).
+ */
+double Buffer_save_progress(Buffer* buf);
+
+#define BUFFER_SAVE_RUNNING 1
+
+/**
+ * Clean up after a background save, waiting for it if `wait`.
+ * Return: BUFFER_SAVE_RUNNING if it hasn't finished (and not `wait`),
+ * otherwise its result, as for Buffer_save. 0 if there was no save.
+ */
+int Buffer_save_finish(Buffer* buf, bool wait);
+
+/**
+ * Check whether the buffer has changed since it matched the file on disk
+ * (when it was loaded, saved or reloaded).
+ */
+bool Buffer_modified(Buffer* buf);
+
+/**
+ * Hold a read lease on the file of a BS_PIECES buffer that reads it through a
+ * mapping (PieceTable_lease), now and after every reload. Another program
+ * opening the file to write to it then waits (and this one gets SIGIO) until
+ * Buffer_check_lease has run, so the buffer doesn't change under its edits.
+ * Return: false if there is no mapping, or no lease to be had right now.
+ */
+bool Buffer_lease_file(Buffer* buf);
+
+/**
+ * Call on SIGIO. If a writer is waiting for the file's lease, a buffer with
+ * unsaved changes (or a save running) moves to a private copy of the file as
+ * it was (PieceTable_detach). Others just let go, to be reloaded once the file
+ * has been written.
+ * Return: true if the lease was broken.
+ */
+bool Buffer_check_lease(Buffer* buf);
+
+/**
+ * Check if part of the file went missing from under the buffer: it was cut
+ * short by another program while the buffer read it through a mapping.
+ * The missing bytes read as zeros.
+ */
+bool Buffer_lost_data(Buffer* buf);
+
+/**
+ * Reloads that differ in more lines than this rewrite the whole differing
+ * middle of the file, instead of just the lines that changed.
+ */
+extern size_t BUFFER_RELOAD_MAX_DIFF;
+
+#define BUFFER_RELOAD_NONE 0        // The file is unchanged (or gone, or being saved).
+#define BUFFER_RELOAD_APPENDED 1    // Only the new end of the file was read.
+#define BUFFER_RELOAD_CHANGED 2
+#define BUFFER_RELOAD_CONFLICT 3    // The buffer has unsaved changes, so wasn't reloaded.
+
+/**
+ * Bring the buffer up to date with its file, if the file changed since the
+ * buffer last matched it.
+ * - If the file was appended to, only the new part is read.
+ * - Otherwise only the lines that differ are rewritten, as one undoable action;
+ *   the cursor, view and marks move with the lines they were on.
+ * Does nothing to a buffer with unsaved changes (see Buffer_modified), except
+ * that a BS_PIECES buffer whose file changed in place stops reading it through
+ * the mapping (PieceTable_detach), so later writes don't show through. (Only a
+ * lease, Buffer_lease_file, keeps this write out too.)
+ */
+int Buffer_reload(Buffer* buf);
+
+/**
+ * Journals bigger than this many bytes get compacted (by a full save) at the
+ * next Buffer_checkpoint.
+ */
+extern size_t BUFFER_JOURNAL_COMPACT;
+
+/**
+ * Start journaling edits to the swapfile: every edit pushed to the undo buffer
+ * (and every undo) is appended to it, and it is removed by Buffer_destroy.
+ * If the swapfile already holds a journal for the current version of the file
+ * (left behind by a crash), those edits are replayed onto the buffer first.
+ * Return: number of edits recovered, or -1 if the journal can't be opened.
+ */
+int Buffer_open_journal(Buffer* buf);
+
+/**
+ * Call between editor actions (when the buffer is consistent with the journal).
+ * Compacts the journal once it passes BUFFER_JOURNAL_COMPACT.
+ */
+void Buffer_checkpoint(Buffer* buf);
+
+/**
+ * Apply an edit to the buffer (the opposite of undoing it).
+ * Doesn't touch the undo buffer or the journal.
+ */
+void Buffer_apply_Edit(Buffer* buf, Edit* ed);
+
 /**
  * Push an entry onto the undo buffer. This should be done for all changes to the buffer content
  */
@@ -93,7 +299,7 @@ int Buffer_redo(Buffer*, size_t undo_index, EditorContext* ctx);
  * Search in more than the current line if cross_lines is true
  * If found, returns the row, col in the EditorContext struct
  *
- * Return: 0 = OK, 1 = NOT_FOUND, -1 = error
+ * Return: 0 = found; -1 = not found; -2 = the pattern is invalid (as Buffer_search).
  */
 int Buffer_find_str(Buffer*, EditorContext* ret, char*, bool cross_lines, bool direction);
 
@@ -102,11 +308,16 @@ int Buffer_find_str(Buffer*, EditorContext* ret, char*, bool cross_lines, bool d
  * Searches for `str` at the passed `line_num`
  * in `buf`, starting at position `offset`.
  * An offset of -1 signifies to search the entire line when searching backwards.
- * Return codes and directional behavior are the same as in Buffer_find_str.
+ * Directional behavior is the same as in Buffer_find_str.
+ * Return: 0 = found; -1 = not found; -2 = the pattern is invalid.
  */
 int Buffer_find_str_inline(Buffer* buf, EditorContext* ctx, char* str, size_t line_num, ssize_t offset, bool direction);
 
-size_t read_file_break_lines(Vector* ret, FILE* infile);
+/**
+ * Read a file into a vector, one String per line.
+ * Lines come from `arena` if it isn't NULL, otherwise they are malloc'd.
+ */
+size_t read_file_break_lines(Vector* ret, FILE* infile, Arena* arena);
 
 /**
  * Searches the current line in `buf` for `c`.
@@ -0,0 +1,52 @@
+#include "iov_writer.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+void inplace_make_IovWriter(IovWriter* w, int fd) {
+    w->fd = fd;
+    w->count = 0;
+    w->written = 0;
+    w->calls = 0;
+    w->failed = false;
+}
+
+void IovWriter_add(IovWriter* w, const void* data, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (w->count == IOW_BATCH) {
+        IovWriter_flush(w);
+    }
+    w->iov[w->count].iov_base = (void*) data;
+    w->iov[w->count].iov_len = length;
+    w->count += 1;
+}
+
+bool IovWriter_flush(IovWriter* w) {
+    struct iovec* iov = w->iov;
+    int count = w->count;
+    w->count = 0;
+    while (count > 0 && !w->failed) {
+        ssize_t n = writev(w->fd, iov, count);
+        w->calls += 1;
+        if (n < 0) {
+            if (errno != EINTR) {
+                w->failed = true;
+            }
+            continue;
+        }
+        w->written += n;
+        // Skip what was written; finish a partly written range next time around.
+        while (count > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return !w->failed;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/**
+ * Gathers writes of many small ranges (eg. lines) into writev calls.
+ *
+ * Ranges are not copied: they must stay valid until the next flush.
+ * Errors are sticky; once a write fails, everything after it is dropped.
+ */
+
+// Ranges per writev call (IOV_MAX is at least 1024 on Linux).
+#define IOW_BATCH 1024
+
+struct IovWriter {
+    int fd;
+    int count;
+    struct iovec iov[IOW_BATCH];
+    size_t written;     // Bytes written so far.
+    size_t calls;       // writev calls made so far.
+    bool failed;
+};
+typedef struct IovWriter IovWriter;
+
+void inplace_make_IovWriter(IovWriter* w, int fd);
+
+/**
+ * Queue a range. Flushes first if the batch is full.
+ */
+void IovWriter_add(IovWriter* w, const void* data, size_t length);
+
+/**
+ * Write out everything queued, retrying short writes and EINTR.
+ * Return: false if any write so far has failed.
+ */
+bool IovWriter_flush(IovWriter* w);
@@ -0,0 +1,248 @@
+#include "journal.h"
+#include "../common.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC "txtjrnl1"
+
+struct JournalHeader {
+    char magic[8];
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+typedef struct JournalHeader JournalHeader;
+
+/**
+ * PRIVATE
+ */
+void _Journal_header(JournalHeader* h, const struct stat* base) {
+    memcpy(h->magic, JOURNAL_MAGIC, sizeof(h->magic));
+    h->size = base->st_size;
+    h->mtime_sec = base->st_mtim.tv_sec;
+    h->mtime_nsec = base->st_mtim.tv_nsec;
+}
+
+/**
+ * PRIVATE
+ * FNV-1a.
+ */
+uint32_t _Journal_checksum(const unsigned char* data, size_t n) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < n; ++i) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * PRIVATE
+ * LEB128. Return: bytes written (at most 10).
+ */
+size_t _Journal_put_varint(unsigned char* out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    out[n++] = v;
+    return n;
+}
+
+/**
+ * PRIVATE
+ * Return: false if the varint runs past `end`.
+ */
+bool _Journal_get_varint(const unsigned char** p, const unsigned char* end, uint64_t* v) {
+    *v = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char byte = *(*p)++;
+        *v |= (uint64_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * PRIVATE
+ */
+bool _Journal_write_all(int fd, const void* data, size_t n) {
+    const char* p = data;
+    while (n > 0) {
+        ssize_t written = write(fd, p, n);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += written;
+        n -= written;
+    }
+    return true;
+}
+
+/**
+ * PRIVATE
+ * Decode records into Edits, stopping at the first incomplete or corrupt one.
+ * Return: bytes of valid records.
+ */
+size_t _Journal_decode(const unsigned char* data, size_t size, Vector* out) {
+    const unsigned char* p = data;
+    const unsigned char* end = data + size;
+    size_t valid = 0;
+    while (p < end) {
+        const unsigned char* record = p;
+        unsigned kind = *p++;
+        if (kind == 0 || kind > 3) break;
+        uint64_t row, col;
+        if (!_Journal_get_varint(&p, end, &row) || !_Journal_get_varint(&p, end, &col)) break;
+        const unsigned char* content[2] = {NULL, NULL};
+        uint64_t length[2] = {0, 0};
+        bool ok = true;
+        for (int i = 0; i < 2 && ok; ++i) {
+            if ((kind & (1 << i)) == 0) continue;
+            ok = _Journal_get_varint(&p, end, &length[i]) && (uint64_t) (end - p) >= length[i];
+            if (ok) {
+                content[i] = p;
+                p += length[i];
+            }
+        }
+        if (!ok || end - p < 4) break;
+        uint32_t checksum;
+        memcpy(&checksum, p, 4);
+        if (checksum != _Journal_checksum(record, p - record)) break;
+        p += 4;
+
+        Edit* ed = malloc(sizeof(Edit));
+        ed->undo_index = 0;
+        ed->start_row = row;
+        ed->start_col = (ssize_t) col - 1;
+        String** fields[2] = {&ed->old_content, &ed->new_content};
+        for (int i = 0; i < 2; ++i) {
+            *fields[i] = NULL;
+            if (content[i] != NULL) {
+                *fields[i] = alloc_String(length[i]);
+                Strncats(fields[i], (const char*) content[i], length[i]);
+            }
+        }
+        Vector_push(out, ed);
+        valid = p - data;
+    }
+    return valid;
+}
+
+Journal* make_Journal(const char* path, const struct stat* base, Vector* recovered) {
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    Journal* ret = malloc(sizeof(Journal));
+    ret->fd = fd;
+    ret->size = 0;
+
+    JournalHeader want;
+    _Journal_header(&want, base);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(JournalHeader)) {
+        size_t size = st.st_size;
+        unsigned char* data = malloc(size);
+        size_t total = 0;
+        while (total < size) {
+            ssize_t n = pread(fd, data + total, size - total, total);
+            if (n <= 0) break;
+            total += n;
+        }
+        if (total == size && memcmp(data, &want, sizeof(JournalHeader)) == 0) {
+            size_t valid = sizeof(JournalHeader)
+                    + _Journal_decode(data + sizeof(JournalHeader), size - sizeof(JournalHeader), recovered);
+            if (valid < size && ftruncate(fd, valid) != 0) {
+                // Can't drop the torn record, so can't append after it either.
+                valid = 0;
+            }
+            ret->size = valid;
+        }
+        free(data);
+        if (ret->size > 0) {
+            return ret;
+        }
+    }
+    if (!Journal_reset(ret, base)) {
+        close(fd);
+        free(ret);
+        return NULL;
+    }
+    return ret;
+}
+
+void Journal_close(Journal* j, const char* path, bool discard) {
+    close(j->fd);
+    if (discard) {
+        remove(path);
+    }
+    free(j);
+}
+
+bool Journal_append(Journal* j, const Edit* ed, bool inverse) {
+    const String* content[2] = {ed->old_content, ed->new_content};
+    if (inverse) {
+        content[0] = ed->new_content;
+        content[1] = ed->old_content;
+    }
+    size_t capacity = 1 + 4 * 10 + 4;
+    for (int i = 0; i < 2; ++i) {
+        if (content[i] != NULL) capacity += content[i]->length;
+    }
+    unsigned char small[256];
+    unsigned char* record = capacity <= sizeof(small) ? small : malloc(capacity);
+
+    size_t n = 1;
+    record[0] = (content[0] != NULL) | (content[1] != NULL) << 1;
+    n += _Journal_put_varint(record + n, ed->start_row);
+    n += _Journal_put_varint(record + n, ed->start_col + 1);
+    for (int i = 0; i < 2; ++i) {
+        if (content[i] == NULL) continue;
+        n += _Journal_put_varint(record + n, content[i]->length);
+        memcpy(record + n, content[i]->data, content[i]->length);
+        n += content[i]->length;
+    }
+    uint32_t checksum = _Journal_checksum(record, n);
+    memcpy(record + n, &checksum, 4);
+    n += 4;
+
+    bool ok = _Journal_write_all(j->fd, record, n);
+    if (ok) {
+        j->size += n;
+    }
+    if (record != small) {
+        free(record);
+    }
+    return ok;
+}
+
+bool Journal_reset(Journal* j, const struct stat* base) {
+    return Journal_rebase(j, base, j->size);
+}
+
+bool Journal_rebase(Journal* j, const struct stat* base, size_t keep_from) {
+    JournalHeader header;
+    _Journal_header(&header, base);
+    size_t kept = keep_from < j->size ? j->size - keep_from : 0;
+    char* records = malloc(kept + 1);
+    bool ok = (size_t) pread(j->fd, records, kept, keep_from) == kept;
+    j->size = 0;
+    ok = ok && ftruncate(j->fd, 0) == 0
+            && _Journal_write_all(j->fd, &header, sizeof(header))
+            && _Journal_write_all(j->fd, records, kept);
+    free(records);
+    if (ok) {
+        j->size = sizeof(header) + kept;
+    }
+    return ok;
+}
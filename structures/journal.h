@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "Vector.h"
+
+/**
+ * Append-only log of the edits made to a buffer since it was last saved.
+ *
+ * Every Edit is appended as a compact binary record, so keeping the log up to
+ * date costs time in proportion to the edits, not the file. If the editor dies,
+ * the log is left behind and replaying it over the file recovers the edits.
+ *
+ * File layout: a header naming the version of the file the edits apply to
+ * (its size and mtime), then records:
+ *     kind (1 byte: 1 = has old content, 2 = has new content)
+ *     row, col + 1, [old length, old bytes], [new length, new bytes]   (lengths and positions are varints)
+ *     checksum (4 bytes, FNV-1a of the rest of the record)
+ * A torn record at the end (from a crash mid-write) is dropped on replay.
+ */
+
+struct Edit;
+
+struct Journal {
+    int fd;
+    size_t size;        // Bytes in the file.
+};
+typedef struct Journal Journal;
+
+/**
+ * Open (or create) the journal at `path` for the version of the file described
+ * by `base`. If it already holds edits for that version, they are decoded into
+ * `recovered` (as malloc'd Edits, in order) and new records are appended after
+ * them. A journal for any other version is discarded.
+ * Returns NULL if the journal can't be opened.
+ */
+Journal* make_Journal(const char* path, const struct stat* base, Vector/*Edit* */ *recovered);
+
+/**
+ * Close the journal. If `discard`, the file is removed too (eg. nothing to recover).
+ */
+void Journal_close(Journal* j, const char* path, bool discard);
+
+/**
+ * Append a record for `ed`. If `inverse`, records the edit that undoes it.
+ * Return: false if the write failed.
+ */
+bool Journal_append(Journal* j, const struct Edit* ed, bool inverse);
+
+/**
+ * Empty the journal, which now applies to the version described by `base`
+ * (eg. the file just got saved).
+ */
+bool Journal_reset(Journal* j, const struct stat* base);
+
+/**
+ * Like Journal_reset, but keep the records from byte `keep_from` on
+ * (edits made after the contents that were saved were snapshotted).
+ */
+bool Journal_rebase(Journal* j, const struct stat* base, size_t keep_from);
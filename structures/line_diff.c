@@ -0,0 +1,139 @@
+#include "line_diff.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+uint64_t line_hash(const char* data, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * PRIVATE
+ * Append a hunk, growing the array as needed.
+ */
+void _line_diff_push(DiffHunk** hunks, size_t* count, size_t* capacity, DiffHunk hunk) {
+    if (*count == *capacity) {
+        *capacity = *capacity * 2 + 4;
+        *hunks = realloc(*hunks, *capacity * sizeof(DiffHunk));
+    }
+    (*hunks)[(*count)++] = hunk;
+}
+
+/**
+ * PRIVATE
+ * Myers' greedy algorithm. Return: the edit distance, or -1 if it's more than `max`.
+ * The V array before each round d is saved in `trace` (at d*d + 2*d, 2*d + 3 entries,
+ * for diagonals -d-1 to d+1), for backtracking.
+ */
+ssize_t _line_diff_myers(const uint64_t* a, ssize_t n, const uint64_t* b, ssize_t m,
+                         ssize_t max, ssize_t** trace) {
+    ssize_t offset = max + 1;
+    ssize_t* v = calloc(2 * max + 3, sizeof(ssize_t));
+    size_t capacity = 0;
+    *trace = NULL;
+    ssize_t ret = -1;
+    for (ssize_t d = 0; d <= max && ret < 0; ++d) {
+        size_t needed = (d + 1) * (d + 1) + 2 * (d + 1);
+        if (needed > capacity) {
+            capacity = needed * 2;
+            *trace = realloc(*trace, capacity * sizeof(ssize_t));
+        }
+        memcpy(*trace + d * d + 2 * d, v + offset - d - 1, (2 * d + 3) * sizeof(ssize_t));
+        for (ssize_t k = -d; k <= d; k += 2) {
+            ssize_t x = (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+                        ? v[offset + k + 1] : v[offset + k - 1] + 1;
+            ssize_t y = x - k;
+            while (x < n && y < m && a[x] == b[y]) {
+                ++x;
+                ++y;
+            }
+            v[offset + k] = x;
+            if (x >= n && y >= m) {
+                ret = d;
+                break;
+            }
+        }
+    }
+    free(v);
+    return ret;
+}
+
+DiffHunk* line_diff(const uint64_t* a, size_t n, const uint64_t* b, size_t m,
+                    size_t max_d, size_t* num_hunks) {
+    size_t prefix = 0;
+    while (prefix < n && prefix < m && a[prefix] == b[prefix]) {
+        ++prefix;
+    }
+    size_t suffix = 0;
+    while (suffix < n - prefix && suffix < m - prefix && a[n - 1 - suffix] == b[m - 1 - suffix]) {
+        ++suffix;
+    }
+    a += prefix;
+    b += prefix;
+    n -= prefix + suffix;
+    m -= prefix + suffix;
+
+    DiffHunk* hunks = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    if (n == 0 && m == 0) {
+        *num_hunks = 0;
+        return NULL;
+    }
+    size_t max = (max_d < n + m) ? max_d : n + m;
+    ssize_t* trace = NULL;
+    ssize_t d = (n == 0 || m == 0) ? -1 : _line_diff_myers(a, n, b, m, max, &trace);
+    if (d < 0) {
+        DiffHunk all = { prefix, n, prefix, m };
+        _line_diff_push(&hunks, &count, &capacity, all);
+        free(trace);
+        *num_hunks = count;
+        return hunks;
+    }
+
+    // Walk back from the end, collecting hunks last to first.
+    ssize_t x = n;
+    ssize_t y = m;
+    for (; d > 0; --d) {
+        ssize_t* v = trace + d * d + 2 * d + d + 1;     // v[k] = V[k] before round d.
+        ssize_t k = x - y;
+        ssize_t prev_k = (k == -d || (k != d && v[k - 1] < v[k + 1])) ? k + 1 : k - 1;
+        ssize_t prev_x = v[prev_k];
+        ssize_t prev_y = prev_x - prev_k;
+        // One line inserted (moving down) or deleted (moving right), then the snake.
+        ssize_t mid_x = (prev_k == k + 1) ? prev_x : prev_x + 1;
+        ssize_t mid_y = mid_x - k;
+        DiffHunk* last = (count > 0) ? &hunks[count - 1] : NULL;
+        if (last != NULL && (ssize_t) last->a_start == mid_x && (ssize_t) last->b_start == mid_y) {
+            last->a_count += mid_x - prev_x;
+            last->b_count += mid_y - prev_y;
+            last->a_start = prev_x;
+            last->b_start = prev_y;
+        }
+        else {
+            DiffHunk hunk = { prev_x, mid_x - prev_x, prev_y, mid_y - prev_y };
+            _line_diff_push(&hunks, &count, &capacity, hunk);
+        }
+        x = prev_x;
+        y = prev_y;
+    }
+    free(trace);
+
+    for (size_t i = 0; i < count / 2; ++i) {
+        DiffHunk tmp = hunks[i];
+        hunks[i] = hunks[count - 1 - i];
+        hunks[count - 1 - i] = tmp;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        hunks[i].a_start += prefix;
+        hunks[i].b_start += prefix;
+    }
+    *num_hunks = count;
+    return hunks;
+}
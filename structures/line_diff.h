@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Line diff, for reloading a file that changed on disk without replacing
+ * every line.
+ *
+ * Lines are compared by hash (line_hash). After stripping the common prefix
+ * and suffix, the rest is diffed with Myers' O(ND) algorithm.
+ */
+
+/**
+ * Lines [a_start, a_start + a_count) of the old version are replaced by lines
+ * [b_start, b_start + b_count) of the new one.
+ */
+struct DiffHunk {
+    size_t a_start;
+    size_t a_count;
+    size_t b_start;
+    size_t b_count;
+};
+typedef struct DiffHunk DiffHunk;
+
+/**
+ * FNV-1a (64 bit).
+ */
+uint64_t line_hash(const char* data, size_t length);
+
+/**
+ * Diff old lines `a` (n of them) against new lines `b` (m).
+ * If they differ in more than `max_d` lines (after the common prefix and
+ * suffix), the differing middle becomes a single hunk instead.
+ * Returns a malloc'd array of hunks, in order, with its length in `num_hunks`.
+ */
+DiffHunk* line_diff(const uint64_t* a, size_t n, const uint64_t* b, size_t m,
+                    size_t max_d, size_t* num_hunks);
@@ -0,0 +1,86 @@
+#include "line_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void inplace_make_LineIndex(LineIndex* idx) {
+    memset(idx, 0, sizeof(LineIndex));
+}
+
+void LineIndex_destroy(LineIndex* idx) {
+    free(idx->tabs);
+    idx->tabs = NULL;
+    idx->num_tabs = 0;
+    idx->capacity = 0;
+}
+
+void LineIndex_build(LineIndex* idx, const char* line, size_t length, int tab_width) {
+    idx->length = length;
+    idx->tab_width = tab_width;
+    idx->num_tabs = 0;
+    const char* end = line + length;
+    const char* p = line;
+    size_t column = 0;
+    const char* tab;
+    // Tabs are sparse in most lines; memchr skips the runs between them.
+    while ((tab = memchr(p, '\t', end - p)) != NULL) {
+        column += tab - p;
+        column = (column / tab_width + 1) * tab_width;
+        if (idx->num_tabs == idx->capacity) {
+            idx->capacity = idx->capacity * 2 + 8;
+            idx->tabs = realloc(idx->tabs, idx->capacity * sizeof(TabStop));
+        }
+        TabStop stop = { tab - line, column };
+        idx->tabs[idx->num_tabs++] = stop;
+        p = tab + 1;
+    }
+    column += end - p;
+    idx->columns = column;
+    idx->width = (length > 0 && line[length - 1] == '\n') ? column - 1 : column;
+}
+
+size_t LineIndex_column(const LineIndex* idx, size_t offset) {
+    // Count the tabs before `offset`.
+    size_t lo = 0;
+    size_t hi = idx->num_tabs;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (idx->tabs[mid].offset < offset) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return offset;
+    }
+    const TabStop* prev = &idx->tabs[lo - 1];
+    return prev->column + (offset - prev->offset - 1);
+}
+
+size_t LineIndex_offset(const LineIndex* idx, size_t column) {
+    // First tab that ends past `column`.
+    size_t lo = 0;
+    size_t hi = idx->num_tabs;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (idx->tabs[mid].column > column) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    size_t start_offset = 0;
+    size_t start_column = 0;
+    if (lo > 0) {
+        start_offset = idx->tabs[lo - 1].offset + 1;
+        start_column = idx->tabs[lo - 1].column;
+    }
+    size_t offset = start_offset + (column - start_column);
+    if (lo < idx->num_tabs && offset >= idx->tabs[lo].offset) {
+        return idx->tabs[lo].offset;
+    }
+    return offset < idx->length ? offset : idx->length;
+}
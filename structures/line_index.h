@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Display-column index of one line: where its tabs are, and the column each
+ * one ends at. Every other byte is one column wide, so converting between byte
+ * offsets and display columns is a binary search over the tabs rather than a
+ * scan from the start of the line.
+ *
+ * Matches line_pos / line_pos_ptr / strlen_tab in the editor. A newline only
+ * ever ends a line, so it takes a column for line_pos but not for the width.
+ */
+
+struct TabStop {
+    size_t offset;          // Byte offset of the tab.
+    size_t column;          // Display column just past it.
+};
+typedef struct TabStop TabStop;
+
+struct LineIndex {
+    size_t length;          // Bytes in the line.
+    size_t columns;         // Display columns up to the end of the line.
+    size_t width;           // Display width, not counting a trailing newline.
+    int tab_width;
+    size_t num_tabs;
+    size_t capacity;
+    TabStop* tabs;
+};
+typedef struct LineIndex LineIndex;
+
+void inplace_make_LineIndex(LineIndex* idx);
+void LineIndex_destroy(LineIndex* idx);
+
+/**
+ * (Re)build the index for `length` bytes of `line`.
+ */
+void LineIndex_build(LineIndex* idx, const char* line, size_t length, int tab_width);
+
+/**
+ * Display column of the byte at `offset` (line_pos_ptr). Tabs left align.
+ */
+size_t LineIndex_column(const LineIndex* idx, size_t offset);
+
+/**
+ * Offset of the byte shown at display column `column` (line_pos): the tab, if
+ * the column is inside one, or the line's length if it's past the end.
+ */
+size_t LineIndex_offset(const LineIndex* idx, size_t column);
@@ -0,0 +1,328 @@
+#include "line_scan.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef LINE_SCAN_X86
+#include <immintrin.h>
+#endif
+
+const char* scan_newline_scalar(const char* start, const char* end) {
+    // Word at a time: a byte of (w ^ NL) is zero iff that byte is a newline.
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    const uint64_t newlines = ones * '\n';
+    while (start < end && ((uintptr_t) start & 7)) {
+        if (*start == '\n') return start;
+        ++start;
+    }
+    while (end - start >= 8) {
+        uint64_t w;
+        memcpy(&w, start, 8);
+        w ^= newlines;
+        if ((w - ones) & ~w & highs) {
+            break;
+        }
+        start += 8;
+    }
+    while (start < end) {
+        if (*start == '\n') return start;
+        ++start;
+    }
+    return NULL;
+}
+
+const char* scan_tab_newline_scalar(const char* start, const char* end) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    const uint64_t newlines = ones * '\n';
+    const uint64_t tabs = ones * '\t';
+    while (start < end && ((uintptr_t) start & 7)) {
+        if (*start == '\n' || *start == '\t') return start;
+        ++start;
+    }
+    while (end - start >= 8) {
+        uint64_t w;
+        memcpy(&w, start, 8);
+        uint64_t n = w ^ newlines;
+        uint64_t t = w ^ tabs;
+        if (((n - ones) & ~n & highs) | ((t - ones) & ~t & highs)) {
+            break;
+        }
+        start += 8;
+    }
+    while (start < end) {
+        if (*start == '\n' || *start == '\t') return start;
+        ++start;
+    }
+    return NULL;
+}
+
+const char* scan_substr_scalar(const char* start, const char* end, const char* needle, size_t length) {
+    if (length == 0) {
+        return start;
+    }
+    while ((size_t) (end - start) >= length) {
+        // Only where the whole needle still fits.
+        start = memchr(start, needle[0], (end - start) - length + 1);
+        if (start == NULL) {
+            return NULL;
+        }
+        if (memcmp(start + 1, needle + 1, length - 1) == 0) {
+            return start;
+        }
+        ++start;
+    }
+    return NULL;
+}
+
+const char* scan_substr_last_scalar(const char* start, const char* end, const char* needle, size_t length) {
+    if (length == 0) {
+        return end;
+    }
+    if ((size_t) (end - start) < length) {
+        return NULL;
+    }
+    for (size_t i = (end - start) - length + 1; i > 0; --i) {
+        const char* p = start + i - 1;
+        if (*p == needle[0] && memcmp(p + 1, needle + 1, length - 1) == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+#ifdef LINE_SCAN_X86
+
+__attribute__((target("sse2")))
+const char* scan_newline_sse2(const char* start, const char* end) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    while (end - start >= 32) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) start), nl);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (start + 16)), nl);
+        unsigned mask = _mm_movemask_epi8(a) | (_mm_movemask_epi8(b) << 16);
+        if (mask) {
+            return start + __builtin_ctz(mask);
+        }
+        start += 32;
+    }
+    return scan_newline_scalar(start, end);
+}
+
+__attribute__((target("avx2")))
+const char* scan_newline_avx2(const char* start, const char* end) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    while (end - start >= 64) {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) start), nl);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (start + 32)), nl);
+        if (!_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_or_si256(a, b))) {
+            uint64_t mask = (uint32_t) _mm256_movemask_epi8(a)
+                          | ((uint64_t) (uint32_t) _mm256_movemask_epi8(b) << 32);
+            return start + __builtin_ctzll(mask);
+        }
+        start += 64;
+    }
+    return scan_newline_sse2(start, end);
+}
+
+__attribute__((target("sse2")))
+const char* scan_tab_newline_sse2(const char* start, const char* end) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i tab = _mm_set1_epi8('\t');
+    while (end - start >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) start);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, tab));
+        unsigned mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            return start + __builtin_ctz(mask);
+        }
+        start += 16;
+    }
+    return scan_tab_newline_scalar(start, end);
+}
+
+__attribute__((target("avx2")))
+const char* scan_tab_newline_avx2(const char* start, const char* end) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    while (end - start >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) start);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, tab));
+        unsigned mask = _mm256_movemask_epi8(hit);
+        if (mask) {
+            return start + __builtin_ctz(mask);
+        }
+        start += 32;
+    }
+    return scan_tab_newline_sse2(start, end);
+}
+
+/*
+ * Substring search: a block compares the needle's first byte at 16 (32)
+ * positions and its last byte at the same positions + length - 1. Only
+ * positions where both match are compared in full. Needles shorter than 2
+ * bytes are just a byte search.
+ */
+
+__attribute__((target("sse2")))
+const char* scan_substr_sse2(const char* start, const char* end, const char* needle, size_t length) {
+    if (length < 2) {
+        return scan_substr_scalar(start, end, needle, length);
+    }
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[length - 1]);
+    while ((size_t) (end - start) >= 16 + length - 1) {
+        __m128i f = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) start), first);
+        __m128i l = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (start + length - 1)), last);
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(f, l));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(start + bit + 1, needle + 1, length - 2) == 0) {
+                return start + bit;
+            }
+            mask &= mask - 1;
+        }
+        start += 16;
+    }
+    return scan_substr_scalar(start, end, needle, length);
+}
+
+__attribute__((target("avx2")))
+const char* scan_substr_avx2(const char* start, const char* end, const char* needle, size_t length) {
+    if (length < 2) {
+        return scan_substr_scalar(start, end, needle, length);
+    }
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[length - 1]);
+    while ((size_t) (end - start) >= 32 + length - 1) {
+        __m256i f = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) start), first);
+        __m256i l = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (start + length - 1)), last);
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(f, l));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(start + bit + 1, needle + 1, length - 2) == 0) {
+                return start + bit;
+            }
+            mask &= mask - 1;
+        }
+        start += 32;
+    }
+    return scan_substr_sse2(start, end, needle, length);
+}
+
+__attribute__((target("sse2")))
+const char* scan_substr_last_sse2(const char* start, const char* end, const char* needle, size_t length) {
+    if (length < 2) {
+        return scan_substr_last_scalar(start, end, needle, length);
+    }
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[length - 1]);
+    while ((size_t) (end - start) >= 16 + length - 1) {
+        // The last 16 positions the needle fits at.
+        const char* block = end - (16 + length - 1);
+        __m128i f = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) block), first);
+        __m128i l = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (block + length - 1)), last);
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(f, l));
+        while (mask) {
+            unsigned bit = 31 - __builtin_clz(mask);
+            if (memcmp(block + bit + 1, needle + 1, length - 2) == 0) {
+                return block + bit;
+            }
+            mask &= ~(1u << bit);
+        }
+        end -= 16;
+    }
+    return scan_substr_last_scalar(start, end, needle, length);
+}
+
+__attribute__((target("avx2")))
+const char* scan_substr_last_avx2(const char* start, const char* end, const char* needle, size_t length) {
+    if (length < 2) {
+        return scan_substr_last_scalar(start, end, needle, length);
+    }
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[length - 1]);
+    while ((size_t) (end - start) >= 32 + length - 1) {
+        const char* block = end - (32 + length - 1);
+        __m256i f = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) block), first);
+        __m256i l = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (block + length - 1)), last);
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(f, l));
+        while (mask) {
+            unsigned bit = 31 - __builtin_clz(mask);
+            if (memcmp(block + bit + 1, needle + 1, length - 2) == 0) {
+                return block + bit;
+            }
+            mask &= ~(1u << bit);
+        }
+        end -= 32;
+    }
+    return scan_substr_last_sse2(start, end, needle, length);
+}
+
+int line_scan_has_sse2() {
+    return __builtin_cpu_supports("sse2");
+}
+
+int line_scan_has_avx2() {
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+int line_scan_has_sse2() {
+    return 0;
+}
+
+int line_scan_has_avx2() {
+    return 0;
+}
+
+#endif
+
+typedef const char* (*scan_fn)(const char*, const char*);
+typedef const char* (*substr_fn)(const char*, const char*, const char*, size_t);
+
+static scan_fn _scan_newline_impl = &scan_newline_scalar;
+static scan_fn _scan_tab_newline_impl = &scan_tab_newline_scalar;
+static substr_fn _scan_substr_impl = &scan_substr_scalar;
+static substr_fn _scan_substr_last_impl = &scan_substr_last_scalar;
+
+/**
+ * PRIVATE
+ * Pick the best implementations, once, before main: the pointers are only
+ * written before any other thread exists (searches call these from workers).
+ */
+__attribute__((constructor))
+static void _line_scan_pick() {
+#ifdef LINE_SCAN_X86
+    __builtin_cpu_init();
+    if (line_scan_has_avx2()) {
+        _scan_newline_impl = &scan_newline_avx2;
+        _scan_tab_newline_impl = &scan_tab_newline_avx2;
+        _scan_substr_impl = &scan_substr_avx2;
+        _scan_substr_last_impl = &scan_substr_last_avx2;
+    }
+    else if (line_scan_has_sse2()) {
+        _scan_newline_impl = &scan_newline_sse2;
+        _scan_tab_newline_impl = &scan_tab_newline_sse2;
+        _scan_substr_impl = &scan_substr_sse2;
+        _scan_substr_last_impl = &scan_substr_last_sse2;
+    }
+#endif
+}
+
+const char* scan_newline(const char* start, const char* end) {
+    return _scan_newline_impl(start, end);
+}
+
+const char* scan_tab_newline(const char* start, const char* end) {
+    return _scan_tab_newline_impl(start, end);
+}
+
+const char* scan_substr(const char* start, const char* end, const char* needle, size_t length) {
+    return _scan_substr_impl(start, end, needle, length);
+}
+
+const char* scan_substr_last(const char* start, const char* end, const char* needle, size_t length) {
+    return _scan_substr_last_impl(start, end, needle, length);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Vectorized newline search, for splitting files into lines.
+ *
+ * scan_newline is a drop-in for memchr(start, '\n', end - start):
+ * returns a pointer to the first '\n' in [start, end), or NULL.
+ * Picks AVX2 or SSE2 at runtime if the CPU has them, else a scalar loop.
+ */
+const char* scan_newline(const char* start, const char* end);
+
+/**
+ * The individual implementations (for tests and benchmarks).
+ * Only call the SIMD ones if line_scan_has_* says they are available.
+ */
+const char* scan_newline_scalar(const char* start, const char* end);
+#if defined(__x86_64__) || defined(__i386__)
+#define LINE_SCAN_X86
+const char* scan_newline_sse2(const char* start, const char* end);
+const char* scan_newline_avx2(const char* start, const char* end);
+#endif
+
+/**
+ * Like scan_newline, but stops at a tab or a newline: the bytes the editor
+ * can't draw as they are. For splitting lines into runs of plain text.
+ */
+const char* scan_tab_newline(const char* start, const char* end);
+
+const char* scan_tab_newline_scalar(const char* start, const char* end);
+#ifdef LINE_SCAN_X86
+const char* scan_tab_newline_sse2(const char* start, const char* end);
+const char* scan_tab_newline_avx2(const char* start, const char* end);
+#endif
+
+/**
+ * Substring search, for literal (regex-free) patterns: returns a pointer to the
+ * first / last occurrence of the `length` bytes of `needle` lying wholly in
+ * [start, end), or NULL. Occurrences may overlap. An empty needle is found at
+ * `start` / `end`.
+ *
+ * The SIMD versions compare the first and last bytes of the needle at 16 or 32
+ * positions at once, and only memcmp the rest where both match.
+ */
+const char* scan_substr(const char* start, const char* end, const char* needle, size_t length);
+const char* scan_substr_last(const char* start, const char* end, const char* needle, size_t length);
+
+const char* scan_substr_scalar(const char* start, const char* end, const char* needle, size_t length);
+const char* scan_substr_last_scalar(const char* start, const char* end, const char* needle, size_t length);
+#ifdef LINE_SCAN_X86
+const char* scan_substr_sse2(const char* start, const char* end, const char* needle, size_t length);
+const char* scan_substr_avx2(const char* start, const char* end, const char* needle, size_t length);
+const char* scan_substr_last_sse2(const char* start, const char* end, const char* needle, size_t length);
+const char* scan_substr_last_avx2(const char* start, const char* end, const char* needle, size_t length);
+#endif
+
+int line_scan_has_sse2();
+int line_scan_has_avx2();
@@ -0,0 +1,350 @@
+#include "line_tree.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * PRIVATE
+ */
+LineTreeNode* _make_LineTreeNode(bool leaf) {
+    LineTreeNode* ret = malloc(sizeof(LineTreeNode));
+    ret->leaf = leaf;
+    ret->size = 0;
+    ret->count = 0;
+    return ret;
+}
+
+LineTree* make_LineTree() {
+    LineTree* ret = malloc(sizeof(LineTree));
+    inplace_make_LineTree(ret);
+    return ret;
+}
+
+void inplace_make_LineTree(LineTree* t) {
+    t->root = _make_LineTreeNode(true);
+}
+
+/**
+ * PRIVATE
+ * Recompute `node->count` from its slots.
+ */
+void _LineTree_recount(LineTreeNode* node) {
+    if (node->leaf) {
+        node->count = node->size;
+        return;
+    }
+    node->count = 0;
+    for (size_t i = 0; i < node->size; ++i) {
+        node->count += ((LineTreeNode*) node->slots[i])->count;
+    }
+}
+
+/**
+ * PRIVATE
+ * Pack `n` items into as few nodes as possible, spread evenly.
+ * Returns a malloc'd array of nodes; its length goes in `num_nodes`.
+ */
+void** _LineTree_build_level(void** items, size_t n, bool leaf, size_t* num_nodes) {
+    size_t nodes = (n + LT_ORDER - 1) / LT_ORDER;
+    void** ret = malloc(nodes * sizeof(void*));
+    size_t pos = 0;
+    for (size_t i = 0; i < nodes; ++i) {
+        size_t take = n / nodes + (i < n % nodes);
+        LineTreeNode* node = _make_LineTreeNode(leaf);
+        memcpy(node->slots, items + pos, take * sizeof(void*));
+        node->size = take;
+        _LineTree_recount(node);
+        ret[i] = node;
+        pos += take;
+    }
+    *num_nodes = nodes;
+    return ret;
+}
+
+void inplace_make_LineTree_from(LineTree* t, void** elements, size_t count) {
+    if (count == 0) {
+        inplace_make_LineTree(t);
+        return;
+    }
+    size_t n;
+    void** level = _LineTree_build_level(elements, count, true, &n);
+    while (n > 1) {
+        void** next = _LineTree_build_level(level, n, false, &n);
+        free(level);
+        level = next;
+    }
+    t->root = level[0];
+    free(level);
+}
+
+/**
+ * PRIVATE
+ */
+void _LineTree_free_node(LineTreeNode* node) {
+    if (!node->leaf) {
+        for (size_t i = 0; i < node->size; ++i) {
+            _LineTree_free_node(node->slots[i]);
+        }
+    }
+    free(node);
+}
+
+void LineTree_destroy(LineTree* t) {
+    _LineTree_free_node(t->root);
+    t->root = NULL;
+}
+
+size_t LineTree_size(LineTree* t) {
+    return t->root->count;
+}
+
+/**
+ * PRIVATE
+ * Find the child of a branch containing `*idx`, and make `*idx` relative to it.
+ * An index one past the end lands at the end of the last child.
+ */
+static inline size_t _LineTree_find_child(LineTreeNode* node, size_t* idx) {
+    size_t last = node->size - 1;
+    for (size_t i = 0; i < last; ++i) {
+        size_t count = ((LineTreeNode*) node->slots[i])->count;
+        if (*idx < count) {
+            return i;
+        }
+        *idx -= count;
+    }
+    return last;
+}
+
+/**
+ * PRIVATE
+ * Leaf containing `*idx`, with `*idx` made relative to it.
+ */
+static inline LineTreeNode* _LineTree_find_leaf(LineTree* t, size_t* idx) {
+    LineTreeNode* node = t->root;
+    while (!node->leaf) {
+        node = node->slots[_LineTree_find_child(node, idx)];
+    }
+    return node;
+}
+
+void** LineTree_get_ref(LineTree* t, size_t idx) {
+    assert(idx < t->root->count);
+    LineTreeNode* leaf = _LineTree_find_leaf(t, &idx);
+    return &leaf->slots[idx];
+}
+
+size_t LineTree_span(LineTree* t, size_t idx, void*** span) {
+    assert(idx < t->root->count);
+    LineTreeNode* leaf = _LineTree_find_leaf(t, &idx);
+    *span = &leaf->slots[idx];
+    return leaf->size - idx;
+}
+
+/**
+ * PRIVATE
+ * Insert into the subtree at `node`. If `node` had to split, returns the new
+ * right half (to be inserted into the parent), otherwise NULL.
+ */
+LineTreeNode* _LineTree_insert(LineTreeNode* node, size_t idx, void* element) {
+    size_t slot = idx;
+    if (!node->leaf) {
+        slot = _LineTree_find_child(node, &idx);
+        LineTreeNode* split = _LineTree_insert(node->slots[slot], idx, element);
+        node->count += 1;
+        if (split == NULL) {
+            return NULL;
+        }
+        element = split;
+        slot += 1;
+    }
+    else {
+        node->count += 1;
+    }
+
+    if (node->size < LT_ORDER) {
+        memmove(node->slots + slot + 1, node->slots + slot, (node->size - slot) * sizeof(void*));
+        node->slots[slot] = element;
+        node->size += 1;
+        return NULL;
+    }
+
+    // Full: move the upper half to a new node, then insert into the correct half.
+    size_t half = LT_ORDER / 2;
+    LineTreeNode* right = _make_LineTreeNode(node->leaf);
+    memcpy(right->slots, node->slots + half, (LT_ORDER - half) * sizeof(void*));
+    right->size = LT_ORDER - half;
+    node->size = half;
+    LineTreeNode* target = node;
+    if (slot > half) {
+        target = right;
+        slot -= half;
+    }
+    memmove(target->slots + slot + 1, target->slots + slot, (target->size - slot) * sizeof(void*));
+    target->slots[slot] = element;
+    target->size += 1;
+    _LineTree_recount(node);
+    _LineTree_recount(right);
+    return right;
+}
+
+void LineTree_insert(LineTree* t, size_t idx, void* element) {
+    assert(idx <= t->root->count);
+    LineTreeNode* split = _LineTree_insert(t->root, idx, element);
+    if (split != NULL) {
+        LineTreeNode* root = _make_LineTreeNode(false);
+        root->slots[0] = t->root;
+        root->slots[1] = split;
+        root->size = 2;
+        _LineTree_recount(root);
+        t->root = root;
+    }
+}
+
+void LineTree_insert_range(LineTree* t, size_t idx, void** elements, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        LineTree_insert(t, idx + i, elements[i]);
+    }
+}
+
+void LineTree_push(LineTree* t, void* element) {
+    LineTree_insert(t, t->root->count, element);
+}
+
+/**
+ * PRIVATE
+ * Copy all elements below `node` into `out`.
+ */
+void _LineTree_collect(LineTreeNode* node, void** out) {
+    if (node->leaf) {
+        memcpy(out, node->slots, node->size * sizeof(void*));
+        return;
+    }
+    for (size_t i = 0; i < node->size; ++i) {
+        LineTreeNode* child = node->slots[i];
+        _LineTree_collect(child, out);
+        out += child->count;
+    }
+}
+
+void _LineTree_fix_children(LineTreeNode* node);
+
+/**
+ * PRIVATE
+ * Merge or even out children `left` and `left+1` of a branch.
+ * Returns true if they were merged.
+ */
+bool _LineTree_rebalance(LineTreeNode* node, size_t left) {
+    LineTreeNode* l = node->slots[left];
+    LineTreeNode* r = node->slots[left + 1];
+    size_t total = l->size + r->size;
+    if (total <= LT_ORDER) {
+        memcpy(l->slots + l->size, r->slots, r->size * sizeof(void*));
+        l->size = total;
+        l->count += r->count;
+        free(r);
+        memmove(node->slots + left + 1, node->slots + left + 2,
+                (node->size - left - 2) * sizeof(void*));
+        node->size -= 1;
+        if (!l->leaf) {
+            _LineTree_fix_children(l);
+        }
+        return true;
+    }
+    size_t target = total / 2;
+    if (l->size < target) {
+        size_t move = target - l->size;
+        memcpy(l->slots + l->size, r->slots, move * sizeof(void*));
+        memmove(r->slots, r->slots + move, (r->size - move) * sizeof(void*));
+        l->size += move;
+        r->size -= move;
+    }
+    else {
+        size_t move = l->size - target;
+        memmove(r->slots + move, r->slots, r->size * sizeof(void*));
+        memcpy(r->slots, l->slots + target, move * sizeof(void*));
+        l->size -= move;
+        r->size += move;
+    }
+    _LineTree_recount(l);
+    _LineTree_recount(r);
+    return false;
+}
+
+/**
+ * PRIVATE
+ * Bring any underfull children of a branch back up to LT_MIN (where possible).
+ */
+void _LineTree_fix_children(LineTreeNode* node) {
+    size_t i = 0;
+    while (i < node->size && node->size > 1) {
+        LineTreeNode* child = node->slots[i];
+        if (child->size >= LT_MIN) {
+            ++i;
+            continue;
+        }
+        size_t left = (i + 1 < node->size) ? i : i - 1;
+        if (!_LineTree_rebalance(node, left)) {
+            ++i;
+        }
+        else {
+            i = left;
+        }
+    }
+}
+
+/**
+ * PRIVATE
+ * Delete [a, b) (relative to `node`), where 0 <= a < b <= node->count.
+ */
+void _LineTree_delete_range(LineTreeNode* node, size_t a, size_t b, void** removed) {
+    node->count -= b - a;
+    if (node->leaf) {
+        if (removed != NULL) {
+            memcpy(removed, node->slots + a, (b - a) * sizeof(void*));
+        }
+        memmove(node->slots + a, node->slots + b, (node->size - b) * sizeof(void*));
+        node->size -= b - a;
+        return;
+    }
+
+    size_t kept = 0;
+    size_t offset = 0;
+    for (size_t i = 0; i < node->size; ++i) {
+        LineTreeNode* child = node->slots[i];
+        size_t child_start = offset;
+        size_t child_end = offset + child->count;
+        offset = child_end;
+
+        size_t lo = a > child_start ? a : child_start;
+        size_t hi = b < child_end ? b : child_end;
+        if (lo >= hi) {
+            node->slots[kept++] = child;
+            continue;
+        }
+        void** out = (removed == NULL) ? NULL : removed + (lo - a);
+        if (lo == child_start && hi == child_end) {
+            if (out != NULL) {
+                _LineTree_collect(child, out);
+            }
+            _LineTree_free_node(child);
+            continue;
+        }
+        _LineTree_delete_range(child, lo - child_start, hi - child_start, out);
+        node->slots[kept++] = child;
+    }
+    node->size = kept;
+    _LineTree_fix_children(node);
+}
+
+void LineTree_delete_range(LineTree* t, size_t a, size_t b, void** removed) {
+    assert(a <= b);
+    assert(b <= t->root->count);
+    if (a == b) return;
+    _LineTree_delete_range(t->root, a, b, removed);
+    while (!t->root->leaf && t->root->size <= 1) {
+        LineTreeNode* old = t->root;
+        t->root = (old->size == 1) ? old->slots[0] : _make_LineTreeNode(true);
+        free(old);
+    }
+}
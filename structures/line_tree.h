@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Counted B+ tree of pointers, indexed by position.
+ *
+ * Holds the lines of a buffer. Random access, insert and delete by index are
+ * O(log n) instead of the O(n) memmove a Vector does in the middle.
+ * Elements live in the leaves; every node knows how many elements are below it.
+ * All leaves are at the same depth.
+ *
+ * The tree does not own its elements (like Vector).
+ */
+
+// Max elements per leaf / children per branch.
+#define LT_ORDER 64
+// Nodes (other than the root) are kept at least this full.
+#define LT_MIN (LT_ORDER / 4)
+
+struct LineTreeNode {
+    bool leaf;
+    size_t size;    // Slots used.
+    size_t count;   // Elements in this subtree.
+    void* slots[LT_ORDER];  // Elements (leaf) or LineTreeNode* children.
+};
+typedef struct LineTreeNode LineTreeNode;
+
+struct LineTree {
+    LineTreeNode* root;
+};
+typedef struct LineTree LineTree;
+
+LineTree* make_LineTree();
+void inplace_make_LineTree(LineTree* t);
+
+/**
+ * Build a tree holding `elements[0 ... count-1]`, with full leaves. O(n).
+ */
+void inplace_make_LineTree_from(LineTree* t, void** elements, size_t count);
+
+/**
+ * Frees the nodes. NOTE: Doesn't call free() on any of the contained elements!
+ */
+void LineTree_destroy(LineTree* t);
+
+size_t LineTree_size(LineTree* t);
+
+/**
+ * Pointer to the slot holding element `idx`.
+ * Invalidated by the next insert or delete.
+ */
+void** LineTree_get_ref(LineTree* t, size_t idx);
+
+static inline void* LineTree_get(LineTree* t, size_t idx) {
+    return *LineTree_get_ref(t, idx);
+}
+
+/**
+ * Pointer to the run of elements starting at `idx` that share a leaf.
+ * Returns the run length. Walk the whole tree with
+ *     for (i = 0; i < size; i += LineTree_span(t, i, &span))
+ */
+size_t LineTree_span(LineTree* t, size_t idx, void*** span);
+
+/**
+ * Postcondition: t[idx] = element
+ */
+void LineTree_insert(LineTree* t, size_t idx, void* element);
+
+/**
+ * Postcondition: t[idx ... idx+count-1] = elements[0 ... count-1]
+ */
+void LineTree_insert_range(LineTree* t, size_t idx, void** elements, size_t count);
+
+void LineTree_push(LineTree* t, void* element);
+
+/**
+ * Delete elements in range [a, b). If `removed` is not NULL, the deleted
+ * elements are copied into it (in order).
+ * Zero length ranges allowed (as long as b <= size).
+ */
+void LineTree_delete_range(LineTree* t, size_t a, size_t b, void** removed);
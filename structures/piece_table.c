@@ -0,0 +1,731 @@
+#define _GNU_SOURCE     // F_SETLEASE
+
+#include "piece_table.h"
+#include "line_scan.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Mapped tables looked at by the SIGBUS handler. Tables past this many aren't guarded.
+#define PT_GUARDED_MAX 64
+
+static PieceTable* _pt_guarded[PT_GUARDED_MAX];
+static struct sigaction _pt_old_sigbus;
+static size_t _pt_page_size;
+
+PieceTable* make_PieceTable(char* original, size_t size) {
+    PieceTable* ret = malloc(sizeof(PieceTable));
+    inplace_make_PieceTable(ret, original, size);
+    return ret;
+}
+
+void inplace_make_PieceTable(PieceTable* pt, char* original, size_t size) {
+    pt->original = original;
+    pt->original_size = size;
+    pt->mapped = false;
+    pt->detached = false;
+    pt->original_dev = 0;
+    pt->original_ino = 0;
+    pt->lease_fd = -1;
+    pt->lost = 0;
+    pt->scan_pos = 0;
+    pt->scanned = false;
+    pt->original_lines = 0;
+    pt->index_stride = PT_INDEX_STRIDE;
+    memset(pt->hint_line, 0, sizeof(pt->hint_line));
+    memset(pt->hint_pos, 0, sizeof(pt->hint_pos));
+    pt->hint_next = 0;
+    inplace_make_Vector(&pt->original_index, 16);
+    Vector_push(&pt->original_index, (void*) 0);
+
+    pt->add_capacity = 4096;
+    pt->add_size = 0;
+    pt->add = malloc(pt->add_capacity);
+    pt->spill_fd = -1;
+    inplace_make_Vector(&pt->add_index, 16);
+    Vector_push(&pt->add_index, (void*) 0);
+
+    inplace_make_Vector(&pt->pieces, 16);
+    pt->num_lines = 0;
+    pt->budget = 0;
+    inplace_make_Vector(&pt->window, 16);
+}
+
+/**
+ * PRIVATE
+ * SIGBUS handler: a mapped file was cut short under a table. Map zeros over
+ * the rest of it, so the read that faulted (and every later one) succeeds.
+ * Faults anywhere else get the disposition there was before.
+ */
+void _PieceTable_sigbus(int signum, siginfo_t* info, void* context) {
+    char* addr = info->si_addr;
+    for (size_t i = 0; i < PT_GUARDED_MAX; ++i) {
+        PieceTable* pt = __atomic_load_n(&_pt_guarded[i], __ATOMIC_ACQUIRE);
+        if (pt == NULL || addr < pt->original || addr >= pt->original + pt->original_size) {
+            continue;
+        }
+        char* page = (char*) ((uintptr_t) addr & ~(uintptr_t) (_pt_page_size - 1));
+        size_t length = pt->original + pt->original_size - page;
+        if (mmap(page, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) {
+            pt->lost = 1;
+            return;
+        }
+    }
+    // Return to the faulting instruction, to fault again without this handler.
+    sigaction(SIGBUS, &_pt_old_sigbus, NULL);
+}
+
+/**
+ * PRIVATE
+ * Add a mapped table to the ones the SIGBUS handler looks at (or take it out).
+ */
+void _PieceTable_guard(PieceTable* pt, bool guard) {
+    static bool installed = false;
+    if (!installed) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = _PieceTable_sigbus;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        _pt_page_size = sysconf(_SC_PAGESIZE);
+        installed = sigaction(SIGBUS, &action, &_pt_old_sigbus) == 0;
+    }
+    PieceTable* from = guard ? NULL : pt;
+    for (size_t i = 0; i < PT_GUARDED_MAX; ++i) {
+        PieceTable* expected = from;
+        if (__atomic_compare_exchange_n(&_pt_guarded[i], &expected, guard ? pt : NULL,
+                                        false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+}
+
+PieceTable* make_PieceTable_mapped(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        return NULL;
+    }
+    char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    PieceTable* ret = make_PieceTable(data, st.st_size);
+    ret->mapped = true;
+    ret->original_dev = st.st_dev;
+    ret->original_ino = st.st_ino;
+    _PieceTable_guard(ret, true);
+    return ret;
+}
+
+bool PieceTable_lease(PieceTable* pt, int fd) {
+    struct stat st;
+    if (!pt->mapped || pt->detached || fstat(fd, &st) != 0
+            || st.st_dev != pt->original_dev || st.st_ino != pt->original_ino
+            || fcntl(fd, F_SETLEASE, F_RDLCK) != 0) {
+        close(fd);
+        return false;
+    }
+    PieceTable_drop_lease(pt);
+    pt->lease_fd = fd;
+    return true;
+}
+
+bool PieceTable_lease_broken(PieceTable* pt) {
+    // While a break is pending, the lease reads as what it is being broken to.
+    return pt->lease_fd >= 0 && fcntl(pt->lease_fd, F_GETLEASE) != F_RDLCK;
+}
+
+void PieceTable_drop_lease(PieceTable* pt) {
+    if (pt->lease_fd >= 0) {
+        // Closing alone isn't enough if a child process shares the file description.
+        fcntl(pt->lease_fd, F_SETLEASE, F_UNLCK);
+        close(pt->lease_fd);
+        pt->lease_fd = -1;
+    }
+}
+
+/**
+ * PRIVATE
+ * Make an unlinked scratch file in $TMPDIR (or /tmp).
+ * Return: its fd, or -1.
+ */
+int _PieceTable_scratch_file() {
+    const char* dir = getenv("TMPDIR");
+    String* name = make_String(dir != NULL ? dir : "/tmp");
+    Strcats(&name, "/txt_spill_XXXXXX");
+    int fd = mkstemp(name->data);
+    if (fd >= 0) {
+        // Nobody else needs to see it; the space is freed when the fd is closed.
+        unlink(name->data);
+    }
+    free(name);
+    return fd;
+}
+
+bool PieceTable_detach(PieceTable* pt) {
+    if (!pt->mapped || pt->detached) {
+        PieceTable_drop_lease(pt);
+        return true;
+    }
+    int fd = _PieceTable_scratch_file();
+    if (fd < 0) {
+        return false;
+    }
+    // Read through the mapping a block at a time (dropping each again with a
+    // budget): it's the version this table was made from, as long as a lease
+    // kept writers out.
+    IovWriter w;
+    inplace_make_IovWriter(&w, fd);
+    bool ok = true;
+    for (size_t start = 0; ok && start < pt->original_size; start += PT_BLOCK_SIZE) {
+        size_t end = pt->original_size - start < PT_BLOCK_SIZE ? pt->original_size : start + PT_BLOCK_SIZE;
+        // Pages gone from the file fault here, where the SIGBUS handler fills
+        // them in, rather than failing the write.
+        for (size_t i = start; i < end; i += _pt_page_size) {
+            (void) *(volatile const char*) (pt->original + i);
+        }
+        IovWriter_add(&w, pt->original + start, end - start);
+        ok = IovWriter_flush(&w);
+        PieceTable_release_range(pt, PT_ORIGINAL, start, end);
+    }
+    // Readers of the old mapping (other threads) see the same bytes throughout.
+    ok = ok && mmap(pt->original, pt->original_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED;
+    close(fd);
+    if (!ok) {
+        return false;
+    }
+    pt->detached = true;
+    PieceTable_drop_lease(pt);
+    return true;
+}
+
+void PieceTable_set_budget(PieceTable* pt, size_t budget) {
+    pt->budget = budget;
+    if (budget > 0 && pt->original_lines == 0) {
+        pt->index_stride = PT_LARGE_INDEX_STRIDE;
+    }
+}
+
+/**
+ * PRIVATE
+ * Drop a block out of the window. Its pages are read back from the file
+ * (or the scratch file) if they are used again.
+ */
+void _PieceTable_evict_block(PieceTable* pt, size_t key) {
+    size_t offset = (key / 2) * PT_BLOCK_SIZE;
+    char* base = pt->original;
+    size_t size = pt->original_size;
+    if (key % 2 == PT_ADD) {
+        base = pt->add;
+        size = pt->add_capacity;
+    }
+    if (offset >= size) {
+        // Stale (the add buffer was remapped).
+        return;
+    }
+    size_t length = size - offset < PT_BLOCK_SIZE ? size - offset : PT_BLOCK_SIZE;
+    madvise(base + offset, length, MADV_DONTNEED);
+}
+
+/**
+ * PRIVATE
+ * Note that bytes [start, end) of a source are being used, evicting the least
+ * recently used blocks if that takes the window over budget.
+ */
+void _PieceTable_touch(PieceTable* pt, int source, size_t start, size_t end) {
+    if (pt->budget == 0 || start >= end) {
+        return;
+    }
+    if (source == PT_ORIGINAL ? !pt->mapped : pt->spill_fd < 0) {
+        return;
+    }
+    Vector* window = &pt->window;
+    size_t max_blocks = (pt->budget - pt->budget / 4) / PT_BLOCK_SIZE;
+    if (max_blocks < 2) {
+        max_blocks = 2;
+    }
+    for (size_t block = start / PT_BLOCK_SIZE; block <= (end - 1) / PT_BLOCK_SIZE; ++block) {
+        size_t key = block * 2 + source;
+        if (window->size > 0 && (size_t) window->elements[window->size - 1] == key) {
+            continue;
+        }
+        for (size_t i = window->size; i > 0; --i) {
+            if ((size_t) window->elements[i - 1] == key) {
+                Vector_delete(window, i - 1);
+                break;
+            }
+        }
+        Vector_push(window, (void*) key);
+        while (window->size > max_blocks) {
+            _PieceTable_evict_block(pt, (size_t) window->elements[0]);
+            Vector_delete(window, 0);
+        }
+    }
+}
+
+/**
+ * PRIVATE
+ * Scan the original until at least `lines` of it are indexed (or it runs out).
+ * Newly scanned lines are added to the end of the document.
+ */
+void _PieceTable_scan(PieceTable* pt, size_t lines) {
+    if (pt->scanned || pt->original_lines >= lines) {
+        return;
+    }
+    size_t old_lines = pt->original_lines;
+    const char* end = pt->original + pt->original_size;
+    while (pt->original_lines < lines) {
+        const char* scan = pt->original + pt->scan_pos;
+        const char* newline = scan_newline(scan, end);
+        pt->original_lines += 1;
+        if (newline == NULL) {
+            // Last line (no trailing newline; possibly empty).
+            _PieceTable_touch(pt, PT_ORIGINAL, pt->scan_pos, pt->original_size);
+            pt->scan_pos = pt->original_size;
+            pt->scanned = true;
+            break;
+        }
+        _PieceTable_touch(pt, PT_ORIGINAL, pt->scan_pos, newline - pt->original + 1);
+        pt->scan_pos = newline - pt->original + 1;
+        if (pt->original_lines % pt->index_stride == 0) {
+            Vector_push(&pt->original_index, (void*) pt->scan_pos);
+        }
+    }
+
+    size_t added = pt->original_lines - old_lines;
+    pt->num_lines += added;
+    if (pt->pieces.size > 0) {
+        Piece* last = pt->pieces.elements[pt->pieces.size - 1];
+        if (last->source == PT_ORIGINAL && last->first_line + last->num_lines == old_lines) {
+            last->num_lines += added;
+            return;
+        }
+    }
+    Piece* piece = malloc(sizeof(Piece));
+    piece->source = PT_ORIGINAL;
+    piece->first_line = old_lines;
+    piece->num_lines = added;
+    Vector_push(&pt->pieces, piece);
+}
+
+void PieceTable_destroy(PieceTable* pt) {
+    for (size_t i = 0; i < pt->pieces.size; ++i) {
+        free(pt->pieces.elements[i]);
+    }
+    Vector_destroy(&pt->pieces);
+    Vector_destroy(&pt->original_index);
+    Vector_destroy(&pt->add_index);
+    Vector_destroy(&pt->window);
+    if (pt->spill_fd >= 0) {
+        munmap(pt->add, pt->add_capacity);
+        close(pt->spill_fd);
+    }
+    else {
+        free(pt->add);
+    }
+    if (pt->mapped) {
+        _PieceTable_guard(pt, false);
+        PieceTable_drop_lease(pt);
+        munmap(pt->original, pt->original_size);
+    }
+    else {
+        free(pt->original);
+    }
+    pt->original = NULL;
+}
+
+size_t PieceTable_num_lines(PieceTable* pt) {
+    _PieceTable_scan(pt, (size_t) -1);
+    return pt->num_lines;
+}
+
+bool PieceTable_has_line(PieceTable* pt, size_t row) {
+    if (row < pt->num_lines) {
+        return true;
+    }
+    _PieceTable_scan(pt, pt->original_lines + (row + 1 - pt->num_lines));
+    return row < pt->num_lines;
+}
+
+/**
+ * PRIVATE
+ * Byte offset of the start of line `line` in a source.
+ * One past the last scanned line gives the end of the scanned part.
+ */
+size_t _PieceTable_line_start(PieceTable* pt, int source, size_t line) {
+    if (source == PT_ADD) {
+        return (size_t) pt->add_index.elements[line];
+    }
+    if (line >= pt->original_lines) {
+        return pt->scan_pos;
+    }
+    // Walk from the closest known line start in the same stride: the index
+    // entry, or a recent lookup (so stepping through lines either way is cheap).
+    size_t stride = pt->index_stride;
+    size_t from = line - line % stride;
+    size_t pos = (size_t) pt->original_index.elements[line / stride];
+    size_t distance = line - from;
+    size_t slot = pt->hint_next;
+    for (size_t i = 0; i < PT_HINTS; ++i) {
+        size_t hint = pt->hint_line[i];
+        if (hint / stride != line / stride) {
+            continue;
+        }
+        size_t d = hint > line ? hint - line : line - hint;
+        if (d < distance) {
+            distance = d;
+            from = hint;
+            pos = pt->hint_pos[i];
+            slot = i;
+        }
+    }
+    if (slot == pt->hint_next) {
+        pt->hint_next = (pt->hint_next + 1) % PT_HINTS;
+    }
+    size_t start = pos;
+    const char* end = pt->original + pt->original_size;
+    for (; from < line; ++from) {
+        const char* newline = scan_newline(pt->original + pos, end);
+        pos = newline - pt->original + 1;
+    }
+    for (; from > line; --from) {
+        // Previous line ends in the newline just before `pos`; find the one before that.
+        pos -= 1;
+        while (pos > 0 && pt->original[pos - 1] != '\n') {
+            --pos;
+        }
+    }
+    pt->hint_line[slot] = line;
+    pt->hint_pos[slot] = pos;
+    _PieceTable_touch(pt, PT_ORIGINAL, pos < start ? pos : start, pos < start ? start : pos);
+    return pos;
+}
+
+static inline const char* _PieceTable_source(PieceTable* pt, int source) {
+    if (source == PT_ADD) {
+        return pt->add;
+    }
+    return pt->original;
+}
+
+/**
+ * PRIVATE
+ * Find the piece containing `row`. Sets `offset` to the line offset within the piece.
+ * Returns the piece index, or pieces.size if row is past the end.
+ */
+size_t _PieceTable_find(PieceTable* pt, size_t row, size_t* offset) {
+    size_t line = 0;
+    for (size_t i = 0; i < pt->pieces.size; ++i) {
+        Piece* p = pt->pieces.elements[i];
+        if (row < line + p->num_lines) {
+            *offset = row - line;
+            return i;
+        }
+        line += p->num_lines;
+    }
+    *offset = 0;
+    return pt->pieces.size;
+}
+
+/**
+ * PRIVATE
+ * Make sure a piece starts at `row`, splitting a piece if needed.
+ * Returns the index of the piece starting at `row` (or pieces.size).
+ */
+size_t _PieceTable_split(PieceTable* pt, size_t row) {
+    size_t offset;
+    size_t idx = _PieceTable_find(pt, row, &offset);
+    if (offset == 0) {
+        return idx;
+    }
+    Piece* p = pt->pieces.elements[idx];
+    Piece* rest = malloc(sizeof(Piece));
+    rest->source = p->source;
+    rest->first_line = p->first_line + offset;
+    rest->num_lines = p->num_lines - offset;
+    p->num_lines = offset;
+    Vector_insert(&pt->pieces, idx + 1, rest);
+    return idx + 1;
+}
+
+const char* PieceTable_line_span(PieceTable* pt, size_t row, size_t* length) {
+    PieceTable_has_line(pt, row);
+    size_t offset;
+    size_t idx = _PieceTable_find(pt, row, &offset);
+    assert(idx < pt->pieces.size);
+    Piece* p = pt->pieces.elements[idx];
+    size_t line = p->first_line + offset;
+    size_t start = _PieceTable_line_start(pt, p->source, line);
+    size_t end;
+    if (p->source == PT_ORIGINAL && line + 1 < pt->original_lines) {
+        const char* newline = scan_newline(pt->original + start, pt->original + pt->original_size);
+        end = newline - pt->original + 1;
+    }
+    else {
+        end = _PieceTable_line_start(pt, p->source, line + 1);
+    }
+    *length = end - start;
+    _PieceTable_touch(pt, p->source, start, end);
+    return _PieceTable_source(pt, p->source) + start;
+}
+
+String* PieceTable_get_line(PieceTable* pt, size_t row) {
+    size_t length;
+    const char* data = PieceTable_line_span(pt, row, &length);
+    String* ret = alloc_String(length);
+    memcpy(ret->data, data, length);
+    ret->data[length] = 0;
+    ret->length = length;
+    return ret;
+}
+
+bool PieceTable_line_equals(PieceTable* pt, size_t row, const char* data, size_t length) {
+    size_t span_length;
+    const char* span = PieceTable_line_span(pt, row, &span_length);
+    return span_length == length && memcmp(span, data, length) == 0;
+}
+
+size_t PieceTable_line_offset(PieceTable* pt, size_t row, int* source) {
+    PieceTable_has_line(pt, row);
+    size_t offset;
+    size_t idx = _PieceTable_find(pt, row, &offset);
+    assert(idx < pt->pieces.size);
+    Piece* p = pt->pieces.elements[idx];
+    *source = p->source;
+    return _PieceTable_line_start(pt, p->source, p->first_line + offset);
+}
+
+size_t PieceTable_row_at(PieceTable* pt, int source, size_t offset) {
+    size_t line;
+    if (source == PT_ADD) {
+        // Every add line's start is indexed (the last entry is the end).
+        Vector* index = &pt->add_index;
+        size_t lo = 0;
+        size_t hi = index->size - 2;
+        while (lo < hi) {
+            size_t mid = (lo + hi + 1) / 2;
+            if ((size_t) index->elements[mid] <= offset) lo = mid;
+            else hi = mid - 1;
+        }
+        line = lo;
+    }
+    else {
+        while (!pt->scanned && pt->scan_pos <= offset) {
+            _PieceTable_scan(pt, pt->original_lines + pt->index_stride);
+        }
+        // Closest indexed line at or before `offset`, then count lines from there.
+        Vector* index = &pt->original_index;
+        size_t lo = 0;
+        size_t hi = index->size - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi + 1) / 2;
+            if ((size_t) index->elements[mid] <= offset) lo = mid;
+            else hi = mid - 1;
+        }
+        line = lo * pt->index_stride;
+        size_t pos = (size_t) index->elements[lo];
+        _PieceTable_touch(pt, PT_ORIGINAL, pos, offset);
+        const char* end = pt->original + offset;
+        const char* newline;
+        while ((newline = scan_newline(pt->original + pos, end)) != NULL) {
+            pos = newline - pt->original + 1;
+            line += 1;
+        }
+    }
+    size_t row = 0;
+    for (size_t i = 0; i < pt->pieces.size; ++i) {
+        Piece* p = pt->pieces.elements[i];
+        if (p->source == source && line >= p->first_line && line < p->first_line + p->num_lines) {
+            return row + (line - p->first_line);
+        }
+        row += p->num_lines;
+    }
+    return row;
+}
+
+const char* PieceTable_source_range(PieceTable* pt, int source, size_t start, size_t end) {
+    _PieceTable_touch(pt, source, start, end);
+    return _PieceTable_source(pt, source) + start;
+}
+
+void PieceTable_release_range(PieceTable* pt, int source, size_t start, size_t end) {
+    if (pt->budget == 0 || (source == PT_ORIGINAL ? !pt->mapped : pt->spill_fd < 0)) {
+        return;
+    }
+    const char* base = _PieceTable_source(pt, source);
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t first = ((size_t) (base + start) + page - 1) / page * page;
+    size_t last = (size_t) (base + end) / page * page;
+    if (last > first) {
+        madvise((void*) first, last - first, MADV_DONTNEED);
+    }
+}
+
+/**
+ * PRIVATE
+ * Map `capacity` bytes of the scratch file as the add buffer.
+ */
+char* _PieceTable_map_spill(PieceTable* pt, size_t capacity) {
+    if (ftruncate(pt->spill_fd, capacity) != 0) {
+        return NULL;
+    }
+    char* ret = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, pt->spill_fd, 0);
+    return ret == MAP_FAILED ? NULL : ret;
+}
+
+/**
+ * PRIVATE
+ * Move the add buffer from the heap to a scratch file.
+ * Leaves it on the heap if no scratch file can be made.
+ */
+void _PieceTable_spill(PieceTable* pt) {
+    pt->spill_fd = _PieceTable_scratch_file();
+    if (pt->spill_fd < 0) {
+        return;
+    }
+    char* spill = _PieceTable_map_spill(pt, pt->add_capacity);
+    if (spill == NULL) {
+        close(pt->spill_fd);
+        pt->spill_fd = -1;
+        return;
+    }
+    memcpy(spill, pt->add, pt->add_size);
+    free(pt->add);
+    pt->add = spill;
+}
+
+/**
+ * PRIVATE
+ * Make room for `size` bytes in the add buffer.
+ */
+void _PieceTable_reserve_add(PieceTable* pt, size_t size) {
+    if (pt->budget > 0 && pt->spill_fd < 0 && size > pt->budget / 4) {
+        _PieceTable_spill(pt);
+    }
+    if (size <= pt->add_capacity) {
+        return;
+    }
+    size_t capacity = 2 * size;
+    if (pt->spill_fd < 0) {
+        pt->add = realloc(pt->add, capacity);
+    }
+    else {
+        munmap(pt->add, pt->add_capacity);
+        pt->add = _PieceTable_map_spill(pt, capacity);
+        assert(pt->add != NULL);
+    }
+    pt->add_capacity = capacity;
+}
+
+void PieceTable_insert_line(PieceTable* pt, size_t row, const char* data, size_t length) {
+    // Make sure `row` is scanned, so the unscanned rest stays after the new line.
+    PieceTable_has_line(pt, row);
+    assert(row <= pt->num_lines);
+    size_t add_line = pt->add_index.size - 1;
+    size_t new_size = pt->add_size + length;
+    _PieceTable_reserve_add(pt, new_size);
+    _PieceTable_touch(pt, PT_ADD, pt->add_size, new_size);
+    memcpy(pt->add + pt->add_size, data, length);
+    pt->add_size = new_size;
+    Vector_push(&pt->add_index, (void*) pt->add_size);
+
+    size_t idx = _PieceTable_split(pt, row);
+    pt->num_lines += 1;
+    if (idx > 0) {
+        // Lines typed one after another extend the same piece.
+        Piece* prev = pt->pieces.elements[idx - 1];
+        if (prev->source == PT_ADD && prev->first_line + prev->num_lines == add_line) {
+            prev->num_lines += 1;
+            return;
+        }
+    }
+    Piece* piece = malloc(sizeof(Piece));
+    piece->source = PT_ADD;
+    piece->first_line = add_line;
+    piece->num_lines = 1;
+    Vector_insert(&pt->pieces, idx, piece);
+}
+
+void PieceTable_delete_lines(PieceTable* pt, size_t a, size_t b) {
+    assert(a <= b);
+    if (b > 0) {
+        PieceTable_has_line(pt, b - 1);
+    }
+    assert(b <= pt->num_lines);
+    if (a == b) return;
+    size_t first = _PieceTable_split(pt, a);
+    size_t last = _PieceTable_split(pt, b);
+    for (size_t i = first; i < last; ++i) {
+        free(pt->pieces.elements[i]);
+    }
+    Vector_delete_range(&pt->pieces, first, last);
+    pt->num_lines -= b - a;
+}
+
+void PieceTable_replace_line(PieceTable* pt, size_t row, const char* data, size_t length) {
+    PieceTable_delete_lines(pt, row, row + 1);
+    PieceTable_insert_line(pt, row, data, length);
+}
+
+/**
+ * PRIVATE
+ * Queue bytes [start, end) of a source. With a budget, each block is written
+ * before moving on, so the window only has to hold what is being written.
+ */
+size_t _PieceTable_write_range(PieceTable* pt, int source, size_t start, size_t end, IovWriter* w) {
+    const char* data = _PieceTable_source(pt, source);
+    if (pt->budget == 0) {
+        IovWriter_add(w, data + start, end - start);
+        return end - start;
+    }
+    size_t total = 0;
+    while (start < end) {
+        size_t next = (start / PT_BLOCK_SIZE + 1) * PT_BLOCK_SIZE;
+        if (next > end) {
+            next = end;
+        }
+        _PieceTable_touch(pt, source, start, next);
+        IovWriter_add(w, data + start, next - start);
+        IovWriter_flush(w);
+        total += next - start;
+        start = next;
+    }
+    return total;
+}
+
+PieceSpan* PieceTable_spans(PieceTable* pt, size_t* count) {
+    PieceSpan* ret = malloc((pt->pieces.size + 1) * sizeof(PieceSpan));
+    size_t n = 0;
+    for (size_t i = 0; i < pt->pieces.size; ++i) {
+        Piece* p = pt->pieces.elements[i];
+        ret[n].source = p->source;
+        ret[n].start = _PieceTable_line_start(pt, p->source, p->first_line);
+        ret[n].end = _PieceTable_line_start(pt, p->source, p->first_line + p->num_lines);
+        ++n;
+    }
+    if (!pt->scanned) {
+        ret[n].source = PT_ORIGINAL;
+        ret[n].start = pt->scan_pos;
+        ret[n].end = pt->original_size;
+        ++n;
+    }
+    *count = n;
+    return ret;
+}
+
+size_t PieceTable_write(PieceTable* pt, IovWriter* w) {
+    size_t count;
+    PieceSpan* spans = PieceTable_spans(pt, &count);
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        total += _PieceTable_write_range(pt, spans[i].source, spans[i].start, spans[i].end, w);
+    }
+    free(spans);
+    return total;
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "String.h"
+#include "Vector.h"
+#include "iov_writer.h"
+
+/**
+ * Line-oriented piece table.
+ *
+ * The document is a sequence of pieces. Each piece is a run of consecutive
+ * lines taken from one of two sources:
+ *  - the original buffer (file contents, read-only), or
+ *  - the add buffer (append-only; every line ever inserted lives here).
+ *
+ * Lines are the unit of storage (not bytes), so a line does not need to end
+ * in a newline to be a line. This matches the `Buffer.lines` model exactly.
+ * Consecutive lines of a source are contiguous in memory, so every piece is
+ * also a single contiguous byte range.
+ *
+ * The original is indexed lazily: only the lines up to the furthest one asked
+ * for have been scanned. The unscanned rest of the original always sits at the
+ * end of the document, and is turned into pieces as the scan reaches it.
+ *
+ * A table can be given a memory budget (PieceTable_set_budget). The mapped
+ * sources are then treated as blocks of PT_BLOCK_SIZE bytes, and only a window
+ * of recently used blocks is kept resident; the rest are dropped back to the
+ * file they map, to be paged in again if needed. Once the add buffer gets too
+ * big to keep on the heap, it moves to a scratch file so it can be paged too.
+ *
+ * A mapped original is only as stable as the file under it. If the file is
+ * cut short, the pages past its new end read as zeros (instead of raising
+ * SIGBUS) and the table is marked `lost`. To keep other programs' writes out
+ * altogether, hold a lease on the file (PieceTable_lease) and move to a
+ * private copy of it (PieceTable_detach) when the lease is broken.
+ */
+
+#define PT_ORIGINAL 0
+#define PT_ADD 1
+
+// Every PT_INDEX_STRIDE'th line of the original gets its byte offset saved.
+#define PT_INDEX_STRIDE 32
+// Sparser index for tables with a memory budget (huge files).
+#define PT_LARGE_INDEX_STRIDE 1024
+// Recent line lookups in the original remembered as starting points.
+#define PT_HINTS 4
+// Unit of residency for a table with a memory budget.
+#define PT_BLOCK_SIZE (1 << 20)
+
+struct Piece {
+    int source;
+    size_t first_line;  // Line index into the source.
+    size_t num_lines;
+};
+typedef struct Piece Piece;
+
+/**
+ * Bytes [start, end) of a source.
+ */
+struct PieceSpan {
+    int source;
+    size_t start;
+    size_t end;
+};
+typedef struct PieceSpan PieceSpan;
+
+struct PieceTable {
+    char* original;             // Owned. Not modified after construction.
+    size_t original_size;
+    bool mapped;                // `original` is an mmap of the file, not malloc'd.
+    bool detached;              // The mapping is of a private copy of the file (PieceTable_detach).
+    dev_t original_dev;         // The mapped file.
+    ino_t original_ino;
+    int lease_fd;               // Holds a read lease on the mapped file, or -1.
+    volatile sig_atomic_t lost; // Part of the mapped file went missing, and reads as zeros.
+    size_t scan_pos;            // Start of the first unscanned line of `original`.
+    bool scanned;               // Whole original has been scanned.
+    size_t original_lines;      // Lines of the original scanned so far.
+    size_t index_stride;
+    Vector/*size_t*/ original_index;    // Sparse line start offsets into `original`.
+    size_t hint_line[PT_HINTS]; // Recently looked up lines of `original`, and their starts.
+    size_t hint_pos[PT_HINTS];  // Neighbouring lines are found from these.
+    size_t hint_next;           // Hint to replace next.
+    char* add;                  // Append only.
+    size_t add_size;
+    size_t add_capacity;
+    int spill_fd;               // Scratch file `add` is mapped from, or -1 (on the heap).
+    Vector/*size_t*/ add_index; // Start offset of each add line, plus end sentinel.
+    Vector/*Piece* */ pieces;
+    size_t num_lines;
+    size_t budget;              // 0 if unlimited.
+    Vector/*size_t*/ window;    // Resident blocks (block * 2 + source), least recent first.
+};
+typedef struct PieceTable PieceTable;
+
+/**
+ * Make a piece table over `original` (size bytes). Takes ownership of `original`,
+ * which must be malloc'd. `original` may be NULL if size is 0.
+ */
+PieceTable* make_PieceTable(char* original, size_t size);
+void inplace_make_PieceTable(PieceTable* pt, char* original, size_t size);
+
+/**
+ * Make a piece table over a read-only private mapping of the file `fd`.
+ * The fd can be closed afterwards.
+ * Returns NULL if the file can't be mapped (eg. it is empty).
+ */
+PieceTable* make_PieceTable_mapped(int fd);
+void PieceTable_destroy(PieceTable* pt);
+
+/**
+ * Take a read lease on the mapped file through `fd`, which must be open
+ * read-only on that same file. The table keeps `fd` (and closes it if the
+ * lease can't be had). While the lease is held, a process opening the file
+ * for writing or truncating it is held up (for up to
+ * /proc/sys/fs/lease-break-time) and this one gets SIGIO, so it can look at
+ * PieceTable_lease_broken and PieceTable_detach or PieceTable_drop_lease.
+ * Return: false if the lease can't be had (eg. the file is open for writing).
+ */
+bool PieceTable_lease(PieceTable* pt, int fd);
+
+/**
+ * Check if someone is waiting for the lease to go.
+ */
+bool PieceTable_lease_broken(PieceTable* pt);
+
+/**
+ * Give up the lease (if any), letting writers go ahead.
+ */
+void PieceTable_drop_lease(PieceTable* pt);
+
+/**
+ * Replace the mapping of the file with one of a private copy of it (an unlinked
+ * scratch file, in $TMPDIR or /tmp), at the same address, so later changes to
+ * the file can't show through. Drops the lease.
+ * Return: false if no copy could be made (the file stays mapped).
+ */
+bool PieceTable_detach(PieceTable* pt);
+
+/**
+ * Keep at most about `budget` bytes of the document resident (0 = no limit).
+ * Only has an effect on the parts of the table that are mapped: the original
+ * (if the table was made with make_PieceTable_mapped) and a spilled add buffer.
+ * The add buffer spills to a scratch file (in $TMPDIR, or /tmp) once it grows
+ * past a quarter of the budget.
+ * Switches to the sparser PT_LARGE_INDEX_STRIDE if nothing has been scanned yet.
+ */
+void PieceTable_set_budget(PieceTable* pt, size_t budget);
+
+/**
+ * Number of lines in the document. Scans the whole original if it hasn't been yet.
+ */
+size_t PieceTable_num_lines(PieceTable* pt);
+
+/**
+ * Check if line `row` exists, scanning no further than needed.
+ */
+bool PieceTable_has_line(PieceTable* pt, size_t row);
+
+/**
+ * Get a pointer to the contents of line `row`, without copying.
+ * The pointer is invalidated by the next insert.
+ */
+const char* PieceTable_line_span(PieceTable* pt, size_t row, size_t* length);
+
+/**
+ * Where line `row` starts: its source (returned in `source`) and the byte
+ * offset into it.
+ */
+size_t PieceTable_line_offset(PieceTable* pt, size_t row, int* source);
+
+/**
+ * The row of the line holding byte `offset` of `source`, found through the
+ * line index. The inverse of PieceTable_line_offset. The byte must be in the
+ * document (eg. in a PieceSpan); the original is scanned up to it if needed.
+ */
+size_t PieceTable_row_at(PieceTable* pt, int source, size_t offset);
+
+/**
+ * Bytes [start, end) of a source, as named by PieceTable_spans (valid until
+ * the next insert). With a budget they count as in use, and older blocks may
+ * be dropped to make room: take a few blocks at a time.
+ */
+const char* PieceTable_source_range(PieceTable* pt, int source, size_t start, size_t end);
+
+/**
+ * With a budget: drop the whole pages of bytes [start, end) of a mapped source,
+ * to be read back from the file if needed. Leaves the window alone, so unlike
+ * PieceTable_source_range it can be called from other threads (while the table
+ * isn't changed), for bytes that were read without going through the window.
+ */
+void PieceTable_release_range(PieceTable* pt, int source, size_t start, size_t end);
+
+/**
+ * Materialize line `row` as a new (malloc'd) String.
+ */
+String* PieceTable_get_line(PieceTable* pt, size_t row);
+
+/**
+ * Check if line `row` has exactly the given contents.
+ */
+bool PieceTable_line_equals(PieceTable* pt, size_t row, const char* data, size_t length);
+
+/**
+ * Insert a line with the given contents so that it becomes line `row`.
+ * O(pieces).
+ */
+void PieceTable_insert_line(PieceTable* pt, size_t row, const char* data, size_t length);
+
+/**
+ * Delete lines [a, b). O(pieces).
+ */
+void PieceTable_delete_lines(PieceTable* pt, size_t a, size_t b);
+
+/**
+ * Replace the contents of line `row`.
+ */
+void PieceTable_replace_line(PieceTable* pt, size_t row, const char* data, size_t length);
+
+/**
+ * The whole document as byte ranges of the sources, in order: one per piece
+ * (plus one for any of the original that hasn't been scanned).
+ * Returns a malloc'd array, with its length in `count`.
+ * The original never changes and the add buffer is only appended to, so the
+ * bytes a span names stay the same (though `add` may move).
+ */
+PieceSpan* PieceTable_spans(PieceTable* pt, size_t* count);
+
+/**
+ * Write the whole document to `w`, one range per piece
+ * (plus one for any of the original that hasn't been scanned).
+ * With a budget, ranges are split into blocks and written a block at a time.
+ * Returns the number of bytes queued; `w` has been flushed if there is a budget.
+ */
+size_t PieceTable_write(PieceTable* pt, IovWriter* w);
@@ -0,0 +1,65 @@
+#include "regex_cache.h"
+
+#include <string.h>
+
+RegexCache regex_cache;
+
+void RegexCache_destroy(RegexCache* cache) {
+    for (size_t i = 0; i < REGEX_CACHE_SIZE; ++i) {
+        RegexCacheEntry* entry = &cache->entries[i];
+        if (entry->pattern == NULL) {
+            continue;
+        }
+        if (entry->status == 0) {
+            regfree(&entry->regex);
+        }
+        String_free(entry->pattern);
+    }
+    memset(cache, 0, sizeof(RegexCache));
+}
+
+const regex_t* RegexCache_get(RegexCache* cache, const char* pattern, int cflags) {
+    cache->clock += 1;
+    RegexCacheEntry* victim = &cache->entries[0];
+    for (size_t i = 0; i < REGEX_CACHE_SIZE; ++i) {
+        RegexCacheEntry* entry = &cache->entries[i];
+        if (entry->pattern == NULL) {
+            if (victim->pattern != NULL) {
+                victim = entry;
+            }
+            continue;
+        }
+        if (entry->cflags == cflags && strcmp(entry->pattern->data, pattern) == 0) {
+            cache->hits += 1;
+            entry->last_used = cache->clock;
+            return (entry->status == 0) ? &entry->regex : NULL;
+        }
+        if (victim->pattern != NULL && entry->last_used < victim->last_used) {
+            victim = entry;
+        }
+    }
+
+    cache->misses += 1;
+    if (victim->pattern != NULL) {
+        if (victim->status == 0) {
+            regfree(&victim->regex);
+        }
+        Strcpys(&victim->pattern, (char*) pattern);
+    }
+    else {
+        victim->pattern = make_String(pattern);
+    }
+    victim->cflags = cflags;
+    victim->status = regcomp(&victim->regex, pattern, cflags);
+    victim->last_used = cache->clock;
+    return (victim->status == 0) ? &victim->regex : NULL;
+}
+
+bool regex_is_literal(const char* pattern, int cflags) {
+    if (cflags & REG_ICASE) {
+        return false;
+    }
+    // Basic regexes; extended ones add the rest.
+    const char* special = (cflags & REG_EXTENDED) ? ".[\\*^$+?|(){}" : ".[\\*^$";
+    return pattern[strcspn(pattern, special)] == '\0';
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <regex.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "String.h"
+
+/**
+ * Compiled regular expressions, keyed by pattern and regcomp flags.
+ *
+ * Searching compiles its pattern once instead of once per line. A small LRU:
+ * the least recently used entry is recompiled into when the cache is full.
+ * Patterns that don't compile are cached too, so a bad pattern isn't retried
+ * on every `n`.
+ *
+ * A zeroed RegexCache is empty and ready to use.
+ */
+
+#define REGEX_CACHE_SIZE 8
+
+struct RegexCacheEntry {
+    String* pattern;            // NULL: unused.
+    int cflags;
+    int status;                 // From regcomp; `regex` is only valid if 0.
+    regex_t regex;
+    size_t last_used;
+};
+typedef struct RegexCacheEntry RegexCacheEntry;
+
+struct RegexCache {
+    RegexCacheEntry entries[REGEX_CACHE_SIZE];
+    size_t clock;               // Lookups so far (orders last_used).
+    size_t hits;
+    size_t misses;              // ... that had to compile.
+};
+typedef struct RegexCache RegexCache;
+
+/**
+ * Shared by every search (/, ?, n, N, ...).
+ */
+extern RegexCache regex_cache;
+
+void RegexCache_destroy(RegexCache* cache);
+
+/**
+ * The compiled form of `pattern` with `cflags`, compiling it if needed.
+ * Valid until `cache` compiles REGEX_CACHE_SIZE other patterns.
+ * Return: NULL if it doesn't compile.
+ */
+const regex_t* RegexCache_get(RegexCache* cache, const char* pattern, int cflags);
+
+/**
+ * Whether `pattern` (with `cflags`) only ever matches itself: it has no
+ * metacharacters, so a plain substring search finds the same matches.
+ */
+bool regex_is_literal(const char* pattern, int cflags);
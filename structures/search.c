@@ -0,0 +1,625 @@
+#include "search.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "line_scan.h"
+#include "piece_table.h"
+#include "regex_cache.h"
+#include "trigram_index.h"
+
+size_t SEARCH_CHUNK_SIZE = 1 << 20;
+size_t SEARCH_THREADS = 0;
+size_t SEARCH_PARALLEL_BYTES = 64 << 20;
+size_t SEARCH_INDEX_SHARE = 8;
+
+// Most threads a search starts.
+#define SEARCH_MAX_THREADS 64
+
+SearchStats search_stats;
+
+void inplace_make_SearchPattern(SearchPattern* pattern, const char* text) {
+    pattern->text = alloc_String(strlen(text));
+    pattern->newlines = 0;
+    for (const char* c = text; *c != '\0'; ++c) {
+        if (c[0] == '\\' && c[1] == 'n') {
+            String_push(&pattern->text, '\n');
+            pattern->newlines += 1;
+            ++c;
+        }
+        else if (c[0] == '\\' && c[1] != '\0') {
+            // Some other escape (maybe of a backslash): leave it to regcomp.
+            String_push(&pattern->text, c[0]);
+            String_push(&pattern->text, c[1]);
+            ++c;
+        }
+        else {
+            String_push(&pattern->text, c[0]);
+        }
+    }
+    pattern->literal = regex_is_literal(pattern->text->data, SEARCH_CFLAGS);
+    pattern->regex = NULL;
+    if (!pattern->literal) {
+        pattern->regex = RegexCache_get(&regex_cache, pattern->text->data, SEARCH_CFLAGS);
+    }
+}
+
+void SearchPattern_destroy(SearchPattern* pattern) {
+    free(pattern->text);
+    pattern->text = NULL;
+}
+
+bool SearchPattern_valid(const SearchPattern* pattern) {
+    return pattern->literal || pattern->regex != NULL;
+}
+
+/**
+ * PRIVATE
+ * Find the first (`forward`) or last match in `data` (`size` bytes, which
+ * start a line) starting in [from, to). `at_end`: `data` runs to the end of the
+ * document, so `$` matches at its end.
+ * Return: whether there is one; its offset and length in `start` and `length`.
+ */
+static bool _search_text(const SearchPattern* pattern, const char* data, size_t size,
+                         size_t from, size_t to, bool forward, bool at_end,
+                         size_t* start, size_t* length) {
+    search_stats.chunks += 1;
+    search_stats.bytes += size;
+    if (from >= to) {
+        return false;
+    }
+    if (pattern->literal) {
+        size_t n = Strlen(pattern->text);
+        const char* found;
+        if (forward) {
+            found = scan_substr(data + from, data + size, pattern->text->data, n);
+        }
+        else {
+            size_t end = (to + n - 1 < size) ? to + n - 1 : size;
+            found = scan_substr_last(data + from, data + end, pattern->text->data, n);
+        }
+        if (found == NULL || (size_t) (found - data) >= to) {
+            return false;
+        }
+        *start = found - data;
+        *length = n;
+        return true;
+    }
+    // REG_STARTEND: `data` needn't be NUL-terminated, and the bytes before
+    // `from` still count for `^`.
+    int eflags = REG_STARTEND | (at_end ? 0 : REG_NOTEOL);
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+    // The sanitizers' regexec interceptor strlen()s the text whatever the flags.
+    char* copy = malloc(size + 1);
+    memcpy(copy, data, size);
+    copy[size] = '\0';
+    data = copy;
+#endif
+    bool ret = false;
+    size_t pos = from;
+    while (pos < to) {
+        regmatch_t pmatch;
+        pmatch.rm_so = pos;
+        pmatch.rm_eo = size;
+        if (regexec(pattern->regex, data, 1, &pmatch, eflags) != 0 || (size_t) pmatch.rm_so >= to) {
+            break;
+        }
+        *start = pmatch.rm_so;
+        *length = pmatch.rm_eo - pmatch.rm_so;
+        ret = true;
+        if (forward) {
+            break;
+        }
+        // Backwards: keep going to the last one.
+        pos = pmatch.rm_so + 1;
+    }
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+    free(copy);
+#endif
+    return ret;
+}
+
+/**
+ * PRIVATE
+ * Position of `data[offset]`, where `data` starts at line `row`.
+ */
+static void _search_locate(const char* data, size_t offset, size_t row, SearchMatch* match) {
+    const char* line = data;
+    const char* end = data + offset;
+    const char* newline;
+    while ((newline = scan_newline(line, end)) != NULL) {
+        line = newline + 1;
+        row += 1;
+    }
+    match->row = row;
+    match->col = end - line;
+}
+
+/**
+ * PRIVATE
+ * Append line `row` to `chunk`, ending in a line break unless it's the last line.
+ * Return: false if there is no line `row`.
+ */
+static bool _search_append_line(Buffer* buf, String** chunk, size_t row) {
+    if (!Buffer_has_line(buf, row)) {
+        return false;
+    }
+    size_t length;
+    const char* line = Buffer_line_span(buf, row, &length);
+    Strncats(chunk, line, length);
+    if ((length == 0 || line[length - 1] != '\n') && Buffer_has_line(buf, row + 1)) {
+        String_push(chunk, '\n');
+    }
+    search_stats.copied += length;
+    return true;
+}
+
+/**
+ * PRIVATE
+ * Append the `count` lines from `row` on (the overlap with the next chunk).
+ * Return: whether that reached the end of the document.
+ */
+static bool _search_append_overlap(Buffer* buf, String** chunk, size_t row, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (!_search_append_line(buf, chunk, row + i)) {
+            return true;
+        }
+    }
+    return !Buffer_has_line(buf, row + count);
+}
+
+/**
+ * PRIVATE
+ * Search chunks of lines copied out of the buffer: for BS_LINES, and for
+ * patterns that span lines (chunks overlap by pattern->newlines lines).
+ */
+static int _Buffer_search_copied(Buffer* buf, const SearchPattern* pattern, size_t row, size_t col,
+                                 bool forward, SearchMatch* match) {
+    String* chunk = alloc_String(2 * SEARCH_CHUNK_SIZE);
+    size_t row_length;
+    Buffer_line_span(buf, row, &row_length);
+    if (col > row_length) {
+        col = row_length;
+    }
+    size_t start;
+    size_t length;
+    int ret = -1;
+    if (forward) {
+        size_t from = (col + 1 < row_length) ? col + 1 : row_length;
+        // Each chunk holds lines [a, b), then the overlap.
+        for (size_t a = row; Buffer_has_line(buf, a); from = 0) {
+            String_clear(chunk);
+            size_t b = a;
+            while (Strlen(chunk) < SEARCH_CHUNK_SIZE && _search_append_line(buf, &chunk, b)) {
+                ++b;
+            }
+            size_t owned = Strlen(chunk);
+            bool at_end = _search_append_overlap(buf, &chunk, b, pattern->newlines);
+            if (_search_text(pattern, chunk->data, Strlen(chunk), from, owned, true, at_end, &start, &length)) {
+                _search_locate(chunk->data, start, a, match);
+                ret = 0;
+                break;
+            }
+            a = b;
+        }
+    }
+    else {
+        size_t b = row + 1;
+        bool first = true;
+        while (b > 0) {
+            size_t a = b;
+            size_t bytes = 0;
+            while (a > 0 && bytes < SEARCH_CHUNK_SIZE) {
+                size_t line_length;
+                Buffer_line_span(buf, --a, &line_length);
+                bytes += line_length;
+            }
+            String_clear(chunk);
+            size_t to = 0;
+            for (size_t r = a; r < b; ++r) {
+                to = Strlen(chunk);
+                _search_append_line(buf, &chunk, r);
+            }
+            // Up to the cursor in the first chunk; all of it after that.
+            to = first ? to + col : Strlen(chunk);
+            bool at_end = _search_append_overlap(buf, &chunk, b, pattern->newlines);
+            if (_search_text(pattern, chunk->data, Strlen(chunk), 0, to, false, at_end, &start, &length)) {
+                _search_locate(chunk->data, start, a, match);
+                ret = 0;
+                break;
+            }
+            b = a;
+            first = false;
+        }
+    }
+    if (ret == 0) {
+        match->length = length;
+    }
+    free(chunk);
+    return ret;
+}
+
+/**
+ * PRIVATE
+ * A chunk of a BS_PIECES buffer to search in place: about bytes [start, end)
+ * of a source, inside [slice_start, slice_end), a run of whole lines (part of a
+ * PieceSpan). Both ends are moved up to a line start when searched, so the
+ * chunk is the lines starting in [start, end).
+ */
+struct SearchUnit {
+    int source;
+    const char* base;           // The source.
+    size_t start;
+    size_t end;
+    size_t slice_start;
+    size_t slice_end;
+    size_t from;                // Only matches starting in [from, to) count (the cursor).
+    size_t to;
+    bool at_end;                // slice_end is the end of the document.
+    size_t line;                // Found: where the searched lines start,
+    size_t match;               // ... where the match does,
+    size_t length;              // ... and its length.
+};
+typedef struct SearchUnit SearchUnit;
+
+/**
+ * PRIVATE
+ * A search of a BS_PIECES buffer: units in search order (nearest the cursor
+ * first), taken in turn by `threads` threads.
+ */
+struct SearchJob {
+    PieceTable* pt;
+    const SearchPattern* pattern;
+    bool forward;
+    size_t threads;
+    SearchUnit* units;
+    size_t num_units;
+    size_t capacity;
+    _Atomic size_t next;        // Next unit to take.
+    _Atomic size_t best;        // Nearest unit with a match (num_units if none yet).
+};
+typedef struct SearchJob SearchJob;
+
+/**
+ * PRIVATE
+ * The first line start at or after `pos` in [slice_start, slice_end].
+ */
+static size_t _search_line_start(const char* base, size_t pos, size_t slice_start, size_t slice_end) {
+    if (pos == slice_start || pos == slice_end || base[pos - 1] == '\n') {
+        return pos;
+    }
+    const char* newline = scan_newline(base + pos, base + slice_end);
+    return (newline != NULL) ? (size_t) (newline - base + 1) : slice_end;
+}
+
+/**
+ * PRIVATE
+ * Cut [slice_start, slice_end) of a source into units of about
+ * SEARCH_CHUNK_SIZE bytes, in search order, and add them to `job`.
+ */
+static void _search_add_units(SearchJob* job, int source, size_t slice_start, size_t slice_end,
+                              size_t from, size_t to, bool at_end) {
+    size_t unit_size = (SEARCH_CHUNK_SIZE > 0) ? SEARCH_CHUNK_SIZE : 1;
+    size_t pos = job->forward ? slice_start : slice_end;
+    while (job->forward ? pos < slice_end : pos > slice_start) {
+        if (job->num_units == job->capacity) {
+            job->capacity = 2 * job->capacity + 16;
+            job->units = realloc(job->units, job->capacity * sizeof(SearchUnit));
+        }
+        SearchUnit* unit = &job->units[job->num_units++];
+        unit->source = source;
+        unit->base = PieceTable_source_range(job->pt, source, 0, 0);
+        if (job->forward) {
+            unit->start = pos;
+            unit->end = (slice_end - pos > unit_size) ? pos + unit_size : slice_end;
+            pos = unit->end;
+        }
+        else {
+            unit->end = pos;
+            unit->start = (pos - slice_start > unit_size) ? pos - unit_size : slice_start;
+            pos = unit->start;
+        }
+        unit->slice_start = slice_start;
+        unit->slice_end = slice_end;
+        unit->from = from;
+        unit->to = to;
+        unit->at_end = at_end;
+    }
+}
+
+/**
+ * PRIVATE
+ * Search unit `u` of `job` (with `pattern`, which may be a thread's own copy).
+ */
+static void _search_unit(SearchJob* job, const SearchPattern* pattern, size_t u) {
+    SearchUnit* unit = &job->units[u];
+    size_t a = _search_line_start(unit->base, unit->start, unit->slice_start, unit->slice_end);
+    size_t b = _search_line_start(unit->base, unit->end, unit->slice_start, unit->slice_end);
+    size_t from = (unit->from > a) ? unit->from : a;
+    size_t to = (unit->to < b) ? unit->to : b;
+    if (from >= to) {
+        return;
+    }
+    if (job->threads == 1) {
+        PieceTable_source_range(job->pt, unit->source, a, b);
+    }
+    bool at_end = unit->at_end && b == unit->slice_end;
+    size_t start;
+    size_t length;
+    bool found = _search_text(pattern, unit->base + a, b - a, from - a, to - a, job->forward, at_end, &start, &length);
+    if (job->threads > 1) {
+        // The window isn't safe to touch from several threads: with a budget,
+        // drop what was read instead, so the threads can't fault in all of it.
+        PieceTable_release_range(job->pt, unit->source, a, b);
+    }
+    if (!found) {
+        return;
+    }
+    unit->line = a;
+    unit->match = a + start;
+    unit->length = length;
+    size_t best = atomic_load(&job->best);
+    while (u < best && !atomic_compare_exchange_weak(&job->best, &best, u)) {
+    }
+}
+
+/**
+ * PRIVATE
+ * Take units of `job` in turn and search them, until they run out or the
+ * next is past one with a match.
+ */
+static void* _search_worker(void* arg) {
+    SearchJob* job = arg;
+    SearchPattern pattern = *job->pattern;
+    regex_t regex;
+    bool own_regex = false;
+    if (!pattern.literal && job->threads > 1) {
+        // glibc's regexec locks the regex_t it runs: threads sharing one would take turns.
+        own_regex = regcomp(&regex, pattern.text->data, SEARCH_CFLAGS) == 0;
+        if (own_regex) {
+            pattern.regex = &regex;
+        }
+    }
+    while (true) {
+        size_t u = atomic_fetch_add(&job->next, 1);
+        if (u >= job->num_units || u > atomic_load(&job->best)) {
+            break;
+        }
+        _search_unit(job, &pattern, u);
+    }
+    if (own_regex) {
+        regfree(&regex);
+    }
+    return NULL;
+}
+
+/**
+ * PRIVATE
+ * Threads to search `bytes` bytes with.
+ */
+static size_t _search_threads(size_t bytes) {
+    if (bytes < SEARCH_PARALLEL_BYTES) {
+        return 1;
+    }
+    size_t threads = SEARCH_THREADS;
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cores > 0) ? (size_t) cores : 1;
+    }
+    return (threads < SEARCH_MAX_THREADS) ? threads : SEARCH_MAX_THREADS;
+}
+
+/**
+ * PRIVATE
+ * Search a BS_PIECES buffer in place, through the piece table's spans (a match
+ * can't span lines, so the units needn't overlap).
+ */
+static int _Buffer_search_pieces(Buffer* buf, const SearchPattern* pattern, size_t row, size_t col,
+                                 bool forward, SearchMatch* match) {
+    PieceTable* pt = buf->pieces;
+    size_t row_length;
+    PieceTable_line_span(pt, row, &row_length);
+    if (col > row_length) {
+        col = row_length;
+    }
+    int source;
+    size_t row_start = PieceTable_line_offset(pt, row, &source);
+    size_t row_end = row_start + row_length;
+    size_t count;
+    PieceSpan* spans = PieceTable_spans(pt, &count);
+    // The span holding the cursor (an empty last line is at the very end of one).
+    size_t i = 0;
+    while (i < count && !(spans[i].source == source && spans[i].start <= row_start && row_start < spans[i].end)) {
+        ++i;
+    }
+    if (i == count) {
+        i = 0;
+        while (i < count && !(spans[i].source == source && spans[i].start <= row_start && row_start <= spans[i].end)) {
+            ++i;
+        }
+    }
+    size_t bytes = 0;
+    for (size_t j = 0; j < count; ++j) {
+        bytes += spans[j].end - spans[j].start;
+    }
+
+    SearchJob job = { .pt = pt, .pattern = pattern, .forward = forward, .threads = _search_threads(bytes) };
+    if (i < count && forward) {
+        size_t from = row_start + ((col + 1 < row_length) ? col + 1 : row_length);
+        _search_add_units(&job, source, row_start, spans[i].end, from, SIZE_MAX, i + 1 == count);
+        for (size_t j = i + 1; j < count; ++j) {
+            _search_add_units(&job, spans[j].source, spans[j].start, spans[j].end, 0, SIZE_MAX, j + 1 == count);
+        }
+    }
+    else if (i < count) {
+        bool at_end = (i + 1 == count && row_end == spans[i].end);
+        _search_add_units(&job, source, spans[i].start, row_end, 0, row_start + col, at_end);
+        for (size_t j = i; j > 0; --j) {
+            _search_add_units(&job, spans[j - 1].source, spans[j - 1].start, spans[j - 1].end, 0, SIZE_MAX, false);
+        }
+    }
+    free(spans);
+    atomic_init(&job.next, 0);
+    atomic_init(&job.best, job.num_units);
+    if (job.threads > job.num_units) {
+        job.threads = (job.num_units > 0) ? job.num_units : 1;
+    }
+
+    // This thread searches too.
+    pthread_t threads[SEARCH_MAX_THREADS];
+    size_t started = 0;
+    while (started + 1 < job.threads && pthread_create(&threads[started], NULL, &_search_worker, &job) == 0) {
+        ++started;
+    }
+    search_stats.threads += started;
+    _search_worker(&job);
+    for (size_t t = 0; t < started; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    size_t best = atomic_load(&job.best);
+    int ret = -1;
+    if (best < job.num_units) {
+        SearchUnit* unit = &job.units[best];
+        PieceTable_source_range(pt, unit->source, unit->line, unit->match + unit->length);
+        _search_locate(unit->base + unit->line, unit->match - unit->line,
+                       PieceTable_row_at(pt, unit->source, unit->line), match);
+        match->length = unit->length;
+        ret = 0;
+    }
+    free(job.units);
+    return ret;
+}
+
+/**
+ * PRIVATE
+ * Search rows [a, b) a line at a time: after (row, col) (`forward`) or
+ * before it. `row` can be outside [a, b), for all of it.
+ */
+static int _search_rows(Buffer* buf, const SearchPattern* pattern, size_t a, size_t b,
+                        size_t row, size_t col, bool forward, SearchMatch* match) {
+    size_t start;
+    size_t length;
+    size_t r = forward ? (row > a ? row : a) : (row < b ? row + 1 : b);
+    while (forward ? r < b : r > a) {
+        if (!forward) {
+            --r;
+        }
+        size_t line_length;
+        const char* line = Buffer_line_span(buf, r, &line_length);
+        size_t from = 0;
+        size_t to = line_length;
+        if (r == row) {
+            size_t cursor = (col < line_length) ? col : line_length;
+            if (forward) {
+                from = (cursor + 1 < line_length) ? cursor + 1 : line_length;
+            }
+            else {
+                to = cursor;
+            }
+        }
+        // A match can't run past the line, so its end is as good as the document's.
+        if (_search_text(pattern, line, line_length, from, to, forward, true, &start, &length)) {
+            match->row = r;
+            match->col = start;
+            match->length = length;
+            return 0;
+        }
+        if (forward) {
+            ++r;
+        }
+    }
+    return -1;
+}
+
+/**
+ * PRIVATE
+ * Search through the whole buffer, in chunks.
+ */
+static int _Buffer_search_scan(Buffer* buf, const SearchPattern* pattern, size_t row, size_t col,
+                               bool forward, SearchMatch* match) {
+    if (buf->storage == BS_PIECES && pattern->newlines == 0) {
+        return _Buffer_search_pieces(buf, pattern, row, col, forward, match);
+    }
+    return _Buffer_search_copied(buf, pattern, row, col, forward, match);
+}
+
+// _Buffer_search_indexed: the index doesn't help, search it all.
+#define SEARCH_UNINDEXED -3
+
+/**
+ * PRIVATE
+ * Search just the rows the trigram index says could match (and the rows it
+ * doesn't cover yet). Only for patterns without line breaks.
+ */
+static int _Buffer_search_indexed(Buffer* buf, const SearchPattern* pattern, size_t row, size_t col,
+                                  bool forward, SearchMatch* match) {
+    TrigramIndex* index = buf->trigrams;
+    uint32_t trigrams[TRIGRAM_QUERY_MAX];
+    size_t count = trigram_required(pattern->text->data, pattern->literal, trigrams, TRIGRAM_QUERY_MAX);
+    if (count == 0 || index->indexed_rows == 0 || (!forward && row >= index->indexed_rows)) {
+        return SEARCH_UNINDEXED;
+    }
+    Vector ranges;
+    inplace_make_Vector(&ranges, 16);
+    size_t rows = TrigramIndex_candidates(index, buf, trigrams, count, &ranges);
+    if (rows > index->indexed_rows / SEARCH_INDEX_SHARE) {
+        // Searching a line at a time is slower than searching it all in chunks.
+        Vector_destroy(&ranges);
+        return SEARCH_UNINDEXED;
+    }
+    search_stats.skipped += index->indexed_rows - rows;
+    int ret = -1;
+    if (forward) {
+        for (size_t i = 0; i < ranges.size && ret != 0; i += 2) {
+            if ((size_t) ranges.elements[i + 1] > row) {
+                ret = _search_rows(buf, pattern, (size_t) ranges.elements[i], (size_t) ranges.elements[i + 1],
+                                   row, col, true, match);
+            }
+        }
+        if (ret != 0 && !index->complete) {
+            // Then the rows that aren't indexed yet: after the last indexed line's
+            // break (a match can't start at one, it needs a trigram).
+            size_t last = index->indexed_rows - 1;
+            size_t last_length;
+            Buffer_line_span(buf, last, &last_length);
+            ret = (row > last) ? _Buffer_search_scan(buf, pattern, row, col, true, match)
+                               : _Buffer_search_scan(buf, pattern, last, last_length - 1, true, match);
+        }
+    }
+    else {
+        for (size_t i = ranges.size; i > 0 && ret != 0; i -= 2) {
+            if ((size_t) ranges.elements[i - 2] <= row) {
+                ret = _search_rows(buf, pattern, (size_t) ranges.elements[i - 2], (size_t) ranges.elements[i - 1],
+                                   row, col, false, match);
+            }
+        }
+    }
+    Vector_destroy(&ranges);
+    return ret;
+}
+
+int Buffer_search(Buffer* buf, const SearchPattern* pattern, size_t row, size_t col,
+                  bool forward, SearchMatch* match) {
+    if (!SearchPattern_valid(pattern)) {
+        return -2;
+    }
+    if (!Buffer_has_line(buf, row)) {
+        return -1;
+    }
+    if (buf->storage == BS_PIECES) {
+        // Edits to lines handed out by Buffer_get_line_abs are only in the line cache.
+        Buffer_sync(buf);
+    }
+    if (buf->trigrams != NULL && pattern->newlines == 0) {
+        int ret = _Buffer_search_indexed(buf, pattern, row, col, forward, match);
+        if (ret != SEARCH_UNINDEXED) {
+            return ret;
+        }
+    }
+    return _Buffer_search_scan(buf, pattern, row, col, forward, match);
+}
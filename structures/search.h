@@ -0,0 +1,107 @@
+#pragma once
+
+#include <regex.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../common.h"
+
+/**
+ * Whole-buffer search.
+ *
+ * The text is searched a chunk (about SEARCH_CHUNK_SIZE bytes of whole lines)
+ * at a time, rather than a line at a time: one scan_substr or regexec call
+ * covers thousands of lines. BS_PIECES buffers are searched in place, straight
+ * out of the piece table's sources. BS_LINES buffers hold each line in its own
+ * String, so their lines are copied into a chunk first. A match is mapped back
+ * to (row, col) from the row its chunk starts at, which for the piece table
+ * comes from its line index.
+ *
+ * `\n` in a pattern matches a line break, so a match can span lines. Chunks
+ * then carry as many lines past their end as the pattern has line breaks, so
+ * a match running over the end of a chunk is still found whole. (A repeated
+ * line break, like `\(a\n\)*`, is only guaranteed to be found that far.)
+ * `.` and bracket expressions never match a line break; `^` and `$` match at
+ * the start and end of every line (REG_NEWLINE).
+ *
+ * BS_PIECES buffers of SEARCH_PARALLEL_BYTES or more are searched by
+ * SEARCH_THREADS threads (patterns without line breaks). The text after (or
+ * before) the cursor is cut into chunks, in search order, which the threads
+ * take in turn. The match in the chunk nearest the cursor wins, and chunks
+ * past a chunk with a match aren't searched. With a memory budget (see
+ * PieceTable_set_budget), each thread drops the pages of a chunk once it's
+ * searched, so a search doesn't fault in the whole file.
+ *
+ * Buffers with a trigram index (Buffer_enable_trigrams) are only searched
+ * where the index says a match could be, for patterns without line breaks.
+ */
+
+/**
+ * Bytes in a chunk, about (chunks are rounded to whole lines).
+ */
+extern size_t SEARCH_CHUNK_SIZE;
+
+/**
+ * Threads searching big buffers (0: one per core).
+ */
+extern size_t SEARCH_THREADS;
+
+/**
+ * BS_PIECES buffers at least this many bytes are searched by SEARCH_THREADS
+ * threads; smaller ones on the calling thread.
+ */
+extern size_t SEARCH_PARALLEL_BYTES;
+
+/**
+ * With a trigram index (see trigram_index.h), only the rows it says could
+ * match are searched, a line at a time. Unless they are more than
+ * 1 / SEARCH_INDEX_SHARE of the indexed rows: then it's all searched as usual.
+ */
+extern size_t SEARCH_INDEX_SHARE;
+
+// regcomp flags for search patterns.
+#define SEARCH_CFLAGS REG_NEWLINE
+
+struct SearchPattern {
+    String* text;               // The pattern, with `\n` turned into line breaks.
+    bool literal;               // No metacharacters: searched with scan_substr.
+    const regex_t* regex;       // Otherwise: compiled, from regex_cache (NULL if invalid).
+    size_t newlines;            // Line breaks in the pattern (chunk overlap, in lines).
+};
+typedef struct SearchPattern SearchPattern;
+
+struct SearchMatch {
+    size_t row;
+    size_t col;
+    size_t length;              // Bytes (can span lines).
+};
+typedef struct SearchMatch SearchMatch;
+
+struct SearchStats {
+    _Atomic size_t chunks;      // Chunks searched.
+    _Atomic size_t bytes;       // ... and their size, overlap included.
+    _Atomic size_t copied;      // Bytes copied to make chunks (0 when searched in place).
+    _Atomic size_t threads;     // Threads started to search.
+    _Atomic size_t skipped;     // Rows a trigram index ruled out.
+};
+typedef struct SearchStats SearchStats;
+
+extern SearchStats search_stats;
+
+void inplace_make_SearchPattern(SearchPattern* pattern, const char* text);
+void SearchPattern_destroy(SearchPattern* pattern);
+
+/**
+ * Whether the pattern can be searched for (it compiled, or is literal).
+ */
+bool SearchPattern_valid(const SearchPattern* pattern);
+
+/**
+ * Find the first match starting after (row, col) (`forward`), or the last one
+ * starting before it. Matches may overlap the cursor.
+ * Return: 0 and the match in `match`; -1 if there isn't one; -2 if the pattern
+ * is invalid.
+ */
+int Buffer_search(Buffer* buf, const SearchPattern* pattern, size_t row, size_t col,
+                  bool forward, SearchMatch* match);
@@ -0,0 +1,495 @@
+#include "trigram_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer.h"
+
+size_t TRIGRAM_BLOCK_LINES = 1 << 14;
+
+/**
+ * PRIVATE
+ * A posting list: block ids, sorted.
+ */
+struct TrigramPostings {
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t ids[];
+};
+typedef struct TrigramPostings TrigramPostings;
+
+void inplace_make_TrigramIndex(TrigramIndex* index) {
+    inplace_make_Vector(&index->blocks, 16);
+    index->indexed_rows = 0;
+    index->complete = false;
+    index->next_id = 0;
+    index->postings = calloc(TRIGRAM_BUCKETS, sizeof(TrigramPostings*));
+    index->num_postings = 0;
+}
+
+/**
+ * PRIVATE
+ */
+static void _TrigramBlock_free(TrigramBlock* block) {
+    Vector_destroy(&block->dirty);
+    free(block);
+}
+
+void TrigramIndex_reset(TrigramIndex* index) {
+    for (size_t i = 0; i < index->blocks.size; ++i) {
+        _TrigramBlock_free(index->blocks.elements[i]);
+    }
+    Vector_clear(&index->blocks, 16);
+    for (size_t i = 0; i < TRIGRAM_BUCKETS; ++i) {
+        free(index->postings[i]);
+        index->postings[i] = NULL;
+    }
+    index->indexed_rows = 0;
+    index->complete = false;
+    index->next_id = 0;
+    index->num_postings = 0;
+}
+
+void TrigramIndex_destroy(TrigramIndex* index) {
+    TrigramIndex_reset(index);
+    Vector_destroy(&index->blocks);
+    free(index->postings);
+    index->postings = NULL;
+}
+
+/**
+ * PRIVATE
+ * The posting list a trigram goes in.
+ */
+static inline uint32_t _trigram_bucket(uint32_t trigram) {
+    return (trigram * 2654435761u) >> (32 - TRIGRAM_BUCKET_BITS);
+}
+
+/**
+ * PRIVATE
+ * Add block `id` to a posting list.
+ */
+static void _TrigramIndex_post(TrigramIndex* index, uint32_t bucket, uint32_t id) {
+    TrigramPostings* list = index->postings[bucket];
+    size_t pos = 0;
+    if (list != NULL) {
+        pos = list->size;
+        if (pos > 0 && list->ids[pos - 1] == id) {
+            // The usual case: the rest of a block's lines.
+            return;
+        }
+        if (pos > 0 && list->ids[pos - 1] > id) {
+            size_t lo = 0;
+            size_t hi = list->size;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (list->ids[mid] < id) lo = mid + 1;
+                else hi = mid;
+            }
+            if (list->ids[lo] == id) {
+                return;
+            }
+            pos = lo;
+        }
+    }
+    if (list == NULL || list->size == list->capacity) {
+        uint32_t capacity = (list == NULL) ? 4 : 2 * list->capacity;
+        uint32_t size = (list == NULL) ? 0 : list->size;
+        list = realloc(list, sizeof(TrigramPostings) + capacity * sizeof(uint32_t));
+        list->size = size;
+        list->capacity = capacity;
+        index->postings[bucket] = list;
+    }
+    memmove(list->ids + pos + 1, list->ids + pos, (list->size - pos) * sizeof(uint32_t));
+    list->ids[pos] = id;
+    list->size += 1;
+    index->num_postings += 1;
+}
+
+/**
+ * PRIVATE
+ * Add the trigrams of `data` (lines) to block `id`.
+ */
+static void _TrigramIndex_add_text(TrigramIndex* index, uint32_t id, const char* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    uint32_t trigram = 0;
+    size_t run = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if (bytes[i] == '\n') {
+            run = 0;
+            continue;
+        }
+        trigram = ((trigram << 8) | bytes[i]) & 0xffffff;
+        if (++run >= 3) {
+            _TrigramIndex_post(index, _trigram_bucket(trigram), id);
+        }
+    }
+}
+
+/**
+ * PRIVATE
+ * Make an empty block, and put it at `at` in the block list.
+ */
+static TrigramBlock* _TrigramIndex_new_block(TrigramIndex* index, size_t at) {
+    TrigramBlock* block = malloc(sizeof(TrigramBlock));
+    block->id = index->next_id++;
+    block->num_lines = 0;
+    inplace_make_Vector(&block->dirty, 4);
+    block->stale = false;
+    Vector_insert(&index->blocks, at, block);
+    return block;
+}
+
+/**
+ * PRIVATE
+ * The block holding `row`, and the row it starts at (in `start`).
+ * Return: its position in the block list (the end if `row` isn't indexed).
+ */
+static size_t _TrigramIndex_find(TrigramIndex* index, size_t row, size_t* start) {
+    size_t first = 0;
+    for (size_t i = 0; i < index->blocks.size; ++i) {
+        TrigramBlock* block = index->blocks.elements[i];
+        if (row < first + block->num_lines) {
+            *start = first;
+            return i;
+        }
+        first += block->num_lines;
+    }
+    *start = first;
+    return index->blocks.size;
+}
+
+/**
+ * PRIVATE
+ * Lines of `block` at `offset` on moved by `shift` (lines inserted or deleted
+ * there). Marks from `offset` to `offset - shift` (deleted lines) are dropped.
+ */
+static void _TrigramBlock_shift(TrigramBlock* block, size_t offset, ssize_t shift) {
+    Vector* dirty = &block->dirty;
+    for (size_t i = dirty->size; i > 0; --i) {
+        size_t line = (size_t) dirty->elements[i - 1];
+        if (line < offset) {
+            continue;
+        }
+        if (shift < 0 && line < offset - shift) {
+            Vector_delete(dirty, i - 1);
+            continue;
+        }
+        dirty->elements[i - 1] = (void*) (line + shift);
+    }
+}
+
+/**
+ * PRIVATE
+ * Split the block at `i` in two. The new second half is indexed again before
+ * the next query; the first keeps all the trigrams.
+ */
+static void _TrigramIndex_split(TrigramIndex* index, size_t i) {
+    TrigramBlock* block = index->blocks.elements[i];
+    TrigramBlock* rest = _TrigramIndex_new_block(index, i + 1);
+    size_t half = block->num_lines / 2;
+    rest->num_lines = block->num_lines - half;
+    rest->stale = true;
+    block->num_lines = half;
+    for (size_t j = block->dirty.size; j > 0; --j) {
+        if ((size_t) block->dirty.elements[j - 1] >= half) {
+            Vector_delete(&block->dirty, j - 1);
+        }
+    }
+}
+
+void TrigramIndex_insert_lines(TrigramIndex* index, size_t row, size_t count, const char* data, size_t length) {
+    if (row > index->indexed_rows || (row == index->indexed_rows && !index->complete)) {
+        // Not indexed yet: Buffer_index_step gets to them.
+        return;
+    }
+    size_t start;
+    size_t i = _TrigramIndex_find(index, row, &start);
+    if (i == index->blocks.size) {
+        // At the end: they go in the last block.
+        if (i == 0) {
+            _TrigramIndex_new_block(index, 0);
+        }
+        i = index->blocks.size - 1;
+        start = index->indexed_rows - ((TrigramBlock*) index->blocks.elements[i])->num_lines;
+    }
+    TrigramBlock* block = index->blocks.elements[i];
+    _TrigramIndex_add_text(index, block->id, data, length);
+    _TrigramBlock_shift(block, row - start, count);
+    block->num_lines += count;
+    index->indexed_rows += count;
+    if (block->num_lines > 2 * TRIGRAM_BLOCK_LINES) {
+        _TrigramIndex_split(index, i);
+    }
+}
+
+void TrigramIndex_delete_lines(TrigramIndex* index, size_t row, size_t count) {
+    if (row >= index->indexed_rows) {
+        return;
+    }
+    size_t remaining = (row + count < index->indexed_rows) ? count : index->indexed_rows - row;
+    index->indexed_rows -= remaining;
+    size_t start;
+    size_t i = _TrigramIndex_find(index, row, &start);
+    while (remaining > 0) {
+        TrigramBlock* block = index->blocks.elements[i];
+        size_t offset = row - start;
+        size_t n = (block->num_lines - offset < remaining) ? block->num_lines - offset : remaining;
+        _TrigramBlock_shift(block, offset, -(ssize_t) n);
+        block->num_lines -= n;
+        remaining -= n;
+        if (block->num_lines == 0) {
+            _TrigramBlock_free(block);
+            Vector_delete(&index->blocks, i);
+        }
+        else {
+            ++i;
+        }
+        // What's left of this block ends at `row`, so the next one starts there.
+        start = row;
+    }
+}
+
+void TrigramIndex_replace_line(TrigramIndex* index, size_t row, const char* data, size_t length) {
+    if (row >= index->indexed_rows) {
+        return;
+    }
+    size_t start;
+    TrigramBlock* block = index->blocks.elements[_TrigramIndex_find(index, row, &start)];
+    _TrigramIndex_add_text(index, block->id, data, length);
+}
+
+void TrigramIndex_change_line(TrigramIndex* index, size_t row) {
+    if (row >= index->indexed_rows) {
+        return;
+    }
+    size_t start;
+    TrigramBlock* block = index->blocks.elements[_TrigramIndex_find(index, row, &start)];
+    if (block->stale) {
+        return;
+    }
+    size_t offset = row - start;
+    for (size_t i = 0; i < block->dirty.size; ++i) {
+        if ((size_t) block->dirty.elements[i] == offset) {
+            return;
+        }
+    }
+    if (block->dirty.size == TRIGRAM_DIRTY_MAX) {
+        block->stale = true;
+        Vector_clear(&block->dirty, 4);
+        return;
+    }
+    Vector_push(&block->dirty, (void*) offset);
+}
+
+/**
+ * PRIVATE
+ * Add the trigrams of line `row` of `buf` to block `id`.
+ */
+static size_t _TrigramIndex_add_line(TrigramIndex* index, Buffer* buf, uint32_t id, size_t row) {
+    if (!Buffer_has_line(buf, row)) {
+        return 0;
+    }
+    size_t length;
+    const char* line = Buffer_line_span(buf, row, &length);
+    _TrigramIndex_add_text(index, id, line, length);
+    return length;
+}
+
+/**
+ * PRIVATE
+ * Index the lines marked as changed (and stale blocks) again.
+ */
+static void _TrigramIndex_refresh(TrigramIndex* index, Buffer* buf) {
+    size_t start = 0;
+    for (size_t i = 0; i < index->blocks.size; ++i) {
+        TrigramBlock* block = index->blocks.elements[i];
+        if (block->stale) {
+            for (size_t row = start; row < start + block->num_lines; ++row) {
+                _TrigramIndex_add_line(index, buf, block->id, row);
+            }
+            block->stale = false;
+        }
+        else {
+            for (size_t j = 0; j < block->dirty.size; ++j) {
+                _TrigramIndex_add_line(index, buf, block->id, start + (size_t) block->dirty.elements[j]);
+            }
+        }
+        if (block->dirty.size > 0) {
+            Vector_clear(&block->dirty, 4);
+        }
+        start += block->num_lines;
+    }
+}
+
+size_t trigram_required(const char* pattern, bool literal, uint32_t* trigrams, size_t max) {
+    size_t count = 0;
+    uint32_t trigram = 0;
+    size_t run = 0;         // Plain characters in a row that every match has.
+    int depth = 0;          // Inside \( \): could be repeated or left out, so doesn't count.
+    for (const unsigned char* c = (const unsigned char*) pattern; *c != '\0'; ++c) {
+        int plain = -1;
+        if (literal) {
+            plain = *c;
+        }
+        else if (c[0] == '\\' && c[1] != '\0') {
+            ++c;
+            if (*c == '|') {
+                // Either side can match: nothing has to be there.
+                return 0;
+            }
+            else if (*c == '(') {
+                depth += 1;
+            }
+            else if (*c == ')') {
+                depth -= 1;
+            }
+            else if (*c == '{') {
+                // An interval: skip its bounds.
+                while (c[1] != '\0' && !(c[0] == '\\' && c[1] == '}')) {
+                    ++c;
+                }
+                c += (c[1] != '\0');
+            }
+            else if (strchr("}+?<>bBwWsS`'123456789", *c) == NULL) {
+                // An escaped plain character, like `\.`.
+                plain = *c;
+            }
+        }
+        else if (*c == '[') {
+            // Skip the bracket expression (and the classes, like [:alpha:], in it).
+            const unsigned char* end = c + 1;
+            end += (*end == '^');
+            end += (*end == ']');
+            while (*end != '\0' && *end != ']') {
+                if (end[0] == '[' && end[1] != '\0' && strchr(":.=", end[1]) != NULL) {
+                    const unsigned char* close = end + 2;
+                    while (*close != '\0' && !(close[0] == end[1] && close[1] == ']')) {
+                        ++close;
+                    }
+                    end = (*close != '\0') ? close + 1 : close;
+                }
+                if (*end != '\0') {
+                    ++end;
+                }
+            }
+            if (*end == '\0') {
+                break;
+            }
+            c = end;
+        }
+        else if (strchr(".*^$", *c) == NULL) {
+            plain = *c;
+        }
+        // A character that may be repeated zero times isn't needed.
+        if (!literal && plain >= 0
+                && (c[1] == '*' || (c[1] == '\\' && (c[2] == '{' || c[2] == '?')))) {
+            plain = -1;
+        }
+        if (plain < 0 || depth > 0) {
+            run = 0;
+            continue;
+        }
+        trigram = ((trigram << 8) | plain) & 0xffffff;
+        if (++run < 3 || count == max) {
+            continue;
+        }
+        bool seen = false;
+        for (size_t i = 0; i < count && !seen; ++i) {
+            seen = trigrams[i] == trigram;
+        }
+        if (!seen) {
+            trigrams[count++] = trigram;
+        }
+    }
+    return count;
+}
+
+size_t TrigramIndex_candidates(TrigramIndex* index, Buffer* buf, const uint32_t* trigrams, size_t count,
+                               Vector* ranges) {
+    Buffer_sync(buf);
+    _TrigramIndex_refresh(index, buf);
+    uint32_t buckets[TRIGRAM_QUERY_MAX];
+    size_t num_buckets = 0;
+    for (size_t i = 0; i < count && num_buckets < TRIGRAM_QUERY_MAX; ++i) {
+        uint32_t bucket = _trigram_bucket(trigrams[i]);
+        bool seen = false;
+        for (size_t j = 0; j < num_buckets && !seen; ++j) {
+            seen = buckets[j] == bucket;
+        }
+        if (!seen) {
+            buckets[num_buckets++] = bucket;
+        }
+    }
+    // A block is a candidate if it's on every list.
+    unsigned char* hits = calloc(index->next_id + 1, 1);
+    for (size_t i = 0; i < num_buckets; ++i) {
+        TrigramPostings* list = index->postings[buckets[i]];
+        for (uint32_t j = 0; list != NULL && j < list->size; ++j) {
+            hits[list->ids[j]] += 1;
+        }
+    }
+    size_t rows = 0;
+    size_t start = 0;
+    for (size_t i = 0; i < index->blocks.size; ++i) {
+        TrigramBlock* block = index->blocks.elements[i];
+        if (hits[block->id] == num_buckets && block->num_lines > 0) {
+            if (ranges->size > 0 && (size_t) ranges->elements[ranges->size - 1] == start) {
+                ranges->elements[ranges->size - 1] = (void*) (start + block->num_lines);
+            }
+            else {
+                Vector_push(ranges, (void*) start);
+                Vector_push(ranges, (void*) (start + block->num_lines));
+            }
+            rows += block->num_lines;
+        }
+        start += block->num_lines;
+    }
+    free(hits);
+    return rows;
+}
+
+void Buffer_enable_trigrams(Buffer* buf) {
+    if (buf->trigrams == NULL) {
+        buf->trigrams = malloc(sizeof(TrigramIndex));
+        inplace_make_TrigramIndex(buf->trigrams);
+    }
+}
+
+/**
+ * PRIVATE
+ */
+static double _trigram_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+bool Buffer_index_step(Buffer* buf, size_t bytes, double ms) {
+    TrigramIndex* index = buf->trigrams;
+    if (index == NULL || index->complete) {
+        return true;
+    }
+    Buffer_sync(buf);
+    TrigramBlock* block = NULL;
+    if (index->blocks.size > 0) {
+        block = index->blocks.elements[index->blocks.size - 1];
+    }
+    size_t done = 0;
+    double deadline = (ms > 0) ? _trigram_now_ms() + ms : 0;
+    for (size_t lines = 0; done < bytes && Buffer_has_line(buf, index->indexed_rows); ++lines) {
+        if (deadline > 0 && lines % TRIGRAM_CLOCK_LINES == TRIGRAM_CLOCK_LINES - 1
+                && _trigram_now_ms() >= deadline) {
+            break;
+        }
+        if (block == NULL || block->num_lines >= TRIGRAM_BLOCK_LINES) {
+            block = _TrigramIndex_new_block(index, index->blocks.size);
+        }
+        done += _TrigramIndex_add_line(index, buf, block->id, index->indexed_rows) + 1;
+        block->num_lines += 1;
+        index->indexed_rows += 1;
+    }
+    index->complete = !Buffer_has_line(buf, index->indexed_rows);
+    return index->complete;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../common.h"
+#include "Vector.h"
+
+/**
+ * Trigram index of a buffer, so a search can go straight to the lines that
+ * could match.
+ *
+ * The rows are split into blocks of about TRIGRAM_BLOCK_LINES lines. Every
+ * trigram (three bytes in a row, within a line) has a posting list: the blocks
+ * with a line containing it. (Trigrams are hashed into TRIGRAM_BUCKETS lists,
+ * so a list can also name blocks that only have other trigrams.) A pattern
+ * that needs some trigrams can only match in the blocks on all their lists.
+ *
+ * Lists only grow: they name every block with the trigram, and maybe blocks
+ * that had it before an edit. Edits keep the index up to date (see
+ * Buffer_push_undo): inserted and replaced lines are indexed from the edit,
+ * deleted ones taken out of their block, and lines changed in part are marked,
+ * to be indexed again before the next query.
+ *
+ * The index is built from the top, a step at a time (Buffer_index_step), so
+ * it can be built in the background. Rows past the indexed ones are searched
+ * as usual.
+ */
+
+/**
+ * Lines in a block, about (blocks grow to twice this with inserts, then split).
+ */
+extern size_t TRIGRAM_BLOCK_LINES;
+
+// Posting lists (trigrams are hashed into these).
+#define TRIGRAM_BUCKET_BITS 20
+#define TRIGRAM_BUCKETS (1 << TRIGRAM_BUCKET_BITS)
+
+// Lines of a block marked as changed before all of it is indexed again instead.
+#define TRIGRAM_DIRTY_MAX 64
+
+// Buffer_index_step checks the time every this many lines.
+#define TRIGRAM_CLOCK_LINES 64
+
+// Most trigrams a query uses (more hardly narrows it down further).
+#define TRIGRAM_QUERY_MAX 32
+
+struct TrigramBlock {
+    uint32_t id;                // Its entry in the posting lists (not reused until a reset).
+    size_t num_lines;
+    Vector/*size_t*/ dirty;     // Lines (from the block start) changed in part since indexed.
+    bool stale;                 // All its lines need indexing again.
+};
+typedef struct TrigramBlock TrigramBlock;
+
+struct TrigramIndex {
+    Vector/*TrigramBlock* */ blocks;    // In order, covering rows [0, indexed_rows).
+    size_t indexed_rows;
+    bool complete;                      // indexed_rows is all of the buffer.
+    uint32_t next_id;
+    struct TrigramPostings** postings;  // TRIGRAM_BUCKETS lists of block ids, sorted.
+    size_t num_postings;                // Entries in all the lists.
+};
+typedef struct TrigramIndex TrigramIndex;
+
+void inplace_make_TrigramIndex(TrigramIndex* index);
+void TrigramIndex_destroy(TrigramIndex* index);
+
+/**
+ * Forget everything indexed (eg. the buffer was reloaded), to build it again.
+ */
+void TrigramIndex_reset(TrigramIndex* index);
+
+/**
+ * Lines inserted at `row`: `count` of them, `data` (`length` bytes) in all.
+ */
+void TrigramIndex_insert_lines(TrigramIndex* index, size_t row, size_t count, const char* data, size_t length);
+
+/**
+ * Lines [row, row + count) deleted.
+ */
+void TrigramIndex_delete_lines(TrigramIndex* index, size_t row, size_t count);
+
+/**
+ * Line `row` replaced by `data` (`length` bytes).
+ */
+void TrigramIndex_replace_line(TrigramIndex* index, size_t row, const char* data, size_t length);
+
+/**
+ * Line `row` changed in part (indexed again before the next query).
+ */
+void TrigramIndex_change_line(TrigramIndex* index, size_t row);
+
+/**
+ * Trigrams every match of `pattern` (a search pattern, see search.h; `literal`
+ * if it has no metacharacters) contains, as 24 bit values, up to `max`.
+ * Regex patterns are only looked into as far as runs of plain characters that
+ * have to be there (patterns with `\|` need none).
+ * Return: how many.
+ */
+size_t trigram_required(const char* pattern, bool literal, uint32_t* trigrams, size_t max);
+
+/**
+ * Rows that could hold a match of a pattern containing `trigrams` (`count`,
+ * from trigram_required): pairs of [start, end) in `ranges`, in order, merged.
+ * Only covers the indexed rows. Lines marked as changed are indexed first,
+ * from `buf`.
+ * Return: how many rows that is.
+ */
+size_t TrigramIndex_candidates(TrigramIndex* index, Buffer* buf, const uint32_t* trigrams, size_t count,
+                               Vector/*size_t*/ * ranges);
+
+/**
+ * Keep a trigram index of `buf` (empty for now, see Buffer_index_step).
+ */
+void Buffer_enable_trigrams(Buffer* buf);
+
+/**
+ * Index about `bytes` more bytes of `buf`'s lines, or as many as take about `ms`
+ * milliseconds (0: no time limit), whichever is less.
+ * Return: whether all of it is indexed (or it has no index).
+ */
+bool Buffer_index_step(Buffer* buf, size_t bytes, double ms);
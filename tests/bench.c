@@ -0,0 +1,40 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "bench_load.h"
+#include "bench_strings.h"
+#include "bench_format.h"
+#include "bench_search.h"
+
+struct Bench {
+    const char* name;
+    void (*run)();
+};
+
+static struct Bench benches[] = {
+    { "load", &bench_load },
+    { "strings", &bench_strings },
+    { "format", &bench_format },
+    { "search", &bench_search },
+};
+
+/**
+ * bin/bench [name...]: run the named benchmarks (default: all of them).
+ */
+int main(int argc, const char** argv) {
+    for (size_t i = 0; i < sizeof(benches) / sizeof(struct Bench); ++i) {
+        bool run = argc < 2;
+        for (int j = 1; j < argc; ++j) {
+            run |= strcmp(argv[j], benches[i].name) == 0;
+        }
+        if (run) {
+            printf("== %s ==\n", benches[i].name);
+            benches[i].run();
+        }
+    }
+    return 0;
+}
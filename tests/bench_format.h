@@ -0,0 +1,105 @@
+#pragma once
+
+#include "../editor/editor.h"
+#include "../structures/line_scan.h"
+#include "bench_utils.h"
+
+/**
+ * Drawing lines: format_respect_tabspace against a character at a time loop
+ * (how it used to work), on ordinary source lines and on one very long line.
+ */
+
+size_t _bench_format_bytewise(String** write_buffer, const char* buf, size_t start, size_t count,
+                              size_t print_start, size_t print_end) {
+    size_t column = start;
+    for (size_t i = 0; i < count; ++i) {
+        if (buf[i] == '\t') {
+            for (size_t end = tab_round_up(column); column < end; ++column) {
+                if (column >= print_start && column < print_end) String_push(write_buffer, ' ');
+            }
+        }
+        else if (buf[i] != '\n') {
+            if (column >= print_start && column < print_end) String_push(write_buffer, buf[i]);
+            ++column;
+        }
+    }
+    return column;
+}
+
+typedef size_t (*bench_format_fn)(String**, const char*, size_t, size_t, size_t, size_t);
+
+/**
+ * Format each of `lines` (NUL separated, `count` of them) into a screen row
+ * [print_start, print_start + 120), `reps` times. Best of 3.
+ */
+void _bench_format(const char* name, bench_format_fn format, const char* lines, size_t count,
+                   size_t print_start, size_t reps) {
+    String* out = alloc_String(256);
+    double best = 1e9;
+    size_t columns = 0;
+    for (int rep = 0; rep < 3; ++rep) {
+        double start = bench_now();
+        for (size_t r = 0; r < reps; ++r) {
+            const char* line = lines;
+            for (size_t i = 0; i < count; ++i) {
+                size_t length = strlen(line);
+                String_clear(out);
+                columns += format(&out, line, 0, length, print_start, print_start + 120);
+                line += length + 1;
+            }
+        }
+        double elapsed = bench_now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    if (columns == 0) printf("?");
+    bench_report_time(name, count * reps, best);
+    free(out);
+}
+
+/**
+ * `count` lines like source code: a few tabs of indent, text with the odd tab.
+ */
+char* _bench_format_source(size_t count) {
+    char* data = malloc(count * 128);
+    char* p = data;
+    srand(15);
+    for (size_t i = 0; i < count; ++i) {
+        int indent = rand() % 4;
+        for (int j = 0; j < indent; ++j) *p++ = '\t';
+        int length = rand() % 90;
+        for (int j = 0; j < length; ++j) {
+            *p++ = (rand() % 40 == 0) ? '\t' : 'a' + rand() % 26;
+        }
+        *p++ = '\n';
+        *p++ = 0;
+    }
+    return data;
+}
+
+/**
+ * One line of `length` bytes, with a tab every 50 bytes or so.
+ */
+char* _bench_format_long(size_t length) {
+    char* data = malloc(length + 1);
+    srand(15);
+    for (size_t i = 0; i < length; ++i) {
+        data[i] = (rand() % 50 == 0) ? '\t' : 'a' + rand() % 26;
+    }
+    data[length] = 0;
+    return data;
+}
+
+void bench_format() {
+    TAB_WIDTH = 4;
+    char* source = _bench_format_source(1000);
+    _bench_format("format bytewise (source lines)", &_bench_format_bytewise, source, 1000, 0, 200);
+    _bench_format("format_respect_tabspace (source lines)", &format_respect_tabspace, source, 1000, 0, 200);
+    free(source);
+
+    char* line = _bench_format_long(100000);
+    _bench_format("format bytewise (100 KB line, left)", &_bench_format_bytewise, line, 1, 0, 2000);
+    _bench_format("format_respect_tabspace (100 KB line, left)", &format_respect_tabspace, line, 1, 0, 2000);
+    _bench_format("format bytewise (100 KB line, right)", &_bench_format_bytewise, line, 1, 90000, 2000);
+    _bench_format("format_respect_tabspace (100 KB line, right)", &format_respect_tabspace, line, 1, 90000, 2000);
+    free(line);
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "../structures/buffer.h"
+#include "../structures/line_scan.h"
+#include "bench_utils.h"
+
+typedef const char* (*bench_scan_fn)(const char*, const char*);
+
+/**
+ * Time splitting `data` into lines with one scanner. Best of 3.
+ */
+void _bench_scan(const char* name, bench_scan_fn scan, const char* data, size_t size) {
+    double best = 1e9;
+    size_t lines = 0;
+    for (int rep = 0; rep < 3; ++rep) {
+        lines = 0;
+        double start = bench_now();
+        const char* p = data;
+        const char* end = data + size;
+        while ((p = scan(p, end)) != NULL) {
+            ++lines;
+            ++p;
+        }
+        double elapsed = bench_now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    if (lines == (size_t) -1) printf("?");    // Keep the loop.
+    bench_report_rate(name, size, best);
+}
+
+const char* _bench_memchr(const char* start, const char* end) {
+    return memchr(start, '\n', end - start);
+}
+
+/**
+ * Time read_file_break_lines on a file (already in the page cache). Best of 3.
+ */
+void _bench_read_file(const char* name, const char* filename, size_t size, bool use_arena) {
+    double best = 1e9;
+    for (int rep = 0; rep < 3; ++rep) {
+        Vector lines;
+        Arena arena;
+        inplace_make_Vector(&lines, 100);
+        inplace_make_Arena(&arena, ARENA_DEFAULT_CHUNK);
+        FILE* f = fopen(filename, "r");
+        double start = bench_now();
+        read_file_break_lines(&lines, f, use_arena ? &arena : NULL);
+        double elapsed = bench_now() - start;
+        fclose(f);
+        if (elapsed < best) best = elapsed;
+        for (size_t i = 0; i < lines.size; ++i) {
+            String_free(lines.elements[i]);
+        }
+        Vector_destroy(&lines);
+        Arena_destroy(&arena);
+    }
+    bench_report_rate(name, size, best);
+}
+
+/**
+ * Time opening and closing a line-mode buffer. Best of 3.
+ */
+void _bench_buffer(const char* label, const char* filename, size_t size) {
+    double best_open = 1e9;
+    double best_close = 1e9;
+    for (int rep = 0; rep < 3; ++rep) {
+        Buffer buf;
+        double start = bench_now();
+        inplace_make_Buffer_storage(&buf, filename, BS_LINES);
+        double opened = bench_now();
+        Buffer_destroy(&buf);
+        double closed = bench_now();
+        if (opened - start < best_open) best_open = opened - start;
+        if (closed - opened < best_close) best_close = closed - opened;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "Buffer open (%s)", label);
+    bench_report_rate(name, size, best_open);
+    snprintf(name, sizeof(name), "Buffer_destroy (%s)", label);
+    bench_report_rate(name, size, best_close);
+}
+
+void _bench_load_text(const char* label, size_t avg_line) {
+    size_t size = bench_size_mb() << 20;
+    char* data = bench_make_text(size, avg_line);
+    char name[64];
+
+    snprintf(name, sizeof(name), "scan memchr (%s)", label);
+    _bench_scan(name, &_bench_memchr, data, size);
+    snprintf(name, sizeof(name), "scan scalar (%s)", label);
+    _bench_scan(name, &scan_newline_scalar, data, size);
+#ifdef LINE_SCAN_X86
+    if (line_scan_has_sse2()) {
+        snprintf(name, sizeof(name), "scan sse2 (%s)", label);
+        _bench_scan(name, &scan_newline_sse2, data, size);
+    }
+    if (line_scan_has_avx2()) {
+        snprintf(name, sizeof(name), "scan avx2 (%s)", label);
+        _bench_scan(name, &scan_newline_avx2, data, size);
+    }
+#endif
+
+    char* filename = bench_write_file(data, size);
+    snprintf(name, sizeof(name), "read_file_break_lines (%s)", label);
+    _bench_read_file(name, filename, size, false);
+    snprintf(name, sizeof(name), "read_file_break_lines arena (%s)", label);
+    _bench_read_file(name, filename, size, true);
+    _bench_buffer(label, filename, size);
+    remove(filename);
+    free(filename);
+    free(data);
+}
+
+void bench_load() {
+    _bench_load_text("short lines", 40);
+    _bench_load_text("long lines", 1 << 20);
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "../structures/buffer.h"
+#include "../structures/line_scan.h"
+#include "../structures/regex_cache.h"
+#include "../structures/search.h"
+#include "../structures/trigram_index.h"
+#include "bench_utils.h"
+
+/**
+ * `/pattern` over a whole buffer, with a pattern that isn't there (so every
+ * line is searched): compiling the pattern for every line (how
+ * Buffer_find_str_inline used to work), regexec with the pattern from the regex
+ * cache, Buffer_find_str (which searches literal patterns with scan_substr)
+ * line by line, and Buffer_search a chunk at a time (BS_LINES, copying lines
+ * into chunks, and BS_PIECES, in place, then on 1, 2, 4 and one thread per
+ * core). Then building a trigram index of the BS_PIECES buffer, and searching
+ * with it. Then scan_substr itself, over the text in one piece.
+ * Text is BENCH_MB / 8.
+ */
+
+/**
+ * The old way: regcomp, regexec and regfree for each line.
+ */
+int _bench_search_uncached(Buffer* buf, const char* pattern) {
+    size_t num_lines = Buffer_get_num_lines(buf);
+    for (size_t i = 0; i < num_lines; ++i) {
+        regex_t regex;
+        regmatch_t pmatch;
+        if (regcomp(&regex, pattern, 0) != 0) {
+            return -2;
+        }
+        int status = regexec(&regex, (*Buffer_get_line_abs(buf, i))->data, 1, &pmatch, 0);
+        regfree(&regex);
+        if (status == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Regex search with the compiled pattern (Buffer_find_str without the literal path).
+ */
+int _bench_search_regex(Buffer* buf, const char* pattern) {
+    const regex_t* regex = RegexCache_get(&regex_cache, pattern, 0);
+    size_t num_lines = Buffer_get_num_lines(buf);
+    for (size_t i = 0; i < num_lines; ++i) {
+        regmatch_t pmatch;
+        if (regexec(regex, (*Buffer_get_line_abs(buf, i))->data, 1, &pmatch, 0) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int _bench_search_buffer(Buffer* buf, const char* pattern) {
+    EditorContext ctx;
+    ctx.jump_row = 0;
+    ctx.jump_col = 0;
+    return Buffer_find_str(buf, &ctx, (char*) pattern, true, true);
+}
+
+int _bench_search_chunked(Buffer* buf, const char* pattern_text) {
+    SearchPattern pattern;
+    inplace_make_SearchPattern(&pattern, pattern_text);
+    SearchMatch match;
+    int ret = Buffer_search(buf, &pattern, 0, 0, true, &match);
+    SearchPattern_destroy(&pattern);
+    return ret;
+}
+
+typedef int (*bench_search_fn)(Buffer*, const char*);
+
+/**
+ * Best of 3.
+ */
+void _bench_search(const char* name, bench_search_fn search, Buffer* buf, const char* pattern, size_t size) {
+    double best = 1e9;
+    for (int rep = 0; rep < 3; ++rep) {
+        double start = bench_now();
+        int result = search(buf, pattern);
+        double elapsed = bench_now() - start;
+        if (result != -1) printf("%s: unexpected match\n", name);
+        if (elapsed < best) best = elapsed;
+    }
+    bench_report_rate_mb(name, size, best);
+}
+
+typedef const char* (*bench_substr_fn)(const char*, const char*, const char*, size_t);
+
+const char* _bench_memmem(const char* start, const char* end, const char* needle, size_t length) {
+    return memmem(start, end - start, needle, length);
+}
+
+/**
+ * One substring search over all of `data` (not found). Best of 3.
+ */
+void _bench_substr(const char* name, bench_substr_fn scan, const char* data, size_t size, const char* needle) {
+    double best = 1e9;
+    for (int rep = 0; rep < 3; ++rep) {
+        double start = bench_now();
+        const char* found = scan(data, data + size, needle, strlen(needle));
+        double elapsed = bench_now() - start;
+        if (found != NULL) printf("%s: unexpected match\n", name);
+        if (elapsed < best) best = elapsed;
+    }
+    bench_report_rate_mb(name, size, best);
+}
+
+void bench_search() {
+    size_t size = (bench_size_mb() << 20) / 8;
+    char* data = bench_make_text(size, 40);
+    char* filename = bench_write_file(data, size);
+    Buffer buf;
+    inplace_make_Buffer_storage(&buf, filename, BS_LINES);
+    Buffer pieces;
+    inplace_make_Buffer_storage(&pieces, filename, BS_PIECES);
+    printf("%zu MB, %zu lines\n", size >> 20, Buffer_get_num_lines(&buf));
+
+    // The text is all lowercase letters.
+    const char* patterns[] = { "q7", "request_id", "ab[0-9]c", "x.*Y" };
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); ++i) {
+        char name[64];
+        snprintf(name, sizeof(name), "regcomp per line  /%s", patterns[i]);
+        _bench_search(name, &_bench_search_uncached, &buf, patterns[i], size);
+        snprintf(name, sizeof(name), "regex (cached)    /%s", patterns[i]);
+        _bench_search(name, &_bench_search_regex, &buf, patterns[i], size);
+        snprintf(name, sizeof(name), "Buffer_find_str   /%s%s", patterns[i],
+                 regex_is_literal(patterns[i], 0) ? " (literal)" : "");
+        _bench_search(name, &_bench_search_buffer, &buf, patterns[i], size);
+        snprintf(name, sizeof(name), "Buffer_search     /%s (lines)", patterns[i]);
+        _bench_search(name, &_bench_search_chunked, &buf, patterns[i], size);
+        snprintf(name, sizeof(name), "Buffer_search     /%s (pieces)", patterns[i]);
+        _bench_search(name, &_bench_search_chunked, &pieces, patterns[i], size);
+    }
+    printf("regex cache: %zu hits, %zu misses\n", regex_cache.hits, regex_cache.misses);
+
+    // BS_PIECES on more threads, whatever the size.
+    size_t save_threads = SEARCH_THREADS;
+    size_t save_parallel = SEARCH_PARALLEL_BYTES;
+    SEARCH_PARALLEL_BYTES = 0;
+    size_t thread_counts[] = { 1, 2, 4, 0 };
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(size_t); ++i) {
+        SEARCH_THREADS = thread_counts[i];
+        for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); ++p) {
+            char name[64];
+            snprintf(name, sizeof(name), "Buffer_search     /%s (pieces x%zu)", patterns[p],
+                     thread_counts[i] ? thread_counts[i] : (size_t) sysconf(_SC_NPROCESSORS_ONLN));
+            _bench_search(name, &_bench_search_chunked, &pieces, patterns[p], size);
+        }
+    }
+    SEARCH_THREADS = save_threads;
+    SEARCH_PARALLEL_BYTES = save_parallel;
+
+    // Only patterns with a trigram the text doesn't have ('_', digits) skip blocks.
+    double start = bench_now();
+    Buffer_enable_trigrams(&pieces);
+    while (!Buffer_index_step(&pieces, 4 << 20, 0)) {}
+    bench_report_rate_mb("Buffer_index_step (trigrams)", size, bench_now() - start);
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); ++p) {
+        char name[64];
+        snprintf(name, sizeof(name), "Buffer_search     /%s (pieces, index)", patterns[p]);
+        _bench_search(name, &_bench_search_chunked, &pieces, patterns[p], size);
+    }
+
+    const char* needle = "request_id";
+    _bench_substr("scan_substr_scalar", &scan_substr_scalar, data, size, needle);
+#ifdef LINE_SCAN_X86
+    if (line_scan_has_sse2()) {
+        _bench_substr("scan_substr_sse2", &scan_substr_sse2, data, size, needle);
+    }
+    if (line_scan_has_avx2()) {
+        _bench_substr("scan_substr_avx2", &scan_substr_avx2, data, size, needle);
+        _bench_substr("scan_substr_last_avx2", &scan_substr_last_avx2, data, size, needle);
+    }
+#endif
+    _bench_substr("memmem", &_bench_memmem, data, size, needle);
+
+    Buffer_destroy(&buf);
+    Buffer_destroy(&pieces);
+    unlink(filename);
+    free(filename);
+    free(data);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <ftw.h>
+#include <malloc.h>
+
+#include "../structures/buffer.h"
+#include "bench_utils.h"
+
+/**
+ * Memory overhead of line Strings, over the files of a real source tree.
+ * Tree is BENCH_TREE (default: /usr/include).
+ */
+
+struct _BenchStringStats {
+    size_t files;
+    size_t lines;
+    size_t text;        // Bytes of actual line contents.
+    size_t loaded;      // Heap bytes for the lines as loaded.
+    size_t arena;       // Arena bytes for the same lines.
+    size_t copies;      // Heap bytes for Strdup'd copies of lines that were once longer.
+};
+static struct _BenchStringStats _bench_string_stats;
+
+static int _bench_string_file(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    if (type != FTW_F || st->st_size == 0 || st->st_size > (16 << 20)) {
+        return 0;
+    }
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    Vector lines;
+    inplace_make_Vector(&lines, 100);
+    read_file_break_lines(&lines, f, NULL);
+    fclose(f);
+
+    struct _BenchStringStats* stats = &_bench_string_stats;
+    stats->files += 1;
+    for (size_t i = 0; i < lines.size; ++i) {
+        String* line = lines.elements[i];
+        stats->lines += 1;
+        stats->text += line->length;
+        stats->loaded += malloc_usable_size(line);
+        stats->arena += (sizeof(String) + line->length + 1 + 7) & ~7ul;
+
+        // Grow it (like typing into it) then cut it back, then copy it (like undo/yank).
+        size_t length = line->length;
+        for (int j = 0; j < 8; ++j) {
+            Strcats(&line, "0123456789abcdef");
+        }
+        Strtrunc(line, length);
+        String* copy = Strdup(line);
+        stats->copies += malloc_usable_size(copy);
+        free(copy);
+        free(line);
+    }
+    Vector_destroy(&lines);
+    return 0;
+}
+
+void bench_strings() {
+    const char* tree = getenv("BENCH_TREE");
+    if (tree == NULL) {
+        tree = "/usr/include";
+    }
+    memset(&_bench_string_stats, 0, sizeof(_bench_string_stats));
+    nftw(tree, &_bench_string_file, 32, 0);
+
+    struct _BenchStringStats* stats = &_bench_string_stats;
+    if (stats->lines == 0) {
+        printf("no files under %s\n", tree);
+        return;
+    }
+    printf("%s: %zu files, %zu lines, %.1f bytes of text per line\n", tree,
+           stats->files, stats->lines, (double) stats->text / stats->lines);
+    printf("%-44s %10zu bytes\n", "sizeof(String)", sizeof(String));
+    printf("%-44s %10.1f bytes/line\n", "overhead, loaded lines",
+           (double) (stats->loaded - stats->text) / stats->lines);
+    printf("%-44s %10.1f bytes/line\n", "overhead, loaded lines (arena)",
+           (double) (stats->arena - stats->text) / stats->lines);
+    printf("%-44s %10.1f bytes/line\n", "overhead, copies of edited lines",
+           (double) (stats->copies - stats->text) / stats->lines);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Helpers for bin/bench. Benchmarks print one line per measurement.
+ */
+
+static inline double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Size of generated inputs, in MB. Override with BENCH_MB=...
+ */
+static inline size_t bench_size_mb() {
+    const char* env = getenv("BENCH_MB");
+    if (env != NULL && atoi(env) > 0) {
+        return atoi(env);
+    }
+    return 128;
+}
+
+static inline void bench_report_rate(const char* name, size_t bytes, double seconds) {
+    printf("%-44s %8.3f GB/s  (%zu MB in %.3f ms)\n",
+           name, bytes / seconds / 1e9, bytes >> 20, seconds * 1e3);
+}
+
+/**
+ * bench_report_rate, for things too slow for GB/s to say much.
+ */
+static inline void bench_report_rate_mb(const char* name, size_t bytes, double seconds) {
+    printf("%-44s %8.1f MB/s  (%zu MB in %.3f ms)\n",
+           name, bytes / seconds / 1e6, bytes >> 20, seconds * 1e3);
+}
+
+static inline void bench_report_time(const char* name, size_t iterations, double seconds) {
+    printf("%-44s %10.1f ns/op (%zu ops)\n",
+           name, seconds * 1e9 / iterations, iterations);
+}
+
+/**
+ * Write `size` bytes to a new temp file. Returns its (malloc'd) name.
+ */
+static inline char* bench_write_file(const char* data, size_t size) {
+    char* filename = strdup("/tmp/txt_bench_XXXXXX");
+    int fd = mkstemp(filename);
+    FILE* f = fdopen(fd, "w");
+    fwrite(data, 1, size, f);
+    fclose(f);
+    return filename;
+}
+
+/**
+ * Text of about `size` bytes. Line lengths are uniform in [0, 2 * avg_line).
+ */
+static inline char* bench_make_text(size_t size, size_t avg_line) {
+    char* data = malloc(size);
+    srand(1);
+    size_t i = 0;
+    while (i < size) {
+        size_t len = rand() % (2 * avg_line);
+        for (size_t j = 0; j < len && i < size; ++j) {
+            data[i++] = 'a' + (rand() % 26);
+        }
+        if (i < size) {
+            data[i++] = '\n';
+        }
+    }
+    return data;
+}
@@ -9,14 +9,28 @@
 #include "test_string.h"
 #include "test_buffer.h"
 #include "test_gapbuffer.h"
+#include "test_piece_table.h"
+#include "test_line_tree.h"
+#include "test_line_scan.h"
+#include "test_arena.h"
+#include "test_iov_writer.h"
+#include "test_line_diff.h"
+#include "test_screen.h"
 #include "test_editor.h"
 #include "test_editor_actions.h"
+#include "test_line_index.h"
+#include "test_event_loop.h"
+#include "test_input.h"
+#include "test_regex_cache.h"
+#include "test_search.h"
+#include "test_trigram_index.h"
 
 UTEST_STATE();
 
 int main(int argc, const char** argv) {
     __debug_init();
     SCREEN_WRITE = false;
+    bottom_bar_info = alloc_String(20);
     editor_init("tests/scratchfile");
     editor_bottom = EDITOR_WINDOW_SIZE;
     editor_top = 0;
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../structures/arena.h"
+
+UTEST(Arena, alloc_owns) {
+    Arena arena;
+    inplace_make_Arena(&arena, 256);
+    ASSERT_FALSE(Arena_owns(&arena, &arena));
+
+    char* a = Arena_alloc(&arena, 3);
+    char* b = Arena_alloc(&arena, 8);
+    ASSERT_EQ(a + 8, b);
+    ASSERT_EQ(1, arena.chunks.size);
+    // Big allocations get their own chunk, and don't disturb the current one.
+    char* big = Arena_alloc(&arena, 1000);
+    char* c = Arena_alloc(&arena, 8);
+    ASSERT_EQ(b + 8, c);
+    ASSERT_EQ(2, arena.chunks.size);
+    memset(big, 'x', 1000);
+
+    ASSERT_TRUE(Arena_owns(&arena, a));
+    ASSERT_TRUE(Arena_owns(&arena, big + 999));
+    ASSERT_TRUE(Arena_owns(&arena, c));
+    char* heap = malloc(8);
+    ASSERT_FALSE(Arena_owns(&arena, heap));
+    free(heap);
+
+    Arena_destroy(&arena);
+}
+
+UTEST(Arena, String_promote) {
+    Arena arena;
+    inplace_make_Arena(&arena, 256);
+
+    String* s = Arena_alloc_String(&arena, 3);
+    memcpy(s->data, "abc", 4);
+    s->length = 3;
+    ASSERT_TRUE(s->arena);
+
+    // Edits that fit stay in place.
+    String_delete_range(s, 1, 2);
+    ASSERT_STREQ("ac", s->data);
+    ASSERT_EQ(s, String_fit(s));
+
+    String* dup = Strdup(s);
+    ASSERT_FALSE(dup->arena);
+    free(dup);
+
+    // Growing moves it to the heap.
+    String* old = s;
+    Strcats(&s, "defg");
+    ASSERT_NE(old, s);
+    ASSERT_FALSE(s->arena);
+    ASSERT_STREQ("acdefg", s->data);
+    ASSERT_FALSE(Arena_owns(&arena, s));
+    String_free(s);
+
+    String* kept = String_detach(old);
+    ASSERT_FALSE(kept->arena);
+    String_free(old);   // No-op.
+    Arena_destroy(&arena);
+    ASSERT_STREQ("ac", kept->data);
+    free(kept);
+}
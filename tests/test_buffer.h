@@ -1,9 +1,16 @@
 #pragma once
 
+#include <fcntl.h>
+#include <glob.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
 #include "../common.h"
 #include "../structures/buffer.h"
 #include "test_utils.h"
 #include "buffer_private.h"
+#include "../structures/journal.h"
 
 UTEST(Buffer_util, read_file_break_lines) {
     Vector ret;
@@ -13,7 +20,7 @@ UTEST(Buffer_util, read_file_break_lines) {
     inplace_make_Vector(&ret, 10);
     FILE* infile = fopen("./tests/testfile", "r");
     ASSERT_NE(NULL, infile);
-    read_file_break_lines(&ret, infile);
+    read_file_break_lines(&ret, infile, NULL);
     fclose(infile);
 
     ASSERT_VS_EQ(&expected, &ret);
@@ -24,6 +31,43 @@ UTEST(Buffer_util, read_file_break_lines) {
     Vector_destroy(&expected);
 }
 
+UTEST(Buffer_util, read_file_long_lines) {
+    // Lines longer than the loader's read block.
+    size_t line_size = (3 << 20) / 2;
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT_NE(-1, fd);
+    FILE* f = fdopen(fd, "w");
+    for (int i = 0; i < 3; ++i) {
+        for (size_t j = 0; j < line_size - 1; ++j) {
+            fputc('a' + i, f);
+        }
+        fputc('\n', f);
+    }
+    fputs("tail", f);
+    fclose(f);
+
+    Vector lines;
+    inplace_make_Vector(&lines, 10);
+    f = fopen(filename, "r");
+    ASSERT_EQ(3 * line_size + 4, read_file_break_lines(&lines, f, NULL));
+    fclose(f);
+    remove(filename);
+
+    ASSERT_EQ(4, lines.size);
+    for (int i = 0; i < 3; ++i) {
+        String* line = lines.elements[i];
+        ASSERT_EQ(line_size, line->length);
+        ASSERT_EQ('a' + i, line->data[0]);
+        ASSERT_EQ('a' + i, line->data[line_size - 2]);
+        ASSERT_EQ('\n', line->data[line_size - 1]);
+    }
+    ASSERT_STREQ("tail", ((String*) lines.elements[3])->data);
+
+    Vector_clear_free(&lines, 10);
+    Vector_destroy(&lines);
+}
+
 UTEST(Buffer, create_destroy) {
     Buffer buf;
     Vector expected;
@@ -35,13 +79,458 @@ UTEST(Buffer, create_destroy) {
     ASSERT_EQ(0, buf.top_row);
     ASSERT_EQ(0, buf.cursor_row);
     ASSERT_EQ(0, buf.cursor_col);
-    ASSERT_VS_EQ(&expected, &buf.lines);
+    ASSERT_BUF_VS_EQ(&expected, &buf);
     
     Vector_clear_free(&expected, 10);
     Vector_destroy(&expected);
     Buffer_destroy(&buf);
 }
 
+UTEST(Buffer, create_destroy_pieces) {
+    Buffer buf;
+    Vector expected;
+
+    inplace_make_Buffer_storage(&buf, "./tests/testfile", BS_PIECES);
+    inplace_make_VS(&expected, infile_dat);
+
+    ASSERT_EQ(BS_PIECES, buf.storage);
+    ASSERT_TRUE(buf.pieces->mapped);
+    ASSERT_BUF_VS_EQ(&expected, &buf);
+    // Same pointer for the same line while it is cached.
+    ASSERT_EQ(Buffer_get_line_abs(&buf, 2), Buffer_get_line_abs(&buf, 2));
+
+    Vector_clear_free(&expected, 10);
+    Vector_destroy(&expected);
+    Buffer_destroy(&buf);
+}
+
+UTEST(Buffer, save_pieces) {
+    Buffer buf;
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ(8, write(fd, "a\nb\nc\nd\n", 8));
+    close(fd);
+
+    inplace_make_Buffer_storage(&buf, filename, BS_PIECES);
+    ASSERT_TRUE(Buffer_has_line(&buf, 1));
+    Buffer_remove_lines(&buf, 1, 2, NULL);
+    Strcats(Buffer_get_line_abs(&buf, 2), "x");
+    ASSERT_EQ(0, Buffer_save(&buf));
+    // Lines still readable from the old mapping after the file was replaced.
+    ASSERT_STREQ("a\n", (*Buffer_get_line_abs(&buf, 0))->data);
+    Buffer_destroy(&buf);
+
+    FILE* f = fopen(filename, "r");
+    char contents[32] = {0};
+    ASSERT_EQ(7, fread(contents, 1, sizeof(contents), f));
+    fclose(f);
+    ASSERT_STREQ("a\nc\nd\nx", contents);
+    remove(filename);
+}
+
+UTEST(Buffer, save_atomic) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ(4, write(fd, "a\nb\n", 4));
+    fchmod(fd, 0640);
+    close(fd);
+    char link[sizeof(filename) + 5];
+    sprintf(link, "%s.lnk", filename);
+    ASSERT_EQ(0, symlink(filename, link));
+    // A file with the name a fixed temp name would have: left alone.
+    char other[sizeof(filename) + 5];
+    sprintf(other, "%s.tmp", filename);
+    FILE* f = fopen(other, "w");
+    fputs("keep", f);
+    fclose(f);
+
+    Buffer* buf = make_Buffer(link);
+    Strcats(Buffer_get_line_abs(buf, 2), "c");
+    ASSERT_EQ(0, Buffer_save(buf));
+    ASSERT_EQ(5, buf->last_save.bytes);
+    ASSERT_EQ(1, buf->last_save.writes);
+    ASSERT_LE(buf->last_save.write_ms, buf->last_save.total_ms);
+    Buffer_destroy(buf);
+    free(buf);
+
+    // Saved through the link, keeping the mode, with no temp file left behind.
+    struct stat st;
+    ASSERT_EQ(0, lstat(link, &st));
+    ASSERT_TRUE(S_ISLNK(st.st_mode));
+    ASSERT_EQ(0, stat(filename, &st));
+    ASSERT_EQ(0640, (st.st_mode & 07777));
+    char pattern[sizeof(filename) + 8];
+    sprintf(pattern, "%s.??????", filename);
+    glob_t temps;
+    ASSERT_EQ(GLOB_NOMATCH, glob(pattern, 0, NULL, &temps));
+    f = fopen(filename, "r");
+    char contents[16] = {0};
+    ASSERT_EQ(5, fread(contents, 1, sizeof(contents), f));
+    fclose(f);
+    ASSERT_STREQ("a\nb\nc", contents);
+    f = fopen(other, "r");
+    memset(contents, 0, sizeof(contents));
+    ASSERT_EQ(4, fread(contents, 1, sizeof(contents), f));
+    fclose(f);
+    ASSERT_STREQ("keep", contents);
+    remove(other);
+    remove(link);
+    remove(filename);
+}
+
+UTEST(Buffer, journal_recover) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ(6, write(fd, "a\nb\nc\n", 6));
+    close(fd);
+
+    Buffer* buf = make_Buffer(filename);
+    ASSERT_EQ(0, Buffer_open_journal(buf));
+    Edit* edits[] = {
+        make_Insert(1, 1, -1, make_String("x\n")),
+        make_Delete(2, 0, 0, make_String("a")),
+        make_Insert(3, 3, 1, make_String("yz")),
+    };
+    for (int i = 0; i < 3; ++i) {
+        Buffer_apply_Edit(buf, edits[i]);
+        Buffer_push_undo(buf, edits[i]);
+    }
+    EditorContext ctx;
+    ASSERT_EQ(1, Buffer_undo(buf, 3, &ctx));
+    // Crash: the journal is left behind.
+    size_t journal_size = buf->journal->size;
+    Journal_close(buf->journal, buf->swapfile_name->data, false);
+    buf->journal = NULL;
+    Buffer_destroy(buf);
+    free(buf);
+    // Including a torn record.
+    char swapfile[sizeof(filename) + 4];
+    sprintf(swapfile, "%s.swp", filename);
+    FILE* f = fopen(swapfile, "a");
+    fputs("\x03\x05", f);
+    fclose(f);
+
+    Vector expected;
+    char* expected_lines[] = {"\n", "x\n", "b\n", "c\n", "", NULL};
+    inplace_make_VS(&expected, expected_lines);
+    buf = make_Buffer(filename);
+    ASSERT_EQ(4, Buffer_open_journal(buf));
+    ASSERT_BUF_VS_EQ(&expected, buf);
+    ASSERT_EQ(journal_size, buf->journal->size);
+
+    // Saving empties it, and a clean close removes it.
+    ASSERT_EQ(0, Buffer_save(buf));
+    ASSERT_LT(buf->journal->size, journal_size);
+    Buffer_destroy(buf);
+    free(buf);
+    struct stat st;
+    ASSERT_NE(0, stat(swapfile, &st));
+    buf = make_Buffer(filename);
+    ASSERT_BUF_VS_EQ(&expected, buf);
+    Buffer_destroy(buf);
+    free(buf);
+
+    Vector_clear_free(&expected, 10);
+    Vector_destroy(&expected);
+    remove(filename);
+}
+
+UTEST(Buffer, save_background) {
+    BufferStorage storages[] = {BS_LINES, BS_PIECES};
+    for (int i = 0; i < 2; ++i) {
+        char filename[] = "/tmp/txt_test_XXXXXX";
+        int fd = mkstemp(filename);
+        ASSERT_NE(-1, fd);
+        ASSERT_EQ(6, write(fd, "a\nb\nc\n", 6));
+        close(fd);
+
+        Buffer* buf = make_Buffer_storage(filename, storages[i]);
+        ASSERT_EQ(0, Buffer_open_journal(buf));
+        Edit* before = make_Insert(1, 1, -1, make_String("x\n"));
+        Buffer_apply_Edit(buf, before);
+        Buffer_push_undo(buf, before);
+        Buffer_save_start(buf);
+        ASSERT_TRUE(Buffer_saving(buf));
+        // Edited while saving: not in the file, but kept in the journal.
+        Edit* during = make_Insert(2, 0, -1, make_String("y\n"));
+        Buffer_apply_Edit(buf, during);
+        Buffer_push_undo(buf, during);
+        ASSERT_EQ(0, Buffer_save_finish(buf, true));
+        ASSERT_FALSE(Buffer_saving(buf));
+        ASSERT_EQ(1, Buffer_save_progress(buf));
+        ASSERT_EQ(8, buf->last_save.bytes);
+        Journal_close(buf->journal, buf->swapfile_name->data, false);
+        buf->journal = NULL;
+        Buffer_destroy(buf);
+        free(buf);
+
+        FILE* f = fopen(filename, "r");
+        char contents[16] = {0};
+        ASSERT_EQ(8, fread(contents, 1, sizeof(contents), f));
+        fclose(f);
+        ASSERT_STREQ("a\nx\nb\nc\n", contents);
+
+        Vector expected;
+        char* expected_lines[] = {"y\n", "a\n", "x\n", "b\n", "c\n", "", NULL};
+        inplace_make_VS(&expected, expected_lines);
+        buf = make_Buffer_storage(filename, storages[i]);
+        ASSERT_EQ(1, Buffer_open_journal(buf));
+        ASSERT_BUF_VS_EQ(&expected, buf);
+        Buffer_destroy(buf);
+        free(buf);
+        Vector_clear_free(&expected, 10);
+        Vector_destroy(&expected);
+        remove(filename);
+    }
+}
+
+UTEST(Buffer, reload_append) {
+    BufferStorage storages[] = {BS_LINES, BS_PIECES};
+    for (int i = 0; i < 2; ++i) {
+        char filename[] = "/tmp/txt_test_XXXXXX";
+        int fd = mkstemp(filename);
+        ASSERT_NE(-1, fd);
+        ASSERT_EQ(5, write(fd, "a\nb\nc", 5));
+
+        Buffer* buf = make_Buffer_storage(filename, storages[i]);
+        ASSERT_EQ(BUFFER_RELOAD_NONE, Buffer_reload(buf));
+        ASSERT_EQ(6, write(fd, "d\ne\nf\n", 6));
+        ASSERT_EQ(BUFFER_RELOAD_APPENDED, Buffer_reload(buf));
+        ASSERT_FALSE(Buffer_modified(buf));
+        Vector expected;
+        char* expected_lines[] = {"a\n", "b\n", "cd\n", "e\n", "f\n", "", NULL};
+        inplace_make_VS(&expected, expected_lines);
+        ASSERT_BUF_VS_EQ(&expected, buf);
+        ASSERT_EQ(BUFFER_RELOAD_NONE, Buffer_reload(buf));
+
+        // Rewritten in place: the tail doesn't match, so it isn't an append.
+        ASSERT_EQ(0, ftruncate(fd, 0));
+        ASSERT_EQ(12, pwrite(fd, "a\nB\ncd\ne\nf\nx", 12, 0));
+        ASSERT_EQ(BUFFER_RELOAD_CHANGED, Buffer_reload(buf));
+        Vector_clear_free(&expected, 10);
+        Vector_destroy(&expected);
+        char* changed_lines[] = {"a\n", "B\n", "cd\n", "e\n", "f\n", "x", NULL};
+        inplace_make_VS(&expected, changed_lines);
+        ASSERT_BUF_VS_EQ(&expected, buf);
+        close(fd);
+
+        Buffer_destroy(buf);
+        free(buf);
+        Vector_clear_free(&expected, 10);
+        Vector_destroy(&expected);
+        remove(filename);
+    }
+}
+
+/**
+ * Rewrite `filename` (leased by `buf`) from another process, which is held up
+ * until the lease is let go. Returns the Buffer_check_lease after the SIGIO.
+ */
+bool _rewrite_leased_file(Buffer* buf, const char* filename, const char* text) {
+    sigset_t sigio, old_mask;
+    sigemptyset(&sigio);
+    sigaddset(&sigio, SIGIO);
+    sigprocmask(SIG_BLOCK, &sigio, &old_mask);
+    pid_t pid = fork();
+    if (pid == 0) {
+        FILE* f = fopen(filename, "w");
+        fputs(text, f);
+        fclose(f);
+        _exit(0);
+    }
+    struct timespec timeout = { 5, 0 };
+    bool broken = sigtimedwait(&sigio, NULL, &timeout) == SIGIO && Buffer_check_lease(buf);
+    waitpid(pid, NULL, 0);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return broken;
+}
+
+UTEST(Buffer, lease) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    write_numbered_lines(filename, 1000);
+    Buffer buf;
+    inplace_make_Buffer_storage(&buf, filename, BS_PIECES);
+    ASSERT_TRUE(Buffer_lease_file(&buf));
+
+    // Unmodified: the writer goes ahead, and a reload maps (and leases) the new file.
+    ASSERT_TRUE(_rewrite_leased_file(&buf, filename, "new 0\nnew 1\n"));
+    ASSERT_FALSE(buf.pieces->detached);
+    ASSERT_EQ(BUFFER_RELOAD_CHANGED, Buffer_reload(&buf));
+    ASSERT_STREQ("new 1\n", (*Buffer_get_line_abs(&buf, 1))->data);
+    ASSERT_NE(-1, buf.pieces->lease_fd);
+
+    // Modified: the buffer gets a copy of the file first.
+    String_inserts(Buffer_get_line_abs(&buf, 1), 0, "edited ");
+    Buffer_push_undo(&buf, make_Insert(1, 1, 0, make_String("edited ")));
+    ASSERT_TRUE(_rewrite_leased_file(&buf, filename, "x\n"));
+    ASSERT_TRUE(buf.pieces->detached);
+    ASSERT_EQ(-1, buf.pieces->lease_fd);
+    ASSERT_EQ(3, Buffer_get_num_lines(&buf));
+    ASSERT_STREQ("new 0\n", (*Buffer_get_line_abs(&buf, 0))->data);
+    ASSERT_STREQ("edited new 1\n", (*Buffer_get_line_abs(&buf, 1))->data);
+    ASSERT_FALSE(Buffer_lost_data(&buf));
+
+    Buffer_destroy(&buf);
+    remove(filename);
+}
+
+UTEST(Buffer, reload_conflict_in_place) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    write_numbered_lines(filename, 1000);
+    Buffer buf;
+    inplace_make_Buffer_storage(&buf, filename, BS_PIECES);
+    ASSERT_EQ(1001, Buffer_get_num_lines(&buf));
+    String_inserts(Buffer_get_line_abs(&buf, 0), 0, "edited ");
+    Buffer_push_undo(&buf, make_Insert(1, 0, 0, make_String("edited ")));
+
+    // Overwritten in place: without a lease, the buffer sees this one.
+    size_t offset = 10 * 7 + 90 * 8 + 400 * 9;
+    int fd = open(filename, O_WRONLY);
+    ASSERT_EQ(4, pwrite(fd, "LINE", 4, offset));
+    ASSERT_EQ(BUFFER_RELOAD_CONFLICT, Buffer_reload(&buf));
+    ASSERT_TRUE(buf.pieces->detached);
+    ASSERT_STREQ("LINE 500\n", (*Buffer_get_line_abs(&buf, 500))->data);
+
+    // But no more: the rest of the file stays as it was.
+    ASSERT_EQ(0, ftruncate(fd, 0));
+    ASSERT_EQ(5, pwrite(fd, "gone\n", 5, 0));
+    close(fd);
+    ASSERT_EQ(BUFFER_RELOAD_CONFLICT, Buffer_reload(&buf));
+    ASSERT_EQ(1001, Buffer_get_num_lines(&buf));
+    ASSERT_STREQ("edited line 0\n", (*Buffer_get_line_abs(&buf, 0))->data);
+    ASSERT_STREQ("line 501\n", (*Buffer_get_line_abs(&buf, 501))->data);
+    ASSERT_STREQ("line 999\n", (*Buffer_get_line_abs(&buf, 999))->data);
+    ASSERT_FALSE(Buffer_lost_data(&buf));
+    Buffer_destroy(&buf);
+    remove(filename);
+
+    // With a lease, not even the first write gets in.
+    char leased[] = "/tmp/txt_test_XXXXXX";
+    write_numbered_lines(leased, 1000);
+    inplace_make_Buffer_storage(&buf, leased, BS_PIECES);
+    ASSERT_TRUE(Buffer_lease_file(&buf));
+    String_inserts(Buffer_get_line_abs(&buf, 0), 0, "edited ");
+    Buffer_push_undo(&buf, make_Insert(1, 0, 0, make_String("edited ")));
+    ASSERT_TRUE(_rewrite_leased_file(&buf, leased, "gone\n"));
+    ASSERT_EQ(BUFFER_RELOAD_CONFLICT, Buffer_reload(&buf));
+    ASSERT_EQ(1001, Buffer_get_num_lines(&buf));
+    ASSERT_STREQ("edited line 0\n", (*Buffer_get_line_abs(&buf, 0))->data);
+    ASSERT_STREQ("line 500\n", (*Buffer_get_line_abs(&buf, 500))->data);
+    ASSERT_STREQ("line 999\n", (*Buffer_get_line_abs(&buf, 999))->data);
+    Buffer_destroy(&buf);
+    remove(leased);
+}
+
+UTEST(Buffer, reload_diff) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    write_numbered_lines(filename, 100);
+
+    Buffer* buf = make_Buffer(filename);
+    buf->top_row = 40;
+    buf->cursor_row = 10;       // Line 50.
+    buf->marks['a'].set = true;
+    buf->marks['a'].row = 90;
+    String* kept = *Buffer_get_line_abs(buf, 70);
+
+    // Replaced by another program (by a rename, like Buffer_save).
+    char temp[sizeof(filename) + 4];
+    sprintf(temp, "%s.new", filename);
+    FILE* f = fopen(temp, "w");
+    fprintf(f, "new 0\nnew 1\n");
+    for (int i = 0; i < 100; ++i) {
+        if (i == 20 || i == 60) continue;
+        fprintf(f, i == 80 ? "changed %d\n" : "line %d\n", i);
+    }
+    fclose(f);
+    ASSERT_EQ(0, rename(temp, filename));
+
+    ASSERT_EQ(BUFFER_RELOAD_CHANGED, Buffer_reload(buf));
+    ASSERT_FALSE(Buffer_modified(buf));
+    ASSERT_EQ(101, Buffer_get_num_lines(buf));
+    ASSERT_STREQ("new 0\n", (*Buffer_get_line_abs(buf, 0))->data);
+    ASSERT_STREQ("changed 80\n", (*Buffer_get_line_abs(buf, 80))->data);
+    // Unchanged lines weren't touched.
+    ASSERT_EQ(kept, *Buffer_get_line_abs(buf, 70));
+    // Same line, same place on the screen.
+    ASSERT_EQ(10, buf->cursor_row);
+    ASSERT_STREQ("line 50\n", (*Buffer_get_line_abs(buf, buf->top_row + buf->cursor_row))->data);
+    ASSERT_STREQ("line 90\n", (*Buffer_get_line_abs(buf, buf->marks['a'].row))->data);
+
+    // One undoable action.
+    EditorContext ctx;
+    ASSERT_EQ(5, Buffer_undo(buf, buf->undo_index, &ctx));
+    ASSERT_TRUE(Buffer_modified(buf));
+    ASSERT_STREQ("line 0\n", (*Buffer_get_line_abs(buf, 0))->data);
+    ASSERT_STREQ("line 80\n", (*Buffer_get_line_abs(buf, 80))->data);
+
+    // Modified buffers are left alone.
+    f = fopen(filename, "a");
+    fprintf(f, "more\n");
+    fclose(f);
+    ASSERT_EQ(BUFFER_RELOAD_CONFLICT, Buffer_reload(buf));
+    ASSERT_EQ(BUFFER_RELOAD_NONE, Buffer_reload(buf));
+    ASSERT_EQ(101, Buffer_get_num_lines(buf));
+
+    Buffer_destroy(buf);
+    free(buf);
+    remove(filename);
+}
+
+UTEST(Buffer, large_file_mode) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT_NE(-1, fd);
+    FILE* f = fdopen(fd, "w");
+    const size_t num_lines = 3 * PT_BLOCK_SIZE / 8;
+    for (size_t i = 0; i < num_lines; ++i) {
+        fprintf(f, "%07zu\n", i);
+    }
+    fclose(f);
+
+    size_t save_pieces = BUFFER_PIECES_THRESHOLD;
+    size_t save_large = BUFFER_LARGE_THRESHOLD;
+    size_t save_budget = BUFFER_MEMORY_BUDGET;
+    BUFFER_PIECES_THRESHOLD = 0;
+    BUFFER_LARGE_THRESHOLD = 0;
+    BUFFER_MEMORY_BUDGET = 2 * PT_BLOCK_SIZE;
+    Buffer* buf = make_Buffer(filename);
+    BUFFER_PIECES_THRESHOLD = save_pieces;
+    BUFFER_LARGE_THRESHOLD = save_large;
+    BUFFER_MEMORY_BUDGET = save_budget;
+    ASSERT_EQ(BS_PIECES, buf->storage);
+    ASSERT_EQ(2 * PT_BLOCK_SIZE, buf->memory_budget);
+
+    // G, then search back up.
+    ASSERT_EQ(num_lines + 1, Buffer_get_num_lines(buf));
+    EditorContext ctx;
+    ctx.jump_row = num_lines;
+    ctx.jump_col = 0;
+    char target[20];
+    sprintf(target, "%07zu", num_lines - 1000);
+    ASSERT_EQ(0, Buffer_find_str(buf, &ctx, target, true, false));
+    ASSERT_EQ(num_lines - 1000, ctx.jump_row);
+    // gg
+    ASSERT_STREQ("0000000\n", (*Buffer_get_line_abs(buf, 0))->data);
+    ASSERT_LE(buf->pieces->window.size * PT_BLOCK_SIZE, buf->memory_budget);
+
+    Strcats(Buffer_get_line_abs(buf, 0), "x");
+    ASSERT_EQ(0, Buffer_save(buf));
+    Buffer_destroy(buf);
+    free(buf);
+
+    f = fopen(filename, "r");
+    char contents[20] = {0};
+    ASSERT_EQ(17, fread(contents, 1, 17, f));
+    ASSERT_STREQ("0000000\nx0000001\n", contents);
+    fseek(f, 0, SEEK_END);
+    ASSERT_EQ(num_lines * 8 + 1, ftell(f));
+    fclose(f);
+    remove(filename);
+}
+
 UTEST(Buffer, get_num_lines) {
     Buffer buf;
     inplace_make_Buffer(&buf, "./tests/testfile");
@@ -291,3 +780,107 @@ UTEST(Buffer, undo_insert4) {
 UTEST(Buffer, insert_copy_basic) {
 
 }
+
+/**
+ * Run the same delete / paste / undo sequence on both storage engines.
+ */
+void _Buffer_edit_sequence(Buffer* buf, Copy* copy) {
+    EditorContext ctx = {0};
+    ctx.buffer = buf;
+
+    // dd rows 1-2
+    ctx.undo_idx = 1;
+    ctx.start_row = 1;
+    ctx.start_col = -1;
+    ctx.jump_row = 2;
+    ctx.jump_col = -1;
+    Buffer_delete_range(buf, copy, &ctx);
+
+    // Paste them back below row 2.
+    ctx.undo_idx = 2;
+    ctx.start_row = 2;
+    ctx.start_col = 0;
+    Buffer_insert_copy(buf, copy, &ctx);
+
+    // Delete from (0, 5) to (3, 9): spans lines.
+    ctx.undo_idx = 3;
+    ctx.start_row = 0;
+    ctx.start_col = 5;
+    ctx.jump_row = 3;
+    ctx.jump_col = 9;
+    Buffer_delete_range(buf, copy, &ctx);
+}
+
+UTEST(Buffer, edit_sequence_storage) {
+    Buffer lines_buf;
+    Buffer pieces_buf;
+    Copy lines_copy = {0};
+    Copy pieces_copy = {0};
+    Vector expected;
+    inplace_make_Vector(&lines_copy.data, 10);
+    inplace_make_Vector(&pieces_copy.data, 10);
+    inplace_make_Buffer_storage(&lines_buf, "./tests/testfile", BS_LINES);
+    inplace_make_Buffer_storage(&pieces_buf, "./tests/testfile", BS_PIECES);
+
+    _Buffer_edit_sequence(&lines_buf, &lines_copy);
+    _Buffer_edit_sequence(&pieces_buf, &pieces_copy);
+
+    ASSERT_EQ(4, Buffer_get_num_lines(&lines_buf));
+    ASSERT_STREQ("aaaaa" "bbbbbbbbbbbbbbbbbbbb\n", (*Buffer_get_line_abs(&lines_buf, 0))->data);
+    ASSERT_EQ(4, Buffer_get_num_lines(&pieces_buf));
+    for (size_t i = 0; i < 4; ++i) {
+        ASSERT_STREQ((*Buffer_get_line_abs(&lines_buf, i))->data, (*Buffer_get_line_abs(&pieces_buf, i))->data);
+    }
+    ASSERT_EQ(4, pieces_copy.data.size);
+    ASSERT_STREQ("dddddddddddddddddddddddddddddd\n", ((String*) pieces_copy.data.elements[1])->data);
+    ASSERT_STREQ("bbbbbbbbbb", ((String*) pieces_copy.data.elements[3])->data);
+
+    // Undo everything.
+    EditorContext ctx = {0};
+    Buffer_undo(&lines_buf, 0, &ctx);
+    Buffer_undo(&pieces_buf, 0, &ctx);
+    inplace_make_VS(&expected, infile_dat);
+    ASSERT_BUF_VS_EQ(&expected, &lines_buf);
+    ASSERT_BUF_VS_EQ(&expected, &pieces_buf);
+
+    Vector_clear_free(&expected, 10);
+    Vector_destroy(&expected);
+    Vector_clear_free(&lines_copy.data, 10);
+    Vector_destroy(&lines_copy.data);
+    Vector_clear_free(&pieces_copy.data, 10);
+    Vector_destroy(&pieces_copy.data);
+    Buffer_destroy(&lines_buf);
+    Buffer_destroy(&pieces_buf);
+}
+
+UTEST(Buffer, insert_text) {
+    Buffer buf;
+    inplace_make_Buffer(&buf, "./tests/testfile");
+    Vector expected;
+    inplace_make_VS(&expected, infile_dat);
+
+    const char* text = "1\n2\n\n3";
+    ASSERT_EQ(4, Buffer_insert_text(&buf, 1, 2, text, strlen(text)));
+    ASSERT_EQ(TESTFILE_LEN + 4, Buffer_get_num_lines(&buf));
+    ASSERT_STREQ("2\n", (*Buffer_get_line_abs(&buf, 3))->data);
+    ASSERT_STREQ("\n", (*Buffer_get_line_abs(&buf, 4))->data);
+    ASSERT_STREQ("3", (*Buffer_get_line_abs(&buf, 5))->data);
+    ASSERT_STREQ(infile_dat[2], (*Buffer_get_line_abs(&buf, 6))->data);
+
+    // One undo entry for all of it, both ways.
+    EditorContext ctx;
+    ASSERT_EQ(1, Buffer_undo(&buf, 1, &ctx));
+    ASSERT_BUF_VS_EQ(&expected, &buf);
+    Edit* ed = make_Delete(2, 1, -1, make_String("x\ny\n"));
+    Buffer_apply_Edit(&buf, ed);
+    ASSERT_STREQ(infile_dat[3], (*Buffer_get_line_abs(&buf, 1))->data);
+    Buffer_undo_Edit(&buf, ed);
+    ASSERT_STREQ("x\n", (*Buffer_get_line_abs(&buf, 1))->data);
+    ASSERT_STREQ("y\n", (*Buffer_get_line_abs(&buf, 2))->data);
+
+    Edit_destroy(ed);
+    free(ed);
+    Buffer_destroy(&buf);
+    Vector_clear_free(&expected, 10);
+    Vector_destroy(&expected);
+}
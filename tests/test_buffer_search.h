@@ -174,6 +174,31 @@ UTEST(Buffer, find_str_at_cursor) {
     Buffer_destroy(&buf);
 }
 
+UTEST(Buffer, find_str_literal) {
+    Buffer buf;
+    inplace_make_Buffer(&buf, "./tests/multi_line_text.txt");
+    // Each literal, and the same thing as a regex (so it isn't searched as a literal).
+    const char* patterns[][2] = { {"the", "[t]he"}, {"o", "[o]"}, {"zy", "[z]y"}, {"dog", "d[o]g"}, {"qq", "[q]q"} };
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); ++p) {
+        for (int flags = 0; flags < 4; ++flags) {
+            for (size_t row = 0; row < 9; ++row) {
+                for (size_t col = 0; col < 7; ++col) {
+                    EditorContext literal;
+                    EditorContext regex;
+                    literal.jump_row = regex.jump_row = row;
+                    literal.jump_col = regex.jump_col = col;
+                    int a = Buffer_find_str(&buf, &literal, (char*) patterns[p][0], flags & 1, flags & 2);
+                    int b = Buffer_find_str(&buf, &regex, (char*) patterns[p][1], flags & 1, flags & 2);
+                    ASSERT_EQ(b, a);
+                    ASSERT_EQ(regex.jump_row, literal.jump_row);
+                    ASSERT_EQ(regex.jump_col, literal.jump_col);
+                }
+            }
+        }
+    }
+    Buffer_destroy(&buf);
+}
+
 UTEST(Buffer, skip_word) {
     Buffer buf;
     EditorContext ctx;
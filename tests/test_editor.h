@@ -2,6 +2,8 @@
 
 #include "../common.h"
 #include "../editor/editor.h"
+#include "../structures/search.h"
+#include "../structures/trigram_index.h"
 #include "test_utils.h"
 #include "editor_private.h"
 
@@ -22,7 +24,7 @@ UTEST(editor, make_buffer) {
     ASSERT_EQ(0, current_buffer->cursor_row);
     ASSERT_EQ(0, current_buffer->cursor_col);
     ASSERT_EQ(EDITOR_WINDOW_SIZE, editor_bottom);
-    ASSERT_VS_EQ(&expected, &current_buffer->lines);
+    ASSERT_BUF_VS_EQ(&expected, current_buffer);
 
     editor_close_buffer(1);
     Vector_clear_free(&expected, 10);
@@ -154,6 +156,55 @@ UTEST(editor, format_respect_tabspace_exhaustive) {
     TAB_WIDTH = STANDARD_TAB_WIDTH;
 }
 
+/**
+ * format_respect_tabspace, a character at a time (how it used to work).
+ */
+size_t format_tabspace_reference(String** write_buffer, const char* buf, size_t start, size_t count,
+                                 size_t print_start, size_t print_end) {
+    size_t column = start;
+    for (size_t i = 0; i < count; ++i) {
+        if (buf[i] == BYTE_TAB) {
+            for (size_t end = tab_round_up(column); column < end; ++column) {
+                if (column >= print_start && column < print_end) String_push(write_buffer, ' ');
+            }
+        }
+        else if (buf[i] != BYTE_ENTER) {
+            if (column >= print_start && column < print_end) String_push(write_buffer, buf[i]);
+            ++column;
+        }
+    }
+    return column;
+}
+
+UTEST(editor, format_respect_tabspace_random) {
+    srand(15);
+    char line[200];
+    String* s = alloc_String(0);
+    String* expected = alloc_String(0);
+    for (int round = 0; round < 2000; ++round) {
+        TAB_WIDTH = 1 + rand() % 8;
+        size_t count = rand() % sizeof(line);
+        for (size_t i = 0; i < count; ++i) {
+            int r = rand() % 10;
+            line[i] = (r == 0) ? '\t' : (r == 1) ? '\n' : 'a' + rand() % 26;
+        }
+        size_t start = rand() % 10;
+        size_t print_start = rand() % 150;
+        size_t print_end = (round % 4 == 0) ? (size_t) -1 : print_start + rand() % 100;
+        String_clear(s);
+        Strcats(&s, "bar ");
+        String_clear(expected);
+        Strcats(&expected, "bar ");
+        ASSERT_EQ(format_tabspace_reference(&expected, line, start, count, print_start, print_end),
+                  format_respect_tabspace(&s, line, start, count, print_start, print_end));
+        ASSERT_STREQ(expected->data, s->data);
+        ASSERT_EQ(expected->length, s->length);
+    }
+    free(s);
+    free(expected);
+    TAB_WIDTH = STANDARD_TAB_WIDTH;
+}
+
 UTEST(editor, strlen_tab) {
     TAB_WIDTH = 4;
     char* test_str;
@@ -260,3 +311,87 @@ UTEST(editor, editor_move_down) {
 
     editor_close_buffer(1);
 }
+
+UTEST(editor, poll_watches) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ(2, write(fd, "a\n", 2));
+    editor_make_buffer(filename, 1);
+    editor_switch_buffer(1);
+    ASSERT_EQ(2, Buffer_get_num_lines(current_buffer));
+
+    ASSERT_EQ(2, write(fd, "b\n", 2));
+    close(fd);
+    editor_poll_watches();
+    ASSERT_EQ(3, Buffer_get_num_lines(current_buffer));
+    ASSERT_STREQ("b\n", (*Buffer_get_line_abs(current_buffer, 1))->data);
+
+    editor_close_buffer(1);
+    remove(filename);
+}
+
+UTEST(editor, index_buffer) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ(4, write(fd, "abc\n", 4));
+    size_t save_threshold = EDITOR_INDEX_THRESHOLD;
+    EDITOR_INDEX_THRESHOLD = 1;
+    editor_make_buffer(filename, 1);
+    editor_switch_buffer(1);
+    ASSERT_NE(NULL, current_buffer->trigrams);
+    ASSERT_TRUE(current_buffer->trigrams->complete);
+
+    // Appended: the new lines are indexed as they're read.
+    ASSERT_EQ(5, write(fd, "bcde\n", 5));
+    close(fd);
+    editor_poll_watches();
+    ASSERT_TRUE(current_buffer->trigrams->complete);
+    ASSERT_EQ(3, current_buffer->trigrams->indexed_rows);
+    SearchPattern pattern;
+    inplace_make_SearchPattern(&pattern, "cde");
+    SearchMatch match;
+    ASSERT_EQ(0, Buffer_search(current_buffer, &pattern, 0, 0, true, &match));
+    ASSERT_EQ(1, match.row);
+    SearchPattern_destroy(&pattern);
+
+    EDITOR_INDEX_THRESHOLD = save_threshold;
+    editor_close_buffer(1);
+    remove(filename);
+}
+
+UTEST(editor, paste) {
+    editor_make_buffer("./tests/scratchfile", 1);
+    editor_switch_buffer(1);
+    Vector expected;
+    inplace_make_VS(&expected, infile_dat);
+
+    // Normal mode: inserted at the cursor, back in normal mode after.
+    const char* text = "xy\n12\n\t34";
+    editor_paste(text, strlen(text));
+    ASSERT_EQ(EM_NORMAL, current_mode);
+    ASSERT_EQ(TESTFILE_LEN + 2, Buffer_get_num_lines(current_buffer));
+    ASSERT_STREQ("xy\n", (*Buffer_get_line_abs(current_buffer, 0))->data);
+    ASSERT_STREQ("12\n", (*Buffer_get_line_abs(current_buffer, 1))->data);
+    ASSERT_EQ(0, strncmp("\t34aaa", (*Buffer_get_line_abs(current_buffer, 2))->data, 6));
+    ASSERT_EQ(2, Buffer_get_line_index(current_buffer, current_buffer->cursor_row));
+    ASSERT_EQ(5, current_buffer->cursor_col);
+
+    // One undo takes all of it back.
+    Buffer_checkpoint(current_buffer);
+    process_input('u', 0);
+    ASSERT_BUF_VS_EQ(&expected, current_buffer);
+
+    // Insert mode: stays in insert mode, text goes before the cursor.
+    process_input('i', 0);
+    editor_paste("zz", 2);
+    ASSERT_EQ(EM_INSERT, current_mode);
+    ASSERT_EQ(2, current_buffer->cursor_col);
+    process_input(BYTE_ESC, 0);
+    ASSERT_EQ(0, strncmp("zzaaa", (*Buffer_get_line_abs(current_buffer, 0))->data, 5));
+
+    editor_close_buffer(1);
+    Vector_clear_free(&expected, 10);
+    Vector_destroy(&expected);
+}
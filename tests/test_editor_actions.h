@@ -177,3 +177,45 @@ UTEST(editor_actions, h_basic) {
     current_buffer = old;
 }
 
+
+UTEST(editor_actions, scroll) {
+    Buffer buf;
+    inplace_make_Buffer(&buf, "./tests/testfile");
+    Buffer* old = current_buffer;
+    current_buffer = &buf;
+
+    // ^E: the cursor's line leaves the window, so the cursor moves with it.
+    ASSERT_EQ(0, process_action(BYTE_CTRLE, 0, &buf));
+    ASSERT_EQ(1, buf.top_row);
+    ASSERT_EQ(1, Buffer_get_line_index(&buf, buf.cursor_row));
+    process_action(BYTE_CTRLE, 0, &buf);
+    // ^Y: the cursor stays on its line.
+    process_action(BYTE_CTRLY, 0, &buf);
+    ASSERT_EQ(1, buf.top_row);
+    ASSERT_EQ(2, Buffer_get_line_index(&buf, buf.cursor_row));
+
+    // ^D: window and cursor move half a window, as far as the window can.
+    process_action(BYTE_CTRLD, 0, &buf);
+    ASSERT_EQ(3, buf.top_row);
+    ASSERT_EQ(4, Buffer_get_line_index(&buf, buf.cursor_row));
+    // ^F at the end: nothing to scroll.
+    process_action(BYTE_CTRLF, 0, &buf);
+    ASSERT_EQ(3, buf.top_row);
+    ASSERT_EQ(4, Buffer_get_line_index(&buf, buf.cursor_row));
+    // ^B: the cursor ends up on the last line of the window.
+    process_action(BYTE_CTRLB, 0, &buf);
+    ASSERT_EQ(1, buf.top_row);
+    ASSERT_EQ(4, Buffer_get_line_index(&buf, buf.cursor_row));
+    process_action(BYTE_CTRLU, 0, &buf);
+    ASSERT_EQ(0, buf.top_row);
+    ASSERT_EQ(2, Buffer_get_line_index(&buf, buf.cursor_row));
+
+    // With a count.
+    process_action('3', 0, &buf);
+    process_action(BYTE_CTRLE, 0, &buf);
+    ASSERT_EQ(3, buf.top_row);
+    ASSERT_EQ(3, Buffer_get_line_index(&buf, buf.cursor_row));
+
+    Buffer_destroy(&buf);
+    current_buffer = old;
+}
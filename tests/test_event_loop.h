@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../editor/event_loop.h"
+
+/**
+ * Records the last callback value, and counts calls.
+ */
+struct EventRecord {
+    int value;
+    int calls;
+};
+
+void record_test_event(int value, void* data) {
+    struct EventRecord* record = data;
+    record->value = value;
+    record->calls += 1;
+}
+
+UTEST(EventLoop, fds) {
+    EventLoop loop = {0};
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    struct EventRecord record = {0};
+    EventLoop_watch(&loop, fds[0], POLLIN, record_test_event, &record);
+
+    // Nothing ready.
+    ASSERT_EQ(0, EventLoop_run_once(&loop, 0));
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    ASSERT_EQ(1, EventLoop_run_once(&loop, 100));
+    ASSERT_EQ(fds[0], record.value);
+    ASSERT_EQ(1, loop.wakeups);
+
+    EventLoop_unwatch(&loop, fds[0]);
+    ASSERT_EQ(0, EventLoop_run_once(&loop, 0));
+    ASSERT_EQ(1, record.calls);
+
+    EventLoop_destroy(&loop);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+UTEST(EventLoop, timer) {
+    EventLoop loop = {0};
+    struct EventRecord record = {0};
+    int timer = EventLoop_add_timer(&loop, record_test_event, &record);
+    ASSERT_LE(0, timer);
+
+    // Disarmed until set.
+    ASSERT_EQ(0, EventLoop_run_once(&loop, 10));
+    EventLoop_set_timer(timer, 1, false);
+    ASSERT_EQ(1, EventLoop_run_once(&loop, 1000));
+    ASSERT_EQ(timer, record.value);
+    ASSERT_EQ(0, EventLoop_run_once(&loop, 10));
+
+    EventLoop_set_timer(timer, 1, true);
+    ASSERT_EQ(1, EventLoop_run_once(&loop, 1000));
+    ASSERT_EQ(1, EventLoop_run_once(&loop, 1000));
+    EventLoop_set_timer(timer, 0, false);
+    ASSERT_EQ(0, EventLoop_run_once(&loop, 10));
+    ASSERT_EQ(3, record.calls);
+    EventLoop_destroy(&loop);
+}
+
+UTEST(EventLoop, signals) {
+    EventLoop loop = {0};
+    struct EventRecord record = {0};
+    const int signals[] = { SIGUSR1 };
+    ASSERT_LE(0, EventLoop_add_signals(&loop, signals, 1, record_test_event, &record));
+
+    // Blocked: waits for the loop instead of killing the test.
+    raise(SIGUSR1);
+    ASSERT_EQ(1, EventLoop_run_once(&loop, 1000));
+    ASSERT_EQ(SIGUSR1, record.value);
+
+    EventLoop_destroy(&loop);
+    sigset_t mask;
+    sigprocmask(SIG_BLOCK, NULL, &mask);
+    ASSERT_FALSE(sigismember(&mask, SIGUSR1));
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <fcntl.h>
+
+#include "../editor/event_loop.h"
+#include "../editor/input.h"
+
+/**
+ * Feed `data` to `dec`, and decode into `keys` (up to `max`).
+ * Return: the number of keys.
+ */
+size_t decode_test_input(InputDecoder* dec, const char* data, InputKey* keys, size_t max) {
+    InputDecoder_feed(dec, data, strlen(data));
+    size_t n = 0;
+    while (n < max && InputDecoder_next(dec, &keys[n])) {
+        ++n;
+    }
+    return n;
+}
+
+UTEST(InputDecoder, keys) {
+    InputDecoder dec;
+    inplace_make_InputDecoder(&dec);
+    InputKey keys[16];
+
+    // Typeahead: sequences in the middle of other keys.
+    ASSERT_EQ(6, decode_test_input(&dec, "j\033[Ak\033[3~\033OB\033[1;5D", keys, 16));
+    ASSERT_EQ('j', keys[0].c);
+    ASSERT_EQ(0, keys[0].control);
+    ASSERT_EQ(BYTE_ESC, keys[1].c);
+    ASSERT_EQ(BYTE_UPARROW, keys[1].control);
+    ASSERT_EQ('k', keys[2].c);
+    ASSERT_EQ(CODE_DELETE, keys[3].control);
+    ASSERT_EQ(BYTE_DOWNARROW, keys[4].control);
+    ASSERT_EQ(BYTE_LEFTARROW, keys[5].control);
+    ASSERT_EQ(KEY_MOD_CTRL, keys[5].modifiers);
+
+    // Split across reads: finished when the rest comes.
+    ASSERT_EQ(0, decode_test_input(&dec, "\033[", keys, 16));
+    ASSERT_TRUE(InputDecoder_pending(&dec));
+    ASSERT_EQ(1, decode_test_input(&dec, "C", keys, 16));
+    ASSERT_EQ(BYTE_RIGHTARROW, keys[0].control);
+
+    // ESC then a key: the escape key, then the key.
+    ASSERT_EQ(2, decode_test_input(&dec, "\033j", keys, 16));
+    ASSERT_EQ(BYTE_ESC, keys[0].c);
+    ASSERT_EQ(0, keys[0].control);
+    ASSERT_EQ('j', keys[1].c);
+
+    // Unknown sequences are dropped; ESC O followed by a non-key is typed.
+    ASSERT_EQ(1, decode_test_input(&dec, "\033[<0;1;2M\033[15~x", keys, 16));
+    ASSERT_EQ('x', keys[0].c);
+    ASSERT_EQ(2, dec.dropped);
+    ASSERT_EQ(3, decode_test_input(&dec, "\033Ox", keys, 16));
+    ASSERT_EQ(BYTE_ESC, keys[0].c);
+    ASSERT_EQ('O', keys[1].c);
+    ASSERT_EQ('x', keys[2].c);
+
+    InputDecoder_destroy(&dec);
+}
+
+UTEST(InputDecoder, timeout) {
+    InputDecoder dec;
+    inplace_make_InputDecoder(&dec);
+    InputKey keys[4];
+
+    ASSERT_EQ(0, decode_test_input(&dec, "\033", keys, 4));
+    ASSERT_TRUE(InputDecoder_pending(&dec));
+    InputDecoder_timeout(&dec);
+    ASSERT_EQ(1, decode_test_input(&dec, "", keys, 4));
+    ASSERT_EQ(BYTE_ESC, keys[0].c);
+    ASSERT_EQ(0, keys[0].control);
+
+    // A cut off sequence comes out as the keys it was.
+    ASSERT_EQ(0, decode_test_input(&dec, "\033[1", keys, 4));
+    InputDecoder_timeout(&dec);
+    ASSERT_EQ(3, decode_test_input(&dec, "", keys, 4));
+    ASSERT_EQ('[', keys[1].c);
+    ASSERT_EQ('1', keys[2].c);
+    ASSERT_FALSE(InputDecoder_pending(&dec));
+
+    InputDecoder_destroy(&dec);
+}
+
+void _input_test_timeout(int fd, void* data) {
+    InputDecoder_timeout(data);
+}
+
+UTEST(InputDecoder, timer) {
+    InputDecoder dec;
+    inplace_make_InputDecoder(&dec);
+    EventLoop loop = {0};
+    int timer = EventLoop_add_timer(&loop, _input_test_timeout, &dec);
+    // Something else waking the loop more often than the timeout.
+    struct EventRecord ticks = {0};
+    int ticker = EventLoop_add_timer(&loop, record_test_event, &ticks);
+    EventLoop_set_timer(ticker, 2, true);
+
+    ASSERT_EQ(-1, InputDecoder_timer_ms(&dec));
+    InputDecoder_feed(&dec, "\033", 1);
+    // The main loop, until the ESC comes out (or it's clearly stuck).
+    InputKey key;
+    bool decoded = false;
+    for (int i = 0; i < 200 && !decoded; ++i) {
+        decoded = InputDecoder_next(&dec, &key);
+        if (!decoded) {
+            double ms = InputDecoder_timer_ms(&dec);
+            if (ms >= 0) {
+                EventLoop_set_timer(timer, ms, false);
+            }
+            EventLoop_run_once(&loop, -1);
+        }
+    }
+    ASSERT_TRUE(decoded);
+    ASSERT_EQ(BYTE_ESC, key.c);
+    ASSERT_EQ(0, key.control);
+    ASSERT_GE(ticks.calls, 5);
+    // Disarmed once nothing is pending; a new ESC arms it again.
+    ASSERT_EQ(0, InputDecoder_timer_ms(&dec));
+    ASSERT_EQ(-1, InputDecoder_timer_ms(&dec));
+    InputKey keys[2];
+    ASSERT_EQ(0, decode_test_input(&dec, "\033", keys, 2));
+    ASSERT_EQ(INPUT_ESC_TIMEOUT_MS, InputDecoder_timer_ms(&dec));
+    ASSERT_EQ(-1, InputDecoder_timer_ms(&dec));
+    // A sequence finished and another started in the same read: armed anew.
+    ASSERT_EQ(1, decode_test_input(&dec, "[A\033", keys, 2));
+    ASSERT_EQ(INPUT_ESC_TIMEOUT_MS, InputDecoder_timer_ms(&dec));
+
+    EventLoop_destroy(&loop);
+    InputDecoder_destroy(&dec);
+}
+
+UTEST(InputDecoder, paste) {
+    InputDecoder dec;
+    inplace_make_InputDecoder(&dec);
+    InputKey keys[4];
+
+    // ESCs in the text, and an end marker split across reads.
+    ASSERT_EQ(1, decode_test_input(&dec, "a\033[200~x\ny\033[20z\033", keys, 4));
+    ASSERT_EQ('a', keys[0].c);
+    ASSERT_EQ(2, decode_test_input(&dec, "[201~b", keys, 4));
+    ASSERT_EQ(CODE_PASTE, keys[0].control);
+    ASSERT_STREQ("x\ny\033[20z", dec.paste->data);
+    ASSERT_EQ('b', keys[1].c);
+
+    InputDecoder_destroy(&dec);
+}
+
+UTEST(InputDecoder, read) {
+    InputDecoder dec;
+    inplace_make_InputDecoder(&dec);
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    ASSERT_EQ(-1, InputDecoder_read(&dec, fds[0]));
+
+    // Wraps around the ring: the arrow keys straddle its end.
+    char data[INPUT_RING_SIZE / 2];
+    size_t count = 0;
+    InputKey key;
+    for (int round = 0; round < 5; ++round) {
+        memset(data, 'x', sizeof(data));
+        memcpy(data + sizeof(data) - 2, "\033[", 2);
+        ASSERT_EQ(sizeof(data), write(fds[1], data, sizeof(data)));
+        ASSERT_EQ(sizeof(data), InputDecoder_read(&dec, fds[0]));
+        ASSERT_EQ(1, write(fds[1], "A", 1));
+        ASSERT_EQ(1, InputDecoder_read(&dec, fds[0]));
+        while (InputDecoder_next(&dec, &key)) {
+            count += (key.control == BYTE_UPARROW) ? 1000 : 1;
+        }
+    }
+    ASSERT_EQ(5 * (1000 + sizeof(data) - 2), count);
+
+    close(fds[1]);
+    ASSERT_EQ(0, InputDecoder_read(&dec, fds[0]));
+    close(fds[0]);
+    InputDecoder_destroy(&dec);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "../structures/iov_writer.h"
+
+UTEST(IovWriter, batches) {
+    FILE* f = tmpfile();
+    IovWriter w;
+    inplace_make_IovWriter(&w, fileno(f));
+    const char* parts[] = { "ab", "", "c\n" };
+    for (size_t i = 0; i < 3 * IOW_BATCH; ++i) {
+        IovWriter_add(&w, parts[i % 3], strlen(parts[i % 3]));
+    }
+    ASSERT_TRUE(IovWriter_flush(&w));
+    // Empty ranges aren't queued.
+    ASSERT_EQ(2, w.calls);
+    ASSERT_EQ(4 * IOW_BATCH, w.written);
+
+    char contents[9] = {0};
+    ASSERT_EQ(8, pread(fileno(f), contents, 8, 4 * IOW_BATCH - 8));
+    ASSERT_STREQ("abc\nabc\n", contents);
+    fclose(f);
+}
+
+UTEST(IovWriter, failure) {
+    IovWriter w;
+    inplace_make_IovWriter(&w, -1);
+    IovWriter_add(&w, "abc", 3);
+    ASSERT_FALSE(IovWriter_flush(&w));
+    // Sticky.
+    ASSERT_FALSE(IovWriter_flush(&w));
+    ASSERT_EQ(0, w.written);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "../structures/line_diff.h"
+
+/**
+ * Apply `hunks` to `a`, into `out`. Return: the length of the result.
+ */
+size_t apply_test_hunks(const uint64_t* a, size_t n, const uint64_t* b,
+                        DiffHunk* hunks, size_t num_hunks, uint64_t* out) {
+    size_t length = 0;
+    size_t pos = 0;
+    for (size_t i = 0; i < num_hunks; ++i) {
+        while (pos < hunks[i].a_start) {
+            out[length++] = a[pos++];
+        }
+        for (size_t j = 0; j < hunks[i].b_count; ++j) {
+            out[length++] = b[hunks[i].b_start + j];
+        }
+        pos += hunks[i].a_count;
+    }
+    while (pos < n) {
+        out[length++] = a[pos++];
+    }
+    return length;
+}
+
+UTEST(line_diff, hunks) {
+    uint64_t a[] = {1, 2, 3, 4, 5, 6, 7};
+    uint64_t b[] = {1, 9, 3, 4, 6, 7, 8};
+    size_t num_hunks;
+    DiffHunk* hunks = line_diff(a, 7, b, 7, 100, &num_hunks);
+    ASSERT_EQ(3, num_hunks);
+    // Replace, delete, insert.
+    ASSERT_EQ(1, hunks[0].a_start);
+    ASSERT_EQ(1, hunks[0].a_count);
+    ASSERT_EQ(1, hunks[0].b_start);
+    ASSERT_EQ(1, hunks[0].b_count);
+    ASSERT_EQ(4, hunks[1].a_start);
+    ASSERT_EQ(1, hunks[1].a_count);
+    ASSERT_EQ(0, hunks[1].b_count);
+    ASSERT_EQ(7, hunks[2].a_start);
+    ASSERT_EQ(0, hunks[2].a_count);
+    ASSERT_EQ(6, hunks[2].b_start);
+    ASSERT_EQ(1, hunks[2].b_count);
+    free(hunks);
+
+    hunks = line_diff(a, 7, a, 7, 100, &num_hunks);
+    ASSERT_EQ(0, num_hunks);
+    free(hunks);
+
+    // Too different: one hunk for the middle.
+    hunks = line_diff(a, 7, b, 7, 2, &num_hunks);
+    ASSERT_EQ(1, num_hunks);
+    ASSERT_EQ(1, hunks[0].a_start);
+    ASSERT_EQ(6, hunks[0].a_count);
+    ASSERT_EQ(6, hunks[0].b_count);
+    free(hunks);
+}
+
+UTEST(line_diff, random) {
+    srand(11);
+    uint64_t a[200], b[200], out[400];
+    for (int round = 0; round < 200; ++round) {
+        size_t n = rand() % 200;
+        size_t m = 0;
+        for (size_t i = 0; i < n; ++i) {
+            a[i] = rand() % 8;
+        }
+        // b: a with some lines changed, dropped and added.
+        for (size_t i = 0; i < n && m < 199; ++i) {
+            int r = rand() % 10;
+            if (r == 0) continue;
+            if (r == 1) b[m++] = rand() % 8;
+            b[m++] = (r == 2) ? 100 + rand() % 8 : a[i];
+        }
+        size_t num_hunks;
+        DiffHunk* hunks = line_diff(a, n, b, m, (round % 2) ? 1000 : 5, &num_hunks);
+        ASSERT_EQ(m, apply_test_hunks(a, n, b, hunks, num_hunks, out));
+        for (size_t i = 0; i < m; ++i) {
+            ASSERT_EQ(b[i], out[i]);
+        }
+        for (size_t i = 1; i < num_hunks; ++i) {
+            ASSERT_LT(hunks[i - 1].a_start + hunks[i - 1].a_count, hunks[i].a_start);
+        }
+        free(hunks);
+    }
+}
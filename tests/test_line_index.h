@@ -0,0 +1,80 @@
+#pragma once
+
+#include "../structures/line_index.h"
+
+UTEST(LineIndex, matches_scan) {
+    srand(14);
+    char line[600];
+    LineIndex idx;
+    inplace_make_LineIndex(&idx);
+    int widths[] = {1, 4, 8};
+    for (int round = 0; round < 100; ++round) {
+        TAB_WIDTH = widths[round % 3];
+        size_t length = rand() % 500;
+        for (size_t i = 0; i < length; ++i) {
+            line[i] = (rand() % 4 == 0) ? '\t' : 'a' + rand() % 26;
+        }
+        if (length > 0 && round % 2) {
+            line[length - 1] = '\n';
+        }
+        line[length] = 0;
+        LineIndex_build(&idx, line, length, TAB_WIDTH);
+        // `line` is on the stack, so these scan.
+        ASSERT_EQ(strlen_tab(line), idx.width);
+        for (size_t i = 0; i <= length; ++i) {
+            ASSERT_EQ(line_pos_ptr(line, line + i), LineIndex_column(&idx, i));
+        }
+        for (size_t x = 0; x < idx.columns + 4; ++x) {
+            ASSERT_EQ(line_pos(line, x) - line, LineIndex_offset(&idx, x));
+        }
+    }
+    TAB_WIDTH = STANDARD_TAB_WIDTH;
+    LineIndex_destroy(&idx);
+}
+
+UTEST(LineIndex, cursor_line) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT_NE(-1, fd);
+    // A long line of tabs and text.
+    for (int i = 0; i < 200; ++i) {
+        ASSERT_EQ(4, write(fd, "\tabc", 4));
+    }
+    ASSERT_EQ(3, write(fd, "\nx\n", 3));
+    close(fd);
+
+    Buffer* buf = make_Buffer_storage(filename, BS_LINES);
+    String* line = *Buffer_get_line_abs(buf, 0);
+    LineIndex* idx = Buffer_cursor_line_index(buf, line->data, 4);
+    ASSERT_TRUE(idx != NULL);
+    // 4 + 3, then 1 + 3 for each of the rest.
+    ASSERT_EQ(7 + 199 * 4, idx->width);
+    ASSERT_EQ(4, LineIndex_offset(idx, 7));
+    ASSERT_EQ(5, LineIndex_offset(idx, 8));
+    ASSERT_EQ(idx, Buffer_cursor_line_index(buf, line->data, 4));
+    // Not the cursor's line, or too short.
+    ASSERT_TRUE(Buffer_cursor_line_index(buf, line->data + 1, 4) == NULL);
+    buf->cursor_row = 1;
+    ASSERT_TRUE(Buffer_cursor_line_index(buf, (*Buffer_get_line_abs(buf, 1))->data, 4) == NULL);
+    buf->cursor_row = 0;
+
+    // An edit that keeps the line's length (and String) rebuilds it.
+    String* old = make_String("\ta");
+    Edit* ed = make_Edit(1, 0, 0, old);
+    free(old);
+    free(ed->new_content);
+    ed->new_content = make_String("ab");
+    Buffer_apply_Edit(buf, ed);
+    Edit_destroy(ed);
+    free(ed);
+    ASSERT_EQ(line, *Buffer_get_line_abs(buf, 0));
+    idx = Buffer_cursor_line_index(buf, line->data, 4);
+    ASSERT_TRUE(idx != NULL);
+    ASSERT_EQ(2, LineIndex_offset(idx, 2));
+    ASSERT_EQ(4, LineIndex_offset(idx, 5));
+    ASSERT_EQ(8, LineIndex_column(idx, 5));
+
+    Buffer_destroy(buf);
+    free(buf);
+    unlink(filename);
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "../structures/line_scan.h"
+
+typedef const char* (*test_scan_fn)(const char*, const char*);
+
+/**
+ * Check a scanner against memchr for every (start, end) pair over a buffer
+ * with newlines at awkward places.
+ */
+bool _check_scanner(test_scan_fn scan) {
+    char data[300];
+    memset(data, 'x', sizeof(data));
+    size_t positions[] = { 0, 7, 8, 31, 32, 63, 64, 65, 130, 299 };
+    for (size_t p = 0; p < sizeof(positions) / sizeof(size_t); ++p) {
+        data[positions[p]] = '\n';
+        for (size_t start = 0; start < 70; ++start) {
+            for (size_t end = start; end <= sizeof(data); ++end) {
+                const char* expected = memchr(data + start, '\n', end - start);
+                if (scan(data + start, data + end) != expected) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Same, for a tab/newline scanner: tabs and newlines alternate.
+ */
+bool _check_tab_scanner(test_scan_fn scan) {
+    char data[300];
+    memset(data, 'x', sizeof(data));
+    size_t positions[] = { 299, 130, 65, 64, 63, 32, 31, 8, 7, 0 };
+    for (size_t p = 0; p < sizeof(positions) / sizeof(size_t); ++p) {
+        data[positions[p]] = (p % 2) ? '\t' : '\n';
+        for (size_t start = 0; start < 70; ++start) {
+            for (size_t end = start; end <= sizeof(data); ++end) {
+                const char* expected = NULL;
+                for (size_t i = start; i < end && expected == NULL; ++i) {
+                    if (data[i] == '\t' || data[i] == '\n') expected = data + i;
+                }
+                if (scan(data + start, data + end) != expected) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+typedef const char* (*test_substr_fn)(const char*, const char*, const char*, size_t);
+
+/**
+ * Check a forward or backward substring search against a plain loop, for
+ * needles of several lengths, at and around block boundaries.
+ */
+bool _check_substr(test_substr_fn scan, bool backward) {
+    char data[200];
+    const char* needles[] = { "a", "ab", "aab", "abcabd", "abcdefghijklmnopqrstuvwxyz0123456789" };
+    srand(22);
+    for (size_t n = 0; n < sizeof(needles) / sizeof(needles[0]); ++n) {
+        const char* needle = needles[n];
+        size_t length = strlen(needle);
+        for (int round = 0; round < 20; ++round) {
+            // Mostly bytes of the needle, so there are near misses and overlaps.
+            for (size_t i = 0; i < sizeof(data); ++i) {
+                data[i] = (rand() % 8) ? needle[rand() % length] : 'x';
+            }
+            if (round % 2) {
+                memcpy(data + rand() % (sizeof(data) - length), needle, length);
+            }
+            for (size_t start = 0; start < 40; ++start) {
+                for (size_t end = start; end <= sizeof(data); end += 1 + (end > 80) * 7) {
+                    const char* expected = NULL;
+                    for (size_t i = start; i + length <= end; ++i) {
+                        if (memcmp(data + i, needle, length) == 0) {
+                            expected = data + i;
+                            if (!backward) break;
+                        }
+                    }
+                    if (scan(data + start, data + end, needle, length) != expected) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+UTEST(line_scan, substr) {
+    ASSERT_TRUE(_check_substr(&scan_substr_scalar, false));
+    ASSERT_TRUE(_check_substr(&scan_substr_last_scalar, true));
+#ifdef LINE_SCAN_X86
+    if (line_scan_has_sse2()) {
+        ASSERT_TRUE(_check_substr(&scan_substr_sse2, false));
+        ASSERT_TRUE(_check_substr(&scan_substr_last_sse2, true));
+    }
+    if (line_scan_has_avx2()) {
+        ASSERT_TRUE(_check_substr(&scan_substr_avx2, false));
+        ASSERT_TRUE(_check_substr(&scan_substr_last_avx2, true));
+    }
+#endif
+    ASSERT_TRUE(_check_substr(&scan_substr, false));
+    ASSERT_TRUE(_check_substr(&scan_substr_last, true));
+}
+
+UTEST(line_scan, scalar) {
+    ASSERT_TRUE(_check_scanner(&scan_newline_scalar));
+    ASSERT_TRUE(_check_tab_scanner(&scan_tab_newline_scalar));
+}
+
+UTEST(line_scan, simd) {
+#ifdef LINE_SCAN_X86
+    if (line_scan_has_sse2()) {
+        ASSERT_TRUE(_check_scanner(&scan_newline_sse2));
+    }
+    if (line_scan_has_avx2()) {
+        ASSERT_TRUE(_check_scanner(&scan_newline_avx2));
+    }
+#endif
+    ASSERT_TRUE(_check_scanner(&scan_newline));
+
+#ifdef LINE_SCAN_X86
+    if (line_scan_has_sse2()) {
+        ASSERT_TRUE(_check_tab_scanner(&scan_tab_newline_sse2));
+    }
+    if (line_scan_has_avx2()) {
+        ASSERT_TRUE(_check_tab_scanner(&scan_tab_newline_avx2));
+    }
+#endif
+    ASSERT_TRUE(_check_tab_scanner(&scan_tab_newline));
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "../structures/line_tree.h"
+#include "test_utils.h"
+
+/**
+ * Check the tree against a reference vector, and check the node invariants.
+ */
+#define ASSERT_LT_VEC_EQ(t, v) \
+do { \
+    ASSERT_EQ((v)->size, LineTree_size(t)); \
+    for (size_t __i = 0; __i < (v)->size; ++__i) { \
+        ASSERT_EQ((v)->elements[__i], LineTree_get((t), __i)); \
+    } \
+    ASSERT_TRUE(_LineTree_check((t)->root, true)); \
+} while (0);
+
+bool _LineTree_check(LineTreeNode* node, bool root) {
+    if (node->size > LT_ORDER) return false;
+    if (node->leaf) return node->count == node->size;
+    if (!root && node->size < LT_MIN) return false;
+    size_t count = 0;
+    for (size_t i = 0; i < node->size; ++i) {
+        LineTreeNode* child = node->slots[i];
+        if (child->leaf != ((LineTreeNode*) node->slots[0])->leaf) return false;
+        if (!_LineTree_check(child, false)) return false;
+        count += child->count;
+    }
+    return count == node->count;
+}
+
+UTEST(LineTree, make_LineTree) {
+    LineTree t;
+    inplace_make_LineTree(&t);
+    ASSERT_EQ(0, LineTree_size(&t));
+    LineTree_push(&t, (void*) 1);
+    LineTree_push(&t, (void*) 2);
+    LineTree_insert(&t, 0, (void*) 0);
+    ASSERT_EQ(3, LineTree_size(&t));
+    ASSERT_EQ((void*) 0, LineTree_get(&t, 0));
+    ASSERT_EQ((void*) 2, LineTree_get(&t, 2));
+    LineTree_destroy(&t);
+}
+
+UTEST(LineTree, from_span) {
+    Vector v;
+    LineTree t;
+    size_t n = LT_ORDER * LT_ORDER * 2 + 5;
+    inplace_make_Vector(&v, n);
+    for (size_t i = 0; i < n; ++i) {
+        Vector_push(&v, (void*) i);
+    }
+    inplace_make_LineTree_from(&t, v.elements, v.size);
+    ASSERT_LT_VEC_EQ(&t, &v);
+
+    void** span;
+    size_t i = 0;
+    while (i < n) {
+        size_t k = LineTree_span(&t, i, &span);
+        ASSERT_LT(0, k);
+        for (size_t j = 0; j < k; ++j) {
+            ASSERT_EQ((void*) (i + j), span[j]);
+        }
+        i += k;
+    }
+    ASSERT_EQ(n, i);
+
+    LineTree_destroy(&t);
+    Vector_destroy(&v);
+}
+
+UTEST(LineTree, random_ops) {
+    Vector v;
+    LineTree t;
+    inplace_make_Vector(&v, 10);
+    inplace_make_LineTree(&t);
+    srand(12345);
+    size_t next = 0;
+    void* removed[3000];
+
+    for (int round = 0; round < 400; ++round) {
+        int op = rand() % 3;
+        if (op < 2 || v.size == 0) {
+            size_t count = 1 + rand() % 40;
+            size_t idx = rand() % (v.size + 1);
+            for (size_t i = 0; i < count; ++i) {
+                Vector_insert(&v, idx + i, (void*) next);
+                LineTree_insert(&t, idx + i, (void*) next);
+                ++next;
+            }
+        }
+        else {
+            size_t a = rand() % v.size;
+            size_t b = a + rand() % (v.size - a + 1);
+            if (b - a > 3000) b = a + 3000;
+            LineTree_delete_range(&t, a, b, removed);
+            for (size_t i = a; i < b; ++i) {
+                ASSERT_EQ(v.elements[i], removed[i - a]);
+            }
+            Vector_delete_range(&v, a, b);
+        }
+        ASSERT_LT_VEC_EQ(&t, &v);
+    }
+
+    LineTree_delete_range(&t, 0, v.size, NULL);
+    ASSERT_EQ(0, LineTree_size(&t));
+    ASSERT_TRUE(t.root->leaf);
+
+    LineTree_destroy(&t);
+    Vector_destroy(&v);
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <fcntl.h>
+
+#include "../structures/piece_table.h"
+#include "test_utils.h"
+
+static char* piece_dat = "zero\none\ntwo\nthree\n";
+
+PieceTable* make_test_PieceTable(const char* data) {
+    return make_PieceTable(strdup(data), strlen(data));
+}
+
+/**
+ * Write `pt` out through a temp file. Returns the (malloc'd, NUL terminated)
+ * contents and their size.
+ */
+char* write_test_PieceTable(PieceTable* pt, size_t* size) {
+    FILE* f = tmpfile();
+    IovWriter w;
+    inplace_make_IovWriter(&w, fileno(f));
+    *size = PieceTable_write(pt, &w);
+    IovWriter_flush(&w);
+    char* ret = malloc(*size + 1);
+    ret[pread(fileno(f), ret, *size, 0)] = 0;
+    fclose(f);
+    return ret;
+}
+
+#define ASSERT_PT_LINE(pt, row, expected) \
+do { \
+    String* __line = PieceTable_get_line((pt), (row)); \
+    ASSERT_STREQ((expected), __line->data); \
+    free(__line); \
+} while (0);
+
+UTEST(PieceTable, make_PieceTable) {
+    PieceTable* pt = make_test_PieceTable(piece_dat);
+    ASSERT_EQ(5, PieceTable_num_lines(pt));
+    ASSERT_PT_LINE(pt, 0, "zero\n");
+    ASSERT_PT_LINE(pt, 3, "three\n");
+    ASSERT_PT_LINE(pt, 4, "");
+    PieceTable_destroy(pt);
+    free(pt);
+
+    pt = make_PieceTable(NULL, 0);
+    ASSERT_EQ(1, PieceTable_num_lines(pt));
+    ASSERT_PT_LINE(pt, 0, "");
+    PieceTable_destroy(pt);
+    free(pt);
+}
+
+UTEST(PieceTable, index_stride) {
+    // Enough lines to need several index entries.
+    String* data = alloc_String(10);
+    char line[20];
+    for (int i = 0; i < 5 * PT_INDEX_STRIDE + 3; ++i) {
+        sprintf(line, "%d\n", i);
+        Strcats(&data, line);
+    }
+    PieceTable* pt = make_test_PieceTable(data->data);
+    ASSERT_EQ(5 * PT_INDEX_STRIDE + 4, PieceTable_num_lines(pt));
+    for (int i = 0; i < 5 * PT_INDEX_STRIDE + 3; ++i) {
+        sprintf(line, "%d\n", i);
+        ASSERT_PT_LINE(pt, i, line);
+    }
+    PieceTable_destroy(pt);
+    free(pt);
+    free(data);
+}
+
+UTEST(PieceTable, lazy_scan) {
+    String* data = alloc_String(10);
+    char line[20];
+    for (int i = 0; i < 200; ++i) {
+        sprintf(line, "%d\n", i);
+        Strcats(&data, line);
+    }
+    PieceTable* pt = make_test_PieceTable(data->data);
+    ASSERT_EQ(0, pt->original_lines);
+
+    ASSERT_PT_LINE(pt, 40, "40\n");
+    ASSERT_EQ(41, pt->original_lines);
+    ASSERT_TRUE(PieceTable_has_line(pt, 50));
+    ASSERT_EQ(51, pt->original_lines);
+
+    // Edits near the top don't scan any further.
+    PieceTable_delete_lines(pt, 0, 10);
+    PieceTable_insert_line(pt, 0, "new\n", 4);
+    ASSERT_EQ(51, pt->original_lines);
+    ASSERT_PT_LINE(pt, 0, "new\n");
+    ASSERT_PT_LINE(pt, 1, "10\n");
+    // Rows past the scanned part come from the rest of the original.
+    ASSERT_PT_LINE(pt, 150, "159\n");
+
+    // Unscanned tail is still written out.
+    size_t out_size;
+    char* out = write_test_PieceTable(pt, &out_size);
+    ASSERT_EQ(0, strncmp("new\n", out, 4));
+    ASSERT_EQ(data->length - strlen("0\n1\n2\n3\n4\n5\n6\n7\n8\n9\n") + 4, out_size);
+    ASSERT_EQ(0, memcmp(out + 4, data->data + 20, out_size - 4));
+    free(out);
+
+    ASSERT_FALSE(pt->scanned);
+    ASSERT_EQ(192, PieceTable_num_lines(pt));
+    ASSERT_TRUE(pt->scanned);
+    ASSERT_FALSE(PieceTable_has_line(pt, 192));
+    ASSERT_PT_LINE(pt, 191, "");
+
+    PieceTable_destroy(pt);
+    free(pt);
+    free(data);
+}
+
+UTEST(PieceTable, insert_delete) {
+    PieceTable* pt = make_test_PieceTable(piece_dat);
+
+    PieceTable_insert_line(pt, 1, "a\n", 2);
+    PieceTable_insert_line(pt, 2, "b\n", 2);
+    ASSERT_EQ(7, PieceTable_num_lines(pt));
+    // Sequential inserts share a piece.
+    ASSERT_EQ(3, pt->pieces.size);
+    ASSERT_PT_LINE(pt, 0, "zero\n");
+    ASSERT_PT_LINE(pt, 1, "a\n");
+    ASSERT_PT_LINE(pt, 2, "b\n");
+    ASSERT_PT_LINE(pt, 3, "one\n");
+
+    // Line without a trailing newline is still its own line.
+    PieceTable_insert_line(pt, 0, "", 0);
+    ASSERT_EQ(8, PieceTable_num_lines(pt));
+    ASSERT_PT_LINE(pt, 0, "");
+    ASSERT_PT_LINE(pt, 1, "zero\n");
+
+    PieceTable_delete_lines(pt, 1, 4);
+    ASSERT_EQ(5, PieceTable_num_lines(pt));
+    ASSERT_PT_LINE(pt, 0, "");
+    ASSERT_PT_LINE(pt, 1, "one\n");
+    ASSERT_PT_LINE(pt, 4, "");
+
+    PieceTable_replace_line(pt, 2, "TWO\n", 4);
+    ASSERT_TRUE(PieceTable_line_equals(pt, 2, "TWO\n", 4));
+    ASSERT_FALSE(PieceTable_line_equals(pt, 2, "two\n", 4));
+
+    PieceTable_destroy(pt);
+    free(pt);
+}
+
+UTEST(PieceTable, write) {
+    PieceTable* pt = make_test_PieceTable(piece_dat);
+    PieceTable_delete_lines(pt, 0, 1);
+    PieceTable_insert_line(pt, 3, "four\n", 5);
+
+    size_t written;
+    char* out = write_test_PieceTable(pt, &written);
+    ASSERT_EQ(strlen("one\ntwo\nthree\nfour\n"), written);
+    ASSERT_STREQ("one\ntwo\nthree\nfour\n", out);
+    free(out);
+
+    PieceTable_destroy(pt);
+    free(pt);
+}
+
+UTEST(PieceTable, budget) {
+    // 6 blocks of 8 byte lines, against a budget of a few blocks.
+    const size_t num_lines = 6 * PT_BLOCK_SIZE / 8;
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT_NE(-1, fd);
+    FILE* f = fdopen(fd, "w+");
+    char line[20];
+    for (size_t i = 0; i < num_lines; ++i) {
+        fprintf(f, "%07zu\n", i);
+    }
+    fflush(f);
+    PieceTable* pt = make_PieceTable_mapped(fd);
+    fclose(f);
+    remove(filename);
+    ASSERT_TRUE(pt != NULL);
+    size_t budget = 4 * PT_BLOCK_SIZE;
+    PieceTable_set_budget(pt, budget);
+    ASSERT_EQ(PT_LARGE_INDEX_STRIDE, pt->index_stride);
+
+    ASSERT_EQ(num_lines + 1, PieceTable_num_lines(pt));
+    ASSERT_LE(pt->window.size * PT_BLOCK_SIZE, budget);
+    for (size_t i = 0; i < num_lines; i += num_lines / 7) {
+        sprintf(line, "%07zu\n", i);
+        ASSERT_PT_LINE(pt, i, line);
+    }
+    ASSERT_LE(pt->window.size * PT_BLOCK_SIZE, budget);
+
+    // Past a quarter of the budget, added lines move to a scratch file.
+    ASSERT_EQ(-1, pt->spill_fd);
+    size_t added = budget / 4 / 8 + 1;
+    for (size_t i = 0; i < added; ++i) {
+        PieceTable_insert_line(pt, i + 1, "added!!\n", 8);
+    }
+    ASSERT_NE(-1, pt->spill_fd);
+    ASSERT_PT_LINE(pt, 0, "0000000\n");
+    ASSERT_PT_LINE(pt, added, "added!!\n");
+    ASSERT_PT_LINE(pt, added + 1, "0000001\n");
+    // Walking backwards through the original uses the previous lookup.
+    for (size_t i = num_lines - 1; i > num_lines - 3 * PT_LARGE_INDEX_STRIDE; --i) {
+        sprintf(line, "%07zu\n", i);
+        ASSERT_PT_LINE(pt, added + i, line);
+    }
+    ASSERT_LE(pt->window.size * PT_BLOCK_SIZE, budget);
+
+    size_t out_size;
+    char* out = write_test_PieceTable(pt, &out_size);
+    ASSERT_EQ((num_lines + added) * 8, out_size);
+    ASSERT_EQ(0, memcmp("0000000\nadded!!\nadded!!\n", out, 24));
+    sprintf(line, "%07zu\n", num_lines - 1);
+    ASSERT_EQ(0, memcmp(line, out + out_size - 8, 8));
+    free(out);
+
+    PieceTable_destroy(pt);
+    free(pt);
+}
+
+UTEST(PieceTable, file_cut_short) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    write_numbered_lines(filename, 10000);
+    int fd = open(filename, O_RDONLY);
+    PieceTable* pt = make_PieceTable_mapped(fd);
+    close(fd);
+    ASSERT_TRUE(pt != NULL);
+    ASSERT_PT_LINE(pt, 0, "line 0\n");
+
+    // Cut short by someone else, with most of it not scanned yet.
+    ASSERT_EQ(0, truncate(filename, 4096));
+    ASSERT_FALSE(pt->lost);
+    // Reading past the new end gets zeros instead of SIGBUS.
+    size_t num_lines = PieceTable_num_lines(pt);
+    ASSERT_TRUE(pt->lost);
+    ASSERT_LT(num_lines, 1000);
+    ASSERT_PT_LINE(pt, 1, "line 1\n");
+    size_t length;
+    const char* last = PieceTable_line_span(pt, num_lines - 1, &length);
+    ASSERT_EQ(0, last[length - 1]);
+
+    // What is left can still be copied.
+    ASSERT_TRUE(PieceTable_detach(pt));
+    ASSERT_TRUE(pt->detached);
+    ASSERT_PT_LINE(pt, 1, "line 1\n");
+
+    PieceTable_destroy(pt);
+    free(pt);
+    remove(filename);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "../structures/regex_cache.h"
+
+UTEST(RegexCache, hits) {
+    RegexCache cache = {0};
+    const regex_t* a = RegexCache_get(&cache, "fo*", 0);
+    ASSERT_NE(NULL, a);
+    ASSERT_EQ(a, RegexCache_get(&cache, "fo*", 0));
+    ASSERT_EQ(1, cache.misses);
+    ASSERT_EQ(1, cache.hits);
+    ASSERT_EQ(0, regexec(a, "xfoo", 0, NULL, 0));
+
+    // Flags are part of the key.
+    const regex_t* b = RegexCache_get(&cache, "fo*", REG_ICASE);
+    ASSERT_NE(a, b);
+    ASSERT_EQ(0, regexec(b, "FOO", 0, NULL, 0));
+    ASSERT_NE(0, regexec(a, "FOO", 0, NULL, 0));
+    ASSERT_EQ(2, cache.misses);
+
+    // Bad patterns are remembered as bad.
+    ASSERT_EQ(NULL, RegexCache_get(&cache, "a\\{", 0));
+    ASSERT_EQ(NULL, RegexCache_get(&cache, "a\\{", 0));
+    ASSERT_EQ(3, cache.misses);
+    RegexCache_destroy(&cache);
+}
+
+UTEST(RegexCache, lru) {
+    RegexCache cache = {0};
+    char pattern[16];
+    for (int i = 0; i < REGEX_CACHE_SIZE; ++i) {
+        sprintf(pattern, "p%d", i);
+        RegexCache_get(&cache, pattern, 0);
+    }
+    // Use p0, so p1 is the oldest; a new pattern replaces it.
+    RegexCache_get(&cache, "p0", 0);
+    RegexCache_get(&cache, "new", 0);
+    ASSERT_EQ(REGEX_CACHE_SIZE + 1, cache.misses);
+    RegexCache_get(&cache, "p0", 0);
+    RegexCache_get(&cache, "p2", 0);
+    ASSERT_EQ(REGEX_CACHE_SIZE + 1, cache.misses);
+    const regex_t* p1 = RegexCache_get(&cache, "p1", 0);
+    ASSERT_EQ(REGEX_CACHE_SIZE + 2, cache.misses);
+    ASSERT_EQ(0, regexec(p1, "p1", 0, NULL, 0));
+    RegexCache_destroy(&cache);
+}
+
+UTEST(RegexCache, literal) {
+    ASSERT_TRUE(regex_is_literal("foo_bar(1) + {x}?", 0));
+    ASSERT_FALSE(regex_is_literal("foo_bar(1) + {x}?", REG_EXTENDED));
+    ASSERT_FALSE(regex_is_literal("foo", REG_ICASE));
+    const char* special[] = { "a.b", "a[b]", "a\\.", "ab*", "^a", "a$" };
+    for (size_t i = 0; i < sizeof(special) / sizeof(special[0]); ++i) {
+        ASSERT_FALSE(regex_is_literal(special[i], 0));
+    }
+}
+
+UTEST(Buffer, find_str_compiles_once) {
+    Buffer buf;
+    inplace_make_Buffer(&buf, "./tests/multi_line_text.txt");
+    EditorContext ctx;
+    ctx.jump_row = 0;
+    ctx.jump_col = 0;
+    size_t misses = regex_cache.misses;
+    // Not in the file: every line is searched.
+    ASSERT_EQ(-1, Buffer_find_str(&buf, &ctx, "not [i]n the file", true, true));
+    ASSERT_EQ(-1, Buffer_find_str(&buf, &ctx, "not [i]n the file", true, false));
+    ASSERT_EQ(misses + 1, regex_cache.misses);
+    Buffer_destroy(&buf);
+}
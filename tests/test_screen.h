@@ -0,0 +1,136 @@
+#pragma once
+
+#include "../editor/screen.h"
+
+/**
+ * Flush `s` into a temp file, and return what was written (malloc'd).
+ */
+char* flush_test_Screen(Screen* s) {
+    FILE* f = tmpfile();
+    size_t n = Screen_flush(s, fileno(f));
+    char* ret = calloc(n + 1, 1);
+    if (n > 0) {
+        pread(fileno(f), ret, n, 0);
+    }
+    fclose(f);
+    return ret;
+}
+
+UTEST(Screen, diff) {
+    Screen s;
+    inplace_make_Screen(&s, 4, 10);
+    const char* frame = "\033[1;1H\033[0Khello\n\033[0Kworld\n";
+    Screen_write(&s, frame, strlen(frame));
+    char* out = flush_test_Screen(&s);
+    // First frame: clear, then just the text.
+    ASSERT_STREQ("\033[m\033[H\033[2Jhello\r\nworld\r\n", out);
+    ASSERT_EQ(1, s.frame_writes);
+    free(out);
+
+    // Nothing to do.
+    out = flush_test_Screen(&s);
+    ASSERT_STREQ("", out);
+    ASSERT_EQ(0, s.frame_writes);
+    free(out);
+
+    // Same frame again: only the cursor has to go back.
+    Screen_write(&s, frame, strlen(frame));
+    out = flush_test_Screen(&s);
+    ASSERT_STREQ("", out);
+    free(out);
+
+    // One cell changed, and the cursor moved.
+    const char* edit = "\033[2;1H\033[0Kwould\033[2;3H";
+    Screen_write(&s, edit, strlen(edit));
+    out = flush_test_Screen(&s);
+    ASSERT_STREQ("\033[2;3Hu\033[D", out);
+    ASSERT_EQ(strlen(out), s.frame_bytes);
+    ASSERT_EQ(1, s.frame_writes);
+    free(out);
+
+    // Shorter line: cleared with EL. Reverse video.
+    const char* shorter = "\033[1;1H\033[0K\033[7mhe\033[0m";
+    Screen_write(&s, shorter, strlen(shorter));
+    out = flush_test_Screen(&s);
+    ASSERT_STREQ("\033[H\033[7mhe\033[m\033[K", out);
+    free(out);
+
+    // Invalidated: everything is drawn again.
+    Screen_invalidate(&s);
+    out = flush_test_Screen(&s);
+    ASSERT_STREQ("\033[m\033[H\033[2J\033[7mhe\r\n\033[mwould\033[1;3H", out);
+    free(out);
+    ASSERT_EQ(4, s.total_writes);
+    Screen_destroy(&s);
+}
+
+UTEST(Screen, utf8) {
+    Screen s;
+    inplace_make_Screen(&s, 2, 16);
+    // 11 columns on the terminal, 13 bytes (cells).
+    const char* frame = "\033[1;1H\033[0Kh\xc3\xa9llo w\xc3\xb6rld\n\033[0Kplain";
+    Screen_write(&s, frame, strlen(frame));
+    free(flush_test_Screen(&s));
+
+    // A change after the multibyte characters: the row is sent whole, so
+    // it lands in the right column.
+    const char* edit = "\033[1;1H\033[0Kh\xc3\xa9llo w\xc3\xb6rlD\033[2;1H";
+    Screen_write(&s, edit, strlen(edit));
+    char* out = flush_test_Screen(&s);
+    ASSERT_STREQ("\033[Hh\xc3\xa9llo w\xc3\xb6rlD\033[K\033[2H", out);
+    free(out);
+
+    // Back to ASCII: the old row's columns can't be trusted either.
+    const char* ascii = "\033[1;1H\033[0Khello world";
+    Screen_write(&s, ascii, strlen(ascii));
+    out = flush_test_Screen(&s);
+    ASSERT_STREQ("\033[Hhello world\033[K\033[1;12H", out);
+    free(out);
+
+    // Cut off by the right edge in the middle of a character: it isn't sent.
+    const char* wide = "\033[1;1H\033[0K0123456789abcde\xe2\x82\xac";
+    Screen_write(&s, wide, strlen(wide));
+    out = flush_test_Screen(&s);
+    ASSERT_STREQ("\r0123456789abcde\033[K\033[1;16H", out);
+    free(out);
+
+    // Unchanged: nothing is sent.
+    Screen_write(&s, wide, strlen(wide));
+    out = flush_test_Screen(&s);
+    ASSERT_STREQ("", out);
+    free(out);
+    Screen_destroy(&s);
+}
+
+UTEST(Screen, scroll) {
+    Screen s;
+    inplace_make_Screen(&s, 6, 4);
+    const char* frame = "top\nl1\nl2\nl3\nl4\nbar";
+    Screen_write(&s, frame, strlen(frame));
+    free(flush_test_Screen(&s));
+
+    // Rows 1-4 scroll up by one: only the new row is sent.
+    Screen_scroll(&s, 1, 5, 1);
+    const char* scrolled = "\033[2;1Hl2\nl3\nl4\nl5\n";
+    Screen_write(&s, scrolled, strlen(scrolled));
+    char* out = flush_test_Screen(&s);
+    ASSERT_STREQ("\033[2;5r\033[S\033[r\033[5Hl5\r\n", out);
+    free(out);
+
+    // And down by two.
+    Screen_scroll(&s, 1, 5, -2);
+    const char* back = "\033[2;1H\033[Kl0\n\033[Kl1\n\033[Kl2\n\033[Kl3\n";
+    Screen_write(&s, back, strlen(back));
+    out = flush_test_Screen(&s);
+    ASSERT_STREQ("\033[2;5r\033[2T\033[r\r\nl0\r\nl1\033[6H", out);
+    free(out);
+
+    // A wrong hint is ignored.
+    Screen_scroll(&s, 1, 5, 1);
+    const char* same = "\033[6;1H";
+    Screen_write(&s, same, strlen(same));
+    out = flush_test_Screen(&s);
+    ASSERT_STREQ("", out);
+    free(out);
+    Screen_destroy(&s);
+}
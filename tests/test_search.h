@@ -0,0 +1,322 @@
+#pragma once
+
+#include "../structures/search.h"
+#include "test_utils.h"
+
+/**
+ * Every match start of `pattern` in `text`, overlapping ones too, by trying
+ * each position (the reference Buffer_search is checked against).
+ * Return: how many (up to `max`).
+ */
+size_t _search_all_matches(const char* text, const SearchPattern* pattern, size_t* starts, size_t max) {
+    size_t n = 0;
+    size_t size = strlen(text);
+    for (size_t i = 0; i < size && n < max; ++i) {
+        if (pattern->literal) {
+            if (strncmp(text + i, pattern->text->data, Strlen(pattern->text)) == 0) {
+                starts[n++] = i;
+            }
+            continue;
+        }
+        regmatch_t pmatch = { i, size };
+        if (regexec(pattern->regex, text, 1, &pmatch, REG_STARTEND) == 0 && (size_t) pmatch.rm_so == i) {
+            starts[n++] = i;
+        }
+    }
+    return n;
+}
+
+/**
+ * Check Buffer_search against _search_all_matches, from every position of
+ * `buf` both ways.
+ */
+bool _check_search(Buffer* buf, const char* pattern_text) {
+    SearchPattern pattern;
+    inplace_make_SearchPattern(&pattern, pattern_text);
+    size_t num_lines = Buffer_get_num_lines(buf);
+    size_t* line_starts = malloc((num_lines + 1) * sizeof(size_t));
+    String* text = alloc_String(0);
+    for (size_t row = 0; row < num_lines; ++row) {
+        line_starts[row] = Strlen(text);
+        String* line = Buffer_dup_line(buf, row);
+        Strcat(&text, line);
+        free(line);
+    }
+    line_starts[num_lines] = Strlen(text);
+    size_t starts[4096];
+    size_t num_matches = _search_all_matches(text->data, &pattern, starts, 4096);
+
+    bool ok = true;
+    for (size_t row = 0; row < num_lines && ok; ++row) {
+        for (size_t col = 0; line_starts[row] + col < line_starts[row + 1] && ok; ++col) {
+            size_t pos = line_starts[row] + col;
+            for (int forward = 0; forward < 2; ++forward) {
+                ssize_t expected = -1;
+                for (size_t i = 0; i < num_matches; ++i) {
+                    if (forward && starts[i] > pos) {
+                        expected = starts[i];
+                        break;
+                    }
+                    if (!forward && starts[i] < pos) {
+                        expected = starts[i];
+                    }
+                }
+                SearchMatch match;
+                int result = Buffer_search(buf, &pattern, row, col, forward, &match);
+                if (result != (expected < 0 ? -1 : 0)) {
+                    ok = false;
+                }
+                else if (result == 0 && line_starts[match.row] + match.col != (size_t) expected) {
+                    ok = false;
+                }
+                if (!ok) {
+                    printf("/%s from (%zu, %zu) %s: got %d (%zu, %zu), expected offset %zd\n",
+                           pattern_text, row, col, forward ? "forward" : "backward",
+                           result, match.row, match.col, expected);
+                    break;
+                }
+            }
+        }
+    }
+    free(text);
+    free(line_starts);
+    SearchPattern_destroy(&pattern);
+    return ok;
+}
+
+/**
+ * A file of short random lines over "abc", with some empty ones.
+ */
+void _search_test_file(char* filename, size_t num_lines, bool trailing_newline) {
+    int fd = mkstemp(filename);
+    FILE* f = fdopen(fd, "w");
+    for (size_t i = 0; i < num_lines; ++i) {
+        size_t length = rand() % 9;
+        for (size_t j = 0; j < length; ++j) {
+            fputc('a' + rand() % 3, f);
+        }
+        if (i + 1 < num_lines || trailing_newline) {
+            fputc('\n', f);
+        }
+    }
+    fclose(f);
+}
+
+const char* _search_test_patterns[] = {
+    "ab", "cab", "a", "bb",             // Literal.
+    "a\\nb", "c\\n\\na",                // Literal, across lines.
+    "b[ac]", "^c", "a$", "^$", "ca*b",  // Regex.
+    "[ab]\\nc", "b$\\n^a",              // Regex, across lines.
+};
+
+UTEST(search, matches_reference) {
+    srand(23);
+    size_t save_chunk = SEARCH_CHUNK_SIZE;
+    size_t save_threads = SEARCH_THREADS;
+    size_t save_parallel = SEARCH_PARALLEL_BYTES;
+    size_t chunk_sizes[] = { 1 << 20, 16, 1 };
+    for (int storage = 0; storage < 2; ++storage) {
+        for (int trailing = 0; trailing < 2; ++trailing) {
+            char filename[] = "/tmp/txt_test_XXXXXX";
+            _search_test_file(filename, 60, trailing);
+            Buffer buf;
+            inplace_make_Buffer_storage(&buf, filename, storage ? BS_PIECES : BS_LINES);
+            // Edits, so a piece table has add pieces between original ones.
+            Buffer_insert_line(&buf, 10, make_String("abcab\n"));
+            Buffer_insert_line(&buf, 11, make_String("\n"));
+            Buffer_remove_lines(&buf, 30, 33, NULL);
+            // Changed in place, as the editor does (BS_PIECES: only in the line cache).
+            String_inserts(Buffer_get_line_abs(&buf, 20), 0, "cab");
+            Strcpys(Buffer_get_line_abs(&buf, 40), "b\n");
+
+            // BS_PIECES: also on 3 threads, whatever the size.
+            for (int threaded = 0; threaded <= storage; ++threaded) {
+                SEARCH_THREADS = threaded ? 3 : 1;
+                SEARCH_PARALLEL_BYTES = 0;
+                for (size_t c = 0; c < sizeof(chunk_sizes) / sizeof(size_t); ++c) {
+                    SEARCH_CHUNK_SIZE = chunk_sizes[c];
+                    for (size_t p = 0; p < sizeof(_search_test_patterns) / sizeof(char*); ++p) {
+                        EXPECT_TRUE(_check_search(&buf, _search_test_patterns[p]));
+                    }
+                }
+            }
+            SEARCH_CHUNK_SIZE = save_chunk;
+            SEARCH_THREADS = save_threads;
+            SEARCH_PARALLEL_BYTES = save_parallel;
+            Buffer_destroy(&buf);
+            remove(filename);
+        }
+    }
+}
+
+UTEST(search, pieces_in_place) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    write_numbered_lines(filename, 10000);
+    Buffer buf;
+    inplace_make_Buffer_storage(&buf, filename, BS_PIECES);
+    Buffer_insert_line(&buf, 5000, make_String("needle\n"));
+
+    SearchPattern pattern;
+    inplace_make_SearchPattern(&pattern, "line 9999");
+    SearchMatch match;
+    size_t copied = search_stats.copied;
+    ASSERT_EQ(0, Buffer_search(&buf, &pattern, 0, 0, true, &match));
+    ASSERT_EQ(10000, match.row);
+    ASSERT_EQ(0, match.col);
+    ASSERT_EQ(9, match.length);
+    SearchPattern_destroy(&pattern);
+
+    inplace_make_SearchPattern(&pattern, "ne*dle");
+    ASSERT_EQ(0, Buffer_search(&buf, &pattern, 9000, 0, false, &match));
+    ASSERT_EQ(5000, match.row);
+    ASSERT_EQ(6, match.length);
+    // Without line breaks in the pattern, nothing is copied.
+    ASSERT_EQ(copied, search_stats.copied);
+    SearchPattern_destroy(&pattern);
+
+    inplace_make_SearchPattern(&pattern, "4999\\nneedle\\nline 5000");
+    ASSERT_EQ(0, Buffer_search(&buf, &pattern, 0, 0, true, &match));
+    ASSERT_EQ(4999, match.row);
+    ASSERT_EQ(5, match.col);
+    SearchPattern_destroy(&pattern);
+
+    Buffer_destroy(&buf);
+    remove(filename);
+}
+
+UTEST(search, threaded) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    write_numbered_lines(filename, 100000);
+    Buffer buf;
+    inplace_make_Buffer_storage(&buf, filename, BS_PIECES);
+    Buffer_insert_line(&buf, 50000, make_String("needle\n"));
+    Buffer_insert_line(&buf, 90000, make_String("needle 2\n"));
+    size_t save_chunk = SEARCH_CHUNK_SIZE;
+    size_t save_threads = SEARCH_THREADS;
+    size_t save_parallel = SEARCH_PARALLEL_BYTES;
+    SEARCH_CHUNK_SIZE = 1024;
+    SEARCH_THREADS = 4;
+    SEARCH_PARALLEL_BYTES = 0;
+
+    const char* patterns[] = { "needle", "ne*dle" };
+    for (size_t p = 0; p < 2; ++p) {
+        SearchPattern pattern;
+        inplace_make_SearchPattern(&pattern, patterns[p]);
+        SearchMatch match;
+        size_t threads = search_stats.threads;
+        ASSERT_EQ(0, Buffer_search(&buf, &pattern, 0, 0, true, &match));
+        ASSERT_EQ(50000, match.row);
+        ASSERT_EQ(0, Buffer_search(&buf, &pattern, 50000, 0, true, &match));
+        ASSERT_EQ(90000, match.row);
+        ASSERT_EQ(0, Buffer_search(&buf, &pattern, 100001, 0, false, &match));
+        ASSERT_EQ(90000, match.row);
+        ASSERT_EQ(0, Buffer_search(&buf, &pattern, 90000, 0, false, &match));
+        ASSERT_EQ(50000, match.row);
+        ASSERT_EQ(-1, Buffer_search(&buf, &pattern, 90000, 0, true, &match));
+        ASSERT_EQ(threads + 5 * 3, search_stats.threads);
+
+        // A match in the first chunk: the rest (about 1000) aren't all searched.
+        size_t chunks = search_stats.chunks;
+        ASSERT_EQ(0, Buffer_search(&buf, &pattern, 49990, 0, true, &match));
+        ASSERT_EQ(50000, match.row);
+        ASSERT_LT(search_stats.chunks - chunks, 100);
+        SearchPattern_destroy(&pattern);
+    }
+
+    // Smaller than SEARCH_PARALLEL_BYTES: on this thread.
+    SEARCH_THREADS = 0;
+    SEARCH_PARALLEL_BYTES = save_parallel;
+    SearchPattern pattern;
+    inplace_make_SearchPattern(&pattern, "needle");
+    SearchMatch match;
+    size_t threads = search_stats.threads;
+    ASSERT_EQ(0, Buffer_search(&buf, &pattern, 0, 0, true, &match));
+    ASSERT_EQ(threads, search_stats.threads);
+    SearchPattern_destroy(&pattern);
+
+    SEARCH_CHUNK_SIZE = save_chunk;
+    SEARCH_THREADS = save_threads;
+    Buffer_destroy(&buf);
+    remove(filename);
+}
+
+/**
+ * A line of /proc/self/status, in kB (-1 if it isn't there).
+ */
+long _search_status_kb(const char* field) {
+    FILE* f = fopen("/proc/self/status", "r");
+    char line[256];
+    long kb = -1;
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, field, strlen(field)) == 0) {
+            kb = atol(line + strlen(field) + 1);
+        }
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    return kb;
+}
+
+UTEST(search, threaded_budget) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    int fd = mkstemp(filename);
+    FILE* f = fdopen(fd, "w");
+    const size_t num_lines = 48 * PT_BLOCK_SIZE / 8;
+    for (size_t i = 0; i < num_lines; ++i) {
+        fprintf(f, "%07zu\n", i);
+    }
+    fclose(f);
+    Buffer buf;
+    inplace_make_Buffer_storage(&buf, filename, BS_PIECES);
+    Buffer_set_memory_budget(&buf, 4 * PT_BLOCK_SIZE);
+    ASSERT_EQ(num_lines + 1, Buffer_get_num_lines(&buf));
+    size_t save_threads = SEARCH_THREADS;
+    size_t save_parallel = SEARCH_PARALLEL_BYTES;
+    SEARCH_THREADS = 4;
+    SEARCH_PARALLEL_BYTES = 0;
+
+    // Peak resident memory, from here (writing 5 resets VmHWM).
+    FILE* clear = fopen("/proc/self/clear_refs", "w");
+    ASSERT_NE(NULL, clear);
+    fputs("5", clear);
+    fclose(clear);
+    long before = _search_status_kb("VmRSS:");
+    SearchPattern pattern;
+    inplace_make_SearchPattern(&pattern, "not there");
+    SearchMatch match;
+    size_t threads = search_stats.threads;
+    ASSERT_EQ(-1, Buffer_search(&buf, &pattern, 0, 0, true, &match));
+    ASSERT_EQ(threads + 3, search_stats.threads);
+    SearchPattern_destroy(&pattern);
+    long peak = _search_status_kb("VmHWM:");
+    ASSERT_LT(peak - before, 16L * PT_BLOCK_SIZE / 1024);
+
+    inplace_make_SearchPattern(&pattern, "0300000");
+    ASSERT_EQ(0, Buffer_search(&buf, &pattern, num_lines, 0, false, &match));
+    ASSERT_EQ(300000, match.row);
+    SearchPattern_destroy(&pattern);
+
+    SEARCH_THREADS = save_threads;
+    SEARCH_PARALLEL_BYTES = save_parallel;
+    Buffer_destroy(&buf);
+    remove(filename);
+}
+
+UTEST(search, pattern) {
+    SearchPattern pattern;
+    inplace_make_SearchPattern(&pattern, "a\\nb\\\\nc\\.");
+    ASSERT_STREQ("a\nb\\\\nc\\.", pattern.text->data);
+    ASSERT_EQ(1, pattern.newlines);
+    ASSERT_FALSE(pattern.literal);
+    ASSERT_TRUE(SearchPattern_valid(&pattern));
+    SearchPattern_destroy(&pattern);
+
+    inplace_make_SearchPattern(&pattern, "x\\ny");
+    ASSERT_TRUE(pattern.literal);
+    SearchPattern_destroy(&pattern);
+
+    inplace_make_SearchPattern(&pattern, "a\\{");
+    ASSERT_FALSE(SearchPattern_valid(&pattern));
+    SearchPattern_destroy(&pattern);
+}
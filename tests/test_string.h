@@ -404,3 +404,47 @@ UTEST(String, String_ninserts) {
     ASSERT_EQ(8, Strlen(s));
     free(s);
 }
+
+UTEST(String, Strdup_length_sized) {
+    String* s = make_String("short");
+    for (int i = 0; i < 10; ++i) {
+        Strcats(&s, "0123456789abcdef");
+    }
+    Strtrunc(s, 5);
+    ASSERT_LT(100, (size_t) s->max_length);
+
+    String* copy = Strdup(s);
+    ASSERT_STREQ("short", copy->data);
+    ASSERT_EQ(5, copy->length);
+    ASSERT_EQ(5, (size_t) copy->max_length);
+    free(copy);
+
+    s = String_fit(s);
+    ASSERT_STREQ("short", s->data);
+    ASSERT_EQ(5, (size_t) s->max_length);
+    free(s);
+}
+
+UTEST(String, String_fit_slack) {
+    String* s = alloc_String(STRING_FIT_SLACK - 1);
+    Strcats(&s, "a");
+    // Not worth a realloc.
+    String* fit = String_fit(s);
+    ASSERT_EQ(s, fit);
+    ASSERT_EQ(STRING_FIT_SLACK - 1, (size_t) fit->max_length);
+    free(fit);
+}
+
+UTEST(String, over_4g) {
+    // Lines aren't limited to int lengths. Only the first page gets touched.
+    size_t length = (size_t) 1 << 32;
+    String* s = alloc_String(length + 1);
+    ASSERT_NE(NULL, s);
+    ASSERT_EQ(length + 1, (size_t) s->max_length);
+    ASSERT_FALSE(s->arena);
+    s->length = length;
+    String_push(&s, 'x');
+    ASSERT_EQ(length + 1, Strlen(s));
+    ASSERT_EQ('x', s->data[length]);
+    free(s);
+}
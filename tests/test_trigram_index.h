@@ -0,0 +1,147 @@
+#pragma once
+
+#include "../structures/trigram_index.h"
+#include "test_search.h"
+
+#define _TRIGRAM(a, b, c) ((uint32_t) (a) << 16 | (uint32_t) (b) << 8 | (uint32_t) (c))
+
+UTEST(trigram_index, required) {
+    uint32_t trigrams[TRIGRAM_QUERY_MAX];
+    ASSERT_EQ(3, trigram_required("hello", true, trigrams, TRIGRAM_QUERY_MAX));
+    ASSERT_EQ(_TRIGRAM('h', 'e', 'l'), trigrams[0]);
+    ASSERT_EQ(_TRIGRAM('l', 'l', 'o'), trigrams[2]);
+    // Literal: metacharacters are plain.
+    ASSERT_EQ(2, trigram_required("a.*b", true, trigrams, TRIGRAM_QUERY_MAX));
+    ASSERT_EQ(1, trigram_required("aaaaa", true, trigrams, TRIGRAM_QUERY_MAX));
+    ASSERT_EQ(2, trigram_required("hello", true, trigrams, 2));
+
+    ASSERT_EQ(2, trigram_required("foo.*bar", false, trigrams, TRIGRAM_QUERY_MAX));
+    ASSERT_EQ(_TRIGRAM('f', 'o', 'o'), trigrams[0]);
+    ASSERT_EQ(_TRIGRAM('b', 'a', 'r'), trigrams[1]);
+    ASSERT_EQ(0, trigram_required("ab*c", false, trigrams, TRIGRAM_QUERY_MAX));
+    ASSERT_EQ(0, trigram_required("abc\\?", false, trigrams, TRIGRAM_QUERY_MAX));
+    ASSERT_EQ(0, trigram_required("x\\(abc\\)y", false, trigrams, TRIGRAM_QUERY_MAX));
+    ASSERT_EQ(0, trigram_required("abc\\|def", false, trigrams, TRIGRAM_QUERY_MAX));
+    ASSERT_EQ(0, trigram_required("a[bcd]e", false, trigrams, TRIGRAM_QUERY_MAX));
+    ASSERT_EQ(1, trigram_required("[[:alpha:]]x\\.y", false, trigrams, TRIGRAM_QUERY_MAX));
+    ASSERT_EQ(_TRIGRAM('x', '.', 'y'), trigrams[0]);
+    // The interval's bounds aren't characters of the match.
+    ASSERT_EQ(1, trigram_required("ab\\{2,3\\}cde", false, trigrams, TRIGRAM_QUERY_MAX));
+    ASSERT_EQ(_TRIGRAM('c', 'd', 'e'), trigrams[0]);
+}
+
+/**
+ * Check searches of `buf` with every _search_test_patterns, and some that use
+ * its trigram index.
+ */
+bool _check_indexed_search(Buffer* buf) {
+    const char* patterns[] = { "cab", "abca", "^bca", "ab[bc]a", "x*abc$", "ca*bc" };
+    bool ok = true;
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(char*); ++p) {
+        ok = ok && _check_search(buf, patterns[p]);
+    }
+    for (size_t p = 0; p < sizeof(_search_test_patterns) / sizeof(char*); ++p) {
+        ok = ok && _check_search(buf, _search_test_patterns[p]);
+    }
+    return ok;
+}
+
+UTEST(trigram_index, search) {
+    srand(25);
+    size_t save_block = TRIGRAM_BLOCK_LINES;
+    size_t save_share = SEARCH_INDEX_SHARE;
+    TRIGRAM_BLOCK_LINES = 4;
+    // Always search the candidate rows (every block has every trigram, here).
+    SEARCH_INDEX_SHARE = 1;
+    for (int storage = 0; storage < 2; ++storage) {
+        // All of it indexed, then part of it.
+        for (int partial = 0; partial < 2; ++partial) {
+            char filename[] = "/tmp/txt_test_XXXXXX";
+            _search_test_file(filename, 60, true);
+            Buffer buf;
+            inplace_make_Buffer_storage(&buf, filename, storage ? BS_PIECES : BS_LINES);
+            Buffer_enable_trigrams(&buf);
+            if (partial) {
+                ASSERT_FALSE(Buffer_index_step(&buf, 100, 0));
+                ASSERT_LT(buf.trigrams->indexed_rows, 40);
+            }
+            else {
+                ASSERT_TRUE(Buffer_index_step(&buf, 1 << 20, 0));
+                ASSERT_EQ(Buffer_get_num_lines(&buf), buf.trigrams->indexed_rows);
+            }
+            EXPECT_TRUE(_check_indexed_search(&buf));
+
+            // Edits, through the undo history.
+            const char* text = "abcab\nxxabca\nbcab\n";
+            Buffer_insert_text(&buf, 1, 2, text, strlen(text));
+            String* removed[3];
+            Buffer_remove_lines(&buf, 20, 23, removed);
+            for (int i = 0; i < 3; ++i) {
+                Buffer_push_undo(&buf, make_Delete(2, 20, -1, removed[i]));
+            }
+            for (size_t row = 6; row < 30; row += 5) {
+                String_inserts(Buffer_get_line_abs(&buf, row), 0, "bca");
+                Buffer_push_undo(&buf, make_Insert(3, row, 0, make_String("bca")));
+            }
+            Buffer_remove_lines(&buf, 30, 31, removed);
+            Buffer_push_undo(&buf, make_Delete(3, 30, -1, removed[0]));
+            EXPECT_TRUE(_check_indexed_search(&buf));
+
+            EditorContext ctx;
+            Buffer_undo(&buf, 3, &ctx);
+            EXPECT_TRUE(_check_indexed_search(&buf));
+            Buffer_undo(&buf, 1, &ctx);
+            EXPECT_TRUE(_check_indexed_search(&buf));
+
+            Buffer_destroy(&buf);
+            remove(filename);
+        }
+    }
+    TRIGRAM_BLOCK_LINES = save_block;
+    SEARCH_INDEX_SHARE = save_share;
+}
+
+UTEST(trigram_index, skips_blocks) {
+    char filename[] = "/tmp/txt_test_XXXXXX";
+    write_numbered_lines(filename, 10000);
+    size_t save_block = TRIGRAM_BLOCK_LINES;
+    TRIGRAM_BLOCK_LINES = 100;
+    Buffer buf;
+    inplace_make_Buffer_storage(&buf, filename, BS_PIECES);
+    Buffer_enable_trigrams(&buf);
+    // Out of time long before the end (the clock is checked every TRIGRAM_CLOCK_LINES).
+    ASSERT_FALSE(Buffer_index_step(&buf, SIZE_MAX, 1e-6));
+    ASSERT_EQ(TRIGRAM_CLOCK_LINES - 1, buf.trigrams->indexed_rows);
+    while (!Buffer_index_step(&buf, 4096, 0)) {}
+    ASSERT_EQ(Buffer_get_num_lines(&buf), buf.trigrams->indexed_rows);
+    const char* text = "a needle\n";
+    Buffer_insert_text(&buf, 1, 7000, text, strlen(text));
+
+    SearchPattern pattern;
+    inplace_make_SearchPattern(&pattern, "ne*dle");
+    SearchMatch match;
+    size_t skipped = search_stats.skipped;
+    size_t chunks = search_stats.chunks;
+    ASSERT_EQ(0, Buffer_search(&buf, &pattern, 0, 0, true, &match));
+    ASSERT_EQ(7000, match.row);
+    ASSERT_EQ(2, match.col);
+    ASSERT_EQ(0, Buffer_search(&buf, &pattern, 9000, 0, false, &match));
+    ASSERT_EQ(7000, match.row);
+    ASSERT_EQ(-1, Buffer_search(&buf, &pattern, 7000, 2, true, &match));
+    // Only the block with the needle is searched (a line at a time).
+    ASSERT_GT(search_stats.skipped - skipped, 3 * 9800);
+    ASSERT_LT(search_stats.chunks - chunks, 3 * 200);
+    SearchPattern_destroy(&pattern);
+
+    // Everywhere: searched as usual.
+    inplace_make_SearchPattern(&pattern, "line");
+    skipped = search_stats.skipped;
+    ASSERT_EQ(0, Buffer_search(&buf, &pattern, 0, 0, true, &match));
+    ASSERT_EQ(1, match.row);
+    ASSERT_EQ(skipped, search_stats.skipped);
+    SearchPattern_destroy(&pattern);
+
+    TRIGRAM_BLOCK_LINES = save_block;
+    Buffer_destroy(&buf);
+    remove(filename);
+}
@@ -23,6 +23,17 @@ do { \
     } \
 } while (0);
 
+/**
+ * Compare a vector of strings against the lines of a buffer (any storage).
+ */
+#define ASSERT_BUF_VS_EQ(a, buf) \
+do { \
+    ASSERT_EQ((a)->size, Buffer_get_num_lines(buf)); \
+    for (size_t i = 0; i < (a)->size; ++i) { \
+        ASSERT_STREQ(((String*) (a)->elements[i])->data, (*Buffer_get_line_abs((buf), i))->data); \
+    } \
+} while (0);
+
 void inplace_make_VS(Vector* ret, char** data) {
     inplace_make_Vector(ret, 10);
     while (*data) {
@@ -30,3 +41,16 @@ void inplace_make_VS(Vector* ret, char** data) {
         ++data;
     }
 }
+
+/**
+ * Create a temp file from the mkstemp template `filename`, with the lines
+ * "line 0" to "line <num_lines - 1>", each ending in a newline.
+ */
+void write_numbered_lines(char* filename, size_t num_lines) {
+    int fd = mkstemp(filename);
+    FILE* f = fdopen(fd, "w");
+    for (size_t i = 0; i < num_lines; ++i) {
+        fprintf(f, "line %zu\n", i);
+    }
+    fclose(f);
+}